@@ -20,6 +20,7 @@
 #include <linux/kvm.h>
 
 #include "qemu/atomic.h"
+#include "qemu/bitops.h"
 #include "qemu/option.h"
 #include "qemu/config-file.h"
 #include "qemu/error-report.h"
@@ -52,6 +53,7 @@
 
 #include "hw/boards.h"
 #include "system/stats.h"
+#include "block/thread-pool.h"
 
 /* This check must be after config-host.h is included */
 #ifdef CONFIG_EVENTFD
@@ -198,6 +200,7 @@ static bool kvm_slots_grow(KVMMemoryListener *kml, unsigned int nr_slots_new)
         return false;
     }
 
+    kml->slot_index = g_renew(unsigned int, kml->slot_index, nr_slots_new);
     if (cur == 0) {
         slots = g_new0(KVMSlot, nr_slots_new);
     } else {
@@ -258,8 +261,9 @@ static KVMSlot *kvm_get_free_slot(KVMMemoryListener *kml)
     unsigned int n;
     int i;
 
-    for (i = 0; i < kml->nr_slots_allocated; i++) {
+    for (i = kml->free_slot_hint; i < kml->nr_slots_allocated; i++) {
         if (kml->slots[i].memory_size == 0) {
+            kml->free_slot_hint = i;
             return &kml->slots[i];
         }
     }
@@ -272,6 +276,7 @@ static KVMSlot *kvm_get_free_slot(KVMMemoryListener *kml)
      */
     n = kml->nr_slots_allocated;
     if (kvm_slots_double(kml)) {
+        kml->free_slot_hint = n;
         return &kml->slots[n];
     }
 
@@ -291,23 +296,6 @@ static KVMSlot *kvm_alloc_slot(KVMMemoryListener *kml)
     abort();
 }
 
-static KVMSlot *kvm_lookup_matching_slot(KVMMemoryListener *kml,
-                                         hwaddr start_addr,
-                                         hwaddr size)
-{
-    int i;
-
-    for (i = 0; i < kml->nr_slots_allocated; i++) {
-        KVMSlot *mem = &kml->slots[i];
-
-        if (start_addr == mem->start_addr && size == mem->memory_size) {
-            return mem;
-        }
-    }
-
-    return NULL;
-}
-
 /*
  * Calculate and align the start address and the size of the section.
  * Return the size. If the size is 0, the aligned section is empty.
@@ -371,6 +359,7 @@ static int kvm_set_user_memory_region(KVMMemoryListener *kml, KVMSlot *slot, boo
          * value. This is needed based on KVM commit 75d61fbc. */
         mem.memory_size = 0;
 
+        s->memslot_stats.ioctls++;
         if (kvm_guest_memfd_supported) {
             ret = kvm_vm_ioctl(s, KVM_SET_USER_MEMORY_REGION2, &mem);
         } else {
@@ -381,6 +370,7 @@ static int kvm_set_user_memory_region(KVMMemoryListener *kml, KVMSlot *slot, boo
         }
     }
     mem.memory_size = slot->memory_size;
+    s->memslot_stats.ioctls++;
     if (kvm_guest_memfd_supported) {
         ret = kvm_vm_ioctl(s, KVM_SET_USER_MEMORY_REGION2, &mem);
     } else {
@@ -780,7 +770,21 @@ static bool kvm_slot_get_dirty_log(KVMState *s, KVMSlot *slot)
     return ret == 0;
 }
 
-/* Should be with all slots_lock held for the address spaces. */
+/*
+ * Rings of this many vCPUs are reaped by one worker of the reaper pool,
+ * using at most KVM_DIRTY_RING_MAX_WORKERS threads besides the caller.
+ */
+#define KVM_DIRTY_RING_SHARD_VCPUS      16
+#define KVM_DIRTY_RING_MAX_WORKERS      8
+
+/* Bounds for the sleep time of the reaper thread */
+#define KVM_DIRTY_RING_MIN_INTERVAL_NS  (10 * SCALE_MS)
+#define KVM_DIRTY_RING_MAX_INTERVAL_NS  NANOSECONDS_PER_SECOND
+
+/*
+ * Should be with all slots_lock held for the address spaces.  Workers of the
+ * reaper pool may mark pages of the same slot concurrently.
+ */
 static void kvm_dirty_ring_mark_page(KVMState *s, uint32_t as_id,
                                      uint32_t slot_id, uint64_t offset)
 {
@@ -799,7 +803,9 @@ static void kvm_dirty_ring_mark_page(KVMState *s, uint32_t as_id,
         return;
     }
 
-    set_bit(offset, mem->dirty_bmap);
+    if (!test_bit(offset, mem->dirty_bmap)) {
+        set_bit_atomic(offset, mem->dirty_bmap);
+    }
 }
 
 static bool dirty_gfn_is_dirtied(struct kvm_dirty_gfn *gfn)
@@ -872,21 +878,97 @@ static uint32_t kvm_dirty_ring_reap_one(KVMState *s, CPUState *cpu)
     return count;
 }
 
+typedef struct KVMDirtyRingShard {
+    KVMState *s;
+    CPUState **cpus;
+    int nr_cpus;
+    uint64_t total;
+    uint32_t fill;              /* most pages found in one ring */
+} KVMDirtyRingShard;
+
+static int kvm_dirty_ring_reap_shard(void *opaque)
+{
+    KVMDirtyRingShard *shard = opaque;
+
+    for (int i = 0; i < shard->nr_cpus; i++) {
+        uint32_t count = kvm_dirty_ring_reap_one(shard->s, shard->cpus[i]);
+
+        shard->total += count;
+        shard->fill = MAX(shard->fill, count);
+    }
+    return 0;
+}
+
+/*
+ * Must be with slots_lock held.  With many vCPUs, the rings are split in
+ * shards that the reaper pool collects in parallel; the calling thread
+ * keeps holding slots_lock on behalf of the workers.
+ */
+static uint64_t kvm_dirty_ring_reap_all(KVMState *s, uint32_t *fill)
+{
+    ThreadPool *pool = s->reaper.pool;
+    g_autofree CPUState **cpus = NULL;
+    g_autofree KVMDirtyRingShard *shards = NULL;
+    int nr_cpus = 0, nr_shards, i;
+    uint64_t total = 0;
+    CPUState *cpu;
+
+    CPU_FOREACH(cpu) {
+        nr_cpus++;
+    }
+    nr_shards = DIV_ROUND_UP(nr_cpus, KVM_DIRTY_RING_SHARD_VCPUS);
+    if (!pool || nr_shards <= 1) {
+        CPU_FOREACH(cpu) {
+            uint32_t count = kvm_dirty_ring_reap_one(s, cpu);
+
+            total += count;
+            *fill = MAX(*fill, count);
+        }
+        return total;
+    }
+
+    cpus = g_new(CPUState *, nr_cpus);
+    i = 0;
+    CPU_FOREACH(cpu) {
+        cpus[i++] = cpu;
+    }
+
+    shards = g_new0(KVMDirtyRingShard, nr_shards);
+    for (i = 0; i < nr_shards; i++) {
+        shards[i].s = s;
+        shards[i].cpus = cpus + i * KVM_DIRTY_RING_SHARD_VCPUS;
+        shards[i].nr_cpus = MIN(KVM_DIRTY_RING_SHARD_VCPUS,
+                                nr_cpus - i * KVM_DIRTY_RING_SHARD_VCPUS);
+        if (i) {
+            thread_pool_submit(pool, kvm_dirty_ring_reap_shard, &shards[i],
+                               NULL);
+        }
+    }
+    kvm_dirty_ring_reap_shard(&shards[0]);
+    thread_pool_wait(pool);
+
+    for (i = 0; i < nr_shards; i++) {
+        total += shards[i].total;
+        *fill = MAX(*fill, shards[i].fill);
+    }
+    return total;
+}
+
 /* Must be with slots_lock held */
 static uint64_t kvm_dirty_ring_reap_locked(KVMState *s, CPUState* cpu)
 {
+    struct KVMDirtyRingReaper *r = &s->reaper;
     int ret;
     uint64_t total = 0;
+    uint32_t fill = 0;
     int64_t stamp;
 
     stamp = get_clock();
 
     if (cpu) {
-        total = kvm_dirty_ring_reap_one(s, cpu);
+        total = fill = kvm_dirty_ring_reap_one(s, cpu);
     } else {
-        CPU_FOREACH(cpu) {
-            total += kvm_dirty_ring_reap_one(s, cpu);
-        }
+        total = kvm_dirty_ring_reap_all(s, &fill);
     }
 
     if (total) {
@@ -896,7 +978,11 @@ static uint64_t kvm_dirty_ring_reap_locked(KVMState *s, CPUState* cpu)
 
     stamp = get_clock() - stamp;
 
+    r->fill = fill;
+    r->max_fill = MAX(r->max_fill, fill);
     if (total) {
+        r->reaps++;
+        r->reaped_pages += total;
         trace_kvm_dirty_ring_reap(total, stamp / 1000);
     }
 
@@ -1458,9 +1544,38 @@ int kvm_set_memory_attributes_shared(hwaddr start, uint64_t size)
     return kvm_set_memory_attributes(start, size, 0);
 }
 
+/* State of kvm_region_commit(), protected by KVMMemoryListener.slots_lock */
+typedef struct KVMMemoryCommit {
+    /* The dirty rings were reaped before removing the first slot */
+    bool rings_reaped;
+    /* Guest addresses of new guest_memfd slots not yet made private */
+    hwaddr private_start;
+    hwaddr private_size;
+} KVMMemoryCommit;
+
+/* Make the new guest_memfd slots private with a single ioctl */
+static void kvm_memory_commit_set_private(KVMMemoryCommit *c)
+{
+    int err;
+
+    if (!c->private_size) {
+        return;
+    }
+
+    kvm_state->memslot_stats.ioctls++;
+    err = kvm_set_memory_attributes_private(c->private_start, c->private_size);
+    if (err) {
+        error_report("%s: failed to set memory attribute private: %s",
+                     __func__, strerror(-err));
+        exit(1);
+    }
+    c->private_size = 0;
+}
+
 /* Called with KVMMemoryListener.slots_lock held */
 static void kvm_set_phys_mem(KVMMemoryListener *kml,
-                             MemoryRegionSection *section, bool add)
+                             MemoryRegionSection *section, bool add,
+                             KVMMemoryCommit *c)
 {
     KVMSlot *mem;
     int err;
@@ -1513,9 +1628,16 @@ static void kvm_set_phys_mem(KVMMemoryListener *kml,
                  * remove the slot.
                  *
                  * Not easy.  Let's cross the fingers until it's fixed.
+                 *
+                 * For the same reason, reaping the rings once for all the
+                 * slots removed by a commit is as good as reaping them
+                 * before removing each slot, and much cheaper.
                  */
                 if (kvm_state->kvm_dirty_ring_size) {
-                    kvm_dirty_ring_reap_locked(kvm_state, NULL);
+                    if (!c->rings_reaped) {
+                        kvm_dirty_ring_reap_locked(kvm_state, NULL);
+                        c->rings_reaped = true;
+                    }
                     if (kvm_state->kvm_dirty_ring_with_bitmap) {
                         kvm_slot_sync_dirty_pages(mem);
                         kvm_slot_get_dirty_log(kvm_state, mem);
@@ -1527,6 +1649,7 @@ static void kvm_set_phys_mem(KVMMemoryListener *kml,
             }
 
             /* unregister the slot */
+            kvm_slot_index_remove(kml, mem);
             g_free(mem->dirty_bmap);
             mem->dirty_bmap = NULL;
             mem->memory_size = 0;
@@ -1539,7 +1662,6 @@ static void kvm_set_phys_mem(KVMMemoryListener *kml,
             }
             start_addr += slot_size;
             size -= slot_size;
-            kml->nr_slots_used--;
         } while (size);
         return;
     }
@@ -1564,24 +1686,47 @@ static void kvm_set_phys_mem(KVMMemoryListener *kml,
                     strerror(-err));
             abort();
         }
+        kvm_slot_index_insert(kml, mem);
 
         if (memory_region_has_guest_memfd(mr)) {
-            err = kvm_set_memory_attributes_private(start_addr, slot_size);
-            if (err) {
-                error_report("%s: failed to set memory attribute private: %s",
-                             __func__, strerror(-err));
-                exit(1);
+            if (c->private_size &&
+                c->private_start + c->private_size != start_addr) {
+                kvm_memory_commit_set_private(c);
+            }
+            if (!c->private_size) {
+                c->private_start = start_addr;
             }
+            c->private_size += slot_size;
         }
 
         start_addr += slot_size;
         ram_start_offset += slot_size;
         ram += slot_size;
         size -= slot_size;
-        kml->nr_slots_used++;
     } while (size);
 }
 
+/*
+ * Called with the BQL held.  Wake up more often if a ring was more than
+ * half full, or if a vCPU had to stop because its ring was full; back off
+ * while the rings stay almost empty.
+ */
+static void kvm_dirty_ring_reaper_adjust(KVMState *s)
+{
+    struct KVMDirtyRingReaper *r = &s->reaper;
+    uint32_t ring_size = s->kvm_dirty_ring_size;
+
+    if (r->full_exits != r->last_full_exits || r->fill > ring_size / 2) {
+        r->interval_ns = MAX(r->interval_ns / 2,
+                             KVM_DIRTY_RING_MIN_INTERVAL_NS);
+    } else if (r->fill < ring_size / 8) {
+        r->interval_ns = MIN(r->interval_ns * 2,
+                             KVM_DIRTY_RING_MAX_INTERVAL_NS);
+    }
+    r->last_full_exits = r->full_exits;
+    trace_kvm_dirty_ring_reaper_interval(r->fill, r->interval_ns);
+}
+
 static void *kvm_dirty_ring_reaper_thread(void *data)
 {
     KVMState *s = data;
@@ -1594,10 +1739,7 @@ static void *kvm_dirty_ring_reaper_thread(void *data)
     while (true) {
         r->reaper_state = KVM_DIRTY_RING_REAPER_WAIT;
         trace_kvm_dirty_ring_reaper("wait");
-        /*
-         * TODO: provide a smarter timeout rather than a constant?
-         */
-        sleep(1);
+        g_usleep(r->interval_ns / SCALE_US);
 
         /* keep sleeping so that dirtylimit not be interfered by reaper */
         if (dirtylimit_in_service()) {
@@ -1609,6 +1751,7 @@ static void *kvm_dirty_ring_reaper_thread(void *data)
 
         bql_lock();
         kvm_dirty_ring_reap(s, NULL);
+        kvm_dirty_ring_reaper_adjust(s);
         bql_unlock();
 
         r->reaper_iteration++;
@@ -1620,6 +1763,16 @@ static void *kvm_dirty_ring_reaper_thread(void *data)
 static void kvm_dirty_ring_reaper_init(KVMState *s)
 {
     struct KVMDirtyRingReaper *r = &s->reaper;
+    int nr_shards = DIV_ROUND_UP(current_machine->smp.max_cpus,
+                                 KVM_DIRTY_RING_SHARD_VCPUS);
+
+    r->interval_ns = KVM_DIRTY_RING_MAX_INTERVAL_NS;
+    if (nr_shards > 1) {
+        r->pool = thread_pool_new();
+        thread_pool_set_max_threads(r->pool,
+                                    MIN(nr_shards - 1,
+                                        KVM_DIRTY_RING_MAX_WORKERS));
+    }
 
     qemu_thread_create(&r->reaper_thr, "kvm-reaper",
                        kvm_dirty_ring_reaper_thread,
@@ -1713,18 +1866,86 @@ static void kvm_region_del(MemoryListener *listener,
     QSIMPLEQ_INSERT_TAIL(&kml->transaction_del, update, next);
 }
 
+/*
+ * Called with KVMMemoryListener.slots_lock held.  Return true if removing
+ * @old and adding @new would unregister slots and register them again
+ * unchanged, for example because only the nonvolatile attribute of the
+ * section changed.
+ */
+static bool kvm_section_slots_unchanged(KVMMemoryListener *kml,
+                                        MemoryRegionSection *old,
+                                        MemoryRegionSection *new)
+{
+    hwaddr start_addr, size, slot_size;
+
+    if (old->offset_within_address_space !=
+        new->offset_within_address_space ||
+        int128_ne(old->size, new->size) ||
+        !memory_region_is_ram(old->mr) || !memory_region_is_ram(new->mr) ||
+        kvm_mem_flags(old->mr) != kvm_mem_flags(new->mr) ||
+        memory_region_get_ram_addr(old->mr) + old->offset_within_region !=
+        memory_region_get_ram_addr(new->mr) + new->offset_within_region) {
+        return false;
+    }
+
+    size = kvm_align_section(old, &start_addr);
+    while (size) {
+        slot_size = MIN(kvm_max_slot_size, size);
+        if (!kvm_lookup_matching_slot(kml, start_addr, slot_size)) {
+            return false;
+        }
+        start_addr += slot_size;
+        size -= slot_size;
+    }
+    return true;
+}
+
+/*
+ * Called with KVMMemoryListener.slots_lock held.  Drop a pair of removed
+ * and added sections that would leave the slots unchanged.  Besides saving
+ * two ioctls per slot, this avoids stopping all vCPUs for what looks like
+ * an overlapping update.
+ */
+static bool kvm_region_merge_unchanged(KVMMemoryListener *kml,
+                                       KVMMemoryUpdate *old,
+                                       KVMMemoryUpdate *new)
+{
+    if (!kvm_section_slots_unchanged(kml, &old->section, &new->section)) {
+        return false;
+    }
+
+    trace_kvm_region_unchanged(kml->as_id,
+                               old->section.offset_within_address_space,
+                               int128_get64(old->section.size));
+    kvm_state->memslot_stats.updates_in_place++;
+    memory_region_unref(old->section.mr);
+    memory_region_ref(new->section.mr);
+    g_free(old);
+    g_free(new);
+    return true;
+}
+
 static void kvm_region_commit(MemoryListener *listener)
 {
     KVMMemoryListener *kml = container_of(listener, KVMMemoryListener,
                                           listener);
+    struct KVMMemslotStats *stats = &kvm_state->memslot_stats;
+    KVMMemoryCommit commit = { };
     KVMMemoryUpdate *u1, *u2;
     bool need_inhibit = false;
+    uint64_t ioctls = stats->ioctls;
+    int64_t start_ns;
+    uint64_t ns;
 
     if (QSIMPLEQ_EMPTY(&kml->transaction_add) &&
         QSIMPLEQ_EMPTY(&kml->transaction_del)) {
         return;
     }
 
+    start_ns = get_clock();
+    kvm_slots_lock();
+    kvm_memory_updates_merge(kml, kvm_region_merge_unchanged);
+
     /*
      * We have to be careful when regions to add overlap with ranges to remove.
      * We have to simulate atomic KVM memslot updates by making sure no ioctl()
@@ -1753,7 +1974,6 @@ static void kvm_region_commit(MemoryListener *listener)
         }
     }
 
-    kvm_slots_lock();
     if (need_inhibit) {
         accel_ioctl_inhibit_begin();
     }
@@ -1763,7 +1983,7 @@ static void kvm_region_commit(MemoryListener *listener)
         u1 = QSIMPLEQ_FIRST(&kml->transaction_del);
         QSIMPLEQ_REMOVE_HEAD(&kml->transaction_del, next);
 
-        kvm_set_phys_mem(kml, &u1->section, false);
+        kvm_set_phys_mem(kml, &u1->section, false, &commit);
         memory_region_unref(u1->section.mr);
 
         g_free(u1);
@@ -1773,15 +1993,23 @@ static void kvm_region_commit(MemoryListener *listener)
         QSIMPLEQ_REMOVE_HEAD(&kml->transaction_add, next);
 
         memory_region_ref(u1->section.mr);
-        kvm_set_phys_mem(kml, &u1->section, true);
+        kvm_set_phys_mem(kml, &u1->section, true, &commit);
 
         g_free(u1);
     }
+    kvm_memory_commit_set_private(&commit);
 
     if (need_inhibit) {
         accel_ioctl_inhibit_end();
     }
     kvm_slots_unlock();
+
+    ns = get_clock() - start_ns;
+    stats->commits++;
+    stats->commit_ns += ns;
+    stats->max_commit_ns = MAX(stats->max_commit_ns, ns);
+    trace_kvm_region_commit(kml->as_id, stats->ioctls - ioctls,
+                            need_inhibit, ns);
 }
 
 static void kvm_log_sync(MemoryListener *listener,
@@ -3237,6 +3465,8 @@ int kvm_cpu_exec(CPUState *cpu)
              */
             trace_kvm_dirty_ring_full(cpu->cpu_index);
             bql_lock();
+            kvm_state->reaper.full_exits++;
+            cpu->kvm_dirty_ring_full_exits++;
             /*
              * We throttle vCPU by making it sleep once it exit from kernel
              * due to dirty ring full. In the dirtylimit scenario, reaping
@@ -3778,13 +4008,17 @@ static bool kvm_accel_has_memory(MachineState *ms, AddressSpace *as,
                                  hwaddr start_addr, hwaddr size)
 {
     KVMState *kvm = KVM_STATE(ms->accelerator);
+    bool found;
     int i;
 
     for (i = 0; i < kvm->nr_as; ++i) {
         if (kvm->as[i].as == as && kvm->as[i].ml) {
             size = MIN(kvm_max_slot_size, size);
-            return NULL != kvm_lookup_matching_slot(kvm->as[i].ml,
-                                                    start_addr, size);
+            kvm_slots_lock();
+            found = NULL != kvm_lookup_matching_slot(kvm->as[i].ml,
+                                                     start_addr, size);
+            kvm_slots_unlock();
+            return found;
         }
     }
 
@@ -4249,6 +4483,99 @@ static StatsDescriptors *find_stats_descriptors(StatsTarget target, int stats_fd
     return descriptors;
 }
 
+/* Statistics kept by QEMU, reported next to the kernel's */
+static const StatsDesc kvm_memslot_stats[] = {
+    STATS_DESC("memslot_commits", STATS_TYPE_CUMULATIVE, STATS_DESC_UNIT_NONE,
+               struct KVMMemslotStats, commits),
+    STATS_DESC("memslot_ioctls", STATS_TYPE_CUMULATIVE, STATS_DESC_UNIT_NONE,
+               struct KVMMemslotStats, ioctls),
+    STATS_DESC("memslot_updates_in_place", STATS_TYPE_CUMULATIVE,
+               STATS_DESC_UNIT_NONE, struct KVMMemslotStats, updates_in_place),
+    STATS_DESC("memslot_commit_time", STATS_TYPE_CUMULATIVE,
+               STATS_DESC_UNIT_NS, struct KVMMemslotStats, commit_ns),
+    STATS_DESC("memslot_max_commit_time", STATS_TYPE_PEAK, STATS_DESC_UNIT_NS,
+               struct KVMMemslotStats, max_commit_ns),
+};
+
+static const StatsDesc kvm_dirty_ring_vm_stats[] = {
+    STATS_DESC("dirty_ring_full_exits", STATS_TYPE_CUMULATIVE,
+               STATS_DESC_UNIT_NONE, struct KVMDirtyRingReaper, full_exits),
+    STATS_DESC("dirty_ring_reaps", STATS_TYPE_CUMULATIVE, STATS_DESC_UNIT_NONE,
+               struct KVMDirtyRingReaper, reaps),
+    STATS_DESC("dirty_ring_reaped_pages", STATS_TYPE_CUMULATIVE,
+               STATS_DESC_UNIT_NONE, struct KVMDirtyRingReaper, reaped_pages),
+    STATS_DESC("dirty_ring_max_fill", STATS_TYPE_PEAK, STATS_DESC_UNIT_NONE,
+               struct KVMDirtyRingReaper, max_fill),
+    STATS_DESC("dirty_ring_reap_interval", STATS_TYPE_INSTANT,
+               STATS_DESC_UNIT_NS, struct KVMDirtyRingReaper, interval_ns),
+};
+
+static const StatsDesc kvm_dirty_ring_vcpu_stats[] = {
+    STATS_DESC("dirty_ring_full_exits", STATS_TYPE_CUMULATIVE,
+               STATS_DESC_UNIT_NONE, CPUState, kvm_dirty_ring_full_exits),
+    STATS_DESC("dirty_ring_pages", STATS_TYPE_CUMULATIVE, STATS_DESC_UNIT_NONE,
+               CPUState, dirty_pages),
+};
+
+typedef struct KVMUserStatsTable {
+    const StatsDesc *desc;
+    size_t n;
+    const void *base;
+} KVMUserStatsTable;
+
+/* Fill @tables with the statistics of @target and return their number */
+static size_t kvm_user_stats_tables(StatsTarget target, CPUState *cpu,
+                                    KVMUserStatsTable tables[2])
+{
+    size_t n = 0;
+
+    if (target == STATS_TARGET_VM) {
+        tables[n++] = (KVMUserStatsTable) {
+            kvm_memslot_stats, ARRAY_SIZE(kvm_memslot_stats),
+            &kvm_state->memslot_stats,
+        };
+    }
+    if (kvm_dirty_ring_enabled()) {
+        if (target == STATS_TARGET_VM) {
+            tables[n++] = (KVMUserStatsTable) {
+                kvm_dirty_ring_vm_stats, ARRAY_SIZE(kvm_dirty_ring_vm_stats),
+                &kvm_state->reaper,
+            };
+        } else {
+            tables[n++] = (KVMUserStatsTable) {
+                kvm_dirty_ring_vcpu_stats,
+                ARRAY_SIZE(kvm_dirty_ring_vcpu_stats), cpu,
+            };
+        }
+    }
+    return n;
+}
+
+static StatsList *add_user_stats(StatsTarget target, CPUState *cpu,
+                                 strList *names, StatsList *stats_list)
+{
+    KVMUserStatsTable tables[2];
+    size_t nr_tables = kvm_user_stats_tables(target, cpu, tables);
+
+    for (size_t t = 0; t < nr_tables; t++) {
+        stats_list = stats_desc_list(tables[t].desc, tables[t].n,
+                                     tables[t].base, names, stats_list);
+    }
+    return stats_list;
+}
+
+static StatsSchemaValueList *add_user_schema(StatsTarget target,
+                                             StatsSchemaValueList *list)
+{
+    KVMUserStatsTable tables[2];
+    size_t nr_tables = kvm_user_stats_tables(target, NULL, tables);
+
+    for (size_t t = 0; t < nr_tables; t++) {
+        list = stats_desc_schema(tables[t].desc, tables[t].n, list);
+    }
+    return list;
+}
+
 static void query_stats(StatsResultList **result, StatsTarget target,
                         strList *names, int stats_fd, CPUState *cpu,
                         Error **errp)
@@ -4298,6 +4625,7 @@ static void query_stats(StatsResultList **result, StatsTarget target,
         }
         stats_list = add_kvmstat_entry(pdesc, stats, stats_list, errp);
     }
+    stats_list = add_user_stats(target, cpu, names, stats_list);
 
     if (!stats_list) {
         return;
@@ -4342,6 +4670,7 @@ static void query_stats_schema(StatsSchemaList **result, StatsTarget target,
         pdesc = (void *)kvm_stats_desc + i * size_desc;
         stats_list = add_kvmschema_entry(pdesc, stats_list, errp);
     }
+    stats_list = add_user_schema(target, stats_list);
 
     add_stats_schema(result, STATS_PROVIDER_KVM, target, stats_list);
 }
@@ -38,6 +38,7 @@
 #include "qemu/target-info.h"
 #ifndef CONFIG_USER_ONLY
 #include "hw/boards.h"
+#include "system/dirty-ring.h"
 #endif
 #include "accel/tcg/cpu-ops.h"
 #include "internal-common.h"
@@ -50,6 +51,7 @@ struct TCGState {
     bool one_insn_per_tb;
     int splitwx_enabled;
     unsigned long tb_size;
+    uint32_t dirty_ring_size;
 };
 typedef struct TCGState TCGState;
 
@@ -122,6 +124,10 @@ static int tcg_init_machine(MachineState *ms)
     default:
         g_assert_not_reached();
     }
+
+    if (s->dirty_ring_size) {
+        dirty_ring_init(s->dirty_ring_size);
+    }
 #endif
 
     tcg_allowed = true;
@@ -193,6 +199,36 @@ static void tcg_set_tb_size(Object *obj, Visitor *v,
     s->tb_size = value;
 }
 
+#ifndef CONFIG_USER_ONLY
+static void tcg_get_dirty_ring_size(Object *obj, Visitor *v,
+                                    const char *name, void *opaque,
+                                    Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    uint32_t value = s->dirty_ring_size;
+
+    visit_type_uint32(v, name, &value, errp);
+}
+
+static void tcg_set_dirty_ring_size(Object *obj, Visitor *v,
+                                    const char *name, void *opaque,
+                                    Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    uint32_t value;
+
+    if (!visit_type_uint32(v, name, &value, errp)) {
+        return;
+    }
+    if (value & (value - 1)) {
+        error_setg(errp, "dirty-ring-size must be a power of two.");
+        return;
+    }
+
+    s->dirty_ring_size = value;
+}
+#endif
+
 static bool tcg_get_splitwx(Object *obj, Error **errp)
 {
     TCGState *s = TCG_STATE(obj);
@@ -264,6 +300,15 @@ static void tcg_accel_class_init(ObjectClass *oc, const void *data)
                                    tcg_set_one_insn_per_tb);
     object_class_property_set_description(oc, "one-insn-per-tb",
         "Only put one guest insn in each translation block");
+
+#ifndef CONFIG_USER_ONLY
+    object_class_property_add(oc, "dirty-ring-size", "uint32",
+        tcg_get_dirty_ring_size, tcg_set_dirty_ring_size,
+        NULL, NULL);
+    object_class_property_set_description(oc, "dirty-ring-size",
+        "Size of the per-thread dirty page rings used by migration "
+        "(default: 0, i.e. use bitmap)");
+#endif
 }
 
 static const TypeInfo tcg_accel_type = {
@@ -16,6 +16,7 @@
 #include "qemu/module.h"
 #include "qemu/madvise.h"
 #include "system/hostmem.h"
+#include "migration/cpr.h"
 #include "qom/object_interfaces.h"
 #include "qom/object.h"
 #include "qapi/visitor.h"
@@ -82,7 +83,8 @@ file_backend_memory_alloc(HostMemoryBackend *backend, Error **errp)
 
     backend->aligned = true;
     name = host_memory_backend_get_name(backend);
-    ram_flags = backend->share ? RAM_SHARED : RAM_PRIVATE;
+    /* A clone maps the memory of its template copy-on-write */
+    ram_flags = backend->share && !cpr_is_clone() ? RAM_SHARED : RAM_PRIVATE;
     ram_flags |= fb->readonly ? RAM_READONLY_FD : 0;
     ram_flags |= fb->rom == ON_OFF_AUTO_ON ? RAM_READONLY : 0;
     ram_flags |= backend->reserve ? 0 : RAM_NORESERVE;
@@ -256,11 +258,14 @@ static void file_memory_backend_set_rom(Object *obj, Visitor *v,
     visit_type_OnOffAuto(v, name, &fb->rom, errp);
 }
 
+static void (*file_backend_parent_unparent)(Object *obj);
+
 static void file_backend_unparent(Object *obj)
 {
     HostMemoryBackend *backend = MEMORY_BACKEND(obj);
     HostMemoryBackendFile *fb = MEMORY_BACKEND_FILE(obj);
 
+    file_backend_parent_unparent(obj);
     if (host_memory_backend_mr_inited(backend) && fb->discard_data) {
         void *ptr = memory_region_get_ram_ptr(&backend->mr);
         uint64_t sz = memory_region_size(&backend->mr);
@@ -275,6 +280,7 @@ file_backend_class_init(ObjectClass *oc, const void *data)
     HostMemoryBackendClass *bc = MEMORY_BACKEND_CLASS(oc);
 
     bc->alloc = file_backend_memory_alloc;
+    file_backend_parent_unparent = oc->unparent;
     oc->unparent = file_backend_unparent;
 
     object_class_property_add_bool(oc, "discard-data",
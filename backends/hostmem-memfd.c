@@ -36,6 +36,7 @@ memfd_backend_memory_alloc(HostMemoryBackend *backend, Error **errp)
     HostMemoryBackendMemfd *m = MEMORY_BACKEND_MEMFD(backend);
     g_autofree char *name = host_memory_backend_get_name(backend);
     int fd = cpr_find_fd(name, 0);
+    bool share = backend->share;
     uint32_t ram_flags;
 
     if (!backend->size) {
@@ -44,6 +45,8 @@ memfd_backend_memory_alloc(HostMemoryBackend *backend, Error **errp)
     }
 
     if (fd >= 0) {
+        /* A clone maps the memory of its template copy-on-write */
+        share = share && !cpr_is_clone();
         goto have_fd;
     }
 
@@ -58,7 +61,7 @@ memfd_backend_memory_alloc(HostMemoryBackend *backend, Error **errp)
 
 have_fd:
     backend->aligned = true;
-    ram_flags = backend->share ? RAM_SHARED : RAM_PRIVATE;
+    ram_flags = share ? RAM_SHARED : RAM_PRIVATE;
     ram_flags |= backend->reserve ? 0 : RAM_NORESERVE;
     ram_flags |= backend->guest_memfd ? RAM_GUEST_MEMFD : 0;
     return memory_region_init_ram_from_fd(&backend->mr, OBJECT(backend), name,
@@ -27,7 +27,7 @@ static bool
 shm_backend_memory_alloc(HostMemoryBackend *backend, Error **errp)
 {
     g_autofree char *backend_name = host_memory_backend_get_name(backend);
-    uint32_t ram_flags;
+    uint32_t ram_flags = RAM_SHARED;
     int fd = cpr_find_fd(backend_name, 0);
 
     if (!backend->size) {
@@ -41,6 +41,10 @@ shm_backend_memory_alloc(HostMemoryBackend *backend, Error **errp)
     }
 
     if (fd >= 0) {
+        /* A clone maps the memory of its template copy-on-write */
+        if (cpr_is_clone()) {
+            ram_flags = RAM_PRIVATE;
+        }
         goto have_fd;
     }
 
@@ -52,7 +56,6 @@ shm_backend_memory_alloc(HostMemoryBackend *backend, Error **errp)
 
 have_fd:
     /* Let's do the same as memory-backend-ram,share=on would do. */
-    ram_flags = RAM_SHARED;
     ram_flags |= backend->reserve ? 0 : RAM_NORESERVE;
 
     return memory_region_init_ram_from_fd(&backend->mr, OBJECT(backend),
@@ -21,7 +21,11 @@
 #include "qemu/mmap-alloc.h"
 #include "qemu/madvise.h"
 #include "qemu/cutils.h"
+#include "qemu/error-report.h"
+#include "qemu/timer.h"
 #include "hw/qdev-core.h"
+#include "migration/misc.h"
+#include "system/runstate.h"
 
 #ifdef CONFIG_NUMA
 #include <numaif.h>
@@ -256,6 +260,114 @@ static void host_memory_backend_set_prealloc(Object *obj, bool value,
     }
 }
 
+static bool host_memory_backend_get_prefault(Object *obj, Error **errp)
+{
+    HostMemoryBackend *backend = MEMORY_BACKEND(obj);
+
+    return backend->prefault;
+}
+
+static void host_memory_backend_set_prefault(Object *obj, bool value,
+                                             Error **errp)
+{
+    HostMemoryBackend *backend = MEMORY_BACKEND(obj);
+
+    if (host_memory_backend_mr_inited(backend)) {
+        error_setg(errp, "cannot change property value");
+        return;
+    }
+    backend->prefault = value;
+}
+
+/* How often to check whether incoming postcopy has completed */
+#define HOST_MEMORY_BACKEND_PREFAULT_RETRY_MS   100
+
+static void host_memory_backend_prefault_start(HostMemoryBackend *backend);
+
+static void host_memory_backend_prefault_retry(void *opaque)
+{
+    if (runstate_is_running()) {
+        host_memory_backend_prefault_start(opaque);
+    }
+}
+
+static void host_memory_backend_prefault_start(HostMemoryBackend *backend)
+{
+    int fd = memory_region_get_fd(&backend->mr);
+    Error *local_err = NULL;
+    bool populate_read;
+
+    if (backend->prefault_started) {
+        return;
+    }
+
+    /*
+     * Pages are placed by the postcopy fault handler, leave them alone.
+     * Nothing notifies the end of incoming postcopy, so check again later.
+     */
+    if (migration_in_incoming_postcopy()) {
+        if (!backend->prefault_timer) {
+            backend->prefault_timer =
+                timer_new_ms(QEMU_CLOCK_REALTIME,
+                             host_memory_backend_prefault_retry, backend);
+        }
+        timer_mod(backend->prefault_timer,
+                  qemu_clock_get_ms(QEMU_CLOCK_REALTIME) +
+                  HOST_MEMORY_BACKEND_PREFAULT_RETRY_MS);
+        return;
+    }
+
+    /*
+     * Write faults on a private file mapping, such as share=off or a
+     * cpr-clone guest, would copy the pages instead of mapping the file.
+     */
+    populate_read = fd >= 0 && !qemu_ram_is_shared(backend->mr.ram_block);
+
+    backend->prefault_started = true;
+    backend->prefault_job =
+        qemu_prefault_mem_start(fd, memory_region_get_ram_ptr(&backend->mr),
+                                memory_region_size(&backend->mr),
+                                populate_read, backend->prealloc_threads,
+                                backend->prealloc_context, &local_err);
+    if (!backend->prefault_job) {
+        error_prepend(&local_err, "memory backend '%s': ",
+                      object_get_canonical_path_component(OBJECT(backend)));
+        warn_report_err(local_err);
+    }
+}
+
+static void host_memory_backend_prefault_vm_state(void *opaque, bool running,
+                                                  RunState state)
+{
+    if (running) {
+        host_memory_backend_prefault_start(opaque);
+    }
+}
+
+MemdevPrefault *host_memory_backend_query_prefault(HostMemoryBackend *backend)
+{
+    MemdevPrefault *info;
+    int error;
+
+    if (!backend->prefault) {
+        return NULL;
+    }
+
+    info = g_new0(MemdevPrefault, 1);
+    if (!backend->prefault_started) {
+        info->status = MEMDEV_PREFAULT_STATUS_PENDING;
+    } else if (!backend->prefault_job) {
+        info->status = MEMDEV_PREFAULT_STATUS_FAILED;
+    } else if (!qemu_prefault_mem_progress(backend->prefault_job,
+                                           &info->populated, &error)) {
+        info->status = MEMDEV_PREFAULT_STATUS_ACTIVE;
+    } else {
+        info->status = error ? MEMDEV_PREFAULT_STATUS_FAILED :
+                               MEMDEV_PREFAULT_STATUS_COMPLETED;
+    }
+    return info;
+}
+
 static void host_memory_backend_get_prealloc_threads(Object *obj, Visitor *v,
     const char *name, void *opaque, Error **errp)
 {
@@ -298,6 +410,21 @@ static void host_memory_backend_post_init(Object *obj)
     object_apply_compat_props(obj);
 }
 
+static void host_memory_backend_unparent(Object *obj)
+{
+    HostMemoryBackend *backend = MEMORY_BACKEND(obj);
+
+    /* The memory is freed together with the children of the backend */
+    if (backend->prefault_vmse) {
+        qemu_del_vm_change_state_handler(backend->prefault_vmse);
+        backend->prefault_vmse = NULL;
+    }
+    timer_free(backend->prefault_timer);
+    backend->prefault_timer = NULL;
+    qemu_prefault_mem_stop(backend->prefault_job);
+    backend->prefault_job = NULL;
+}
+
 bool host_memory_backend_mr_inited(HostMemoryBackend *backend)
 {
     /*
@@ -342,6 +469,10 @@ host_memory_backend_memory_complete(UserCreatable *uc, Error **errp)
     if (!bc->alloc) {
         return;
     }
+    if (backend->prealloc && backend->prefault) {
+        error_setg(errp, "'prealloc=on' and 'prefault=on' are incompatible");
+        return;
+    }
     if (!bc->alloc(backend, errp)) {
         return;
     }
@@ -429,6 +560,18 @@ host_memory_backend_memory_complete(UserCreatable *uc, Error **errp)
                                                 async, errp)) {
         return;
     }
+
+    /*
+     * Prefaulting in the background is started when the guest runs, so that
+     * the parts it touches first can be populated first.
+     */
+    if (backend->prefault) {
+        backend->prefault_vmse = qemu_add_vm_change_state_handler(
+            host_memory_backend_prefault_vm_state, backend);
+        if (runstate_is_running()) {
+            host_memory_backend_prefault_start(backend);
+        }
+    }
 }
 
 static bool
@@ -507,6 +650,7 @@ host_memory_backend_class_init(ObjectClass *oc, const void *data)
 
     ucc->complete = host_memory_backend_memory_complete;
     ucc->can_be_deleted = host_memory_backend_can_be_deleted;
+    oc->unparent = host_memory_backend_unparent;
 
     object_class_property_add_bool(oc, "merge",
         host_memory_backend_get_merge,
@@ -534,6 +678,11 @@ host_memory_backend_class_init(ObjectClass *oc, const void *data)
         object_property_allow_set_link, OBJ_PROP_LINK_STRONG);
     object_class_property_set_description(oc, "prealloc-context",
         "Context to use for creating CPU threads for preallocation");
+    object_class_property_add_bool(oc, "prefault",
+        host_memory_backend_get_prefault,
+        host_memory_backend_set_prefault);
+    object_class_property_set_description(oc, "prefault",
+        "Populate memory in the background once the guest runs");
     object_class_property_add(oc, "size", "int",
         host_memory_backend_get_size,
         host_memory_backend_set_size,
@@ -183,6 +183,7 @@ typedef struct BDRVRawState {
     bool use_linux_aio:1;
     bool has_laio_fdsync:1;
     bool use_linux_io_uring:1;
+    bool use_io_uring_fixed_bufs:1;
     bool use_mpath:1;
     int page_cache_inconsistent; /* errno from fdatasync failure */
     bool has_fallocate;
@@ -190,6 +191,8 @@ typedef struct BDRVRawState {
     bool force_alignment;
     bool drop_cache;
     bool check_cache_dropped;
+    unsigned io_uring_setup_flags; /* LURING_SETUP_* */
+    GHashTable *io_uring_bufs; /* host address -> size of registered buffers */
     struct {
         uint64_t discard_nb_ok;
         uint64_t discard_nb_failed;
@@ -585,6 +588,25 @@ static QemuOptsList raw_runtime_opts = {
             .type = QEMU_OPT_NUMBER,
             .help = "AIO max batch size (0 = auto handled by AIO backend, default: 0)",
         },
+#ifdef CONFIG_LINUX_IO_URING
+        {
+            .name = "io-uring-sqpoll",
+            .type = QEMU_OPT_BOOL,
+            .help = "poll the io_uring submission queue from a kernel thread "
+                    "(default: off)",
+        },
+        {
+            .name = "io-uring-iopoll",
+            .type = QEMU_OPT_BOOL,
+            .help = "busy-poll for io_uring completions (default: off)",
+        },
+        {
+            .name = "io-uring-fixed-buffers",
+            .type = QEMU_OPT_BOOL,
+            .help = "register guest RAM as io_uring fixed buffers "
+                    "(default: off)",
+        },
+#endif
         {
             .name = "locking",
             .type = QEMU_OPT_STRING,
@@ -666,6 +688,25 @@ static int raw_open_common(BlockDriverState *bs, QDict *options,
 
     s->aio_max_batch = qemu_opt_get_number(opts, "aio-max-batch", 0);
 
+#ifdef CONFIG_LINUX_IO_URING
+    if (qemu_opt_get_bool(opts, "io-uring-sqpoll", false)) {
+        s->io_uring_setup_flags |= LURING_SETUP_SQPOLL;
+    }
+    if (qemu_opt_get_bool(opts, "io-uring-iopoll", false)) {
+        s->io_uring_setup_flags |= LURING_SETUP_IOPOLL;
+    }
+    s->use_io_uring_fixed_bufs =
+        qemu_opt_get_bool(opts, "io-uring-fixed-buffers", false);
+
+    if (!s->use_linux_io_uring &&
+        (s->io_uring_setup_flags || s->use_io_uring_fixed_bufs)) {
+        error_setg(errp, "io-uring-sqpoll, io-uring-iopoll and "
+                         "io-uring-fixed-buffers require aio=io_uring");
+        ret = -EINVAL;
+        goto fail;
+    }
+#endif
+
     locking = qapi_enum_parse(&OnOffAuto_lookup,
                               qemu_opt_get(opts, "locking"),
                               ON_OFF_AUTO_AUTO, &local_err);
@@ -755,7 +796,19 @@ static int raw_open_common(BlockDriverState *bs, QDict *options,
     }
 #endif /* !defined(CONFIG_LINUX_AIO) */
 
-#ifndef CONFIG_LINUX_IO_URING
+#ifdef CONFIG_LINUX_IO_URING
+    /* Polled I/O is only supported by the kernel for O_DIRECT */
+    if ((s->io_uring_setup_flags & LURING_SETUP_IOPOLL) &&
+        !(s->open_flags & O_DIRECT)) {
+        error_setg(errp, "io-uring-iopoll=on was specified, but it requires "
+                         "cache.direct=on, which was not specified.");
+        ret = -EINVAL;
+        goto fail;
+    }
+    if (s->use_io_uring_fixed_bufs) {
+        s->io_uring_bufs = g_hash_table_new(NULL, NULL);
+    }
+#else
     if (s->use_linux_io_uring) {
         error_setg(errp, "aio=io_uring was specified, but is not supported "
                          "in this build.");
@@ -823,6 +876,9 @@ static int raw_open_common(BlockDriverState *bs, QDict *options,
     } else if (s->use_linux_io_uring && !luring_has_fua()) {
         bs->supported_write_flags &= ~BDRV_REQ_FUA;
     }
+    if (s->use_io_uring_fixed_bufs) {
+        bs->supported_write_flags |= BDRV_REQ_REGISTERED_BUF;
+    }
 
     bs->supported_zero_flags = BDRV_REQ_MAY_UNMAP | BDRV_REQ_NO_FALLBACK;
     if (S_ISREG(st.st_mode)) {
@@ -834,6 +890,12 @@ fail:
     if (ret < 0 && s->fd != -1) {
         qemu_close(s->fd);
     }
+#ifdef CONFIG_LINUX_IO_URING
+    if (ret < 0 && s->io_uring_bufs) {
+        g_hash_table_destroy(s->io_uring_bufs);
+        s->io_uring_bufs = NULL;
+    }
+#endif
     if (filename && (bdrv_flags & BDRV_O_TEMPORARY)) {
         unlink(filename);
     }
@@ -2523,7 +2585,8 @@ static bool bdrv_qiov_is_aligned(BlockDriverState *bs, QEMUIOVector *qiov)
 }
 
 #ifdef CONFIG_LINUX_IO_URING
-static inline bool raw_check_linux_io_uring(BDRVRawState *s)
+static inline bool raw_check_linux_io_uring(BDRVRawState *s,
+                                            unsigned setup_flags)
 {
     Error *local_err = NULL;
     AioContext *ctx;
@@ -2533,7 +2596,7 @@ static inline bool raw_check_linux_io_uring(BDRVRawState *s)
     }
 
     ctx = qemu_get_current_aio_context();
-    if (unlikely(!aio_setup_linux_io_uring(ctx, &local_err))) {
+    if (unlikely(!aio_setup_linux_io_uring(ctx, setup_flags, &local_err))) {
         error_reportf_err(local_err, "Unable to use linux io_uring, "
                                      "falling back to thread pool: ");
         s->use_linux_io_uring = false;
@@ -2595,9 +2658,10 @@ static int coroutine_fn raw_co_prw(BlockDriverState *bs, int64_t *offset_ptr,
     if (s->needs_alignment && !bdrv_qiov_is_aligned(bs, qiov)) {
         type |= QEMU_AIO_MISALIGNED;
 #ifdef CONFIG_LINUX_IO_URING
-    } else if (raw_check_linux_io_uring(s)) {
+    } else if (raw_check_linux_io_uring(s, s->io_uring_setup_flags)) {
         assert(qiov->size == bytes);
-        ret = luring_co_submit(bs, s->fd, offset, qiov, type, flags);
+        ret = luring_co_submit(bs, s->fd, offset, qiov, type, flags,
+                               s->io_uring_setup_flags, s->aio_max_batch);
         goto out;
 #endif
 #ifdef CONFIG_LINUX_AIO
@@ -2692,8 +2756,12 @@ static int coroutine_fn raw_co_flush_to_disk(BlockDriverState *bs)
     };
 
 #ifdef CONFIG_LINUX_IO_URING
-    if (raw_check_linux_io_uring(s)) {
-        return luring_co_submit(bs, s->fd, 0, NULL, QEMU_AIO_FLUSH, 0);
+    /* IOPOLL rings cannot fsync, use a regular ring for flushes */
+    if (raw_check_linux_io_uring(s, s->io_uring_setup_flags &
+                                    ~LURING_SETUP_IOPOLL)) {
+        return luring_co_submit(bs, s->fd, 0, NULL, QEMU_AIO_FLUSH, 0,
+                                s->io_uring_setup_flags & ~LURING_SETUP_IOPOLL,
+                                0);
     }
 #endif
 #ifdef CONFIG_LINUX_AIO
@@ -2704,10 +2772,59 @@ static int coroutine_fn raw_co_flush_to_disk(BlockDriverState *bs)
     return raw_thread_pool_submit(handle_aiocb_flush, &acb);
 }
 
+#ifdef CONFIG_LINUX_IO_URING
+static bool raw_register_buf(BlockDriverState *bs, void *host, size_t size,
+                             Error **errp)
+{
+    BDRVRawState *s = bs->opaque;
+
+    if (!s->io_uring_bufs || g_hash_table_contains(s->io_uring_bufs, host)) {
+        return true;
+    }
+
+    if (!luring_register_buf(host, size, errp)) {
+        return false;
+    }
+
+    g_hash_table_insert(s->io_uring_bufs, host, GSIZE_TO_POINTER(size));
+    return true;
+}
+
+static void raw_unregister_buf(BlockDriverState *bs, void *host, size_t size)
+{
+    BDRVRawState *s = bs->opaque;
+
+    if (s->io_uring_bufs && g_hash_table_remove(s->io_uring_bufs, host)) {
+        luring_unregister_buf(host, size);
+    }
+}
+
+static void raw_unregister_all_bufs(BDRVRawState *s)
+{
+    GHashTableIter iter;
+    gpointer host, size;
+
+    if (!s->io_uring_bufs) {
+        return;
+    }
+
+    g_hash_table_iter_init(&iter, s->io_uring_bufs);
+    while (g_hash_table_iter_next(&iter, &host, &size)) {
+        luring_unregister_buf(host, GPOINTER_TO_SIZE(size));
+    }
+    g_hash_table_destroy(s->io_uring_bufs);
+    s->io_uring_bufs = NULL;
+}
+#endif
+
 static void raw_close(BlockDriverState *bs)
 {
     BDRVRawState *s = bs->opaque;
 
+#ifdef CONFIG_LINUX_IO_URING
+    raw_unregister_all_bufs(s);
+#endif
+
     if (s->fd >= 0) {
 #if defined(CONFIG_BLKZONED)
         g_free(bs->wps);
@@ -4000,6 +4117,10 @@ BlockDriver bdrv_file = {
     .bdrv_co_copy_range_from = raw_co_copy_range_from,
     .bdrv_co_copy_range_to  = raw_co_copy_range_to,
     .bdrv_refresh_limits = raw_refresh_limits,
+#ifdef CONFIG_LINUX_IO_URING
+    .bdrv_register_buf      = raw_register_buf,
+    .bdrv_unregister_buf    = raw_unregister_buf,
+#endif
 
     .bdrv_co_truncate                   = raw_co_truncate,
     .bdrv_co_getlength                  = raw_co_getlength,
@@ -4458,6 +4579,10 @@ static BlockDriver bdrv_host_device = {
     .bdrv_co_copy_range_from = raw_co_copy_range_from,
     .bdrv_co_copy_range_to  = raw_co_copy_range_to,
     .bdrv_refresh_limits = raw_refresh_limits,
+#ifdef CONFIG_LINUX_IO_URING
+    .bdrv_register_buf      = raw_register_buf,
+    .bdrv_unregister_buf    = raw_unregister_buf,
+#endif
 
     .bdrv_co_truncate                   = raw_co_truncate,
     .bdrv_co_getlength                  = raw_co_getlength,
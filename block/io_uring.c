@@ -16,6 +16,8 @@
 #include "block/raw-aio.h"
 #include "qemu/coroutine.h"
 #include "qemu/defer-call.h"
+#include "qemu/rcu.h"
+#include "qemu/thread.h"
 #include "qapi/error.h"
 #include "system/block-backend.h"
 #include "trace.h"
@@ -26,14 +28,28 @@
 /* io_uring ring size */
 #define MAX_ENTRIES 128
 
+/* Idle time in milliseconds before the SQPOLL kernel thread goes to sleep */
+#define SQPOLL_IDLE_MS 1000
+
+/*
+ * Fixed buffer table size.  The kernel limits a single fixed buffer to 1 GiB,
+ * so larger guest RAM regions occupy several slots.
+ */
+#define MAX_FIXED_BUFS 4096
+#define FIXED_BUF_MAX_SIZE (1ULL << 30)
+
 typedef struct LuringAIOCB {
     Coroutine *co;
+    LuringState *s;
     struct io_uring_sqe sqeq;
     ssize_t ret;
     QEMUIOVector *qiov;
     bool is_read;
     QSIMPLEQ_ENTRY(LuringAIOCB) next;
 
+    /* Completion callback when the fd monitoring ring is shared */
+    CqeHandler cqe_handler;
+
     /*
      * Buffered reads may require resubmission, see
      * luring_resubmit_short_read().
@@ -52,22 +68,339 @@ typedef struct LuringQueue {
 struct LuringState {
     AioContext *aio_context;
 
-    struct io_uring ring;
+    /* Either own_ring or the fd monitoring ring of aio_context */
+    struct io_uring *ring;
+    struct io_uring own_ring;
+
+    /*
+     * Requests go through the fd monitoring ring with aio_add_sqe() so that
+     * a single io_uring_enter(2) per aio_poll() iteration submits and reaps
+     * them together with fd events and the timer deadline.  io_q only tracks
+     * in-flight requests then, they are never queued.
+     */
+    bool shared_ring;
+
+    /* LURING_SETUP_* flags the ring was created with */
+    unsigned setup_flags;
 
     /* No locking required, only accessed from AioContext home thread */
     LuringQueue io_q;
 
     QEMUBH *completion_bh;
+
+    /* Set if the ring has a fixed buffer table, see luring_register_buf() */
+    bool has_fixed_bufs;
+    QLIST_ENTRY(LuringState) fixed_bufs_next;
 };
 
+typedef struct {
+    void *host;
+    size_t size;
+} LuringFixedBuf;
+
+/* Immutable copy of the fixed buffer slots that is read under RCU */
+typedef struct {
+    struct rcu_head rcu;
+    unsigned nr;
+    LuringFixedBuf bufs[];
+} LuringFixedBufTable;
+
+/*
+ * Fixed buffers are process-wide: every ring with a buffer table mirrors the
+ * same slots so that a request can use a registered buffer no matter which
+ * AioContext it is submitted from.
+ */
+static struct {
+    QemuMutex lock;
+
+    /* The following fields are protected by lock */
+    LuringFixedBuf bufs[MAX_FIXED_BUFS];
+    unsigned refcnt[MAX_FIXED_BUFS];
+    QLIST_HEAD(, LuringState) states;
+
+    /* RCU-protected copy of bufs[] for lookups in the I/O path */
+    LuringFixedBufTable *table;
+} luring_fixed_bufs;
+
+static void __attribute__((constructor)) luring_fixed_bufs_init(void)
+{
+    qemu_mutex_init(&luring_fixed_bufs.lock);
+    QLIST_INIT(&luring_fixed_bufs.states);
+}
+
+/* Called with luring_fixed_bufs.lock held */
+static int luring_update_fixed_buf(LuringState *s, unsigned slot)
+{
+#ifdef HAVE_IO_URING_REGISTER_BUFFERS_SPARSE
+    struct iovec iov = {
+        .iov_base = luring_fixed_bufs.bufs[slot].host,
+        .iov_len = luring_fixed_bufs.bufs[slot].size,
+    };
+    int ret;
+
+    ret = io_uring_register_buffers_update_tag(s->ring, slot, &iov, NULL, 1);
+    trace_luring_update_fixed_buf(s, slot, iov.iov_base, iov.iov_len, ret);
+    return ret < 0 ? ret : 0;
+#else
+    /* Rings never get a buffer table, see luring_init_fixed_bufs() */
+    g_assert_not_reached();
+#endif
+}
+
+/*
+ * Update @slot in all rings.  Called with luring_fixed_bufs.lock held.
+ *
+ * io_uring_register(2) may be called from any thread and the kernel keeps
+ * buffers of in-flight requests alive, so this does not need to synchronize
+ * with the AioContexts that own the rings.
+ */
+static int luring_update_fixed_buf_all(unsigned slot)
+{
+    LuringState *s;
+    int ret;
+
+    QLIST_FOREACH(s, &luring_fixed_bufs.states, fixed_bufs_next) {
+        ret = luring_update_fixed_buf(s, slot);
+        if (ret < 0) {
+            return ret;
+        }
+    }
+    return 0;
+}
+
+/* Publish bufs[] for the I/O path.  Called with luring_fixed_bufs.lock held */
+static void luring_publish_fixed_bufs(void)
+{
+    LuringFixedBufTable *old = luring_fixed_bufs.table;
+    LuringFixedBufTable *table;
+    unsigned nr = 0;
+    unsigned i;
+
+    for (i = 0; i < MAX_FIXED_BUFS; i++) {
+        if (luring_fixed_bufs.refcnt[i]) {
+            nr = i + 1;
+        }
+    }
+
+    table = g_malloc(sizeof(*table) + nr * sizeof(table->bufs[0]));
+    table->nr = nr;
+    memcpy(table->bufs, luring_fixed_bufs.bufs, nr * sizeof(table->bufs[0]));
+    qatomic_rcu_set(&luring_fixed_bufs.table, table);
+
+    if (old) {
+        g_free_rcu(old, rcu);
+    }
+}
+
+static int luring_find_fixed_buf(void *host, size_t size)
+{
+    unsigned i;
+
+    for (i = 0; i < MAX_FIXED_BUFS; i++) {
+        if (luring_fixed_bufs.refcnt[i] &&
+            luring_fixed_bufs.bufs[i].host == host &&
+            luring_fixed_bufs.bufs[i].size == size) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static void luring_put_fixed_buf(unsigned slot)
+{
+    assert(luring_fixed_bufs.refcnt[slot] > 0);
+    if (--luring_fixed_bufs.refcnt[slot] > 0) {
+        return;
+    }
+
+    luring_fixed_bufs.bufs[slot] = (LuringFixedBuf) {};
+    luring_update_fixed_buf_all(slot);
+}
+
+static void luring_unregister_chunks(void *host, size_t size)
+{
+    size_t offset;
+
+    for (offset = 0; offset < size; offset += FIXED_BUF_MAX_SIZE) {
+        size_t len = MIN(size - offset, FIXED_BUF_MAX_SIZE);
+        int slot = luring_find_fixed_buf(host + offset, len);
+
+        if (slot >= 0) {
+            luring_put_fixed_buf(slot);
+        }
+    }
+}
+
+/**
+ * luring_register_buf:
+ * @host: start of the memory region
+ * @size: size of the memory region in bytes
+ * @errp: error object
+ *
+ * Register @host as fixed buffer with all io_uring rings, including rings
+ * created later on.  Requests with the BDRV_REQ_REGISTERED_BUF flag whose
+ * data lies within a single fixed buffer are then submitted as
+ * IORING_OP_READ_FIXED/IORING_OP_WRITE_FIXED, which saves the kernel from
+ * pinning and unpinning the guest pages on every request.
+ *
+ * Registrations are reference counted, each call must be balanced by
+ * luring_unregister_buf().
+ *
+ * Returns: true on success, false on failure with @errp set.
+ */
+bool luring_register_buf(void *host, size_t size, Error **errp)
+{
+    size_t offset;
+    int ret;
+
+    QEMU_LOCK_GUARD(&luring_fixed_bufs.lock);
+
+    for (offset = 0; offset < size; offset += FIXED_BUF_MAX_SIZE) {
+        size_t len = MIN(size - offset, FIXED_BUF_MAX_SIZE);
+        int slot = luring_find_fixed_buf(host + offset, len);
+
+        if (slot >= 0) {
+            luring_fixed_bufs.refcnt[slot]++;
+            continue;
+        }
+
+        for (slot = 0; slot < MAX_FIXED_BUFS; slot++) {
+            if (!luring_fixed_bufs.refcnt[slot]) {
+                break;
+            }
+        }
+        if (slot == MAX_FIXED_BUFS) {
+            error_setg(errp, "io_uring fixed buffer table is full");
+            goto fail;
+        }
+
+        luring_fixed_bufs.bufs[slot] = (LuringFixedBuf) {
+            .host = host + offset,
+            .size = len,
+        };
+        luring_fixed_bufs.refcnt[slot] = 1;
+
+        ret = luring_update_fixed_buf_all(slot);
+        if (ret < 0) {
+            error_setg_errno(errp, -ret, "failed to register io_uring fixed "
+                             "buffer (check RLIMIT_MEMLOCK)");
+            offset += len;
+            goto fail;
+        }
+    }
+
+    luring_publish_fixed_bufs();
+    return true;
+
+fail:
+    luring_unregister_chunks(host, offset);
+    luring_publish_fixed_bufs();
+    return false;
+}
+
+void luring_unregister_buf(void *host, size_t size)
+{
+    QEMU_LOCK_GUARD(&luring_fixed_bufs.lock);
+
+    luring_unregister_chunks(host, size);
+    luring_publish_fixed_bufs();
+}
+
+/* Returns the fixed buffer slot that contains @iov or -1 */
+static int luring_fixed_buf_index(const struct iovec *iov)
+{
+    LuringFixedBufTable *table;
+    unsigned i;
+
+    RCU_READ_LOCK_GUARD();
+
+    table = qatomic_rcu_read(&luring_fixed_bufs.table);
+    if (!table) {
+        return -1;
+    }
+
+    for (i = 0; i < table->nr; i++) {
+        LuringFixedBuf *buf = &table->bufs[i];
+
+        if (iov->iov_base >= buf->host &&
+            iov->iov_base + iov->iov_len <= buf->host + buf->size) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/*
+ * Set up the fixed buffer table of a new ring and fill it with the buffers
+ * that are already registered.  Rings keep working without fixed buffers if
+ * the kernel or liburing do not support sparse buffer tables.
+ */
+static void luring_init_fixed_bufs(LuringState *s)
+{
+#ifdef HAVE_IO_URING_REGISTER_BUFFERS_SPARSE
+    unsigned i;
+
+    if (io_uring_register_buffers_sparse(s->ring, MAX_FIXED_BUFS) < 0) {
+        return;
+    }
+
+    QEMU_LOCK_GUARD(&luring_fixed_bufs.lock);
+
+    for (i = 0; i < MAX_FIXED_BUFS; i++) {
+        if (luring_fixed_bufs.refcnt[i] && luring_update_fixed_buf(s, i) < 0) {
+            /* Leave the ring without fixed buffers rather than half-filled */
+            io_uring_unregister_buffers(s->ring);
+            return;
+        }
+    }
+
+    s->has_fixed_bufs = true;
+    QLIST_INSERT_HEAD(&luring_fixed_bufs.states, s, fixed_bufs_next);
+#endif
+}
+
+static void luring_cleanup_fixed_bufs(LuringState *s)
+{
+    if (s->has_fixed_bufs) {
+        QEMU_LOCK_GUARD(&luring_fixed_bufs.lock);
+        QLIST_REMOVE(s, fixed_bufs_next);
+        s->has_fixed_bufs = false;
+    }
+}
+
+static void luring_prep_sqe(struct io_uring_sqe *sqe, void *opaque)
+{
+    LuringAIOCB *luringcb = opaque;
+
+    *sqe = luringcb->sqeq;
+}
+
+/*
+ * Hand a request to the shared fd monitoring ring.  aio_poll() submits it
+ * with its next io_uring_enter(2) call and runs luring_cqe_handler_cb() when
+ * it completes.
+ */
+static void luring_add_sqe(LuringState *s, LuringAIOCB *luringcb)
+{
+    aio_add_sqe(s->aio_context, luring_prep_sqe, luringcb,
+                &luringcb->cqe_handler);
+    s->io_q.in_flight++;
+}
+
 /**
  * luring_resubmit:
  *
  * Resubmit a request by appending it to submit_queue.  The caller must ensure
  * that ioq_submit() is called later so that submit_queue requests are started.
+ * Shared rings take the request right away.
  */
 static void luring_resubmit(LuringState *s, LuringAIOCB *luringcb)
 {
+    if (s->shared_ring) {
+        luring_add_sqe(s, luringcb);
+        return;
+    }
+
     QSIMPLEQ_INSERT_TAIL(&s->io_q.submit_queue, luringcb, next);
     s->io_q.in_queue++;
 }
@@ -90,6 +423,15 @@ static void luring_resubmit_short_read(LuringState *s, LuringAIOCB *luringcb,
     luringcb->total_read += nread;
     remaining = luringcb->qiov->size - luringcb->total_read;
 
+    /* Fixed buffer reads use a flat buffer instead of an iovec */
+    if (luringcb->sqeq.opcode == IORING_OP_READ_FIXED) {
+        luringcb->sqeq.off += nread;
+        luringcb->sqeq.addr += nread;
+        luringcb->sqeq.len = remaining;
+        luring_resubmit(s, luringcb);
+        return;
+    }
+
     /* Shorten qiov */
     resubmit_qiov = &luringcb->resubmit_qiov;
     if (resubmit_qiov->iov == NULL) {
@@ -108,6 +450,103 @@ static void luring_resubmit_short_read(LuringState *s, LuringAIOCB *luringcb,
     luring_resubmit(s, luringcb);
 }
 
+/*
+ * Rings created with IORING_SETUP_IOPOLL do not raise completion events, the
+ * kernel only polls the device for completions when asked to by
+ * io_uring_enter(2) with IORING_ENTER_GETEVENTS.  io_uring_submit() does that
+ * for IOPOLL rings even if there is nothing to submit.
+ */
+static void luring_reap_iopoll(LuringState *s)
+{
+    if ((s->setup_flags & LURING_SETUP_IOPOLL) && s->io_q.in_flight > 0 &&
+        !io_uring_cq_ready(s->ring)) {
+        io_uring_submit(s->ring);
+    }
+}
+
+/**
+ * luring_complete:
+ * @s: AIO state
+ * @luringcb: the request whose cqe has been consumed
+ * @ret: the result from the cqe
+ *
+ * Finish a request and wake up its coroutine, or resubmit it if the request
+ * needs another go.
+ */
+static void luring_complete(LuringState *s, LuringAIOCB *luringcb, int ret)
+{
+    /* total_read is non-zero only for resubmitted read requests */
+    int total_bytes = ret + luringcb->total_read;
+
+    trace_luring_process_completion(s, luringcb, ret);
+
+    if (ret < 0) {
+        /*
+         * Only writev/readv/fsync requests on regular files or host block
+         * devices are submitted. Therefore -EAGAIN is not expected but it's
+         * known to happen sometimes with Linux SCSI. Submit again and hope
+         * the request completes successfully.
+         *
+         * For more information, see:
+         * https://lore.kernel.org/io-uring/20210727165811.284510-3-axboe@kernel.dk/T/#u
+         *
+         * If the code is changed to submit other types of requests in the
+         * future, then this workaround may need to be extended to deal with
+         * genuine -EAGAIN results that should not be resubmitted
+         * immediately.
+         */
+        if (ret == -EINTR || ret == -EAGAIN) {
+            luring_resubmit(s, luringcb);
+            return;
+        }
+    } else if (!luringcb->qiov) {
+        /* Flush, ret is 0 */
+    } else if (total_bytes == luringcb->qiov->size) {
+        ret = 0;
+    /* Only read/write */
+    } else {
+        /* Short Read/Write */
+        if (luringcb->is_read) {
+            if (ret > 0) {
+                luring_resubmit_short_read(s, luringcb, ret);
+                return;
+            } else {
+                /* Pad with zeroes */
+                qemu_iovec_memset(luringcb->qiov, total_bytes, 0,
+                                  luringcb->qiov->size - total_bytes);
+                ret = 0;
+            }
+        } else {
+            ret = -ENOSPC;
+        }
+    }
+
+    luringcb->ret = ret;
+    qemu_iovec_destroy(&luringcb->resubmit_qiov);
+
+    /*
+     * If the coroutine is already entered it must be in ioq_submit()
+     * and will notice luringcb->ret has been filled in when it
+     * eventually runs later. Coroutines cannot be entered recursively
+     * so avoid doing that!
+     */
+    assert(luringcb->co->ctx == s->aio_context);
+    if (!qemu_coroutine_entered(luringcb->co)) {
+        aio_co_wake(luringcb->co);
+    }
+}
+
+/* Completion callback for requests on the shared fd monitoring ring */
+static void luring_cqe_handler_cb(CqeHandler *cqe_handler)
+{
+    LuringAIOCB *luringcb = container_of(cqe_handler, LuringAIOCB,
+                                         cqe_handler);
+    LuringState *s = luringcb->s;
+
+    s->io_q.in_flight--;
+    luring_complete(s, luringcb, cqe_handler->cqe.res);
+}
+
 /**
  * luring_process_completions:
  * @s: AIO state
@@ -124,7 +563,6 @@ static void luring_resubmit_short_read(LuringState *s, LuringAIOCB *luringcb,
 static void luring_process_completions(LuringState *s)
 {
     struct io_uring_cqe *cqes;
-    int total_bytes;
 
     defer_call_begin();
 
@@ -145,7 +583,9 @@ static void luring_process_completions(LuringState *s)
      */
     qemu_bh_schedule(s->completion_bh);
 
-    while (io_uring_peek_cqe(&s->ring, &cqes) == 0) {
+    luring_reap_iopoll(s);
+
+    while (io_uring_peek_cqe(s->ring, &cqes) == 0) {
         LuringAIOCB *luringcb;
         int ret;
 
@@ -155,73 +595,21 @@ static void luring_process_completions(LuringState *s)
 
         luringcb = io_uring_cqe_get_data(cqes);
         ret = cqes->res;
-        io_uring_cqe_seen(&s->ring, cqes);
+        io_uring_cqe_seen(s->ring, cqes);
         cqes = NULL;
 
         /* Change counters one-by-one because we can be nested. */
         s->io_q.in_flight--;
-        trace_luring_process_completion(s, luringcb, ret);
-
-        /* total_read is non-zero only for resubmitted read requests */
-        total_bytes = ret + luringcb->total_read;
-
-        if (ret < 0) {
-            /*
-             * Only writev/readv/fsync requests on regular files or host block
-             * devices are submitted. Therefore -EAGAIN is not expected but it's
-             * known to happen sometimes with Linux SCSI. Submit again and hope
-             * the request completes successfully.
-             *
-             * For more information, see:
-             * https://lore.kernel.org/io-uring/20210727165811.284510-3-axboe@kernel.dk/T/#u
-             *
-             * If the code is changed to submit other types of requests in the
-             * future, then this workaround may need to be extended to deal with
-             * genuine -EAGAIN results that should not be resubmitted
-             * immediately.
-             */
-            if (ret == -EINTR || ret == -EAGAIN) {
-                luring_resubmit(s, luringcb);
-                continue;
-            }
-        } else if (!luringcb->qiov) {
-            goto end;
-        } else if (total_bytes == luringcb->qiov->size) {
-            ret = 0;
-        /* Only read/write */
-        } else {
-            /* Short Read/Write */
-            if (luringcb->is_read) {
-                if (ret > 0) {
-                    luring_resubmit_short_read(s, luringcb, ret);
-                    continue;
-                } else {
-                    /* Pad with zeroes */
-                    qemu_iovec_memset(luringcb->qiov, total_bytes, 0,
-                                      luringcb->qiov->size - total_bytes);
-                    ret = 0;
-                }
-            } else {
-                ret = -ENOSPC;
-            }
-        }
-end:
-        luringcb->ret = ret;
-        qemu_iovec_destroy(&luringcb->resubmit_qiov);
-
-        /*
-         * If the coroutine is already entered it must be in ioq_submit()
-         * and will notice luringcb->ret has been filled in when it
-         * eventually runs later. Coroutines cannot be entered recursively
-         * so avoid doing that!
-         */
-        assert(luringcb->co->ctx == s->aio_context);
-        if (!qemu_coroutine_entered(luringcb->co)) {
-            aio_co_wake(luringcb->co);
-        }
+        luring_complete(s, luringcb, ret);
     }
 
-    qemu_bh_cancel(s->completion_bh);
+    /*
+     * Nothing will wake up the event loop when IOPOLL requests complete, so
+     * keep the BH scheduled to busy-poll until all of them are done.
+     */
+    if (!(s->setup_flags & LURING_SETUP_IOPOLL) || s->io_q.in_flight == 0) {
+        qemu_bh_cancel(s->completion_bh);
+    }
 
     defer_call_end();
 }
@@ -238,7 +626,7 @@ static int ioq_submit(LuringState *s)
          */
         QSIMPLEQ_FOREACH_SAFE(luringcb, &s->io_q.submit_queue, next,
                               luringcb_next) {
-            struct io_uring_sqe *sqes = io_uring_get_sqe(&s->ring);
+            struct io_uring_sqe *sqes = io_uring_get_sqe(s->ring);
             if (!sqes) {
                 break;
             }
@@ -246,7 +634,7 @@ static int ioq_submit(LuringState *s)
             *sqes = luringcb->sqeq;
             QSIMPLEQ_REMOVE_HEAD(&s->io_q.submit_queue, next);
         }
-        ret = io_uring_submit(&s->ring);
+        ret = io_uring_submit(s->ring);
         trace_luring_io_uring_submit(s, ret);
         /* Prevent infinite loop if submission is refused */
         if (ret <= 0) {
@@ -295,7 +683,8 @@ static bool qemu_luring_poll_cb(void *opaque)
 {
     LuringState *s = opaque;
 
-    return io_uring_cq_ready(&s->ring);
+    luring_reap_iopoll(s);
+    return io_uring_cq_ready(s->ring);
 }
 
 static void qemu_luring_poll_ready(void *opaque)
@@ -323,6 +712,61 @@ static void luring_deferred_fn(void *opaque)
     }
 }
 
+static uint64_t luring_max_batch(LuringState *s, uint64_t dev_max_batch)
+{
+    uint64_t max_batch = s->aio_context->aio_max_batch ?: MAX_ENTRIES;
+
+    /*
+     * The ring is shared by all block devices in the AioContext, so
+     * `dev_max_batch` allows reducing the batch size for latency-sensitive
+     * devices.
+     */
+    max_batch = MIN_NON_ZERO(dev_max_batch, max_batch);
+
+    /* limit the batch with the number of available ring entries */
+    max_batch = MIN_NON_ZERO(MAX_ENTRIES - s->io_q.in_flight, max_batch);
+
+    return max_batch;
+}
+
+/*
+ * Prepare a read or write from/to a registered buffer.  Only requests with a
+ * single iovec that lies completely within one fixed buffer qualify, all
+ * others use the vectored opcodes.
+ */
+static bool luring_prep_rw_fixed(LuringState *s, LuringAIOCB *luringcb,
+                                 int fd, uint64_t offset, int type,
+                                 BdrvRequestFlags flags)
+{
+    struct io_uring_sqe *sqes = &luringcb->sqeq;
+    struct iovec *iov = luringcb->qiov->iov;
+    int index;
+
+    if (!(flags & BDRV_REQ_REGISTERED_BUF) || !s->has_fixed_bufs ||
+        luringcb->qiov->niov != 1) {
+        return false;
+    }
+
+    index = luring_fixed_buf_index(iov);
+    if (index < 0) {
+        return false;
+    }
+
+    if (type == QEMU_AIO_READ) {
+        io_uring_prep_read_fixed(sqes, fd, iov->iov_base, iov->iov_len,
+                                 offset, index);
+    } else {
+        io_uring_prep_write_fixed(sqes, fd, iov->iov_base, iov->iov_len,
+                                  offset, index);
+#ifdef HAVE_IO_URING_PREP_WRITEV2
+        if (flags & BDRV_REQ_FUA) {
+            sqes->rw_flags = RWF_DSYNC;
+        }
+#endif
+    }
+    return true;
+}
+
 /**
  * luring_do_submit:
  * @fd: file descriptor for I/O
@@ -330,16 +774,24 @@ static void luring_deferred_fn(void *opaque)
  * @s: AIO state
  * @offset: offset for request
  * @type: type of request
+ * @flags: request flags
+ * @dev_max_batch: maximum number of requests to batch for this device
  *
  * Fetches sqes from ring, adds to pending queue and preps them
  *
  */
 static int luring_do_submit(int fd, LuringAIOCB *luringcb, LuringState *s,
-                            uint64_t offset, int type, BdrvRequestFlags flags)
+                            uint64_t offset, int type, BdrvRequestFlags flags,
+                            uint64_t dev_max_batch)
 {
     int ret;
     struct io_uring_sqe *sqes = &luringcb->sqeq;
 
+    if ((type == QEMU_AIO_READ || type == QEMU_AIO_WRITE) &&
+        luring_prep_rw_fixed(s, luringcb, fd, offset, type, flags)) {
+        goto prepped;
+    }
+
     switch (type) {
     case QEMU_AIO_WRITE:
 #ifdef HAVE_IO_URING_PREP_WRITEV2
@@ -370,6 +822,15 @@ static int luring_do_submit(int fd, LuringAIOCB *luringcb, LuringState *s,
                         __func__, type);
         abort();
     }
+
+prepped:
+    if (s->shared_ring) {
+        /* Batching happens naturally, aio_poll() submits all requests */
+        luring_add_sqe(s, luringcb);
+        trace_luring_do_submit(s, false, 0, s->io_q.in_flight);
+        return 0;
+    }
+
     io_uring_sqe_set_data(sqes, luringcb);
 
     QSIMPLEQ_INSERT_TAIL(&s->io_q.submit_queue, luringcb, next);
@@ -377,7 +838,7 @@ static int luring_do_submit(int fd, LuringAIOCB *luringcb, LuringState *s,
     trace_luring_do_submit(s, s->io_q.blocked, s->io_q.in_queue,
                            s->io_q.in_flight);
     if (!s->io_q.blocked) {
-        if (s->io_q.in_flight + s->io_q.in_queue >= MAX_ENTRIES) {
+        if (s->io_q.in_queue >= luring_max_batch(s, dev_max_batch)) {
             ret = ioq_submit(s);
             trace_luring_do_submit_done(s, ret);
             return ret;
@@ -390,20 +851,27 @@ static int luring_do_submit(int fd, LuringAIOCB *luringcb, LuringState *s,
 
 int coroutine_fn luring_co_submit(BlockDriverState *bs, int fd, uint64_t offset,
                                   QEMUIOVector *qiov, int type,
-                                  BdrvRequestFlags flags)
+                                  BdrvRequestFlags flags, unsigned setup_flags,
+                                  uint64_t dev_max_batch)
 {
     int ret;
     AioContext *ctx = qemu_get_current_aio_context();
-    LuringState *s = aio_get_linux_io_uring(ctx);
+    LuringState *s = aio_get_linux_io_uring(ctx, setup_flags);
     LuringAIOCB luringcb = {
         .co         = qemu_coroutine_self(),
+        .s          = s,
+        .cqe_handler.cb = luring_cqe_handler_cb,
         .ret        = -EINPROGRESS,
         .qiov       = qiov,
         .is_read    = (type == QEMU_AIO_READ),
     };
     trace_luring_co_submit(bs, s, &luringcb, fd, offset, qiov ? qiov->size : 0,
                            type);
-    ret = luring_do_submit(fd, &luringcb, s, offset, type, flags);
+    /* IOPOLL rings only support polled reads and writes */
+    assert(!(setup_flags & LURING_SETUP_IOPOLL) || type != QEMU_AIO_FLUSH);
+
+    ret = luring_do_submit(fd, &luringcb, s, offset, type, flags,
+                           dev_max_batch);
 
     if (ret < 0) {
         return ret;
@@ -417,7 +885,19 @@ int coroutine_fn luring_co_submit(BlockDriverState *bs, int fd, uint64_t offset,
 
 void luring_detach_aio_context(LuringState *s, AioContext *old_context)
 {
-    aio_set_fd_handler(old_context, s->ring.ring_fd,
+    if (s->shared_ring) {
+        /*
+         * The fd monitoring ring may go away next, stop mirroring fixed
+         * buffers to it once no request needs it anymore.
+         */
+        aio_drain_sqes(old_context);
+        assert(s->io_q.in_flight == 0);
+        luring_cleanup_fixed_bufs(s);
+        s->aio_context = NULL;
+        return;
+    }
+
+    aio_set_fd_handler(old_context, s->ring->ring_fd,
                        NULL, NULL, NULL, NULL, s);
     qemu_bh_delete(s->completion_bh);
     s->aio_context = NULL;
@@ -426,35 +906,70 @@ void luring_detach_aio_context(LuringState *s, AioContext *old_context)
 void luring_attach_aio_context(LuringState *s, AioContext *new_context)
 {
     s->aio_context = new_context;
+    if (s->shared_ring) {
+        /* Completions are dispatched by aio_poll() */
+        assert(s->ring == &new_context->fdmon_io_uring);
+        return;
+    }
+
     s->completion_bh = aio_bh_new(new_context, qemu_luring_completion_bh, s);
-    aio_set_fd_handler(s->aio_context, s->ring.ring_fd,
+    aio_set_fd_handler(s->aio_context, s->ring->ring_fd,
                        qemu_luring_completion_cb, NULL,
                        qemu_luring_poll_cb, qemu_luring_poll_ready, s);
 }
 
-LuringState *luring_init(Error **errp)
+LuringState *luring_init(AioContext *ctx, unsigned setup_flags, Error **errp)
 {
     int rc;
     LuringState *s = g_new0(LuringState, 1);
-    struct io_uring *ring = &s->ring;
+    struct io_uring *ring = &s->own_ring;
+    struct io_uring_params params = {};
 
     trace_luring_init_state(s, sizeof(*s));
 
-    rc = io_uring_queue_init(MAX_ENTRIES, ring, 0);
+    /*
+     * Plain rings are not needed if the AioContext monitors fds with io_uring,
+     * requests can go through that ring instead.
+     */
+    if (!setup_flags && aio_has_io_uring(ctx)) {
+        s->ring = &ctx->fdmon_io_uring;
+        s->shared_ring = true;
+        ioq_init(&s->io_q);
+        luring_init_fixed_bufs(s);
+        return s;
+    }
+
+    if (setup_flags & LURING_SETUP_SQPOLL) {
+        params.flags |= IORING_SETUP_SQPOLL;
+        params.sq_thread_idle = SQPOLL_IDLE_MS;
+    }
+    if (setup_flags & LURING_SETUP_IOPOLL) {
+        params.flags |= IORING_SETUP_IOPOLL;
+    }
+
+    rc = io_uring_queue_init_params(MAX_ENTRIES, ring, &params);
     if (rc < 0) {
-        error_setg_errno(errp, -rc, "failed to init linux io_uring ring");
+        error_setg_errno(errp, -rc, "failed to init linux io_uring ring%s%s",
+                         setup_flags & LURING_SETUP_SQPOLL ? " with sqpoll" : "",
+                         setup_flags & LURING_SETUP_IOPOLL ? " with iopoll" : "");
         g_free(s);
         return NULL;
     }
 
+    s->ring = ring;
+    s->setup_flags = setup_flags;
     ioq_init(&s->io_q);
+    luring_init_fixed_bufs(s);
     return s;
 
 }
 
 void luring_cleanup(LuringState *s)
 {
-    io_uring_queue_exit(&s->ring);
+    luring_cleanup_fixed_bufs(s);
+    if (!s->shared_ring) {
+        io_uring_queue_exit(s->ring);
+    }
     trace_luring_cleanup_state(s);
     g_free(s);
 }
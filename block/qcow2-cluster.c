@@ -1893,6 +1893,121 @@ again:
     return 0;
 }
 
+/*
+ * Make the guest cluster at @dst_offset point to the data cluster that is
+ * used by the guest cluster at @src_offset instead of copying its content.
+ * The refcount of the data cluster is increased and QCOW_OFLAG_COPIED is
+ * cleared in both L2 entries, so a later write to either guest cluster
+ * allocates a new cluster, just like for clusters shared with an internal
+ * snapshot.  Once only one of them is left, the flag is set again when the
+ * image is closed (see qcow2_free_any_cluster()).
+ *
+ * Both offsets must be cluster aligned, and the image must not use
+ * subclusters or an external data file.
+ *
+ * Returns -ENOTSUP if the source is not a normal data cluster, if the
+ * destination is already allocated, if either cluster is part of an
+ * allocation in flight or if the refcount would overflow. The caller must
+ * copy the data in this case.
+ *
+ * Must be called with s->lock held.
+ */
+int coroutine_fn qcow2_share_cluster(BlockDriverState *bs, uint64_t src_offset,
+                                     uint64_t dst_offset)
+{
+    BDRVQcow2State *s = bs->opaque;
+    QCowL2Meta *m;
+    QCow2SubclusterType type;
+    uint64_t host_offset, dst_host_offset, refcount, l2_entry;
+    uint64_t *l2_slice;
+    unsigned int bytes;
+    int l2_index, ret;
+
+    assert(!has_subclusters(s) && !has_data_file(bs));
+    assert(!offset_into_cluster(s, src_offset));
+    assert(!offset_into_cluster(s, dst_offset));
+
+    QLIST_FOREACH(m, &s->cluster_allocs, next_in_flight) {
+        uint64_t start = start_of_cluster(s, l2meta_cow_start(m));
+        uint64_t end = ROUND_UP(l2meta_cow_end(m), s->cluster_size);
+
+        if ((src_offset >= start && src_offset < end) ||
+            (dst_offset >= start && dst_offset < end)) {
+            return -ENOTSUP;
+        }
+    }
+
+    bytes = s->cluster_size;
+    ret = qcow2_get_host_offset(bs, src_offset, &bytes, &host_offset, &type);
+    if (ret < 0) {
+        return ret;
+    }
+    if (type != QCOW2_SUBCLUSTER_NORMAL) {
+        return -ENOTSUP;
+    }
+
+    bytes = s->cluster_size;
+    ret = qcow2_get_host_offset(bs, dst_offset, &bytes, &dst_host_offset,
+                                &type);
+    if (ret < 0) {
+        return ret;
+    }
+    if (type != QCOW2_SUBCLUSTER_UNALLOCATED_PLAIN &&
+        type != QCOW2_SUBCLUSTER_ZERO_PLAIN) {
+        return -ENOTSUP;
+    }
+
+    ret = qcow2_get_refcount(bs, host_offset >> s->cluster_bits, &refcount);
+    if (ret < 0) {
+        return ret;
+    }
+    if (refcount == 0 || refcount >= s->refcount_max) {
+        return -ENOTSUP;
+    }
+
+    trace_qcow2_share_cluster(qemu_coroutine_self(), src_offset, dst_offset,
+                              host_offset);
+
+    /*
+     * If anything fails from here on, the cluster has a refcount that is
+     * too high, which only leaks it.
+     */
+    ret = qcow2_update_cluster_refcount(bs, host_offset >> s->cluster_bits,
+                                        1, false, QCOW2_DISCARD_NEVER);
+    if (ret < 0) {
+        return ret;
+    }
+
+    if (s->use_lazy_refcounts) {
+        qcow2_mark_dirty(bs);
+    }
+    if (qcow2_need_accurate_refcounts(s)) {
+        qcow2_cache_set_dependency(bs, s->l2_table_cache,
+                                   s->refcount_block_cache);
+    }
+
+    ret = get_cluster_table(bs, src_offset, &l2_slice, &l2_index);
+    if (ret < 0) {
+        return ret;
+    }
+    l2_entry = get_l2_entry(s, l2_slice, l2_index);
+    if (l2_entry & QCOW_OFLAG_COPIED) {
+        qcow2_cache_entry_mark_dirty(s->l2_table_cache, l2_slice);
+        set_l2_entry(s, l2_slice, l2_index, l2_entry & ~QCOW_OFLAG_COPIED);
+    }
+    qcow2_cache_put(s->l2_table_cache, (void **) &l2_slice);
+
+    ret = get_cluster_table(bs, dst_offset, &l2_slice, &l2_index);
+    if (ret < 0) {
+        return ret;
+    }
+    qcow2_cache_entry_mark_dirty(s->l2_table_cache, l2_slice);
+    set_l2_entry(s, l2_slice, l2_index, host_offset);
+    qcow2_cache_put(s->l2_table_cache, (void **) &l2_slice);
+
+    return 0;
+}
+
 /*
  * This discards as many clusters of nb_clusters as possible at once (i.e.
  * all clusters in the same L2 slice) and returns the number of discarded
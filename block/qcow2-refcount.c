@@ -1193,8 +1193,22 @@ void qcow2_free_any_cluster(BlockDriverState *bs, uint64_t l2_entry,
                                     "Cannot free unaligned cluster %#llx",
                                     l2_entry & L2E_OFFSET_MASK);
         } else {
+            uint64_t refcount;
+
             qcow2_free_clusters(bs, l2_entry & L2E_OFFSET_MASK,
                                 s->cluster_size, type);
+
+            /*
+             * The cluster was shared.  If one reference is left, it may
+             * be another entry of the active L1 table (see
+             * qcow2_share_cluster()) that must get QCOW_OFLAG_COPIED back.
+             */
+            if (!(l2_entry & QCOW_OFLAG_COPIED) &&
+                (qcow2_get_refcount(bs, (l2_entry & L2E_OFFSET_MASK) >>
+                                        s->cluster_bits, &refcount) < 0 ||
+                 refcount == 1)) {
+                s->copied_flags_stale = true;
+            }
         }
         break;
     case QCOW2_CLUSTER_ZERO_PLAIN:
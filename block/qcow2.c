@@ -1984,6 +1984,26 @@ static void qcow2_refresh_limits(BlockDriverState *bs, Error **errp)
     bs->bl.pdiscard_alignment = s->cluster_size;
 }
 
+/*
+ * Set QCOW_OFLAG_COPIED again on active L2 entries whose cluster used to be
+ * shared and is now down to one reference.  Finding them takes a walk over
+ * the whole active L1 table, so it is deferred until the image is closed,
+ * inactivated or reopened read-only.  Until then the entries only cost an
+ * unnecessary COW on the next write.
+ */
+static int GRAPH_RDLOCK qcow2_update_copied_flags(BlockDriverState *bs)
+{
+    BDRVQcow2State *s = bs->opaque;
+
+    if (!s->copied_flags_stale || !s->l1_table) {
+        return 0;
+    }
+    s->copied_flags_stale = false;
+
+    return qcow2_update_snapshot_refcount(bs, s->l1_table_offset, s->l1_size,
+                                          0);
+}
+
 static int GRAPH_UNLOCKED
 qcow2_reopen_prepare(BDRVReopenState *state,BlockReopenQueue *queue,
                      Error **errp)
@@ -2011,6 +2031,12 @@ qcow2_reopen_prepare(BDRVReopenState *state,BlockReopenQueue *queue,
             goto fail;
         }
 
+        ret = qcow2_update_copied_flags(state->bs);
+        if (ret < 0) {
+            error_setg_errno(errp, -ret, "Failed to update the L2 tables");
+            goto fail;
+        }
+
         ret = bdrv_flush(state->bs);
         if (ret < 0) {
             goto fail;
@@ -2762,6 +2788,12 @@ static int GRAPH_RDLOCK qcow2_inactivate(BlockDriverState *bs)
     int ret, result = 0;
     Error *local_err = NULL;
 
+    ret = qcow2_update_copied_flags(bs);
+    if (ret < 0) {
+        result = ret;
+        error_report("Failed to update the L2 tables: %s", strerror(-ret));
+    }
+
     qcow2_store_persistent_dirty_bitmaps(bs, true, &local_err);
     if (local_err != NULL) {
         result = -EINVAL;
@@ -2795,6 +2827,12 @@ static void coroutine_mixed_fn GRAPH_RDLOCK
 qcow2_do_close(BlockDriverState *bs, bool close_data_file)
 {
     BDRVQcow2State *s = bs->opaque;
+
+    if (!(s->flags & BDRV_O_INACTIVE)) {
+        /* Needs the active L1 table, so do it before freeing it */
+        qcow2_update_copied_flags(bs);
+    }
+
     qemu_vfree(s->l1_table);
     /* else pre-write overlap checks in cache_destroy may crash */
     s->l1_table = NULL;
@@ -4157,6 +4195,16 @@ qcow2_co_copy_range_from(BlockDriverState *bs,
     BdrvRequestFlags cur_write_flags;
 
     assert(!bs->encrypted);
+
+    if (dst->bs == bs) {
+        /*
+         * Copy within the image: let qcow2_co_copy_range_to() share the
+         * clusters instead of copying the data.
+         */
+        return bdrv_co_copy_range_to(src, src_offset, dst, dst_offset, bytes,
+                                     read_flags, write_flags);
+    }
+
     qemu_co_mutex_lock(&s->lock);
 
     while (bytes != 0) {
@@ -4226,6 +4274,41 @@ out:
     return ret;
 }
 
+/*
+ * Copy @bytes from @src_offset to @dst_offset within the same image by
+ * sharing the data clusters (see qcow2_share_cluster()). Returns -ENOTSUP
+ * if this is not possible; some of the clusters may have been shared
+ * already in this case.
+ */
+static int coroutine_fn GRAPH_RDLOCK
+qcow2_co_copy_range_share(BlockDriverState *bs, int64_t src_offset,
+                          int64_t dst_offset, int64_t bytes)
+{
+    BDRVQcow2State *s = bs->opaque;
+    int ret = 0;
+
+    if (has_subclusters(s) || has_data_file(bs) ||
+        !QEMU_IS_ALIGNED(src_offset | dst_offset | bytes, s->cluster_size))
+    {
+        return -ENOTSUP;
+    }
+
+    qemu_co_mutex_lock(&s->lock);
+    while (bytes != 0) {
+        ret = qcow2_share_cluster(bs, src_offset, dst_offset);
+        if (ret < 0) {
+            break;
+        }
+
+        bytes -= s->cluster_size;
+        src_offset += s->cluster_size;
+        dst_offset += s->cluster_size;
+    }
+    qemu_co_mutex_unlock(&s->lock);
+
+    return ret;
+}
+
 static int coroutine_fn GRAPH_RDLOCK
 qcow2_co_copy_range_to(BlockDriverState *bs,
                        BdrvChild *src, int64_t src_offset,
@@ -4241,6 +4324,10 @@ qcow2_co_copy_range_to(BlockDriverState *bs,
 
     assert(!bs->encrypted);
 
+    if (src->bs == bs) {
+        return qcow2_co_copy_range_share(bs, src_offset, dst_offset, bytes);
+    }
+
     qemu_co_mutex_lock(&s->lock);
 
     while (bytes != 0) {
@@ -4250,9 +4337,7 @@ qcow2_co_copy_range_to(BlockDriverState *bs,
         cur_bytes = MIN(bytes, INT_MAX);
 
         /* TODO:
-         * If src->bs == dst->bs, we could simply copy by incrementing
-         * the refcnt, without copying user data.
-         * Or if src->bs == dst->bs->backing->bs, we could copy by discarding. */
+         * If src->bs == dst->bs->backing->bs, we could copy by discarding. */
         ret = qcow2_alloc_host_offset(bs, dst_offset, &cur_bytes,
                                       &host_offset, &l2meta);
         if (ret < 0) {
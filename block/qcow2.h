@@ -401,6 +401,12 @@ typedef struct BDRVQcow2State {
     QTAILQ_HEAD (, Qcow2DiscardRegion) discards;
     bool cache_discards;
 
+    /*
+     * A cluster that was shared within the active L1 table is down to one
+     * reference, whose L2 entry still lacks QCOW_OFLAG_COPIED.
+     */
+    bool copied_flags_stale;
+
     /* Backing file path and format as stored in the image (this is not the
      * effective path/format, which may be the result of a runtime option
      * override) */
@@ -937,6 +943,10 @@ qcow2_alloc_host_offset(BlockDriverState *bs, uint64_t offset,
                         unsigned int *bytes, uint64_t *host_offset,
                         QCowL2Meta **m);
 
+int coroutine_fn GRAPH_RDLOCK
+qcow2_share_cluster(BlockDriverState *bs, uint64_t src_offset,
+                    uint64_t dst_offset);
+
 int coroutine_fn GRAPH_RDLOCK
 qcow2_alloc_compressed_cluster_offset(BlockDriverState *bs, uint64_t offset,
                                       int compressed_size, uint64_t *host_offset);
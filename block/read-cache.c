@@ -0,0 +1,753 @@
+/*
+ * In-memory read cache filter driver
+ *
+ * The driver is inserted above any node and keeps recently read blocks of
+ * its file child in a bounded amount of memory.  Repeated reads are served
+ * from memory, which helps read-mostly images on slow (e.g. network)
+ * storage.  Writes go through to the child and invalidate the blocks they
+ * touch; the least recently used blocks are evicted when the cache is full.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "qemu/osdep.h"
+
+#include "qapi/error.h"
+#include "qemu/host-utils.h"
+#include "qemu/memalign.h"
+#include "qemu/module.h"
+#include "qemu/option.h"
+#include "qemu/queue.h"
+#include "qemu/units.h"
+#include "block/block-io.h"
+#include "block/block_int.h"
+#include "trace.h"
+
+#ifdef CONFIG_POSIX
+#include "qemu/memfd.h"
+#include "qemu/mmap-alloc.h"
+#endif
+
+#define READ_CACHE_OPT_SIZE         "size"
+#define READ_CACHE_OPT_BLOCK_SIZE   "block-size"
+#define READ_CACHE_OPT_MEMORY       "memory"
+
+#define READ_CACHE_MIN_BLOCK_SIZE   512
+#define READ_CACHE_MAX_BLOCK_SIZE   (2 * MiB)
+
+typedef struct ReadCacheOpts {
+    uint64_t size;
+    uint64_t block_size;
+    BlockdevReadCacheMemory memory;
+} ReadCacheOpts;
+
+typedef struct ReadCacheBlock {
+    /* Block number in the image, only valid while the block is in @map */
+    int64_t index;
+    /* Entry in the LRU list while cached, in the free list otherwise */
+    QTAILQ_ENTRY(ReadCacheBlock) next;
+} ReadCacheBlock;
+
+typedef struct ReadCache {
+    ReadCacheOpts opts;
+    int block_bits;
+
+    /* Data of block i of @blocks is at data + (i << block_bits) */
+    uint8_t *data;
+    size_t data_size;
+    int fd;
+
+    ReadCacheBlock *blocks;
+    uint64_t nb_blocks;
+    uint64_t nb_cached;
+
+    /* Maps &ReadCacheBlock.index to the ReadCacheBlock */
+    GHashTable *map;
+    /* Most recently used first */
+    QTAILQ_HEAD(, ReadCacheBlock) lru;
+    QTAILQ_HEAD(, ReadCacheBlock) free;
+} ReadCache;
+
+typedef struct BDRVReadCacheState {
+    /* Protects everything below, requests may come from several threads */
+    QemuMutex lock;
+    ReadCache *cache;
+
+    /*
+     * Incremented whenever cached data is invalidated.  A read that misses
+     * only populates the cache if no invalidation happened while it was
+     * reading from the child, otherwise it could insert stale data.
+     */
+    uint64_t generation;
+
+    struct {
+        uint64_t hits;
+        uint64_t misses;
+        uint64_t evictions;
+        uint64_t invalidations;
+    } stats;
+} BDRVReadCacheState;
+
+static QemuOptsList runtime_opts = {
+    .name = "read-cache",
+    .head = QTAILQ_HEAD_INITIALIZER(runtime_opts.head),
+    .desc = {
+        {
+            .name = READ_CACHE_OPT_SIZE,
+            .type = QEMU_OPT_SIZE,
+            .help = "maximum amount of data to cache, default 64M",
+        },
+        {
+            .name = READ_CACHE_OPT_BLOCK_SIZE,
+            .type = QEMU_OPT_SIZE,
+            .help = "cache granularity, default 64k",
+        },
+        {
+            .name = READ_CACHE_OPT_MEMORY,
+            .type = QEMU_OPT_STRING,
+            .help = "memory used for the cache "
+                "(anonymous, memfd, hugetlb), default anonymous",
+        },
+        { /* end of list */ }
+    },
+};
+
+static bool read_cache_absorb_opts(ReadCacheOpts *dest, QDict *options,
+                                   Error **errp)
+{
+    QemuOpts *opts = qemu_opts_create(&runtime_opts, NULL, 0, &error_abort);
+    Error *local_err = NULL;
+    bool ret = false;
+
+    if (!qemu_opts_absorb_qdict(opts, options, errp)) {
+        goto out;
+    }
+
+    dest->size = qemu_opt_get_size(opts, READ_CACHE_OPT_SIZE, 64 * MiB);
+    dest->block_size =
+        qemu_opt_get_size(opts, READ_CACHE_OPT_BLOCK_SIZE, 64 * KiB);
+    dest->memory = qapi_enum_parse(&BlockdevReadCacheMemory_lookup,
+                                   qemu_opt_get(opts, READ_CACHE_OPT_MEMORY),
+                                   BLOCKDEV_READ_CACHE_MEMORY_ANONYMOUS,
+                                   &local_err);
+    if (local_err) {
+        error_propagate(errp, local_err);
+        goto out;
+    }
+
+    if (!is_power_of_2(dest->block_size) ||
+        dest->block_size < READ_CACHE_MIN_BLOCK_SIZE ||
+        dest->block_size > READ_CACHE_MAX_BLOCK_SIZE) {
+        error_setg(errp, "block-size parameter of read-cache filter must be "
+                   "a power of 2 between 512 and 2M");
+        goto out;
+    }
+
+    if (dest->size < dest->block_size) {
+        error_setg(errp, "size parameter of read-cache filter must be at "
+                   "least block-size (%" PRIu64 ")", dest->block_size);
+        goto out;
+    }
+
+    if (dest->size > SIZE_MAX) {
+        error_setg(errp, "size parameter of read-cache filter is too large");
+        goto out;
+    }
+
+    ret = true;
+out:
+    qemu_opts_del(opts);
+    return ret;
+}
+
+static bool read_cache_opts_equal(const ReadCacheOpts *a,
+                                  const ReadCacheOpts *b)
+{
+    return a->size == b->size && a->block_size == b->block_size &&
+        a->memory == b->memory;
+}
+
+#ifdef CONFIG_POSIX
+static void *read_cache_memfd_alloc(size_t *size, bool hugetlb, int *fd,
+                                    Error **errp)
+{
+    size_t pagesize;
+    void *ptr;
+    int mfd;
+
+    mfd = qemu_memfd_create("read-cache", 0, hugetlb, 0, 0, errp);
+    if (mfd < 0) {
+        return NULL;
+    }
+
+    pagesize = qemu_fd_getpagesize(mfd);
+    *size = ROUND_UP(*size, pagesize);
+
+    if (ftruncate(mfd, *size) < 0) {
+        error_setg_errno(errp, errno, "failed to resize memfd to %zu", *size);
+        close(mfd);
+        return NULL;
+    }
+
+    ptr = mmap(NULL, *size, PROT_READ | PROT_WRITE, MAP_SHARED, mfd, 0);
+    if (ptr == MAP_FAILED) {
+        error_setg_errno(errp, errno, "failed to map read cache memory");
+        close(mfd);
+        return NULL;
+    }
+
+    *fd = mfd;
+    return ptr;
+}
+#endif
+
+static void read_cache_free(ReadCache *cache)
+{
+    if (!cache) {
+        return;
+    }
+
+    if (cache->fd >= 0) {
+#ifdef CONFIG_POSIX
+        qemu_memfd_free(cache->data, cache->data_size, cache->fd);
+#endif
+    } else {
+        qemu_vfree(cache->data);
+    }
+
+    g_hash_table_destroy(cache->map);
+    g_free(cache->blocks);
+    g_free(cache);
+}
+
+static ReadCache *read_cache_new(const ReadCacheOpts *opts, Error **errp)
+{
+    ReadCache *cache = g_new0(ReadCache, 1);
+    uint64_t i;
+
+    cache->opts = *opts;
+    cache->block_bits = ctz64(opts->block_size);
+    cache->nb_blocks = opts->size >> cache->block_bits;
+    cache->data_size = cache->nb_blocks << cache->block_bits;
+    cache->fd = -1;
+
+    switch (opts->memory) {
+    case BLOCKDEV_READ_CACHE_MEMORY_ANONYMOUS:
+        cache->data = qemu_try_memalign(qemu_real_host_page_size(),
+                                        cache->data_size);
+        if (!cache->data) {
+            error_setg(errp, "Could not allocate %zu bytes for the read cache",
+                       cache->data_size);
+        }
+        break;
+    case BLOCKDEV_READ_CACHE_MEMORY_MEMFD:
+    case BLOCKDEV_READ_CACHE_MEMORY_HUGETLB:
+#ifdef CONFIG_POSIX
+        cache->data = read_cache_memfd_alloc(
+            &cache->data_size, opts->memory == BLOCKDEV_READ_CACHE_MEMORY_HUGETLB,
+            &cache->fd, errp);
+#else
+        error_setg(errp, "memfd is not supported on this host");
+#endif
+        break;
+    default:
+        g_assert_not_reached();
+    }
+
+    if (!cache->data) {
+        g_free(cache);
+        return NULL;
+    }
+
+    cache->blocks = g_new(ReadCacheBlock, cache->nb_blocks);
+    cache->map = g_hash_table_new(g_int64_hash, g_int64_equal);
+    QTAILQ_INIT(&cache->lru);
+    QTAILQ_INIT(&cache->free);
+    for (i = 0; i < cache->nb_blocks; i++) {
+        QTAILQ_INSERT_TAIL(&cache->free, &cache->blocks[i], next);
+    }
+
+    return cache;
+}
+
+static inline uint8_t *read_cache_block_data(ReadCache *cache,
+                                             ReadCacheBlock *blk)
+{
+    return cache->data + ((uint64_t)(blk - cache->blocks) << cache->block_bits);
+}
+
+/* Called with s->lock held */
+static void read_cache_drop_block(BDRVReadCacheState *s, ReadCacheBlock *blk)
+{
+    ReadCache *cache = s->cache;
+
+    g_hash_table_remove(cache->map, &blk->index);
+    QTAILQ_REMOVE(&cache->lru, blk, next);
+    QTAILQ_INSERT_HEAD(&cache->free, blk, next);
+    cache->nb_cached--;
+}
+
+/* Called with s->lock held */
+static void read_cache_insert(BDRVReadCacheState *s, int64_t index,
+                              const uint8_t *buf)
+{
+    ReadCache *cache = s->cache;
+    ReadCacheBlock *blk;
+
+    if (g_hash_table_contains(cache->map, &index)) {
+        /* Inserted by a concurrent read of the same block */
+        return;
+    }
+
+    blk = QTAILQ_FIRST(&cache->free);
+    if (!blk) {
+        blk = QTAILQ_LAST(&cache->lru);
+        read_cache_drop_block(s, blk);
+        s->stats.evictions++;
+    }
+
+    QTAILQ_REMOVE(&cache->free, blk, next);
+    blk->index = index;
+    memcpy(read_cache_block_data(cache, blk), buf, cache->opts.block_size);
+    g_hash_table_insert(cache->map, &blk->index, blk);
+    QTAILQ_INSERT_HEAD(&cache->lru, blk, next);
+    cache->nb_cached++;
+}
+
+/* Drop all cached blocks that intersect [offset, offset + bytes) */
+static void read_cache_invalidate(BDRVReadCacheState *s, int64_t offset,
+                                  int64_t bytes)
+{
+    ReadCache *cache = s->cache;
+    int64_t first, last;
+    uint64_t dropped = 0;
+
+    if (!bytes) {
+        return;
+    }
+
+    first = offset >> cache->block_bits;
+    last = (offset + bytes - 1) >> cache->block_bits;
+
+    qemu_mutex_lock(&s->lock);
+    s->generation++;
+
+    if ((uint64_t)(last - first) < cache->nb_cached) {
+        int64_t i;
+
+        for (i = first; i <= last; i++) {
+            ReadCacheBlock *blk = g_hash_table_lookup(cache->map, &i);
+
+            if (blk) {
+                read_cache_drop_block(s, blk);
+                dropped++;
+            }
+        }
+    } else {
+        ReadCacheBlock *blk, *next_blk;
+
+        QTAILQ_FOREACH_SAFE(blk, &cache->lru, next, next_blk) {
+            if (blk->index >= first && blk->index <= last) {
+                read_cache_drop_block(s, blk);
+                dropped++;
+            }
+        }
+    }
+
+    s->stats.invalidations += dropped;
+    qemu_mutex_unlock(&s->lock);
+
+    trace_read_cache_invalidate(s, offset, bytes, dropped);
+}
+
+static int read_cache_open(BlockDriverState *bs, QDict *options, int flags,
+                           Error **errp)
+{
+    BDRVReadCacheState *s = bs->opaque;
+    ReadCacheOpts opts;
+    int ret;
+
+    GLOBAL_STATE_CODE();
+
+    ret = bdrv_open_file_child(NULL, options, "file", bs, errp);
+    if (ret < 0) {
+        return ret;
+    }
+
+    if (!read_cache_absorb_opts(&opts, options, errp)) {
+        return -EINVAL;
+    }
+
+    s->cache = read_cache_new(&opts, errp);
+    if (!s->cache) {
+        return -ENOMEM;
+    }
+    qemu_mutex_init(&s->lock);
+
+    GRAPH_RDLOCK_GUARD_MAINLOOP();
+
+    bs->supported_write_flags = BDRV_REQ_WRITE_UNCHANGED |
+        (BDRV_REQ_FUA & bs->file->bs->supported_write_flags);
+
+    bs->supported_zero_flags = BDRV_REQ_WRITE_UNCHANGED |
+        ((BDRV_REQ_FUA | BDRV_REQ_MAY_UNMAP | BDRV_REQ_NO_FALLBACK) &
+            bs->file->bs->supported_zero_flags);
+
+    return 0;
+}
+
+static void read_cache_close(BlockDriverState *bs)
+{
+    BDRVReadCacheState *s = bs->opaque;
+
+    read_cache_free(s->cache);
+    s->cache = NULL;
+    qemu_mutex_destroy(&s->lock);
+}
+
+/*
+ * Changing the geometry of the cache allocates a new one in prepare, which
+ * replaces the old one (and its content) on commit.  The node is drained
+ * during reopen, so no request can see the switch.
+ */
+static int read_cache_reopen_prepare(BDRVReopenState *reopen_state,
+                                     BlockReopenQueue *queue, Error **errp)
+{
+    BDRVReadCacheState *s = reopen_state->bs->opaque;
+    ReadCacheOpts opts;
+
+    GLOBAL_STATE_CODE();
+
+    if (!read_cache_absorb_opts(&opts, reopen_state->options, errp)) {
+        return -EINVAL;
+    }
+
+    if (!read_cache_opts_equal(&opts, &s->cache->opts)) {
+        reopen_state->opaque = read_cache_new(&opts, errp);
+        if (!reopen_state->opaque) {
+            return -ENOMEM;
+        }
+    }
+
+    return 0;
+}
+
+static void read_cache_reopen_commit(BDRVReopenState *state)
+{
+    BDRVReadCacheState *s = state->bs->opaque;
+    ReadCache *old_cache;
+
+    if (!state->opaque) {
+        return;
+    }
+
+    qemu_mutex_lock(&s->lock);
+    old_cache = s->cache;
+    s->cache = state->opaque;
+    s->generation++;
+    qemu_mutex_unlock(&s->lock);
+
+    read_cache_free(old_cache);
+    state->opaque = NULL;
+}
+
+static void read_cache_reopen_abort(BDRVReopenState *state)
+{
+    read_cache_free(state->opaque);
+    state->opaque = NULL;
+}
+
+/*
+ * Read blocks [first, last] from the child, copy the part of the request
+ * that they cover to @qiov and add them to the cache unless they were
+ * invalidated in the meantime.
+ */
+static int coroutine_fn GRAPH_RDLOCK
+read_cache_fill(BlockDriverState *bs, int64_t first, int64_t last,
+                int64_t offset, int64_t bytes, QEMUIOVector *qiov,
+                size_t qiov_offset, uint64_t generation)
+{
+    BDRVReadCacheState *s = bs->opaque;
+    ReadCache *cache = s->cache;
+    int64_t len, start, end, copy_start, copy_end;
+    uint8_t *buf;
+    int ret;
+
+    len = bdrv_co_getlength(bs->file->bs);
+    if (len < 0) {
+        return len;
+    }
+
+    start = first << cache->block_bits;
+    end = MIN((last + 1) << cache->block_bits, len);
+    copy_start = MAX(start, offset);
+    copy_end = MIN(end, offset + bytes);
+    if (copy_end <= copy_start) {
+        /* The request is beyond the end of the child */
+        return bdrv_co_preadv_part(bs->file, offset, bytes, qiov, qiov_offset,
+                                   0);
+    }
+
+    buf = qemu_try_blockalign(bs->file->bs, end - start);
+    if (!buf) {
+        return -ENOMEM;
+    }
+
+    ret = bdrv_co_pread(bs->file, start, end - start, buf, 0);
+    if (ret < 0) {
+        goto out;
+    }
+
+    qemu_iovec_from_buf(qiov, qiov_offset + (copy_start - offset),
+                        buf + (copy_start - start), copy_end - copy_start);
+
+    qemu_mutex_lock(&s->lock);
+    if (s->generation == generation) {
+        int64_t i;
+
+        /* A partial block at the end of the image is not cached */
+        for (i = first; ((i + 1) << cache->block_bits) <= end; i++) {
+            read_cache_insert(s, i, buf + ((i - first) << cache->block_bits));
+        }
+    }
+    qemu_mutex_unlock(&s->lock);
+
+    ret = 0;
+out:
+    qemu_vfree(buf);
+    return ret;
+}
+
+static int coroutine_fn GRAPH_RDLOCK
+read_cache_co_preadv_part(BlockDriverState *bs, int64_t offset, int64_t bytes,
+                          QEMUIOVector *qiov, size_t qiov_offset,
+                          BdrvRequestFlags flags)
+{
+    BDRVReadCacheState *s = bs->opaque;
+    ReadCache *cache = s->cache;
+    int64_t first, last, i;
+    uint64_t hits = 0, misses = 0;
+    int ret;
+
+    if (!bytes) {
+        return 0;
+    }
+
+    first = offset >> cache->block_bits;
+    last = (offset + bytes - 1) >> cache->block_bits;
+
+    for (i = first; i <= last; ) {
+        ReadCacheBlock *blk;
+        uint64_t generation;
+        int64_t j;
+
+        qemu_mutex_lock(&s->lock);
+        blk = g_hash_table_lookup(cache->map, &i);
+        if (blk) {
+            int64_t start = MAX(offset, i << cache->block_bits);
+            int64_t end = MIN(offset + bytes, (i + 1) << cache->block_bits);
+
+            QTAILQ_REMOVE(&cache->lru, blk, next);
+            QTAILQ_INSERT_HEAD(&cache->lru, blk, next);
+            qemu_iovec_from_buf(qiov, qiov_offset + (start - offset),
+                                read_cache_block_data(cache, blk) +
+                                (start - (i << cache->block_bits)),
+                                end - start);
+            s->stats.hits++;
+            qemu_mutex_unlock(&s->lock);
+            hits++;
+            i++;
+            continue;
+        }
+
+        /* Read the whole run of missing blocks with a single request */
+        for (j = i + 1; j <= last; j++) {
+            if (g_hash_table_contains(cache->map, &j)) {
+                break;
+            }
+        }
+        s->stats.misses += j - i;
+        generation = s->generation;
+        qemu_mutex_unlock(&s->lock);
+
+        misses += j - i;
+        ret = read_cache_fill(bs, i, j - 1, offset, bytes, qiov, qiov_offset,
+                              generation);
+        if (ret < 0) {
+            return ret;
+        }
+        i = j;
+    }
+
+    trace_read_cache_co_preadv(bs, offset, bytes, hits, misses);
+    return 0;
+}
+
+/*
+ * Invalidate both before and after the write: the first invalidation keeps
+ * concurrent reads from being served the old data once the write has
+ * started, the second one (through the generation count) drops data that a
+ * concurrent read fetched from the child before the write completed.
+ */
+static int coroutine_fn GRAPH_RDLOCK
+read_cache_co_pwritev_part(BlockDriverState *bs, int64_t offset, int64_t bytes,
+                           QEMUIOVector *qiov, size_t qiov_offset,
+                           BdrvRequestFlags flags)
+{
+    BDRVReadCacheState *s = bs->opaque;
+    int ret;
+
+    if (flags & BDRV_REQ_WRITE_UNCHANGED) {
+        return bdrv_co_pwritev_part(bs->file, offset, bytes, qiov, qiov_offset,
+                                    flags);
+    }
+
+    read_cache_invalidate(s, offset, bytes);
+    ret = bdrv_co_pwritev_part(bs->file, offset, bytes, qiov, qiov_offset,
+                               flags);
+    read_cache_invalidate(s, offset, bytes);
+
+    return ret;
+}
+
+static int coroutine_fn GRAPH_RDLOCK
+read_cache_co_pwrite_zeroes(BlockDriverState *bs, int64_t offset,
+                            int64_t bytes, BdrvRequestFlags flags)
+{
+    BDRVReadCacheState *s = bs->opaque;
+    int ret;
+
+    if (flags & BDRV_REQ_WRITE_UNCHANGED) {
+        return bdrv_co_pwrite_zeroes(bs->file, offset, bytes, flags);
+    }
+
+    read_cache_invalidate(s, offset, bytes);
+    ret = bdrv_co_pwrite_zeroes(bs->file, offset, bytes, flags);
+    read_cache_invalidate(s, offset, bytes);
+
+    return ret;
+}
+
+static int coroutine_fn GRAPH_RDLOCK
+read_cache_co_pdiscard(BlockDriverState *bs, int64_t offset, int64_t bytes)
+{
+    BDRVReadCacheState *s = bs->opaque;
+    int ret;
+
+    read_cache_invalidate(s, offset, bytes);
+    ret = bdrv_co_pdiscard(bs->file, offset, bytes);
+    read_cache_invalidate(s, offset, bytes);
+
+    return ret;
+}
+
+static int coroutine_fn GRAPH_RDLOCK
+read_cache_co_truncate(BlockDriverState *bs, int64_t offset, bool exact,
+                       PreallocMode prealloc, BdrvRequestFlags flags,
+                       Error **errp)
+{
+    BDRVReadCacheState *s = bs->opaque;
+    int ret;
+
+    read_cache_invalidate(s, offset, INT64_MAX - offset);
+    ret = bdrv_co_truncate(bs->file, offset, exact, prealloc, flags, errp);
+    read_cache_invalidate(s, offset, INT64_MAX - offset);
+
+    return ret;
+}
+
+static int coroutine_fn GRAPH_RDLOCK read_cache_co_flush(BlockDriverState *bs)
+{
+    return bdrv_co_flush(bs->file->bs);
+}
+
+static int64_t coroutine_fn GRAPH_RDLOCK
+read_cache_co_getlength(BlockDriverState *bs)
+{
+    return bdrv_co_getlength(bs->file->bs);
+}
+
+/* The image may have been modified by the migration source */
+static void coroutine_fn GRAPH_RDLOCK
+read_cache_co_invalidate_cache(BlockDriverState *bs, Error **errp)
+{
+    read_cache_invalidate(bs->opaque, 0, INT64_MAX);
+}
+
+static void read_cache_child_perm(BlockDriverState *bs, BdrvChild *c,
+                                  BdrvChildRole role,
+                                  BlockReopenQueue *reopen_queue,
+                                  uint64_t perm, uint64_t shared,
+                                  uint64_t *nperm, uint64_t *nshared)
+{
+    bdrv_default_perms(bs, c, role, reopen_queue, perm, shared, nperm, nshared);
+
+    /*
+     * Writes that bypass the filter would not invalidate the cache, so don't
+     * let anybody else write to the child.
+     */
+    *nshared &= ~BLK_PERM_WRITE;
+}
+
+static BlockStatsSpecific *read_cache_get_specific_stats(BlockDriverState *bs)
+{
+    BlockStatsSpecific *stats = g_new(BlockStatsSpecific, 1);
+    BDRVReadCacheState *s = bs->opaque;
+
+    qemu_mutex_lock(&s->lock);
+    stats->driver = BLOCKDEV_DRIVER_READ_CACHE;
+    stats->u.read_cache = (BlockStatsSpecificReadCache) {
+        .hits = s->stats.hits,
+        .misses = s->stats.misses,
+        .evictions = s->stats.evictions,
+        .invalidations = s->stats.invalidations,
+        .cached_bytes = s->cache->nb_cached << s->cache->block_bits,
+    };
+    qemu_mutex_unlock(&s->lock);
+
+    return stats;
+}
+
+static BlockDriver bdrv_read_cache_filter = {
+    .format_name = "read-cache",
+    .instance_size = sizeof(BDRVReadCacheState),
+
+    .bdrv_co_getlength    = read_cache_co_getlength,
+    .bdrv_open            = read_cache_open,
+    .bdrv_close           = read_cache_close,
+
+    .bdrv_reopen_prepare  = read_cache_reopen_prepare,
+    .bdrv_reopen_commit   = read_cache_reopen_commit,
+    .bdrv_reopen_abort    = read_cache_reopen_abort,
+
+    .bdrv_co_preadv_part = read_cache_co_preadv_part,
+    .bdrv_co_pwritev_part = read_cache_co_pwritev_part,
+    .bdrv_co_pwrite_zeroes = read_cache_co_pwrite_zeroes,
+    .bdrv_co_pdiscard = read_cache_co_pdiscard,
+    .bdrv_co_flush = read_cache_co_flush,
+    .bdrv_co_truncate = read_cache_co_truncate,
+    .bdrv_co_invalidate_cache = read_cache_co_invalidate_cache,
+
+    .bdrv_child_perm = read_cache_child_perm,
+    .bdrv_get_specific_stats = read_cache_get_specific_stats,
+
+    .is_filter = true,
+};
+
+static void bdrv_read_cache_init(void)
+{
+    bdrv_register(&bdrv_read_cache_filter);
+}
+
+block_init(bdrv_read_cache_init);
@@ -39,6 +39,53 @@ static void throttle_group_obj_init(Object *obj);
 static void throttle_group_obj_complete(UserCreatable *obj, Error **errp);
 static void timer_cb(ThrottleGroupMember *tgm, ThrottleDirection direction);
 
+/* Maximum number of AioContexts with a local budget in a group */
+#define THROTTLE_GROUP_MAX_LOCAL 64
+
+/* How long a local budget is valid, and how much I/O it may cover at most */
+#define THROTTLE_GROUP_LOCAL_SLICE_NS (10 * SCALE_MS)
+
+/* Local budgets count operations in fixed point because of iops-size */
+#define THROTTLE_GROUP_LOCAL_UNIT_SCALE 16
+
+/*
+ * Budgets smaller than this are not worth handing out: with such low limits
+ * there are not enough requests for the group lock to be contended.
+ */
+#define THROTTLE_GROUP_LOCAL_MIN_UNITS 4
+#define THROTTLE_GROUP_LOCAL_MIN_BYTES (64 * KiB)
+
+#define THROTTLE_GROUP_LOCAL_UNLIMITED INT64_MAX
+
+/* A ThrottleGroupLocal holds I/O budget of one AioContext in a group.
+ *
+ * The budget is granted under the group lock, and it is accounted in the
+ * group's ThrottleState at that point already. Requests submitted from the
+ * AioContext are then charged against the budget without taking the group
+ * lock (see throttle_group_local_take()), so that members used from several
+ * IOThreads, e.g. with virtio-blk's iothread-vq-mapping, do not serialize on
+ * it.
+ *
+ * Budgets are only handed out while no request in the group is throttled,
+ * and never exceed what the leaky buckets would accept right away, so the
+ * limits are enforced exactly as without local budgets. A budget expires
+ * after THROTTLE_GROUP_LOCAL_SLICE_NS. Whatever is left of it is given back
+ * to the group when the AioContext needs a new one, and the remaining
+ * headroom is shared between the AioContexts that are currently active.
+ *
+ * Once claimed, a slot is only accessed by the thread that runs its
+ * AioContext, always under the group lock except for the budget fields
+ * in throttle_group_local_take().
+ */
+typedef struct ThrottleGroupLocal {
+    AioContext *ctx;
+    uint64_t op_size;
+    unsigned gen[THROTTLE_MAX];     /* ThrottleGroup.local_gen at grant time */
+    int64_t expires[THROTTLE_MAX];
+    int64_t bytes[THROTTLE_MAX];
+    int64_t units[THROTTLE_MAX];    /* in 1/THROTTLE_GROUP_LOCAL_UNIT_SCALE */
+} QEMU_ALIGNED(64) ThrottleGroupLocal;
+
 /* The ThrottleGroup structure (with its ThrottleState) is shared
  * among different ThrottleGroupMembers and it's independent from
  * AioContext, so in order to use it from different threads it needs
@@ -70,13 +117,19 @@ struct ThrottleGroup {
     bool is_initialized;
     char *name; /* This is constant during the lifetime of the group */
 
-    QemuMutex lock; /* This lock protects the following four fields */
+    QemuMutex lock; /* This lock protects the following five fields */
     ThrottleState ts;
     QLIST_HEAD(, ThrottleGroupMember) head;
     ThrottleGroupMember *tokens[THROTTLE_MAX];
     bool any_timer_armed[THROTTLE_MAX];
+    unsigned pending_reqs[THROTTLE_MAX]; /* sum over all members */
     QEMUClockType clock_type;
 
+    /* Written under lock, read with atomic operations */
+    unsigned local_gen; /* invalidates all local budgets when incremented */
+    unsigned nr_local;
+    ThrottleGroupLocal local[THROTTLE_GROUP_MAX_LOCAL];
+
     /* This field is protected by the global QEMU mutex */
     QTAILQ_ENTRY(ThrottleGroup) list;
 };
@@ -350,6 +403,152 @@ static void coroutine_mixed_fn schedule_next_request(ThrottleGroupMember *tgm,
     }
 }
 
+/* Return the local budget slot of an AioContext, or NULL if it has none. This
+ * can be called without holding tg->lock.
+ */
+static ThrottleGroupLocal *throttle_group_find_local(ThrottleGroup *tg,
+                                                     AioContext *ctx)
+{
+    unsigned nr = qatomic_load_acquire(&tg->nr_local);
+    unsigned i;
+
+    for (i = 0; i < nr; i++) {
+        if (tg->local[i].ctx == ctx) {
+            return &tg->local[i];
+        }
+    }
+    return NULL;
+}
+
+/* Charge an I/O request against the local budget of the current AioContext
+ * without taking tg->lock.
+ *
+ * @tgm:       the current ThrottleGroupMember
+ * @bytes:     the number of bytes for this I/O
+ * @direction: the ThrottleDirection
+ * @ret:       whether the request was charged and can be executed
+ */
+static bool throttle_group_local_take(ThrottleGroupMember *tgm, int64_t bytes,
+                                      ThrottleDirection direction)
+{
+    ThrottleGroup *tg = container_of(tgm->throttle_state, ThrottleGroup, ts);
+    AioContext *ctx = qemu_get_current_aio_context();
+    ThrottleGroupLocal *local;
+    int64_t units;
+
+    /* Requests of a member must not overtake its throttled requests */
+    if (!ctx || qatomic_read(&tgm->pending_reqs[direction])) {
+        return false;
+    }
+
+    local = throttle_group_find_local(tg, ctx);
+    if (!local ||
+        local->gen[direction] != qatomic_read(&tg->local_gen) ||
+        local->expires[direction] <= qemu_clock_get_ns(tg->clock_type)) {
+        return false;
+    }
+
+    /* See throttle_account() */
+    units = THROTTLE_GROUP_LOCAL_UNIT_SCALE;
+    if (local->op_size && bytes > local->op_size) {
+        units = (uint64_t) bytes * THROTTLE_GROUP_LOCAL_UNIT_SCALE /
+                local->op_size;
+    }
+
+    if (local->units[direction] < units || local->bytes[direction] < bytes) {
+        return false;
+    }
+
+    if (local->units[direction] != THROTTLE_GROUP_LOCAL_UNLIMITED) {
+        local->units[direction] -= units;
+    }
+    if (local->bytes[direction] != THROTTLE_GROUP_LOCAL_UNLIMITED) {
+        local->bytes[direction] -= bytes;
+    }
+    return true;
+}
+
+/* Give back what is left of the local budget of the current AioContext and,
+ * if no request in the group is waiting, grant a new one.
+ *
+ * This assumes that tg->lock is held.
+ *
+ * @tg:        the ThrottleGroup
+ * @direction: the ThrottleDirection
+ */
+static void throttle_group_local_refill(ThrottleGroup *tg,
+                                        ThrottleDirection direction)
+{
+    AioContext *ctx = qemu_get_current_aio_context();
+    ThrottleGroupLocal *local;
+    unsigned nr_active = 1;
+    double bytes, units;
+    int64_t now;
+    unsigned i;
+
+    if (!ctx) {
+        return;
+    }
+
+    local = throttle_group_find_local(tg, ctx);
+    if (!local) {
+        if (tg->nr_local == THROTTLE_GROUP_MAX_LOCAL) {
+            return;
+        }
+        local = &tg->local[tg->nr_local];
+        *local = (ThrottleGroupLocal) { .ctx = ctx };
+        qatomic_store_release(&tg->nr_local, tg->nr_local + 1);
+    }
+
+    /* Budgets from before the last throttle_group_config() are void */
+    if (local->gen[direction] == tg->local_gen && local->expires[direction]) {
+        throttle_account_batch(&tg->ts, direction,
+            local->bytes[direction] == THROTTLE_GROUP_LOCAL_UNLIMITED ?
+                0 : -(double) local->bytes[direction],
+            local->units[direction] == THROTTLE_GROUP_LOCAL_UNLIMITED ?
+                0 : -(double) local->units[direction] /
+                    THROTTLE_GROUP_LOCAL_UNIT_SCALE);
+    }
+    local->expires[direction] = 0;
+
+    if (tg->pending_reqs[direction] || tg->any_timer_armed[direction]) {
+        return;
+    }
+
+    now = qemu_clock_get_ns(tg->clock_type);
+    for (i = 0; i < tg->nr_local; i++) {
+        if (&tg->local[i] != local &&
+            tg->local[i].gen[direction] == tg->local_gen &&
+            tg->local[i].expires[direction] > now) {
+            nr_active++;
+        }
+    }
+
+    if (!throttle_compute_budget(&tg->ts, direction, now,
+                                 THROTTLE_GROUP_LOCAL_SLICE_NS / nr_active,
+                                 &bytes, &units)) {
+        return;
+    }
+    if ((units >= 0 && units < THROTTLE_GROUP_LOCAL_MIN_UNITS) ||
+        (bytes >= 0 && bytes < THROTTLE_GROUP_LOCAL_MIN_BYTES)) {
+        return;
+    }
+
+    local->op_size = tg->ts.cfg.op_size;
+    local->gen[direction] = tg->local_gen;
+    local->expires[direction] = now + THROTTLE_GROUP_LOCAL_SLICE_NS;
+    local->bytes[direction] = bytes < 0 ? THROTTLE_GROUP_LOCAL_UNLIMITED :
+                                          (int64_t) bytes;
+    local->units[direction] = units < 0 ? THROTTLE_GROUP_LOCAL_UNLIMITED :
+                              (int64_t) (units *
+                                         THROTTLE_GROUP_LOCAL_UNIT_SCALE);
+
+    throttle_account_batch(&tg->ts, direction,
+        bytes < 0 ? 0 : local->bytes[direction],
+        units < 0 ? 0 : (double) local->units[direction] /
+                        THROTTLE_GROUP_LOCAL_UNIT_SCALE);
+}
+
 /* Check if an I/O request needs to be throttled, wait and set a timer
  * if necessary, and schedule the next request using a round robin
  * algorithm.
@@ -369,6 +568,11 @@ void coroutine_fn throttle_group_co_io_limits_intercept(ThrottleGroupMember *tgm
     assert(bytes >= 0);
     assert(direction < THROTTLE_MAX);
 
+    /* Fast path: the AioContext still has budget from the group */
+    if (throttle_group_local_take(tgm, bytes, direction)) {
+        return;
+    }
+
     qemu_mutex_lock(&tg->lock);
 
     /* First we check if this I/O has to be throttled. */
@@ -377,14 +581,16 @@ void coroutine_fn throttle_group_co_io_limits_intercept(ThrottleGroupMember *tgm
 
     /* Wait if there's a timer set or queued requests of this type */
     if (must_wait || tgm->pending_reqs[direction]) {
-        tgm->pending_reqs[direction]++;
+        qatomic_inc(&tgm->pending_reqs[direction]);
+        tg->pending_reqs[direction]++;
         qemu_mutex_unlock(&tg->lock);
         qemu_co_mutex_lock(&tgm->throttled_reqs_lock);
         qemu_co_queue_wait(&tgm->throttled_reqs[direction],
                            &tgm->throttled_reqs_lock);
         qemu_co_mutex_unlock(&tgm->throttled_reqs_lock);
         qemu_mutex_lock(&tg->lock);
-        tgm->pending_reqs[direction]--;
+        tg->pending_reqs[direction]--;
+        qatomic_dec(&tgm->pending_reqs[direction]);
     }
 
     /* The I/O will be executed, so do the accounting */
@@ -393,6 +599,9 @@ void coroutine_fn throttle_group_co_io_limits_intercept(ThrottleGroupMember *tgm
     /* Schedule the next request */
     schedule_next_request(tgm, direction);
 
+    /* Let the following requests from this AioContext skip the lock */
+    throttle_group_local_refill(tg, direction);
+
     qemu_mutex_unlock(&tg->lock);
 }
 
@@ -478,6 +687,8 @@ void throttle_group_config(ThrottleGroupMember *tgm, ThrottleConfig *cfg)
     ThrottleGroup *tg = container_of(ts, ThrottleGroup, ts);
     qemu_mutex_lock(&tg->lock);
     throttle_config(ts, tg->clock_type, cfg);
+    /* throttle_config() resets the buckets, drop budgets accounted there */
+    qatomic_inc(&tg->local_gen);
     qemu_mutex_unlock(&tg->lock);
 
     throttle_group_restart_tgm(tgm);
@@ -903,6 +1114,7 @@ static void throttle_group_set_limits(Object *obj, Visitor *v,
         goto unlock;
     }
     throttle_config(&tg->ts, tg->clock_type, &cfg);
+    qatomic_inc(&tg->local_gen);
 
 unlock:
     qemu_mutex_unlock(&tg->lock);
@@ -965,6 +1177,7 @@ static const TypeInfo throttle_group_info = {
     .parent = TYPE_OBJECT,
     .class_init = throttle_group_obj_class_init,
     .instance_size = sizeof(ThrottleGroup),
+    .instance_align = __alignof__(ThrottleGroup),
     .instance_init = throttle_group_obj_init,
     .instance_finalize = throttle_group_obj_finalize,
     .interfaces = (const InterfaceInfo[]) {
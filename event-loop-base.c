@@ -15,6 +15,7 @@
 #include "qom/object_interfaces.h"
 #include "qapi/error.h"
 #include "block/thread-pool.h"
+#include "qemu/thread-context.h"
 #include "system/event-loop-base.h"
 
 typedef struct {
@@ -75,14 +76,31 @@ static void event_loop_base_set_param(Object *obj, Visitor *v,
     }
 }
 
+static void event_loop_base_check_thread_pool_context(const Object *obj,
+        const char *name, Object *val, Error **errp)
+{
+    EventLoopBase *base = EVENT_LOOP_BASE(obj);
+
+    /* Worker threads that already exist would keep their old affinity */
+    if (base->initialized) {
+        error_setg(errp, "%s cannot be changed after the event loop has "
+                   "been created", name);
+    }
+}
+
 static void event_loop_base_complete(UserCreatable *uc, Error **errp)
 {
+    ERRP_GUARD();
     EventLoopBaseClass *bc = EVENT_LOOP_BASE_GET_CLASS(uc);
     EventLoopBase *base = EVENT_LOOP_BASE(uc);
 
     if (bc->init) {
         bc->init(base, errp);
+        if (*errp) {
+            return;
+        }
     }
+    base->initialized = true;
 }
 
 static bool event_loop_base_can_be_deleted(UserCreatable *uc)
@@ -116,6 +134,13 @@ static void event_loop_base_class_init(ObjectClass *klass,
                               event_loop_base_get_param,
                               event_loop_base_set_param,
                               NULL, &thread_pool_max_info);
+    object_class_property_add_link(klass, "thread-pool-context",
+                                   TYPE_THREAD_CONTEXT,
+                                   offsetof(EventLoopBase, thread_pool_context),
+                                   event_loop_base_check_thread_pool_context,
+                                   OBJ_PROP_LINK_STRONG);
+    object_class_property_set_description(klass, "thread-pool-context",
+        "Context to use for creating thread pool worker threads");
 }
 
 static const TypeInfo event_loop_base_info = {
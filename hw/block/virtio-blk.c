@@ -18,6 +18,7 @@
 #include "qemu/module.h"
 #include "qemu/error-report.h"
 #include "qemu/main-loop.h"
+#include "qemu/timer.h"
 #include "block/block_int.h"
 #include "trace.h"
 #include "hw/block/block.h"
@@ -89,7 +90,7 @@ static int virtio_blk_handle_rw_error(VirtIOBlockReq *req, int error,
         if (acct_failed) {
             block_acct_failed(blk_get_stats(s->blk), &req->acct);
         }
-        g_free(req);
+        virtqueue_element_free(req);
     }
 
     blk_error_action(s->blk, action, is_read, error);
@@ -132,7 +133,7 @@ static void virtio_blk_rw_complete(void *opaque, int ret)
 
         virtio_blk_req_complete(req, VIRTIO_BLK_S_OK);
         block_acct_done(blk_get_stats(s->blk), &req->acct);
-        g_free(req);
+        virtqueue_element_free(req);
     }
 }
 
@@ -147,7 +148,7 @@ static void virtio_blk_flush_complete(void *opaque, int ret)
 
     virtio_blk_req_complete(req, VIRTIO_BLK_S_OK);
     block_acct_done(blk_get_stats(s->blk), &req->acct);
-    g_free(req);
+    virtqueue_element_free(req);
 }
 
 static void virtio_blk_discard_write_zeroes_complete(void *opaque, int ret)
@@ -165,7 +166,7 @@ static void virtio_blk_discard_write_zeroes_complete(void *opaque, int ret)
     if (is_write_zeroes) {
         block_acct_done(blk_get_stats(s->blk), &req->acct);
     }
-    g_free(req);
+    virtqueue_element_free(req);
 }
 
 static VirtIOBlockReq *virtio_blk_get_request(VirtIOBlock *s, VirtQueue *vq)
@@ -210,7 +211,7 @@ static void virtio_blk_handle_scsi(VirtIOBlockReq *req)
 
 fail:
     virtio_blk_req_complete(req, status);
-    g_free(req);
+    virtqueue_element_free(req);
 }
 
 static inline void submit_requests(VirtIOBlock *s, MultiReqBuffer *mrb,
@@ -608,7 +609,7 @@ static void virtio_blk_zone_report_complete(void *opaque, int ret)
 
 out:
     virtio_blk_req_complete(req, err_status);
-    g_free(req);
+    virtqueue_element_free(req);
     g_free(data->zone_report_data.zones);
     g_free(data);
 }
@@ -657,7 +658,7 @@ static void virtio_blk_handle_zone_report(VirtIOBlockReq *req,
     return;
 out:
     virtio_blk_req_complete(req, err_status);
-    g_free(req);
+    virtqueue_element_free(req);
 }
 
 static void virtio_blk_zone_mgmt_complete(void *opaque, int ret)
@@ -673,7 +674,7 @@ static void virtio_blk_zone_mgmt_complete(void *opaque, int ret)
     }
 
     virtio_blk_req_complete(req, err_status);
-    g_free(req);
+    virtqueue_element_free(req);
 }
 
 static int virtio_blk_handle_zone_mgmt(VirtIOBlockReq *req, BlockZoneOp op)
@@ -715,7 +716,7 @@ static int virtio_blk_handle_zone_mgmt(VirtIOBlockReq *req, BlockZoneOp op)
     return 0;
 out:
     virtio_blk_req_complete(req, err_status);
-    g_free(req);
+    virtqueue_element_free(req);
     return err_status;
 }
 
@@ -746,7 +747,7 @@ static void virtio_blk_zone_append_complete(void *opaque, int ret)
 
 out:
     virtio_blk_req_complete(req, err_status);
-    g_free(req);
+    virtqueue_element_free(req);
     g_free(data);
 }
 
@@ -784,7 +785,7 @@ static int virtio_blk_handle_zone_append(VirtIOBlockReq *req,
 
 out:
     virtio_blk_req_complete(req, err_status);
-    g_free(req);
+    virtqueue_element_free(req);
     return err_status;
 }
 
@@ -851,7 +852,7 @@ static int virtio_blk_handle_request(VirtIOBlockReq *req, MultiReqBuffer *mrb)
             virtio_blk_req_complete(req, VIRTIO_BLK_S_IOERR);
             block_acct_invalid(blk_get_stats(s->blk),
                                is_write ? BLOCK_ACCT_WRITE : BLOCK_ACCT_READ);
-            g_free(req);
+            virtqueue_element_free(req);
             return 0;
         }
 
@@ -907,7 +908,7 @@ static int virtio_blk_handle_request(VirtIOBlockReq *req, MultiReqBuffer *mrb)
                               VIRTIO_BLK_ID_BYTES));
         iov_from_buf(in_iov, in_num, 0, serial, size);
         virtio_blk_req_complete(req, VIRTIO_BLK_S_OK);
-        g_free(req);
+        virtqueue_element_free(req);
         break;
     }
     case VIRTIO_BLK_T_ZONE_APPEND & ~VIRTIO_BLK_T_OUT:
@@ -939,7 +940,7 @@ static int virtio_blk_handle_request(VirtIOBlockReq *req, MultiReqBuffer *mrb)
         if (unlikely(!(type & VIRTIO_BLK_T_OUT) ||
                      out_len > sizeof(dwz_hdr))) {
             virtio_blk_req_complete(req, VIRTIO_BLK_S_UNSUPP);
-            g_free(req);
+            virtqueue_element_free(req);
             return 0;
         }
 
@@ -956,7 +957,7 @@ static int virtio_blk_handle_request(VirtIOBlockReq *req, MultiReqBuffer *mrb)
                                                             is_write_zeroes);
         if (err_status != VIRTIO_BLK_S_OK) {
             virtio_blk_req_complete(req, err_status);
-            g_free(req);
+            virtqueue_element_free(req);
         }
 
         break;
@@ -971,7 +972,7 @@ static int virtio_blk_handle_request(VirtIOBlockReq *req, MultiReqBuffer *mrb)
         if (!vbk->handle_unknown_request ||
             !vbk->handle_unknown_request(req, mrb, type)) {
             virtio_blk_req_complete(req, VIRTIO_BLK_S_UNSUPP);
-            g_free(req);
+            virtqueue_element_free(req);
         }
     }
     }
@@ -980,6 +981,9 @@ static int virtio_blk_handle_request(VirtIOBlockReq *req, MultiReqBuffer *mrb)
 
 void virtio_blk_handle_vq(VirtIOBlock *s, VirtQueue *vq)
 {
+    IOThreadVirtQueueLoad *load = &s->vq_load[virtio_get_queue_index(vq)];
+    int64_t start_ns = get_clock();
+    uint64_t requests = 0;
     VirtIOBlockReq *req;
     MultiReqBuffer mrb = {};
     bool suppress_notifications = virtio_queue_get_notification(vq);
@@ -992,9 +996,10 @@ void virtio_blk_handle_vq(VirtIOBlock *s, VirtQueue *vq)
         }
 
         while ((req = virtio_blk_get_request(s, vq))) {
+            requests++;
             if (virtio_blk_handle_request(req, &mrb)) {
                 virtqueue_detach_element(req->vq, &req->elem, 0);
-                g_free(req);
+                virtqueue_element_free(req);
                 break;
             }
         }
@@ -1009,6 +1014,9 @@ void virtio_blk_handle_vq(VirtIOBlock *s, VirtQueue *vq)
     }
 
     defer_call_end();
+
+    stat64_add(&load->requests, requests);
+    stat64_add(&load->busy_ns, get_clock() - start_ns);
 }
 
 static void virtio_blk_handle_output(VirtIODevice *vdev, VirtQueue *vq)
@@ -1044,7 +1052,7 @@ static void virtio_blk_dma_restart_bh(void *opaque)
             while (req) {
                 next = req->next;
                 virtqueue_detach_element(req->vq, &req->elem, 0);
-                g_free(req);
+                virtqueue_element_free(req);
                 req = next;
             }
             break;
@@ -1127,7 +1135,7 @@ static void virtio_blk_reset(VirtIODevice *vdev)
             /* No other threads can access req->vq here */
             virtqueue_detach_element(req->vq, &req->elem, 0);
 
-            g_free(req);
+            virtqueue_element_free(req);
         }
     }
 
@@ -1425,6 +1433,125 @@ static const BlockDevOps virtio_block_ops = {
     .drained_end   = virtio_blk_drained_end,
 };
 
+/*
+ * Move the virtqueues to the AioContexts in @vq_aio_context.
+ *
+ * Requests complete in the AioContext that submitted them, so the device
+ * is drained while virtqueues move: virtio_blk_drained_begin() detaches
+ * the host notifiers from the old AioContexts, and virtio_blk_drained_end()
+ * attaches them to the new ones.
+ *
+ * The BlockBackend keeps the AioContext that it got in
+ * virtio_blk_start_ioeventfd() even if virtqueue 0 moves.  Requests can be
+ * submitted from any AioContext, so that is only its home AioContext, and
+ * it is updated the next time ioeventfd is started.
+ *
+ * Context: BQL held
+ */
+static void virtio_blk_set_vq_aio_contexts(VirtIOBlock *s,
+                                           AioContext **vq_aio_context)
+{
+    BlockDriverState *bs = blk_bs(s->conf.conf.blk);
+
+    if (bs) {
+        bdrv_drained_begin(bs);
+    } else if (s->ioeventfd_started) {
+        virtio_blk_ioeventfd_detach(s);
+    }
+
+    for (uint16_t i = 0; i < s->conf.num_queues; i++) {
+        if (s->vq_aio_context[i] != vq_aio_context[i]) {
+            trace_virtio_blk_set_vq_aio_context(s, i, vq_aio_context[i]);
+            s->vq_aio_context[i] = vq_aio_context[i];
+        }
+    }
+
+    if (bs) {
+        bdrv_drained_end(bs);
+    } else if (s->ioeventfd_started) {
+        virtio_blk_ioeventfd_attach(s);
+    }
+}
+
+/* Context: BQL held */
+static void virtio_blk_rebalance_timer_cb(void *opaque)
+{
+    VirtIOBlock *s = opaque;
+    VirtIOBlkConf *conf = &s->conf;
+
+    if (s->ioeventfd_started && !s->ioeventfd_stopping) {
+        g_autofree AioContext **vq_aio_context =
+            g_memdup2(s->vq_aio_context,
+                      conf->num_queues * sizeof(AioContext *));
+        unsigned moved;
+
+        moved = iothread_vq_mapping_rebalance(conf->iothread_vq_mapping_list,
+                                              vq_aio_context, s->vq_load,
+                                              conf->num_queues);
+        trace_virtio_blk_rebalance(s, moved);
+        if (moved) {
+            virtio_blk_set_vq_aio_contexts(s, vq_aio_context);
+        }
+    }
+
+    timer_mod(s->rebalance_timer, qemu_clock_get_ms(QEMU_CLOCK_REALTIME) +
+              conf->iothread_vq_rebalance_ms);
+}
+
+/* Context: BQL held */
+static VirtQueueIOThreadList *virtio_blk_query_vq_iothreads(VirtIODevice *vdev,
+                                                            Error **errp)
+{
+    VirtIOBlock *s = VIRTIO_BLK(vdev);
+    VirtIOBlkConf *conf = &s->conf;
+
+    if (!conf->iothread_vq_mapping_list) {
+        error_setg(errp, "iothread-vq-mapping is not set");
+        return NULL;
+    }
+
+    return iothread_vq_mapping_query(conf->iothread_vq_mapping_list,
+                                     s->vq_aio_context, s->vq_load,
+                                     conf->num_queues);
+}
+
+/* Context: BQL held */
+static bool virtio_blk_set_vq_iothread(VirtIODevice *vdev, uint16_t queue,
+                                       const char *iothread, Error **errp)
+{
+    VirtIOBlock *s = VIRTIO_BLK(vdev);
+    VirtIOBlkConf *conf = &s->conf;
+    g_autofree AioContext **vq_aio_context = NULL;
+    AioContext *ctx;
+
+    if (!conf->iothread_vq_mapping_list) {
+        error_setg(errp, "iothread-vq-mapping is not set");
+        return false;
+    }
+
+    if (queue >= conf->num_queues) {
+        error_setg(errp, "Invalid virtqueue number %u", queue);
+        return false;
+    }
+
+    ctx = iothread_vq_mapping_get_aio_context(conf->iothread_vq_mapping_list,
+                                              iothread, errp);
+    if (!ctx) {
+        return false;
+    }
+
+    if (s->ioeventfd_starting || s->ioeventfd_stopping) {
+        error_setg(errp, "ioeventfd is being started or stopped");
+        return false;
+    }
+
+    vq_aio_context = g_memdup2(s->vq_aio_context,
+                               conf->num_queues * sizeof(AioContext *));
+    vq_aio_context[queue] = ctx;
+    virtio_blk_set_vq_aio_contexts(s, vq_aio_context);
+    return true;
+}
+
 /* Context: BQL held */
 static bool virtio_blk_vq_aio_context_init(VirtIOBlock *s, Error **errp)
 {
@@ -1454,7 +1581,14 @@ static bool virtio_blk_vq_aio_context_init(VirtIOBlock *s, Error **errp)
         }
     }
 
+    if (conf->iothread_vq_rebalance_ms && !conf->iothread_vq_mapping_list) {
+        error_setg(errp, "iothread-vq-rebalance-interval requires "
+                   "iothread-vq-mapping");
+        return false;
+    }
+
     s->vq_aio_context = g_new(AioContext *, conf->num_queues);
+    s->vq_load = g_new0(IOThreadVirtQueueLoad, conf->num_queues);
 
     if (conf->iothread_vq_mapping_list) {
         if (!iothread_vq_mapping_apply(conf->iothread_vq_mapping_list,
@@ -1463,8 +1597,19 @@ static bool virtio_blk_vq_aio_context_init(VirtIOBlock *s, Error **errp)
                                        errp)) {
             g_free(s->vq_aio_context);
             s->vq_aio_context = NULL;
+            g_free(s->vq_load);
+            s->vq_load = NULL;
             return false;
         }
+
+        if (conf->iothread_vq_rebalance_ms) {
+            s->rebalance_timer = timer_new_ms(QEMU_CLOCK_REALTIME,
+                                              virtio_blk_rebalance_timer_cb,
+                                              s);
+            timer_mod(s->rebalance_timer,
+                      qemu_clock_get_ms(QEMU_CLOCK_REALTIME) +
+                      conf->iothread_vq_rebalance_ms);
+        }
     } else if (conf->iothread) {
         AioContext *ctx = iothread_get_aio_context(conf->iothread);
         for (unsigned i = 0; i < conf->num_queues; i++) {
@@ -1490,6 +1635,9 @@ static void virtio_blk_vq_aio_context_cleanup(VirtIOBlock *s)
 
     assert(!s->ioeventfd_started);
 
+    timer_free(s->rebalance_timer);
+    s->rebalance_timer = NULL;
+
     if (conf->iothread_vq_mapping_list) {
         iothread_vq_mapping_cleanup(conf->iothread_vq_mapping_list);
     }
@@ -1500,6 +1648,8 @@ static void virtio_blk_vq_aio_context_cleanup(VirtIOBlock *s)
 
     g_free(s->vq_aio_context);
     s->vq_aio_context = NULL;
+    g_free(s->vq_load);
+    s->vq_load = NULL;
 }
 
 /* Context: BQL held */
@@ -1873,6 +2023,8 @@ static const Property virtio_blk_properties[] = {
                      IOThread *),
     DEFINE_PROP_IOTHREAD_VQ_MAPPING_LIST("iothread-vq-mapping", VirtIOBlock,
                                          conf.iothread_vq_mapping_list),
+    DEFINE_PROP_UINT32("iothread-vq-rebalance-interval", VirtIOBlock,
+                       conf.iothread_vq_rebalance_ms, 0),
     DEFINE_PROP_BIT64("discard", VirtIOBlock, host_features,
                       VIRTIO_BLK_F_DISCARD, true),
     DEFINE_PROP_BOOL("report-discard-granularity", VirtIOBlock,
@@ -1906,6 +2058,9 @@ static void virtio_blk_class_init(ObjectClass *klass, const void *data)
     vdc->load = virtio_blk_load_device;
     vdc->start_ioeventfd = virtio_blk_start_ioeventfd;
     vdc->stop_ioeventfd = virtio_blk_stop_ioeventfd;
+    vdc->query_vq_iothreads = virtio_blk_query_vq_iothreads;
+    vdc->set_vq_iothread = virtio_blk_set_vq_iothread;
+    vdc->slab_elements = true;
 }
 
 static const TypeInfo virtio_blk_info = {
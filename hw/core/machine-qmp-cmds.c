@@ -12,6 +12,7 @@
 #include "hw/boards.h"
 #include "hw/intc/intc.h"
 #include "hw/mem/memory-device.h"
+#include "migration/cpr.h"
 #include "qapi/error.h"
 #include "qapi/qapi-builtin-visit.h"
 #include "qapi/qapi-commands-machine.h"
@@ -201,6 +202,7 @@ static int query_memdev(Object *obj, void *opaque)
         visit_type_uint16List(v, NULL, &m->host_nodes, &error_abort);
         visit_free(v);
         qobject_unref(host_nodes);
+        m->prefault = host_memory_backend_query_prefault(MEMORY_BACKEND(obj));
 
         QAPI_LIST_PREPEND(*list, m);
     }
@@ -276,6 +278,11 @@ UuidInfo *qmp_query_uuid(Error **errp)
 
 void qmp_system_reset(Error **errp)
 {
+    /* Reset would reload ROMs into memory that the clones still use */
+    if (cpr_is_clone_template()) {
+        error_setg(errp, "The guest RAM is shared with clones of this VM");
+        return;
+    }
     qemu_system_reset_request(SHUTDOWN_CAUSE_HOST_QMP_SYSTEM_RESET);
 }
 
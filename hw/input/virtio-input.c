@@ -320,6 +320,7 @@ static void virtio_input_class_init(ObjectClass *klass, const void *data)
     vdc->get_features = virtio_input_get_features;
     vdc->set_status   = virtio_input_set_status;
     vdc->reset        = virtio_input_reset;
+    vdc->lockless_get_config = true;
 }
 
 static const TypeInfo virtio_input_info = {
@@ -1612,10 +1612,10 @@ static void virtio_net_handle_ctrl(VirtIODevice *vdev, VirtQueue *vq)
         if (written > 0) {
             virtqueue_push(vq, elem, written);
             virtio_notify(vdev, vq);
-            g_free(elem);
+            virtqueue_element_free(elem);
         } else {
             virtqueue_detach_element(vq, elem, 0);
-            g_free(elem);
+            virtqueue_element_free(elem);
             break;
         }
     }
@@ -1976,7 +1976,7 @@ static ssize_t virtio_net_receive_rcu(NetClientState *nc, const uint8_t *buf,
             virtio_error(vdev,
                          "virtio-net receive queue contains no in buffers");
             virtqueue_detach_element(q->rx_vq, elem, 0);
-            g_free(elem);
+            virtqueue_element_free(elem);
             err = -1;
             goto err;
         }
@@ -2018,7 +2018,7 @@ static ssize_t virtio_net_receive_rcu(NetClientState *nc, const uint8_t *buf,
          * Otherwise, drop it. */
         if (!n->mergeable_rx_bufs && offset < size) {
             virtqueue_unpop(q->rx_vq, elem, total);
-            g_free(elem);
+            virtqueue_element_free(elem);
             err = size;
             goto err;
         }
@@ -2039,7 +2039,7 @@ static ssize_t virtio_net_receive_rcu(NetClientState *nc, const uint8_t *buf,
     for (j = 0; j < i; j++) {
         /* signal other side */
         virtqueue_fill(q->rx_vq, elems[j], lens[j], j);
-        g_free(elems[j]);
+        virtqueue_element_free(elems[j]);
     }
 
     virtqueue_flush(q->rx_vq, i);
@@ -2050,7 +2050,7 @@ static ssize_t virtio_net_receive_rcu(NetClientState *nc, const uint8_t *buf,
 err:
     for (j = 0; j < i; j++) {
         virtqueue_detach_element(q->rx_vq, elems[j], lens[j]);
-        g_free(elems[j]);
+        virtqueue_element_free(elems[j]);
     }
 
     return err;
@@ -2695,7 +2695,7 @@ static void virtio_net_tx_complete(NetClientState *nc, ssize_t len)
     virtqueue_push(q->tx_vq, q->async_tx.elem, 0);
     virtio_notify(vdev, q->tx_vq);
 
-    g_free(q->async_tx.elem);
+    virtqueue_element_free(q->async_tx.elem);
     q->async_tx.elem = NULL;
 
     virtio_queue_set_notification(q->tx_vq, 1);
@@ -2806,7 +2806,7 @@ static int32_t virtio_net_flush_tx(VirtIONetQueue *q)
 drop:
         virtqueue_push(q->tx_vq, elem, 0);
         virtio_notify(vdev, q->tx_vq);
-        g_free(elem);
+        virtqueue_element_free(elem);
 
         if (++num_packets >= n->tx_burst) {
             break;
@@ -2816,7 +2816,7 @@ drop:
 
 detach:
     virtqueue_detach_element(q->tx_vq, elem, 0);
-    g_free(elem);
+    virtqueue_element_free(elem);
     return -EINVAL;
 }
 
@@ -4163,6 +4163,7 @@ static void virtio_net_class_init(ObjectClass *klass, const void *data)
     vdc->primary_unplug_pending = primary_unplug_pending;
     vdc->get_vhost = virtio_net_get_vhost;
     vdc->toggle_device_iotlb = vhost_toggle_device_iotlb;
+    vdc->slab_elements = true;
 }
 
 static const TypeInfo virtio_net_info = {
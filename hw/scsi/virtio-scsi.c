@@ -100,7 +100,7 @@ static void virtio_scsi_free_req(VirtIOSCSIReq *req)
 {
     qemu_iovec_destroy(&req->resp_iov);
     qemu_sglist_destroy(&req->qsgl);
-    g_free(req);
+    virtqueue_element_free(req);
 }
 
 static void virtio_scsi_complete_req(VirtIOSCSIReq *req, QemuMutex *vq_lock)
@@ -1420,6 +1420,8 @@ static void virtio_scsi_class_init(ObjectClass *klass, const void *data)
     vdc->reset = virtio_scsi_reset;
     vdc->start_ioeventfd = virtio_scsi_dataplane_start;
     vdc->stop_ioeventfd = virtio_scsi_dataplane_stop;
+    vdc->slab_elements = true;
+    vdc->lockless_get_config = true;
     hc->pre_plug = virtio_scsi_pre_hotplug;
     hc->plug = virtio_scsi_hotplug;
     hc->unplug = virtio_scsi_hotunplug;
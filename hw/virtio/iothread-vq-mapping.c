@@ -129,3 +129,109 @@ void iothread_vq_mapping_cleanup(IOThreadVirtQueueMappingList *list)
     }
 }
 
+
+AioContext *iothread_vq_mapping_get_aio_context(
+        IOThreadVirtQueueMappingList *list,
+        const char *iothread,
+        Error **errp)
+{
+    IOThreadVirtQueueMappingList *node;
+
+    for (node = list; node; node = node->next) {
+        if (g_str_equal(node->value->iothread, iothread)) {
+            return iothread_get_aio_context(iothread_by_id(iothread));
+        }
+    }
+
+    error_setg(errp, "IOThread \"%s\" is not in iothread-vq-mapping",
+               iothread);
+    return NULL;
+}
+
+static const char *
+iothread_vq_mapping_find_id(IOThreadVirtQueueMappingList *list,
+                            AioContext *ctx)
+{
+    IOThreadVirtQueueMappingList *node;
+
+    for (node = list; node; node = node->next) {
+        IOThread *iothread = iothread_by_id(node->value->iothread);
+
+        if (iothread_get_aio_context(iothread) == ctx) {
+            return node->value->iothread;
+        }
+    }
+    g_assert_not_reached();
+}
+
+unsigned iothread_vq_mapping_rebalance(
+        IOThreadVirtQueueMappingList *list,
+        AioContext **vq_aio_context,
+        IOThreadVirtQueueLoad *vq_load,
+        uint16_t num_queues)
+{
+    IOThreadVirtQueueMappingList *node;
+    size_t num_iothreads = 0;
+    g_autofree AioContext **ctx = NULL;
+    g_autofree uint64_t *iothread_load = NULL;
+    g_autofree uint64_t *load = g_new(uint64_t, num_queues);
+    g_autofree unsigned *vq_iothread = g_new(unsigned, num_queues);
+    unsigned moved;
+
+    for (node = list; node; node = node->next) {
+        num_iothreads++;
+    }
+
+    ctx = g_new(AioContext *, num_iothreads);
+    iothread_load = g_new0(uint64_t, num_iothreads);
+    num_iothreads = 0;
+    for (node = list; node; node = node->next) {
+        IOThread *iothread = iothread_by_id(node->value->iothread);
+
+        ctx[num_iothreads++] = iothread_get_aio_context(iothread);
+    }
+
+    for (uint16_t i = 0; i < num_queues; i++) {
+        uint64_t busy_ns = stat64_get(&vq_load[i].busy_ns);
+        unsigned j;
+
+        load[i] = busy_ns - vq_load[i].last_busy_ns;
+        vq_load[i].last_busy_ns = busy_ns;
+
+        for (j = 0; ctx[j] != vq_aio_context[i]; j++) {
+            assert(j + 1 < num_iothreads);
+        }
+        vq_iothread[i] = j;
+        iothread_load[j] += load[i];
+    }
+
+    moved = iothread_vq_rebalance_loads(iothread_load, num_iothreads, load,
+                                        vq_iothread, num_queues);
+    for (uint16_t i = 0; i < num_queues; i++) {
+        vq_aio_context[i] = ctx[vq_iothread[i]];
+    }
+
+    return moved;
+}
+
+VirtQueueIOThreadList *iothread_vq_mapping_query(
+        IOThreadVirtQueueMappingList *list,
+        AioContext **vq_aio_context,
+        IOThreadVirtQueueLoad *vq_load,
+        uint16_t num_queues)
+{
+    VirtQueueIOThreadList *head = NULL, **tail = &head;
+
+    for (uint16_t i = 0; i < num_queues; i++) {
+        VirtQueueIOThread *info = g_new0(VirtQueueIOThread, 1);
+
+        info->queue = i;
+        info->iothread = g_strdup(iothread_vq_mapping_find_id(list,
+                                      vq_aio_context[i]));
+        info->requests = stat64_get(&vq_load[i].requests);
+        info->busy_ns = stat64_get(&vq_load[i].busy_ns);
+        QAPI_LIST_APPEND(tail, info);
+    }
+
+    return head;
+}
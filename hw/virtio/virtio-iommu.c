@@ -1690,6 +1690,18 @@ static void virtio_iommu_class_init(ObjectClass *klass, const void *data)
     vdc->vmsd = &vmstate_virtio_iommu_device;
 }
 
+static int virtio_iommu_get_attr(IOMMUMemoryRegion *mr,
+                                 enum IOMMUMemoryRegionAttr attr, void *data)
+{
+    /* VIRTIO_IOMMU_T_UNMAP and detach requests notify the unmapped ranges */
+    if (attr == IOMMU_ATTR_NOTIFIES_UNMAP) {
+        *(bool *) data = true;
+        return 0;
+    }
+
+    return -EINVAL;
+}
+
 static void virtio_iommu_memory_region_class_init(ObjectClass *klass,
                                                   const void *data)
 {
@@ -1698,6 +1710,7 @@ static void virtio_iommu_memory_region_class_init(ObjectClass *klass,
     imrc->translate = virtio_iommu_translate;
     imrc->replay = virtio_iommu_replay;
     imrc->notify_flag_changed = virtio_iommu_notify_flag_changed;
+    imrc->get_attr = virtio_iommu_get_attr;
 }
 
 static const TypeInfo virtio_iommu_info = {
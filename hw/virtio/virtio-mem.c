@@ -979,6 +979,11 @@ static void virtio_mem_device_realize(DeviceState *dev, Error **errp)
                    " virtio-mem device. ", VIRTIO_MEM_MEMDEV_PROP,
                    object_get_canonical_path_component(OBJECT(vmem->memdev)));
         return;
+    } else if (vmem->memdev->prefault) {
+        error_setg(errp, "'%s' property specifies a memdev with prefaulting"
+                   " enabled: %s", VIRTIO_MEM_MEMDEV_PROP,
+                   object_get_canonical_path_component(OBJECT(vmem->memdev)));
+        return;
     }
 
     if ((nb_numa_nodes && vmem->node >= nb_numa_nodes) ||
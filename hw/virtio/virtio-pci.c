@@ -28,7 +28,9 @@
 #include "hw/qdev-properties.h"
 #include "qapi/error.h"
 #include "qemu/error-report.h"
+#include "qemu/lockable.h"
 #include "qemu/log.h"
+#include "qemu/main-loop.h"
 #include "qemu/module.h"
 #include "hw/pci/msi.h"
 #include "hw/pci/msix.h"
@@ -529,6 +531,8 @@ static uint64_t virtio_pci_config_read(void *opaque, hwaddr addr,
         return UINT64_MAX;
     }
 
+    QEMU_LOCK_GUARD(&proxy->lock);
+
     if (addr < config) {
         return virtio_ioport_read(proxy, addr);
     }
@@ -565,6 +569,8 @@ static void virtio_pci_config_write(void *opaque, hwaddr addr,
         return;
     }
 
+    QEMU_LOCK_GUARD(&proxy->lock);
+
     if (addr < config) {
         virtio_ioport_write(proxy, addr, val);
         return;
@@ -1476,14 +1482,26 @@ int virtio_pci_add_shm_cap(VirtIOPCIProxy *proxy,
     return virtio_pci_add_mem_cap(proxy, &cap.cap);
 }
 
+/*
+ * The common config, ISR and device config regions are dispatched without
+ * the BQL, and their callbacks run with proxy->lock held.  Return the device
+ * or NULL if it was unplugged; it cannot go away until the lock is released.
+ */
+static VirtIODevice *virtio_pci_get_plugged_device(VirtIOPCIProxy *proxy)
+{
+    return proxy->plugged ? virtio_bus_get_device(&proxy->bus) : NULL;
+}
+
 static uint64_t virtio_pci_common_read(void *opaque, hwaddr addr,
                                        unsigned size)
 {
     VirtIOPCIProxy *proxy = opaque;
-    VirtIODevice *vdev = virtio_bus_get_device(&proxy->bus);
+    VirtIODevice *vdev;
     uint32_t val = 0;
     int i;
 
+    QEMU_LOCK_GUARD(&proxy->lock);
+    vdev = virtio_pci_get_plugged_device(proxy);
     if (vdev == NULL) {
         return UINT64_MAX;
     }
@@ -1522,7 +1540,7 @@ static uint64_t virtio_pci_common_read(void *opaque, hwaddr addr,
         val = vdev->status;
         break;
     case VIRTIO_PCI_COMMON_CFGGENERATION:
-        val = vdev->generation;
+        val = qatomic_read(&vdev->generation);
         break;
     case VIRTIO_PCI_COMMON_Q_SELECT:
         val = vdev->queue_sel;
@@ -1572,9 +1590,11 @@ static void virtio_pci_common_write(void *opaque, hwaddr addr,
                                     uint64_t val, unsigned size)
 {
     VirtIOPCIProxy *proxy = opaque;
-    VirtIODevice *vdev = virtio_bus_get_device(&proxy->bus);
+    VirtIODevice *vdev;
     uint16_t vector;
 
+    QEMU_LOCK_GUARD(&proxy->lock);
+    vdev = virtio_pci_get_plugged_device(proxy);
     if (vdev == NULL) {
         return;
     }
@@ -1698,6 +1718,33 @@ static void virtio_pci_common_write(void *opaque, hwaddr addr,
     }
 }
 
+/*
+ * Reads, and writes that only latch a value until the driver acts on it,
+ * are dispatched without the BQL.
+ */
+static bool virtio_pci_common_needs_bql(void *opaque, hwaddr addr,
+                                        unsigned size, bool is_write)
+{
+    if (!is_write) {
+        return false;
+    }
+
+    switch (addr) {
+    case VIRTIO_PCI_COMMON_DFSELECT:
+    case VIRTIO_PCI_COMMON_GFSELECT:
+    case VIRTIO_PCI_COMMON_Q_SELECT:
+    case VIRTIO_PCI_COMMON_Q_DESCLO:
+    case VIRTIO_PCI_COMMON_Q_DESCHI:
+    case VIRTIO_PCI_COMMON_Q_AVAILLO:
+    case VIRTIO_PCI_COMMON_Q_AVAILHI:
+    case VIRTIO_PCI_COMMON_Q_USEDLO:
+    case VIRTIO_PCI_COMMON_Q_USEDHI:
+        return false;
+    default:
+        return true;
+    }
+}
+
 
 static uint64_t virtio_pci_notify_read(void *opaque, hwaddr addr,
                                        unsigned size)
@@ -1738,19 +1785,48 @@ static void virtio_pci_notify_write_pio(void *opaque, hwaddr addr,
     }
 }
 
+/*
+ * Lowering INTx does not call back into the device, so taking the BQL here
+ * rather than in the dispatch code is safe without the re-entrancy guard.
+ */
+static void virtio_pci_isr_update_intx(VirtIOPCIProxy *proxy)
+{
+    VirtIODevice *vdev;
+
+    BQL_LOCK_GUARD();
+    QEMU_LOCK_GUARD(&proxy->lock);
+    vdev = virtio_pci_get_plugged_device(proxy);
+    if (vdev == NULL) {
+        return;
+    }
+
+    /* The device may have been notified again since the ISR was read */
+    if (msix_enabled(&proxy->pci_dev)) {
+        pci_irq_deassert(&proxy->pci_dev);
+    } else {
+        pci_set_irq(&proxy->pci_dev, qatomic_read(&vdev->isr) & 1);
+    }
+}
+
 static uint64_t virtio_pci_isr_read(void *opaque, hwaddr addr,
                                     unsigned size)
 {
     VirtIOPCIProxy *proxy = opaque;
-    VirtIODevice *vdev = virtio_bus_get_device(&proxy->bus);
+    VirtIODevice *vdev;
     uint64_t val;
 
-    if (vdev == NULL) {
-        return UINT64_MAX;
+    WITH_QEMU_LOCK_GUARD(&proxy->lock) {
+        vdev = virtio_pci_get_plugged_device(proxy);
+        if (vdev == NULL) {
+            return UINT64_MAX;
+        }
+        val = qatomic_xchg(&vdev->isr, 0);
     }
 
-    val = qatomic_xchg(&vdev->isr, 0);
-    pci_irq_deassert(&proxy->pci_dev);
+    /* Only take the BQL if INTx may have to be lowered */
+    if (val || qatomic_read(&proxy->pci_dev.irq_state)) {
+        virtio_pci_isr_update_intx(proxy);
+    }
     return val;
 }
 
@@ -1759,13 +1835,24 @@ static void virtio_pci_isr_write(void *opaque, hwaddr addr,
 {
 }
 
+/* set_config may notify the driver */
+static bool virtio_pci_device_needs_bql(void *opaque, hwaddr addr,
+                                        unsigned size, bool is_write)
+{
+    VirtIOPCIProxy *proxy = opaque;
+
+    return is_write || !qatomic_read(&proxy->lockless_config);
+}
+
 static uint64_t virtio_pci_device_read(void *opaque, hwaddr addr,
                                        unsigned size)
 {
     VirtIOPCIProxy *proxy = opaque;
-    VirtIODevice *vdev = virtio_bus_get_device(&proxy->bus);
+    VirtIODevice *vdev;
     uint64_t val;
 
+    QEMU_LOCK_GUARD(&proxy->lock);
+    vdev = virtio_pci_get_plugged_device(proxy);
     if (vdev == NULL) {
         return UINT64_MAX;
     }
@@ -1791,8 +1878,10 @@ static void virtio_pci_device_write(void *opaque, hwaddr addr,
                                     uint64_t val, unsigned size)
 {
     VirtIOPCIProxy *proxy = opaque;
-    VirtIODevice *vdev = virtio_bus_get_device(&proxy->bus);
+    VirtIODevice *vdev;
 
+    QEMU_LOCK_GUARD(&proxy->lock);
+    vdev = virtio_pci_get_plugged_device(proxy);
     if (vdev == NULL) {
         return;
     }
@@ -1816,6 +1905,7 @@ static void virtio_pci_modern_regions_init(VirtIOPCIProxy *proxy,
     static const MemoryRegionOps common_ops = {
         .read = virtio_pci_common_read,
         .write = virtio_pci_common_write,
+        .needs_bql = virtio_pci_common_needs_bql,
         .impl = {
             .min_access_size = 1,
             .max_access_size = 4,
@@ -1834,6 +1924,7 @@ static void virtio_pci_modern_regions_init(VirtIOPCIProxy *proxy,
     static const MemoryRegionOps device_ops = {
         .read = virtio_pci_device_read,
         .write = virtio_pci_device_write,
+        .needs_bql = virtio_pci_device_needs_bql,
         .impl = {
             .min_access_size = 1,
             .max_access_size = 4,
@@ -1881,6 +1972,12 @@ static void virtio_pci_modern_regions_init(VirtIOPCIProxy *proxy,
                           name->str,
                           proxy->device.size);
 
+    if (proxy->flags & VIRTIO_PCI_FLAG_LOCKLESS_IO) {
+        memory_region_enable_lockless_io(&proxy->common.mr);
+        memory_region_enable_lockless_io(&proxy->isr.mr);
+        memory_region_enable_lockless_io(&proxy->device.mr);
+    }
+
     g_string_printf(name, "virtio-pci-notify-%s", vdev_name);
     memory_region_init_io(&proxy->notify.mr, OBJECT(proxy),
                           &notify_ops,
@@ -2125,6 +2222,12 @@ static void virtio_pci_device_plugged(DeviceState *d, Error **errp)
             virtio_add_feature(&vdev->host_features, VIRTIO_F_SR_IOV);
         }
     }
+
+    WITH_QEMU_LOCK_GUARD(&proxy->lock) {
+        proxy->plugged = true;
+        qatomic_set(&proxy->lockless_config,
+                    VIRTIO_DEVICE_GET_CLASS(vdev)->lockless_get_config);
+    }
 }
 
 static void virtio_pci_device_unplugged(DeviceState *d)
@@ -2133,6 +2236,12 @@ static void virtio_pci_device_unplugged(DeviceState *d)
     bool modern = virtio_pci_modern(proxy);
     bool modern_pio = proxy->flags & VIRTIO_PCI_FLAG_MODERN_PIO_NOTIFY;
 
+    /* Wait for lockless accesses, later ones see that vdev is gone */
+    WITH_QEMU_LOCK_GUARD(&proxy->lock) {
+        proxy->plugged = false;
+        qatomic_set(&proxy->lockless_config, false);
+    }
+
     virtio_pci_stop_ioeventfd(proxy);
 
     if (modern) {
@@ -2307,6 +2416,7 @@ static void virtio_pci_reset(DeviceState *qdev)
     VirtioBusState *bus = VIRTIO_BUS(&proxy->bus);
     int i;
 
+    QEMU_LOCK_GUARD(&proxy->lock);
     virtio_bus_reset(bus);
     msix_unuse_all_vectors(&proxy->pci_dev);
 
@@ -2388,6 +2498,8 @@ static const Property virtio_pci_properties[] = {
                     VIRTIO_PCI_FLAG_INIT_FLR_BIT, true),
     DEFINE_PROP_BIT("aer", VirtIOPCIProxy, flags,
                     VIRTIO_PCI_FLAG_AER_BIT, false),
+    DEFINE_PROP_BIT("x-lockless-io", VirtIOPCIProxy, flags,
+                    VIRTIO_PCI_FLAG_LOCKLESS_IO_BIT, true),
 };
 
 static void virtio_pci_dc_realize(DeviceState *qdev, Error **errp)
@@ -2430,10 +2542,26 @@ static void virtio_pci_class_init(ObjectClass *klass, const void *data)
     dc->sync_config = virtio_pci_sync_config;
 }
 
+static void virtio_pci_instance_init(Object *obj)
+{
+    VirtIOPCIProxy *proxy = VIRTIO_PCI(obj);
+
+    qemu_rec_mutex_init(&proxy->lock);
+}
+
+static void virtio_pci_instance_finalize(Object *obj)
+{
+    VirtIOPCIProxy *proxy = VIRTIO_PCI(obj);
+
+    qemu_rec_mutex_destroy(&proxy->lock);
+}
+
 static const TypeInfo virtio_pci_info = {
     .name          = TYPE_VIRTIO_PCI,
     .parent        = TYPE_PCI_DEVICE,
     .instance_size = sizeof(VirtIOPCIProxy),
+    .instance_init = virtio_pci_instance_init,
+    .instance_finalize = virtio_pci_instance_finalize,
     .class_init    = virtio_pci_class_init,
     .class_size    = sizeof(VirtioPCIClass),
     .abstract      = true,
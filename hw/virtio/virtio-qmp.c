@@ -774,6 +774,7 @@ VirtioStatus *qmp_x_query_virtio_status(const char *path, Error **errp)
     status->disable_legacy_check = vdev->disable_legacy_check;
     status->bus_name = g_strdup(vdev->bus_name);
     status->use_guest_notifier_mask = vdev->use_guest_notifier_mask;
+    status->irq_coalesced = stat64_get(&vdev->irq_coalesced);
 
     if (vdev->vhost_started) {
         VirtioDeviceClass *vdc = VIRTIO_DEVICE_GET_CLASS(vdev);
@@ -844,3 +845,47 @@ VirtVhostQueueStatus *qmp_x_query_virtio_vhost_queue_status(const char *path,
 
     return status;
 }
+
+VirtQueueIOThreadList *qmp_x_query_virtio_iothread_vq_mapping(const char *path,
+                                                              Error **errp)
+{
+    VirtIODevice *vdev;
+    VirtioDeviceClass *vdc;
+
+    vdev = qmp_find_virtio_device(path);
+    if (vdev == NULL) {
+        error_setg(errp, "Path %s is not a VirtIODevice", path);
+        return NULL;
+    }
+
+    vdc = VIRTIO_DEVICE_GET_CLASS(vdev);
+    if (!vdc->query_vq_iothreads) {
+        error_setg(errp, "Device %s does not support iothread-vq-mapping",
+                   vdev->name);
+        return NULL;
+    }
+
+    return vdc->query_vq_iothreads(vdev, errp);
+}
+
+void qmp_x_virtio_set_vq_iothread(const char *path, uint16_t queue,
+                                  const char *iothread, Error **errp)
+{
+    VirtIODevice *vdev;
+    VirtioDeviceClass *vdc;
+
+    vdev = qmp_find_virtio_device(path);
+    if (vdev == NULL) {
+        error_setg(errp, "Path %s is not a VirtIODevice", path);
+        return;
+    }
+
+    vdc = VIRTIO_DEVICE_GET_CLASS(vdev);
+    if (!vdc->set_vq_iothread) {
+        error_setg(errp, "Device %s does not support iothread-vq-mapping",
+                   vdev->name);
+        return;
+    }
+
+    vdc->set_vq_iothread(vdev, queue, iothread, errp);
+}
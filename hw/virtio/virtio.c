@@ -20,6 +20,7 @@
 #include "qemu/log.h"
 #include "qemu/main-loop.h"
 #include "qemu/module.h"
+#include "qemu/slab.h"
 #include "exec/tswap.h"
 #include "qom/object_interfaces.h"
 #include "hw/core/cpu.h"
@@ -32,6 +33,7 @@
 #include "hw/virtio/virtio-access.h"
 #include "system/dma.h"
 #include "system/runstate.h"
+#include "system/xen.h"
 #include "virtio-qmp.h"
 
 #include "standard-headers/linux/virtio_ids.h"
@@ -112,6 +114,33 @@ typedef struct VRing
     VRingMemoryRegionCaches *caches;
 } VRing;
 
+#define VIRTQUEUE_IOVA_CACHE_SIZE 8
+
+typedef struct VirtQueueIOVAEntry {
+    hwaddr iova;                /* start of the IOMMU page */
+    hwaddr addr_mask;           /* size of the IOMMU page - 1 */
+    IOMMUAccessFlags perm;      /* direction that was translated */
+    MemoryRegion *mr;           /* referenced, NULL if the entry is free */
+    uint8_t *host;              /* host address of @iova */
+} VirtQueueIOVAEntry;
+
+typedef struct VirtQueueIOVACache {
+    QemuSpin lock;
+    /* Incremented by invalidations, so that racing fills are dropped */
+    unsigned int gen;
+    /* Entry to replace next */
+    unsigned int next;
+    VirtQueueIOVAEntry entries[VIRTQUEUE_IOVA_CACHE_SIZE];
+} VirtQueueIOVACache;
+
+struct VirtIOIOVANotifier {
+    IOMMUNotifier n;
+    MemoryRegion *mr;
+    hwaddr iommu_offset;
+    VirtIODevice *vdev;
+    QLIST_ENTRY(VirtIOIOVANotifier) next;
+};
+
 typedef struct VRingPackedDescEvent {
     uint16_t off_wrap;
     uint16_t flags;
@@ -153,6 +182,21 @@ struct VirtQueue
     EventNotifier host_notifier;
     bool host_notifier_enabled;
     QLIST_ENTRY(VirtQueue) node;
+
+    VirtQueueIOVACache iova_cache;
+
+    /*
+     * Interrupt coalescing.  irq_lock protects irq_pending, irq_irqfd and
+     * the interrupt suppression state (signalled_used, signalled_used_valid).
+     * irq_ctx, irq_bh and irq_timer belong to the AioContext that notifies
+     * the queue, which only changes while the queue is quiescent.
+     */
+    QemuSpin irq_lock;
+    uint32_t irq_pending;
+    bool irq_irqfd;
+    AioContext *irq_ctx;
+    QEMUBH *irq_bh;
+    QEMUTimer *irq_timer;
 };
 
 const char *virtio_device_names[] = {
@@ -235,6 +279,57 @@ static void virtio_virtqueue_reset_region_cache(struct VirtQueue *vq)
     }
 }
 
+/*
+ * Behind a vIOMMU, dma_memory_map() walks the IOMMU for every descriptor.
+ * To avoid that, each virtqueue remembers the last few IOMMU pages that it
+ * mapped, together with a reference to the RAM region that they translate
+ * to.  The cache is only used while IOMMU notifiers are registered for all
+ * IOMMU regions in the DMA address space: entries are dropped when the
+ * IOMMU unmaps them, and all entries are dropped on every change to the
+ * memory map.
+ */
+static void virtqueue_iova_cache_invalidate(VirtQueue *vq, hwaddr start,
+                                            hwaddr last)
+{
+    VirtQueueIOVACache *cache = &vq->iova_cache;
+    MemoryRegion *mrs[VIRTQUEUE_IOVA_CACHE_SIZE];
+    int i, n = 0;
+
+    qemu_spin_lock(&cache->lock);
+    cache->gen++;
+    for (i = 0; i < VIRTQUEUE_IOVA_CACHE_SIZE; i++) {
+        VirtQueueIOVAEntry *e = &cache->entries[i];
+
+        if (e->mr && e->iova <= last && start <= e->iova + e->addr_mask) {
+            mrs[n++] = e->mr;
+            e->mr = NULL;
+        }
+    }
+    qemu_spin_unlock(&cache->lock);
+
+    for (i = 0; i < n; i++) {
+        memory_region_unref(mrs[i]);
+    }
+}
+
+static void virtio_iova_cache_invalidate(VirtIODevice *vdev, hwaddr start,
+                                         hwaddr last)
+{
+    unsigned int i, nvqs;
+
+    /* Pairs with the cmpxchg in virtqueue_iova_cache_fill() */
+    smp_mb();
+    nvqs = qatomic_read(&vdev->iova_cache_nvqs);
+    if (!nvqs) {
+        return;
+    }
+
+    trace_virtio_iova_cache_invalidate(vdev, start, last);
+    for (i = 0; i < nvqs; i++) {
+        virtqueue_iova_cache_invalidate(&vdev->vq[i], start, last);
+    }
+}
+
 void virtio_init_region_cache(VirtIODevice *vdev, int n)
 {
     VirtQueue *vq = &vdev->vq[n];
@@ -1561,11 +1656,176 @@ int virtqueue_avail_bytes(VirtQueue *vq, unsigned int in_bytes,
     return in_bytes <= in_total && out_bytes <= out_total;
 }
 
-static bool virtqueue_map_desc(VirtIODevice *vdev, unsigned int *p_num_sg,
+/* Called with the cache lock held */
+static VirtQueueIOVAEntry *virtqueue_iova_cache_find(VirtQueueIOVACache *cache,
+                                                     hwaddr iova,
+                                                     IOMMUAccessFlags perm)
+{
+    int i;
+
+    for (i = 0; i < VIRTQUEUE_IOVA_CACHE_SIZE; i++) {
+        VirtQueueIOVAEntry *e = &cache->entries[i];
+
+        if (e->mr && (e->perm & perm) == perm &&
+            iova - e->iova <= e->addr_mask) {
+            return e;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Map as much as possible of [@iova, @iova + *@plen) using contiguous cache
+ * entries.  Like address_space_map(), take a reference to the memory region
+ * for address_space_unmap() to drop.
+ */
+static void *virtqueue_iova_cache_lookup(VirtQueue *vq, hwaddr iova,
+                                         hwaddr *plen, bool is_write)
+{
+    VirtQueueIOVACache *cache = &vq->iova_cache;
+    IOMMUAccessFlags perm = is_write ? IOMMU_WO : IOMMU_RO;
+    MemoryRegion *mr = NULL;
+    uint8_t *host = NULL;
+    hwaddr len = 0;
+
+    qemu_spin_lock(&cache->lock);
+    while (len < *plen) {
+        hwaddr addr = iova + len;
+        VirtQueueIOVAEntry *e = virtqueue_iova_cache_find(cache, addr, perm);
+        hwaddr offset;
+
+        if (!e) {
+            break;
+        }
+        offset = addr - e->iova;
+        if (!mr) {
+            mr = e->mr;
+            host = e->host + offset;
+        } else if (e->mr != mr || e->host + offset != host + len) {
+            break;
+        }
+        len += MIN(*plen - len, e->addr_mask - offset + 1);
+    }
+    if (mr) {
+        memory_region_ref(mr);
+    }
+    qemu_spin_unlock(&cache->lock);
+
+    *plen = len;
+    return host;
+}
+
+/*
+ * Translate the IOMMU page that contains @iova and return a reference to the
+ * RAM region that it maps to, or NULL if the page cannot be cached.
+ */
+static MemoryRegion *virtqueue_iova_translate(VirtIODevice *vdev, hwaddr iova,
+                                              bool is_write,
+                                              IOMMUTLBEntry *iotlb,
+                                              hwaddr *xlat)
+{
+    MemoryRegion *mr;
+    hwaddr plen;
+
+    RCU_READ_LOCK_GUARD();
+    *iotlb = address_space_get_iotlb_entry(vdev->dma_as, iova, is_write,
+                                           MEMTXATTRS_UNSPECIFIED);
+    if (iotlb->perm == IOMMU_NONE || iotlb->addr_mask == HWADDR_MAX) {
+        return NULL;
+    }
+
+    /* The whole IOMMU page must be in a single RAM region */
+    plen = iotlb->addr_mask + 1;
+    mr = address_space_translate(iotlb->target_as, iotlb->translated_addr,
+                                 xlat, &plen, is_write,
+                                 MEMTXATTRS_UNSPECIFIED);
+    if (plen <= iotlb->addr_mask ||
+        !memory_access_is_direct(mr, is_write, MEMTXATTRS_UNSPECIFIED)) {
+        return NULL;
+    }
+    memory_region_ref(mr);
+    return mr;
+}
+
+static void virtqueue_iova_cache_fill(VirtQueue *vq, hwaddr iova,
+                                      bool is_write)
+{
+    VirtIODevice *vdev = vq->vdev;
+    VirtQueueIOVACache *cache = &vq->iova_cache;
+    unsigned int nvqs = qatomic_read(&vdev->iova_cache_nvqs);
+    VirtQueueIOVAEntry *e;
+    IOMMUTLBEntry iotlb;
+    MemoryRegion *mr, *old;
+    hwaddr xlat;
+    unsigned int gen;
+
+    /* Make sure that invalidations see this queue before it is filled */
+    while (nvqs <= vq->queue_index) {
+        nvqs = qatomic_cmpxchg(&vdev->iova_cache_nvqs, nvqs,
+                               vq->queue_index + 1);
+    }
+    gen = qatomic_read(&cache->gen);
+
+    mr = virtqueue_iova_translate(vdev, iova, is_write, &iotlb, &xlat);
+    if (!mr) {
+        return;
+    }
+
+    trace_virtio_iova_cache_fill(vq, iotlb.iova, iotlb.addr_mask, is_write);
+
+    qemu_spin_lock(&cache->lock);
+    if (cache->gen != gen) {
+        /* The translation may be stale already */
+        qemu_spin_unlock(&cache->lock);
+        memory_region_unref(mr);
+        return;
+    }
+    e = &cache->entries[cache->next++ % VIRTQUEUE_IOVA_CACHE_SIZE];
+    old = e->mr;
+    e->iova = iotlb.iova;
+    e->addr_mask = iotlb.addr_mask;
+    e->perm = is_write ? IOMMU_WO : IOMMU_RO;
+    e->mr = mr;
+    e->host = qemu_map_ram_ptr(mr->ram_block, xlat);
+    qemu_spin_unlock(&cache->lock);
+
+    if (old) {
+        memory_region_unref(old);
+    }
+}
+
+static void *virtqueue_dma_map(VirtQueue *vq, hwaddr pa, hwaddr *plen,
+                               bool is_write)
+{
+    VirtIODevice *vdev = vq->vdev;
+
+    if (qatomic_read(&vdev->iova_cache_active)) {
+        hwaddr len = *plen;
+        void *ptr = virtqueue_iova_cache_lookup(vq, pa, &len, is_write);
+
+        if (!ptr) {
+            virtqueue_iova_cache_fill(vq, pa, is_write);
+            len = *plen;
+            ptr = virtqueue_iova_cache_lookup(vq, pa, &len, is_write);
+        }
+        if (ptr) {
+            *plen = len;
+            return ptr;
+        }
+    }
+
+    return dma_memory_map(vdev->dma_as, pa, plen,
+                          is_write ? DMA_DIRECTION_FROM_DEVICE :
+                                     DMA_DIRECTION_TO_DEVICE,
+                          MEMTXATTRS_UNSPECIFIED);
+}
+
+static bool virtqueue_map_desc(VirtQueue *vq, unsigned int *p_num_sg,
                                hwaddr *addr, struct iovec *iov,
                                unsigned int max_num_sg, bool is_write,
                                hwaddr pa, size_t sz)
 {
+    VirtIODevice *vdev = vq->vdev;
     bool ok = false;
     unsigned num_sg = *p_num_sg;
     assert(num_sg <= max_num_sg);
@@ -1584,11 +1844,7 @@ static bool virtqueue_map_desc(VirtIODevice *vdev, unsigned int *p_num_sg,
             goto out;
         }
 
-        iov[num_sg].iov_base = dma_memory_map(vdev->dma_as, pa, &len,
-                                              is_write ?
-                                              DMA_DIRECTION_FROM_DEVICE :
-                                              DMA_DIRECTION_TO_DEVICE,
-                                              MEMTXATTRS_UNSPECIFIED);
+        iov[num_sg].iov_base = virtqueue_dma_map(vq, pa, &len, is_write);
         if (!iov[num_sg].iov_base) {
             virtio_error(vdev, "virtio: bogus descriptor or out of resources");
             goto out;
@@ -1657,7 +1913,8 @@ void virtqueue_map(VirtIODevice *vdev, VirtQueueElement *elem)
                                                                         false);
 }
 
-static void *virtqueue_alloc_element(size_t sz, unsigned out_num, unsigned in_num)
+static void *virtqueue_alloc_element(VirtIODevice *vdev, size_t sz,
+                                     unsigned out_num, unsigned in_num)
 {
     VirtQueueElement *elem;
     size_t in_addr_ofs = QEMU_ALIGN_UP(sz, __alignof__(elem->in_addr[0]));
@@ -1668,7 +1925,13 @@ static void *virtqueue_alloc_element(size_t sz, unsigned out_num, unsigned in_nu
     size_t out_sg_end = out_sg_ofs + out_num * sizeof(elem->out_sg[0]);
 
     assert(sz >= sizeof(VirtQueueElement));
-    elem = g_malloc(out_sg_end);
+    if (VIRTIO_DEVICE_GET_CLASS(vdev)->slab_elements) {
+        elem = qemu_slab_alloc(out_sg_end);
+        elem->slab_size = out_sg_end;
+    } else {
+        elem = g_malloc(out_sg_end);
+        elem->slab_size = 0;
+    }
     trace_virtqueue_alloc_element(elem, sz, in_num, out_num);
     elem->out_num = out_num;
     elem->in_num = in_num;
@@ -1763,7 +2026,7 @@ static void *virtqueue_split_pop(VirtQueue *vq, size_t sz)
         bool map_ok;
 
         if (desc.flags & VRING_DESC_F_WRITE) {
-            map_ok = virtqueue_map_desc(vdev, &in_num, addr + out_num,
+            map_ok = virtqueue_map_desc(vq, &in_num, addr + out_num,
                                         iov + out_num,
                                         VIRTQUEUE_MAX_SIZE - out_num, true,
                                         desc.addr, desc.len);
@@ -1772,7 +2035,7 @@ static void *virtqueue_split_pop(VirtQueue *vq, size_t sz)
                 virtio_error(vdev, "Incorrect order for descriptors");
                 goto err_undo_map;
             }
-            map_ok = virtqueue_map_desc(vdev, &out_num, addr, iov,
+            map_ok = virtqueue_map_desc(vq, &out_num, addr, iov,
                                         VIRTQUEUE_MAX_SIZE, false,
                                         desc.addr, desc.len);
         }
@@ -1794,7 +2057,7 @@ static void *virtqueue_split_pop(VirtQueue *vq, size_t sz)
     }
 
     /* Now copy what we have collected and mapped */
-    elem = virtqueue_alloc_element(sz, out_num, in_num);
+    elem = virtqueue_alloc_element(vdev, sz, out_num, in_num);
     elem->index = head;
     elem->ndescs = 1;
     for (i = 0; i < out_num; i++) {
@@ -1901,7 +2164,7 @@ static void *virtqueue_packed_pop(VirtQueue *vq, size_t sz)
         bool map_ok;
 
         if (desc.flags & VRING_DESC_F_WRITE) {
-            map_ok = virtqueue_map_desc(vdev, &in_num, addr + out_num,
+            map_ok = virtqueue_map_desc(vq, &in_num, addr + out_num,
                                         iov + out_num,
                                         VIRTQUEUE_MAX_SIZE - out_num, true,
                                         desc.addr, desc.len);
@@ -1910,7 +2173,7 @@ static void *virtqueue_packed_pop(VirtQueue *vq, size_t sz)
                 virtio_error(vdev, "Incorrect order for descriptors");
                 goto err_undo_map;
             }
-            map_ok = virtqueue_map_desc(vdev, &out_num, addr, iov,
+            map_ok = virtqueue_map_desc(vq, &out_num, addr, iov,
                                         VIRTQUEUE_MAX_SIZE, false,
                                         desc.addr, desc.len);
         }
@@ -1935,7 +2198,7 @@ static void *virtqueue_packed_pop(VirtQueue *vq, size_t sz)
     }
 
     /* Now copy what we have collected and mapped */
-    elem = virtqueue_alloc_element(sz, out_num, in_num);
+    elem = virtqueue_alloc_element(vdev, sz, out_num, in_num);
     for (i = 0; i < out_num; i++) {
         elem->out_addr[i] = addr[i];
         elem->out_sg[i] = iov[i];
@@ -1989,6 +2252,25 @@ void *virtqueue_pop(VirtQueue *vq, size_t sz)
     }
 }
 
+/*
+ * virtqueue_element_free:
+ * @elem: an element returned by virtqueue_pop() or
+ *        qemu_get_virtqueue_element(), or NULL
+ *
+ * Devices with VirtioDeviceClass::slab_elements must release their elements
+ * with this function, other devices may also use g_free().
+ */
+void virtqueue_element_free(void *elem)
+{
+    VirtQueueElement *e = elem;
+
+    if (e && e->slab_size) {
+        qemu_slab_free(e, e->slab_size);
+    } else {
+        g_free(e);
+    }
+}
+
 static unsigned int virtqueue_packed_drop_all(VirtQueue *vq)
 {
     VRingMemoryRegionCaches *caches;
@@ -2124,7 +2406,7 @@ void *qemu_get_virtqueue_element(VirtIODevice *vdev, QEMUFile *f, size_t sz)
     assert(ARRAY_SIZE(data.in_addr) >= data.in_num);
     assert(ARRAY_SIZE(data.out_addr) >= data.out_num);
 
-    elem = virtqueue_alloc_element(sz, data.out_num, data.in_num);
+    elem = virtqueue_alloc_element(vdev, sz, data.out_num, data.in_num);
     elem->index = data.index;
 
     for (i = 0; i < elem->in_num; i++) {
@@ -2279,6 +2561,27 @@ static enum virtio_device_endian virtio_current_cpu_endian(void)
     }
 }
 
+static void virtqueue_irq_coalesce_reset(VirtQueue *vq)
+{
+    qemu_spin_lock(&vq->irq_lock);
+    vq->irq_pending = 0;
+    qemu_spin_unlock(&vq->irq_lock);
+}
+
+static void virtqueue_irq_coalesce_cleanup(VirtQueue *vq)
+{
+    virtqueue_irq_coalesce_reset(vq);
+    if (vq->irq_timer) {
+        timer_free(vq->irq_timer);
+        vq->irq_timer = NULL;
+    }
+    if (vq->irq_bh) {
+        qemu_bh_delete(vq->irq_bh);
+        vq->irq_bh = NULL;
+    }
+    vq->irq_ctx = NULL;
+}
+
 static void __virtio_queue_reset(VirtIODevice *vdev, uint32_t i)
 {
     vdev->vq[i].vring.desc = 0;
@@ -2297,6 +2600,8 @@ static void __virtio_queue_reset(VirtIODevice *vdev, uint32_t i)
     vdev->vq[i].vring.num = vdev->vq[i].vring.num_default;
     vdev->vq[i].inuse = 0;
     virtio_virtqueue_reset_region_cache(&vdev->vq[i]);
+    virtqueue_iova_cache_invalidate(&vdev->vq[i], 0, HWADDR_MAX);
+    virtqueue_irq_coalesce_reset(&vdev->vq[i]);
 }
 
 void virtio_queue_reset(VirtIODevice *vdev, uint32_t queue_index)
@@ -2534,6 +2839,8 @@ void virtio_delete_queue(VirtQueue *vq)
     g_free(vq->used_elems);
     vq->used_elems = NULL;
     virtio_virtqueue_reset_region_cache(vq);
+    virtqueue_iova_cache_invalidate(vq, 0, HWADDR_MAX);
+    virtqueue_irq_coalesce_cleanup(vq);
 }
 
 void virtio_del_queue(VirtIODevice *vdev, int n)
@@ -2634,6 +2941,160 @@ static bool virtio_should_notify(VirtIODevice *vdev, VirtQueue *vq)
     }
 }
 
+/*
+ * Interrupt coalescing
+ *
+ * With irq-coalesce-usecs or irq-coalesce-max set, virtio_notify() and
+ * virtio_notify_irqfd() only count the notification.  The interrupt is
+ * sent when irq-coalesce-usecs have passed since the first pending
+ * notification, when irq-coalesce-max notifications are pending, or, if
+ * irq-coalesce-usecs is 0, at the end of the current AioContext iteration.
+ *
+ * Whether the guest wants the interrupt is decided when it is sent, so
+ * that VIRTIO_RING_F_EVENT_IDX and VRING_AVAIL_F_NO_INTERRUPT apply to all
+ * the buffers used since the previous interrupt.
+ *
+ * Pending interrupts are not migrated.  Coalescing stops when the VM
+ * stops, so that requests completed by the drain in do_vm_stop() send
+ * their interrupts at once.  virtio_save() flushes any that raced with
+ * the state change.
+ */
+static bool virtio_irq_coalesce_configured(VirtIODevice *vdev)
+{
+    return vdev->irq_coalesce_usecs || vdev->irq_coalesce_max;
+}
+
+static bool virtio_irq_coalesce_enabled(VirtIODevice *vdev)
+{
+    return virtio_irq_coalesce_configured(vdev) &&
+           qatomic_read(&vdev->vm_running);
+}
+
+/*
+ * Take the pending notifications of @vq, return how many there were and
+ * set *@notify if the guest wants an interrupt for them.
+ */
+static uint32_t virtqueue_irq_take(VirtQueue *vq, bool *notify)
+{
+    uint32_t pending;
+
+    QEMU_LOCK_GUARD(&vq->irq_lock);
+    pending = vq->irq_pending;
+    if (pending) {
+        RCU_READ_LOCK_GUARD();
+
+        vq->irq_pending = 0;
+        *notify |= virtio_should_notify(vq->vdev, vq);
+    }
+    return pending;
+}
+
+static void virtqueue_irq_flush(VirtQueue *vq)
+{
+    VirtIODevice *vdev = vq->vdev;
+    bool notify = false;
+    uint64_t saved;
+    uint32_t pending;
+    VirtQueue *other;
+
+    pending = virtqueue_irq_take(vq, &notify);
+    if (!pending) {
+        return;
+    }
+    saved = pending - 1;
+
+    /*
+     * Queues that share the vector would raise the same interrupt, send
+     * theirs now too.  The lists only change under the BQL.  Queues that
+     * are processed in another AioContext may be updating their used ring
+     * right now, so leave them to their own flush.
+     */
+    if (bql_locked() && vdev->vector_queues &&
+        vq->vector != VIRTIO_NO_VECTOR) {
+        AioContext *ctx = qemu_get_current_aio_context();
+
+        QLIST_FOREACH(other, &vdev->vector_queues[vq->vector], node) {
+            if (other != vq && other->irq_ctx == ctx) {
+                saved += virtqueue_irq_take(other, &notify);
+            }
+        }
+    }
+
+    if (saved) {
+        stat64_add(&vdev->irq_coalesced, saved);
+    }
+    trace_virtio_notify_coalesced(vdev, vq, pending, notify);
+    if (!notify) {
+        return;
+    }
+
+    /* See virtio_notify_irqfd() for why the ISR is set with MSI too */
+    virtio_set_isr(vdev, 0x1);
+    if (vq->irq_irqfd) {
+        event_notifier_set(&vq->guest_notifier);
+    } else {
+        virtio_notify_vector(vdev, vq->vector);
+    }
+}
+
+static void virtqueue_irq_flush_cb(void *opaque)
+{
+    virtqueue_irq_flush(opaque);
+}
+
+static void virtqueue_irq_set_context(VirtQueue *vq, AioContext *ctx)
+{
+    virtqueue_irq_coalesce_cleanup(vq);
+    vq->irq_ctx = ctx;
+    vq->irq_bh = aio_bh_new(ctx, virtqueue_irq_flush_cb, vq);
+    vq->irq_timer = aio_timer_new(ctx, QEMU_CLOCK_REALTIME, SCALE_NS,
+                                  virtqueue_irq_flush_cb, vq);
+}
+
+static void virtio_notify_coalesced(VirtIODevice *vdev, VirtQueue *vq,
+                                    bool irqfd)
+{
+    AioContext *ctx = qemu_get_current_aio_context();
+    uint32_t pending;
+
+    if (unlikely(vq->irq_ctx != ctx)) {
+        virtqueue_irq_set_context(vq, ctx);
+    }
+
+    WITH_QEMU_LOCK_GUARD(&vq->irq_lock) {
+        pending = ++vq->irq_pending;
+        vq->irq_irqfd = irqfd;
+    }
+
+    if (vdev->irq_coalesce_max && pending >= vdev->irq_coalesce_max) {
+        virtqueue_irq_flush(vq);
+    } else if (pending > 1) {
+        /* Already scheduled */
+    } else if (vdev->irq_coalesce_usecs) {
+        timer_mod(vq->irq_timer, qemu_clock_get_ns(QEMU_CLOCK_REALTIME) +
+                  vdev->irq_coalesce_usecs * SCALE_US);
+    } else {
+        qemu_bh_schedule(vq->irq_bh);
+    }
+}
+
+/* Send the interrupts that are still pending, e.g. before migration */
+static void virtio_irq_coalesce_flush_all(VirtIODevice *vdev)
+{
+    int i;
+
+    if (!virtio_irq_coalesce_configured(vdev)) {
+        return;
+    }
+
+    for (i = 0; i < VIRTIO_QUEUE_MAX; i++) {
+        if (vdev->vq[i].vring.num == 0) {
+            break;
+        }
+        virtqueue_irq_flush(&vdev->vq[i]);
+    }
+}
+
 /* Batch irqs while inside a defer_call_begin()/defer_call_end() section */
 static void virtio_notify_irqfd_deferred_fn(void *opaque)
 {
@@ -2646,6 +3107,11 @@ static void virtio_notify_irqfd_deferred_fn(void *opaque)
 
 void virtio_notify_irqfd(VirtIODevice *vdev, VirtQueue *vq)
 {
+    if (virtio_irq_coalesce_enabled(vdev)) {
+        virtio_notify_coalesced(vdev, vq, true);
+        return;
+    }
+
     WITH_RCU_READ_LOCK_GUARD() {
         if (!virtio_should_notify(vdev, vq)) {
             return;
@@ -2681,6 +3147,11 @@ static void virtio_irq(VirtQueue *vq)
 
 void virtio_notify(VirtIODevice *vdev, VirtQueue *vq)
 {
+    if (virtio_irq_coalesce_enabled(vdev)) {
+        virtio_notify_coalesced(vdev, vq, false);
+        return;
+    }
+
     WITH_RCU_READ_LOCK_GUARD() {
         if (!virtio_should_notify(vdev, vq)) {
             return;
@@ -2697,7 +3168,7 @@ void virtio_notify_config(VirtIODevice *vdev)
         return;
 
     virtio_set_isr(vdev, 0x3);
-    vdev->generation++;
+    qatomic_inc(&vdev->generation);
     virtio_notify_vector(vdev, vdev->config_vector);
 }
 
@@ -2983,6 +3454,9 @@ int virtio_save(VirtIODevice *vdev, QEMUFile *f)
     uint32_t guest_features_lo = (vdev->guest_features & 0xffffffff);
     int i;
 
+    /* Before saving the ISR and the MSI-X pending bits */
+    virtio_irq_coalesce_flush_all(vdev);
+
     if (k->save_config) {
         k->save_config(qbus->parent, f);
     }
@@ -3440,7 +3914,7 @@ static int virtio_vmstate_change(void *opaque, bool running, RunState state)
     BusState *qbus = qdev_get_parent_bus(DEVICE(vdev));
     VirtioBusClass *k = VIRTIO_BUS_GET_CLASS(qbus);
     bool backend_run = running && virtio_device_started(vdev, vdev->status);
-    vdev->vm_running = running;
+    qatomic_set(&vdev->vm_running, running);
 
     if (backend_run) {
         virtio_set_status(vdev, vdev->status);
@@ -3450,6 +3924,11 @@ static int virtio_vmstate_change(void *opaque, bool running, RunState state)
         k->vmstate_change(qbus->parent, backend_run);
     }
 
+    /* Pending interrupts are not migrated */
+    if (!running) {
+        virtio_irq_coalesce_flush_all(vdev);
+    }
+
     if (!backend_run) {
         int ret = virtio_set_status(vdev, vdev->status);
         if (ret) {
@@ -3498,7 +3977,10 @@ void virtio_init(VirtIODevice *vdev, uint16_t device_id, size_t config_size)
         vdev->vq[i].vdev = vdev;
         vdev->vq[i].queue_index = i;
         vdev->vq[i].host_notifier_enabled = false;
+        qemu_spin_init(&vdev->vq[i].iova_cache.lock);
+        qemu_spin_init(&vdev->vq[i].irq_lock);
     }
+    QLIST_INIT(&vdev->iova_notifiers);
 
     vdev->name = virtio_id_to_name(device_id);
     vdev->config_len = config_size;
@@ -3948,6 +4430,111 @@ static void virtio_memory_listener_commit(MemoryListener *listener)
         }
         virtio_init_region_cache(vdev, i);
     }
+
+    /*
+     * The commit callback runs for changes to any address space, including
+     * the ones that the IOMMU translates to.
+     */
+    virtio_iova_cache_invalidate(vdev, 0, HWADDR_MAX);
+}
+
+static void virtio_iova_cache_update_active(VirtIODevice *vdev)
+{
+    qatomic_set(&vdev->iova_cache_active,
+                !QLIST_EMPTY(&vdev->iova_notifiers) &&
+                !vdev->iova_cache_failed);
+}
+
+static void virtio_iova_cache_unmap_notify(IOMMUNotifier *n,
+                                           IOMMUTLBEntry *iotlb)
+{
+    VirtIOIOVANotifier *notifier = container_of(n, VirtIOIOVANotifier, n);
+    hwaddr iova = iotlb->iova + notifier->iommu_offset;
+
+    virtio_iova_cache_invalidate(notifier->vdev, iova,
+                                 iova + iotlb->addr_mask);
+}
+
+static void virtio_memory_listener_region_add(MemoryListener *listener,
+                                              MemoryRegionSection *section)
+{
+    VirtIODevice *vdev = container_of(listener, VirtIODevice, listener);
+    VirtIOIOVANotifier *notifier;
+    IOMMUMemoryRegion *iommu_mr;
+    Error *local_err = NULL;
+    bool notifies_unmap = false;
+    Int128 end;
+    int iommu_idx;
+
+    if (!vdev->iova_cache || xen_enabled() ||
+        !memory_region_is_iommu(section->mr)) {
+        return;
+    }
+
+    iommu_mr = IOMMU_MEMORY_REGION(section->mr);
+
+    /*
+     * Some IOMMUs, such as amd-iommu, accept UNMAP notifiers but never call
+     * them.  Only trust the ones that say they notify the ranges that the
+     * guest unmaps.
+     */
+    if (memory_region_iommu_get_attr(iommu_mr, IOMMU_ATTR_NOTIFIES_UNMAP,
+                                     &notifies_unmap) || !notifies_unmap) {
+        trace_virtio_iova_cache_disabled(vdev,
+                                         "IOMMU does not notify unmaps");
+        vdev->iova_cache_failed = true;
+        virtio_iova_cache_update_active(vdev);
+        return;
+    }
+
+    notifier = g_new0(VirtIOIOVANotifier, 1);
+    end = int128_add(int128_make64(section->offset_within_region),
+                     section->size);
+    end = int128_sub(end, int128_one());
+    iommu_idx = memory_region_iommu_attrs_to_index(iommu_mr,
+                                                   MEMTXATTRS_UNSPECIFIED);
+    iommu_notifier_init(&notifier->n, virtio_iova_cache_unmap_notify,
+                        IOMMU_NOTIFIER_UNMAP, section->offset_within_region,
+                        int128_get64(end), iommu_idx);
+    notifier->mr = section->mr;
+    notifier->iommu_offset = section->offset_within_address_space -
+                             section->offset_within_region;
+    notifier->vdev = vdev;
+
+    if (memory_region_register_iommu_notifier(section->mr, &notifier->n,
+                                              &local_err)) {
+        /* Without notifications, the cache could not be kept coherent */
+        trace_virtio_iova_cache_disabled(vdev, error_get_pretty(local_err));
+        error_free(local_err);
+        g_free(notifier);
+        vdev->iova_cache_failed = true;
+    } else {
+        QLIST_INSERT_HEAD(&vdev->iova_notifiers, notifier, next);
+    }
+    virtio_iova_cache_update_active(vdev);
+}
+
+static void virtio_memory_listener_region_del(MemoryListener *listener,
+                                              MemoryRegionSection *section)
+{
+    VirtIODevice *vdev = container_of(listener, VirtIODevice, listener);
+    VirtIOIOVANotifier *notifier;
+
+    if (!memory_region_is_iommu(section->mr)) {
+        return;
+    }
+
+    QLIST_FOREACH(notifier, &vdev->iova_notifiers, next) {
+        if (notifier->mr == section->mr &&
+            notifier->n.start == section->offset_within_region) {
+            memory_region_unregister_iommu_notifier(notifier->mr,
+                                                    &notifier->n);
+            QLIST_REMOVE(notifier, next);
+            g_free(notifier);
+            break;
+        }
+    }
+    virtio_iova_cache_update_active(vdev);
 }
 
 static void virtio_device_realize(DeviceState *dev, Error **errp)
@@ -3983,6 +4570,8 @@ static void virtio_device_realize(DeviceState *dev, Error **errp)
     }
 
     vdev->listener.commit = virtio_memory_listener_commit;
+    vdev->listener.region_add = virtio_memory_listener_region_add;
+    vdev->listener.region_del = virtio_memory_listener_region_del;
     vdev->listener.name = "virtio";
     memory_listener_register(&vdev->listener, vdev->dma_as);
 }
@@ -3991,14 +4580,21 @@ static void virtio_device_unrealize(DeviceState *dev)
 {
     VirtIODevice *vdev = VIRTIO_DEVICE(dev);
     VirtioDeviceClass *vdc = VIRTIO_DEVICE_GET_CLASS(dev);
+    int i;
 
     memory_listener_unregister(&vdev->listener);
+    vdev->iova_cache_failed = false;
+    virtio_iova_cache_invalidate(vdev, 0, HWADDR_MAX);
     virtio_bus_device_unplugged(vdev);
 
     if (vdc->unrealize != NULL) {
         vdc->unrealize(dev);
     }
 
+    for (i = 0; i < VIRTIO_QUEUE_MAX; i++) {
+        virtqueue_irq_coalesce_cleanup(&vdev->vq[i]);
+    }
+
     g_free(vdev->bus_name);
     vdev->bus_name = NULL;
 }
@@ -4035,6 +4631,11 @@ static const Property virtio_properties[] = {
     DEFINE_PROP_BOOL("use-disabled-flag", VirtIODevice, use_disabled_flag, true),
     DEFINE_PROP_BOOL("x-disable-legacy-check", VirtIODevice,
                      disable_legacy_check, false),
+    DEFINE_PROP_BOOL("x-iova-cache", VirtIODevice, iova_cache, true),
+    DEFINE_PROP_UINT32("irq-coalesce-usecs", VirtIODevice,
+                       irq_coalesce_usecs, 0),
+    DEFINE_PROP_UINT32("irq-coalesce-max", VirtIODevice,
+                       irq_coalesce_max, 0),
 };
 
 static int virtio_device_start_ioeventfd_impl(VirtIODevice *vdev)
@@ -58,6 +58,44 @@ struct ThreadPoolAio;
 struct LinuxAioState;
 typedef struct LuringState LuringState;
 
+/*
+ * io_uring ring setup flags.  An AioContext has a separate ring for each
+ * combination of flags that is in use.
+ */
+typedef enum {
+    /* A kernel thread polls the submission queue */
+    LURING_SETUP_SQPOLL = 1 << 0,
+    /* Busy-poll for completions, only for O_DIRECT reads and writes */
+    LURING_SETUP_IOPOLL = 1 << 1,
+    /*
+     * Do not share the fd monitoring ring of the AioContext, see
+     * aio_add_sqe().  Implied by the other flags.
+     */
+    LURING_SETUP_OWN_RING = 1 << 2,
+    LURING_SETUP_MAX    = 1 << 3,
+} LuringSetupFlags;
+
+#ifdef CONFIG_LINUX_IO_URING
+/*
+ * A user-defined io_uring request on the AioContext's fd monitoring ring, see
+ * aio_add_sqe().
+ */
+typedef struct CqeHandler CqeHandler;
+typedef void CqeHandlerFunc(CqeHandler *cqe_handler);
+
+struct CqeHandler {
+    /* Called by aio_poll() once the request has completed */
+    CqeHandlerFunc *cb;
+
+    /* Copy of the cqe, filled in before cb is called */
+    struct io_uring_cqe cqe;
+
+    QSIMPLEQ_ENTRY(CqeHandler) next;
+};
+
+typedef QSIMPLEQ_HEAD(, CqeHandler) CqeHandlerSimpleQ;
+#endif /* CONFIG_LINUX_IO_URING */
+
 /* Is polling disabled? */
 bool aio_poll_disabled(AioContext *ctx);
 
@@ -106,6 +144,19 @@ typedef struct {
      * Returns: true if ->wait() should be called, false otherwise.
      */
     bool (*need_wait)(AioContext *ctx);
+
+    /*
+     * dispatch:
+     * @ctx: the AioContext
+     *
+     * Run completion callbacks for requests that are not AioHandlers, after
+     * ->wait() has collected them.  May be NULL.
+     *
+     * Called with ctx->list_lock incremented but not locked.
+     *
+     * Returns: true if progress was made.
+     */
+    bool (*dispatch)(AioContext *ctx);
 } FDMonOps;
 
 /*
@@ -208,6 +259,8 @@ struct AioContext {
 
     int thread_pool_min;
     int thread_pool_max;
+    /* Creates the thread pool's workers, if non-NULL.  Holds a reference.  */
+    struct ThreadContext *thread_pool_context;
     /* Thread pool for performing work and receiving completion callbacks.
      * Has its own locking.
      */
@@ -217,11 +270,18 @@ struct AioContext {
     struct LinuxAioState *linux_aio;
 #endif
 #ifdef CONFIG_LINUX_IO_URING
-    LuringState *linux_io_uring;
+    LuringState *linux_io_uring[LURING_SETUP_MAX];
 
     /* State for file descriptor monitoring using Linux io_uring */
     struct io_uring fdmon_io_uring;
     AioHandlerSList submit_list;
+
+    /*
+     * Requests added with aio_add_sqe().  Only accessed from the AioContext
+     * home thread.
+     */
+    unsigned cqe_handlers_in_flight;
+    CqeHandlerSimpleQ cqe_handler_ready_list;
 #endif
 
     /* TimerLists for calling timers - one per clock type.  Has its own
@@ -512,11 +572,62 @@ struct LinuxAioState *aio_setup_linux_aio(AioContext *ctx, Error **errp);
 /* Return the LinuxAioState bound to this AioContext */
 struct LinuxAioState *aio_get_linux_aio(AioContext *ctx);
 
-/* Setup the LuringState bound to this AioContext */
-LuringState *aio_setup_linux_io_uring(AioContext *ctx, Error **errp);
+/*
+ * Setup the LuringState bound to this AioContext for the given
+ * LURING_SETUP_* flags
+ */
+LuringState *aio_setup_linux_io_uring(AioContext *ctx, unsigned setup_flags,
+                                      Error **errp);
+
+/*
+ * Return the LuringState bound to this AioContext for the given
+ * LURING_SETUP_* flags
+ */
+LuringState *aio_get_linux_io_uring(AioContext *ctx, unsigned setup_flags);
+
+#ifdef CONFIG_LINUX_IO_URING
+/**
+ * aio_has_io_uring:
+ * @ctx: the AioContext
+ *
+ * Returns: true if @ctx monitors file descriptors with io_uring, so that
+ * aio_add_sqe() can be used.
+ */
+bool aio_has_io_uring(AioContext *ctx);
+
+/**
+ * aio_add_sqe:
+ * @ctx: the AioContext, must be the current thread's AioContext
+ * @prep_sqe: fills in the sqe
+ * @opaque: argument for @prep_sqe
+ * @cqe_handler: called with the cqe when the request completes
+ *
+ * Add a request to the io_uring ring that @ctx uses for file descriptor
+ * monitoring.  It is submitted together with fd monitoring changes and the
+ * timer deadline by the next io_uring_enter(2) call in aio_poll(), and
+ * @cqe_handler->cb is called from aio_poll() once it completes.
+ *
+ * @prep_sqe must not call io_uring_sqe_set_data() because user_data
+ * identifies @cqe_handler.  @cqe_handler must stay valid until its callback
+ * runs.
+ *
+ * May only be called if aio_has_io_uring() returns true.
+ */
+void aio_add_sqe(AioContext *ctx,
+                 void (*prep_sqe)(struct io_uring_sqe *sqe, void *opaque),
+                 void *opaque, CqeHandler *cqe_handler);
 
-/* Return the LuringState bound to this AioContext */
-LuringState *aio_get_linux_io_uring(AioContext *ctx);
+/**
+ * aio_drain_sqes:
+ * @ctx: the AioContext, must be the current thread's AioContext unless no
+ *       requests are in flight
+ *
+ * Wait for all requests added with aio_add_sqe() to complete, including
+ * requests added by their completion callbacks.  Only completion callbacks
+ * run, file descriptor handlers, bottom halves and timers do not.
+ */
+void aio_drain_sqes(AioContext *ctx);
+#endif /* CONFIG_LINUX_IO_URING */
 /**
  * aio_timer_new_with_attrs:
  * @ctx: the aio context
@@ -724,4 +835,15 @@ void aio_context_set_aio_params(AioContext *ctx, int64_t max_batch);
  */
 void aio_context_set_thread_pool_params(AioContext *ctx, int64_t min,
                                         int64_t max, Error **errp);
+
+/**
+ * aio_context_set_thread_pool_context:
+ * @ctx: the aio context
+ * @tc: thread context used to create worker threads, or NULL
+ *
+ * Worker threads created from now on inherit the CPU and NUMA node affinity
+ * of @tc.
+ */
+void aio_context_set_thread_pool_context(AioContext *ctx,
+                                         struct ThreadContext *tc);
 #endif
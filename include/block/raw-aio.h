@@ -74,16 +74,25 @@ static inline bool laio_has_fua(void)
 #endif
 /* io_uring.c - Linux io_uring implementation */
 #ifdef CONFIG_LINUX_IO_URING
-LuringState *luring_init(Error **errp);
+LuringState *luring_init(AioContext *ctx, unsigned setup_flags, Error **errp);
 void luring_cleanup(LuringState *s);
 
-/* luring_co_submit: submit I/O requests in the thread's current AioContext. */
+/*
+ * luring_co_submit: submit I/O requests in the thread's current AioContext,
+ * using the ring for the given LURING_SETUP_* flags.  Without flags, the ring
+ * that the AioContext uses for fd monitoring is shared if there is one.
+ */
 int coroutine_fn luring_co_submit(BlockDriverState *bs, int fd, uint64_t offset,
                                   QEMUIOVector *qiov, int type,
-                                  BdrvRequestFlags flags);
+                                  BdrvRequestFlags flags, unsigned setup_flags,
+                                  uint64_t dev_max_batch);
 void luring_detach_aio_context(LuringState *s, AioContext *old_context);
 void luring_attach_aio_context(LuringState *s, AioContext *new_context);
 bool luring_has_fua(void);
+
+/* Fixed buffers registered with all rings, see BDRV_REQ_REGISTERED_BUF */
+bool luring_register_buf(void *host, size_t size, Error **errp);
+void luring_unregister_buf(void *host, size_t size);
 #else
 static inline bool luring_has_fua(void)
 {
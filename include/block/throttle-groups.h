@@ -51,7 +51,8 @@ typedef struct ThrottleGroupMember {
 
     /* The following fields are protected by the ThrottleGroup lock.
      * See the ThrottleGroup documentation for details.
-     * throttle_state tells us if I/O limits are configured. */
+     * throttle_state tells us if I/O limits are configured.
+     * pending_reqs is also read with atomic operations outside the lock. */
     ThrottleState *throttle_state;
     ThrottleTimers throttle_timers;
     unsigned       pending_reqs[THROTTLE_MAX];
@@ -452,6 +452,8 @@ struct qemu_work_item;
  *    ring is enabled.
  * @kvm_fetch_index: Keeps the index that we last fetched from the per-vCPU
  *    dirty ring structure.
+ * @kvm_dirty_ring_full_exits: Number of times this CPU exited to userspace
+ *    because its KVM dirty ring was full.
  *
  * @neg_align: The CPUState is the common part of a concrete ArchCPU
  * which is allocated when an individual CPU instance is created. As
@@ -536,6 +538,7 @@ struct CPUState {
     struct kvm_dirty_gfn *kvm_dirty_gfns;
     uint32_t kvm_fetch_index;
     uint64_t dirty_pages;
+    uint64_t kvm_dirty_ring_full_exits;
     int kvm_vcpu_stats_fd;
     bool vcpu_dirty;
 
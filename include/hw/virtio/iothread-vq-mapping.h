@@ -11,6 +11,19 @@
 
 #include "qapi/error.h"
 #include "qapi/qapi-types-virtio.h"
+#include "qemu/stats64.h"
+
+/*
+ * Load of a virtqueue, updated by its AioContext and read by the main loop
+ * when rebalancing.
+ */
+typedef struct IOThreadVirtQueueLoad {
+    Stat64 requests;
+    Stat64 busy_ns;
+
+    /* Value of busy_ns at the previous rebalancing, BQL held */
+    uint64_t last_busy_ns;
+} IOThreadVirtQueueLoad;
 
 /**
  * iothread_vq_mapping_apply:
@@ -42,4 +55,140 @@ bool iothread_vq_mapping_apply(
  */
 void iothread_vq_mapping_cleanup(IOThreadVirtQueueMappingList *list);
 
+/**
+ * iothread_vq_mapping_get_aio_context:
+ * @list: The mapping of virtqueues to IOThreads.
+ * @iothread: The id of an IOThread.
+ * @errp: If an error occurs, a pointer to the area to store the error.
+ *
+ * Virtqueues can only be moved between the IOThreads in @list, because
+ * iothread_vq_mapping_apply() holds references to them.
+ *
+ * Returns: the AioContext of @iothread, or %NULL if it is not in @list.
+ */
+AioContext *iothread_vq_mapping_get_aio_context(
+        IOThreadVirtQueueMappingList *list,
+        const char *iothread,
+        Error **errp);
+
+/*
+ * Virtqueues are only moved while the busiest and the least busy IOThread
+ * differ by more than this percentage of the average load, so that noise
+ * does not make them bounce back and forth.
+ */
+#define IOTHREAD_VQ_REBALANCE_SLACK 25
+
+/**
+ * iothread_vq_rebalance_loads:
+ * @iothread_load: The load of each IOThread.
+ * @num_iothreads: The length of @iothread_load.
+ * @vq_load: The load of each virtqueue.
+ * @vq_iothread: The index in @iothread_load of the IOThread of each virtqueue.
+ * @num_queues: The length of @vq_load and @vq_iothread.
+ *
+ * The algorithm behind iothread_vq_mapping_rebalance(), which does not need
+ * IOThreads.  Move virtqueues from the busiest IOThreads to the least busy
+ * ones, updating @vq_iothread and @iothread_load.  At most @num_iothreads
+ * virtqueues are moved, and only those that lower the peak load of the two
+ * IOThreads.
+ *
+ * Returns: the number of virtqueues that were moved.
+ */
+static inline unsigned iothread_vq_rebalance_loads(
+        uint64_t *iothread_load,
+        size_t num_iothreads,
+        const uint64_t *vq_load,
+        unsigned *vq_iothread,
+        uint16_t num_queues)
+{
+    uint64_t total = 0;
+    unsigned moved = 0;
+
+    for (size_t j = 0; j < num_iothreads; j++) {
+        total += iothread_load[j];
+    }
+
+    /* Each iteration moves one virtqueue from the busiest IOThread */
+    while (num_iothreads > 1 && moved < num_iothreads) {
+        unsigned busiest = 0, idlest = 0;
+        uint64_t best_peak;
+        int best = -1;
+
+        for (unsigned j = 1; j < num_iothreads; j++) {
+            if (iothread_load[j] > iothread_load[busiest]) {
+                busiest = j;
+            }
+            if (iothread_load[j] < iothread_load[idlest]) {
+                idlest = j;
+            }
+        }
+
+        if ((iothread_load[busiest] - iothread_load[idlest]) * 100 <=
+            total / num_iothreads * IOTHREAD_VQ_REBALANCE_SLACK) {
+            break;
+        }
+
+        /* Pick the virtqueue that leaves the lower peak between the two */
+        best_peak = iothread_load[busiest];
+        for (uint16_t i = 0; i < num_queues; i++) {
+            uint64_t peak;
+
+            if (vq_iothread[i] != busiest || !vq_load[i]) {
+                continue;
+            }
+            peak = MAX(iothread_load[busiest] - vq_load[i],
+                       iothread_load[idlest] + vq_load[i]);
+            if (peak < best_peak) {
+                best = i;
+                best_peak = peak;
+            }
+        }
+        if (best < 0) {
+            break;
+        }
+
+        iothread_load[busiest] -= vq_load[best];
+        iothread_load[idlest] += vq_load[best];
+        vq_iothread[best] = idlest;
+        moved++;
+    }
+
+    return moved;
+}
+
+/**
+ * iothread_vq_mapping_rebalance:
+ * @list: The mapping of virtqueues to IOThreads.
+ * @vq_aio_context: The array of AioContext pointers to update.
+ * @vq_load: The load counters of each virtqueue.
+ * @num_queues: The length of @vq_aio_context and @vq_load.
+ *
+ * Look at the time that each virtqueue kept its IOThread busy since the
+ * previous call, and move virtqueues from the busiest IOThreads to the
+ * least busy ones in @vq_aio_context.  Nothing is moved if the load is
+ * already even enough.
+ *
+ * Returns: the number of virtqueues that were moved.
+ */
+unsigned iothread_vq_mapping_rebalance(
+        IOThreadVirtQueueMappingList *list,
+        AioContext **vq_aio_context,
+        IOThreadVirtQueueLoad *vq_load,
+        uint16_t num_queues);
+
+/**
+ * iothread_vq_mapping_query:
+ * @list: The mapping of virtqueues to IOThreads.
+ * @vq_aio_context: The AioContext of each virtqueue.
+ * @vq_load: The load counters of each virtqueue.
+ * @num_queues: The length of @vq_aio_context and @vq_load.
+ *
+ * Returns: the current assignment of virtqueues to IOThreads, for QMP.
+ */
+VirtQueueIOThreadList *iothread_vq_mapping_query(
+        IOThreadVirtQueueMappingList *list,
+        AioContext **vq_aio_context,
+        IOThreadVirtQueueLoad *vq_load,
+        uint16_t num_queues);
+
 #endif /* HW_VIRTIO_IOTHREAD_VQ_MAPPING_H */
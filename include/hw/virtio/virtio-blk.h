@@ -22,6 +22,7 @@
 #include "system/block-ram-registrar.h"
 #include "qom/object.h"
 #include "qapi/qapi-types-virtio.h"
+#include "hw/virtio/iothread-vq-mapping.h"
 
 #define TYPE_VIRTIO_BLK "virtio-blk-device"
 OBJECT_DECLARE_TYPE(VirtIOBlock, VirtIOBlkClass, VIRTIO_BLK)
@@ -39,6 +40,7 @@ struct VirtIOBlkConf
     BlockConf conf;
     IOThread *iothread;
     IOThreadVirtQueueMappingList *iothread_vq_mapping_list;
+    uint32_t iothread_vq_rebalance_ms;
     char *serial;
     uint32_t request_merging;
     uint16_t num_queues;
@@ -71,6 +73,10 @@ struct VirtIOBlock {
      */
     AioContext **vq_aio_context;
 
+    /* Load of each virtqueue, and timer for iothread-vq-mapping rebalancing */
+    IOThreadVirtQueueLoad *vq_load;
+    QEMUTimer *rebalance_timer;
+
     uint64_t host_features;
     size_t config_size;
     BlockRAMRegistrar blk_ram_registrar;
@@ -17,6 +17,7 @@
 
 #include "hw/pci/msi.h"
 #include "hw/virtio/virtio-bus.h"
+#include "qemu/thread.h"
 #include "qom/object.h"
 
 
@@ -42,6 +43,7 @@ enum {
     VIRTIO_PCI_FLAG_AER_BIT,
     VIRTIO_PCI_FLAG_ATS_PAGE_ALIGNED_BIT,
     VIRTIO_PCI_FLAG_PM_NO_SOFT_RESET_BIT,
+    VIRTIO_PCI_FLAG_LOCKLESS_IO_BIT,
 };
 
 /* Need to activate work-arounds for buggy guests at vmstate load. */
@@ -86,6 +88,9 @@ enum {
 #define VIRTIO_PCI_FLAG_ATS_PAGE_ALIGNED \
   (1 << VIRTIO_PCI_FLAG_ATS_PAGE_ALIGNED_BIT)
 
+/* Dispatch common config, ISR and device config accesses without the BQL */
+#define VIRTIO_PCI_FLAG_LOCKLESS_IO (1 << VIRTIO_PCI_FLAG_LOCKLESS_IO_BIT)
+
 typedef struct {
     MSIMessage msg;
     int virq;
@@ -161,6 +166,19 @@ struct VirtIOPCIProxy {
     uint32_t guest_features[2];
     VirtIOPCIQueue vqs[VIRTIO_QUEUE_MAX];
 
+    /*
+     * The common config, ISR and device config regions are dispatched
+     * without the BQL.  Their callbacks hold lock, which protects the
+     * fields above and the queue selector and vectors of the device.  Code
+     * that changes them with the BQL held, such as reset, takes it too.
+     * The BQL must be taken first.
+     */
+    QemuRecMutex lock;
+    /* Protected by lock */
+    bool plugged;
+    /* get_config of the device does not need the BQL */
+    bool lockless_config;
+
     VirtIOIRQFD *vector_irqfd;
     int nvqs_with_notifiers;
     VirtioBusState bus;
@@ -19,10 +19,12 @@
 #include "net/net.h"
 #include "migration/vmstate.h"
 #include "qemu/event_notifier.h"
+#include "qemu/stats64.h"
 #include "standard-headers/linux/virtio_config.h"
 #include "standard-headers/linux/virtio_ring.h"
 #include "qom/object.h"
 #include "block/aio.h"
+#include "qapi/qapi-types-virtio.h"
 
 /*
  * A guest should never accept this. It implies negotiation is broken
@@ -59,6 +61,7 @@ size_t virtio_get_config_size(const VirtIOConfigSizeParams *params,
                               uint64_t host_features);
 
 typedef struct VirtQueue VirtQueue;
+typedef struct VirtIOIOVANotifier VirtIOIOVANotifier;
 
 #define VIRTQUEUE_MAX_SIZE 1024
 
@@ -71,6 +74,8 @@ typedef struct VirtQueueElement
     unsigned int in_num;
     /* Element has been processed (VIRTIO_F_IN_ORDER) */
     bool in_order_filled;
+    /* Allocation size if from qemu_slab_alloc(), 0 if from g_malloc() */
+    size_t slab_size;
     hwaddr *in_addr;
     hwaddr *out_addr;
     struct iovec *in_sg;
@@ -167,6 +172,28 @@ struct VirtIODevice
      */
     EventNotifier config_notifier;
     bool device_iotlb_enabled;
+    /**
+     * @iova_cache: cache IOMMU translations in each virtqueue.  The cache
+     * is active while IOMMU unmap notifiers are registered for all IOMMU
+     * regions of @dma_as, and all of them have IOMMU_ATTR_NOTIFIES_UNMAP
+     * set.  @iova_cache_nvqs is the number of virtqueues
+     * that may have cached translations.
+     */
+    bool iova_cache;
+    bool iova_cache_active;
+    bool iova_cache_failed;
+    unsigned int iova_cache_nvqs;
+    QLIST_HEAD(, VirtIOIOVANotifier) iova_notifiers;
+    /**
+     * @irq_coalesce_usecs: maximum delay of a virtqueue interrupt, 0 to
+     * send it at the end of the AioContext iteration
+     * @irq_coalesce_max: send the interrupt once this many notifications
+     * are pending, 0 for no limit
+     * @irq_coalesced: number of interrupts that were merged into another
+     */
+    uint32_t irq_coalesce_usecs;
+    uint32_t irq_coalesce_max;
+    Stat64 irq_coalesced;
 };
 
 struct VirtioDeviceClass {
@@ -228,6 +255,24 @@ struct VirtioDeviceClass {
     /* May be called even when vdev->vhost_started is false */
     struct vhost_dev *(*get_vhost)(VirtIODevice *vdev);
     void (*toggle_device_iotlb)(VirtIODevice *vdev);
+    /* For devices with the iothread-vq-mapping property.  BQL held. */
+    VirtQueueIOThreadList *(*query_vq_iothreads)(VirtIODevice *vdev,
+                                                 Error **errp);
+    bool (*set_vq_iothread)(VirtIODevice *vdev, uint16_t queue,
+                            const char *iothread, Error **errp);
+    /*
+     * Set if the device releases all elements returned by virtqueue_pop()
+     * and qemu_get_virtqueue_element() with virtqueue_element_free().  The
+     * elements then come from the per-thread caches of qemu/slab.h instead
+     * of g_malloc().
+     */
+    bool slab_elements;
+    /*
+     * Set if get_config does not need the BQL: it only reads state that
+     * does not change after realize, or that only set_config and reset
+     * change.  Transports serialize it against those.
+     */
+    bool lockless_get_config;
 };
 
 void virtio_instance_init_common(Object *proxy_obj, void *data,
@@ -270,6 +315,7 @@ void virtqueue_fill(VirtQueue *vq, const VirtQueueElement *elem,
 
 void virtqueue_map(VirtIODevice *vdev, VirtQueueElement *elem);
 void *virtqueue_pop(VirtQueue *vq, size_t sz);
+void virtqueue_element_free(void *elem);
 unsigned int virtqueue_drop_all(VirtQueue *vq);
 void *qemu_get_virtqueue_element(VirtIODevice *vdev, QEMUFile *f, size_t sz);
 void qemu_put_virtqueue_element(VirtIODevice *vdev, QEMUFile *f,
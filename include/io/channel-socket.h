@@ -49,6 +49,7 @@ struct QIOChannelSocket {
     socklen_t remoteAddrLen;
     ssize_t zero_copy_queued;
     ssize_t zero_copy_sent;
+    bool zero_copy_used;
 };
 
 
@@ -95,6 +96,40 @@ int qio_channel_socket_connect_sync(QIOChannelSocket *ioc,
                                     SocketAddress *addr,
                                     Error **errp);
 
+/**
+ * qio_channel_socket_set_zero_copy:
+ * @ioc: the socket channel object
+ * @errp: pointer to a NULL-initialized error object
+ *
+ * Enable MSG_ZEROCOPY transmission on the connected socket
+ * @ioc, for example one returned by qio_channel_socket_accept().
+ * On success the channel reports the
+ * QIO_CHANNEL_FEATURE_WRITE_ZERO_COPY feature, and callers may
+ * pass QIO_CHANNEL_WRITE_FLAG_ZERO_COPY to qio_channel_writev_full().
+ *
+ * Returns: 0 on success, -1 if the host or socket type does not
+ * support zero copy transmission
+ */
+int qio_channel_socket_set_zero_copy(QIOChannelSocket *ioc,
+                                     Error **errp);
+
+/**
+ * qio_channel_socket_flush_nonblock:
+ * @ioc: the socket channel object
+ * @errp: pointer to a NULL-initialized error object
+ *
+ * Like qio_channel_flush(), but only reap the zero copy
+ * completions that are already available instead of waiting
+ * for the rest.  Completions reaped by an earlier call that
+ * returned QIO_CHANNEL_ERR_BLOCK still count towards the
+ * final result.
+ *
+ * Returns: QIO_CHANNEL_ERR_BLOCK if some zero copy sends have
+ * not completed yet, otherwise the same as qio_channel_flush()
+ */
+int qio_channel_socket_flush_nonblock(QIOChannelSocket *ioc,
+                                      Error **errp);
+
 /**
  * qio_channel_socket_connect_async:
  * @ioc: the socket channel object
@@ -22,6 +22,9 @@ int cpr_find_fd(const char *name, int id);
 MigMode cpr_get_incoming_mode(void);
 void cpr_set_incoming_mode(MigMode mode);
 bool cpr_is_incoming(void);
+bool cpr_is_clone(void);
+bool cpr_is_clone_template(void);
+bool cpr_mode_uses_channel(MigMode mode);
 
 int cpr_state_save(MigrationChannel *channel, Error **errp);
 int cpr_state_load(MigrationChannel *channel, Error **errp);
@@ -0,0 +1,35 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Histograms with power-of-two buckets
+ */
+
+#ifndef QEMU_LOG2_HISTOGRAM_H
+#define QEMU_LOG2_HISTOGRAM_H
+
+#include "qemu/host-utils.h"
+
+#define LOG2_HISTOGRAM_BUCKETS 40
+
+/*
+ * Bucket 0 counts zero values, bucket N counts values between 2^(N-1) and
+ * 2^N - 1, and the last bucket also counts larger ones.  Durations are
+ * recorded in nanoseconds, so the last bucket starts at about 4.5 minutes.
+ */
+typedef struct Log2Histogram {
+    uint64_t buckets[LOG2_HISTOGRAM_BUCKETS];
+} Log2Histogram;
+
+static inline void log2_histogram_add(Log2Histogram *hist, uint64_t value)
+{
+    hist->buckets[MIN(64 - clz64(value), LOG2_HISTOGRAM_BUCKETS - 1)]++;
+}
+
+static inline void log2_histogram_merge(Log2Histogram *dst,
+                                        const Log2Histogram *src)
+{
+    for (int i = 0; i < LOG2_HISTOGRAM_BUCKETS; i++) {
+        dst->buckets[i] += src->buckets[i];
+    }
+}
+
+#endif
@@ -26,6 +26,7 @@
 #define QEMU_MAIN_LOOP_H
 
 #include "block/aio.h"
+#include "qemu/log2-histogram.h"
 #include "qom/object.h"
 #include "system/event-loop-base.h"
 
@@ -365,6 +366,35 @@ void bql_lock_impl(const char *file, int line);
  */
 void bql_unlock(void);
 
+/*
+ * BQL statistics for the callers of bql_lock() at one source location.
+ * Wait times are only recorded when the lock could not be taken
+ * immediately.  Time spent waiting on a condition
+ * variable with the BQL released does not count as hold time.
+ */
+typedef struct BQLCallSiteStats {
+    const char *file;
+    int line;
+    uint64_t acquisitions;
+    uint64_t contended;         /* acquisitions that had to wait */
+    uint64_t wait_ns;
+    uint64_t max_wait_ns;
+    uint64_t hold_ns;
+    uint64_t max_hold_ns;
+    Log2Histogram wait_hist;
+    Log2Histogram hold_hist;
+} BQLCallSiteStats;
+
+/**
+ * bql_get_call_site_stats: Return a copy of the BQL statistics.
+ *
+ * @n: filled with the number of call sites
+ *
+ * Must be called with the BQL held.  The caller frees the array with
+ * g_free().
+ */
+BQLCallSiteStats *bql_get_call_site_stats(size_t *n);
+
 /**
  * BQL_LOCK_GUARD
  *
@@ -48,6 +48,7 @@ typedef enum {
     MODULE_INIT_XEN_BACKEND,
     MODULE_INIT_LIBQOS,
     MODULE_INIT_FUZZ_TARGET,
+    MODULE_INIT_STATS,
     MODULE_INIT_MAX
 } module_init_type;
 
@@ -61,6 +62,7 @@ typedef enum {
 #define fuzz_target_init(function) module_init(function, \
                                                MODULE_INIT_FUZZ_TARGET)
 #define migration_init(function) module_init(function, MODULE_INIT_MIGRATION)
+#define stats_init(function) module_init(function, MODULE_INIT_STATS)
 #define block_module_load(lib, errp) module_load("block-", lib, errp)
 #define ui_module_load(lib, errp) module_load("ui-", lib, errp)
 #define audio_module_load(lib, errp) module_load("audio-", lib, errp)
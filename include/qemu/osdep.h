@@ -735,6 +735,55 @@ bool qemu_prealloc_mem(int fd, char *area, size_t sz, int max_threads,
  */
 bool qemu_finish_async_prealloc_mem(Error **errp);
 
+typedef struct QemuPrefault QemuPrefault;
+
+/**
+ * qemu_prefault_mem_start:
+ * @fd: the fd mapped into the area, -1 for anonymous memory
+ * @area: start address of the area to prefault
+ * @sz: the size of the area to prefault
+ * @populate_read: populate the area for reading only.  Use it for private
+ *     file mappings, where write faults would replace the file pages with
+ *     private copies.
+ * @max_threads: maximum number of threads to use
+ * @tc: prealloc context threads pointer, NULL if not in use
+ * @errp: returns an error if this function fails
+ *
+ * Start populating the page tables of the area in background threads, like
+ * qemu_prealloc_mem() but without waiting for it to complete.  The memory
+ * can be used, including by a running guest, while it is being prefaulted.
+ * Parts of the area that were already accessed are populated first.
+ * Pages that were discarded before the threads reach them, for example by
+ * virtio-balloon, are populated again.
+ *
+ * Requires MADV_POPULATE_WRITE, or MADV_POPULATE_READ if @populate_read.
+ *
+ * Return: a handle that must be freed with qemu_prefault_mem_stop(), or
+ * NULL setting @errp with error.
+ */
+QemuPrefault *qemu_prefault_mem_start(int fd, char *area, size_t sz,
+                                      bool populate_read, int max_threads,
+                                      ThreadContext *tc, Error **errp);
+
+/**
+ * qemu_prefault_mem_progress:
+ * @pf: the prefault handle
+ * @populated: returns the number of bytes populated so far
+ * @error: returns a negative errno value if prefaulting failed, else 0
+ *
+ * Return: true if all threads have terminated.
+ */
+bool qemu_prefault_mem_progress(QemuPrefault *pf, uint64_t *populated,
+                                int *error);
+
+/**
+ * qemu_prefault_mem_stop:
+ * @pf: the prefault handle, or NULL
+ *
+ * Stop prefaulting, wait for the threads to terminate and free @pf.
+ */
+void qemu_prefault_mem_stop(QemuPrefault *pf);
+
 /**
  * qemu_get_pid_name:
  * @pid: pid of a process
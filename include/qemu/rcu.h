@@ -143,6 +143,22 @@ struct rcu_head {
 void call_rcu1(struct rcu_head *head, RCUCBFunc *func);
 void drain_call_rcu(void);
 
+/*
+ * Statistics for the call_rcu thread.  A batch collects the callbacks
+ * queued by all threads and waits for a single grace period.
+ */
+typedef struct RCUCallStats {
+    uint64_t pending;       /* callbacks waiting for the next batch */
+    uint64_t queues;        /* threads with a callback queue */
+    uint64_t callbacks;     /* callbacks run so far */
+    uint64_t batches;       /* batches (and grace periods) so far */
+    uint64_t max_batch;     /* largest batch so far */
+    uint64_t gp_ns_total;   /* total time spent waiting for grace periods */
+    uint64_t gp_ns_max;     /* longest grace period */
+} RCUCallStats;
+
+void rcu_call_get_stats(RCUCallStats *stats);
+
 /* The operands of the minus operator must have the same type,
  * which must be the one that we specify in the cast.
  */
@@ -0,0 +1,59 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Size-class allocator with per-thread caches
+ *
+ * For short-lived objects that are allocated and freed at high rates, such
+ * as virtqueue elements and the device requests that embed them.  Sizes are
+ * rounded up to a power of two between QEMU_SLAB_MIN_SIZE and
+ * QEMU_SLAB_MAX_SIZE; each thread keeps a small cache of free objects for
+ * every size class, and exchanges batches of them with a shared cache when
+ * its own runs empty or overflows.  An object can be freed by a different
+ * thread than the one that allocated it.
+ *
+ * Larger sizes go straight to g_malloc()/g_free().
+ */
+#ifndef QEMU_SLAB_H
+#define QEMU_SLAB_H
+
+#define QEMU_SLAB_MIN_SHIFT     8
+#define QEMU_SLAB_MAX_SHIFT     16
+#define QEMU_SLAB_MIN_SIZE      (1 << QEMU_SLAB_MIN_SHIFT)
+#define QEMU_SLAB_MAX_SIZE      (1 << QEMU_SLAB_MAX_SHIFT)
+#define QEMU_SLAB_CLASSES       (QEMU_SLAB_MAX_SHIFT - QEMU_SLAB_MIN_SHIFT + 1)
+
+/**
+ * qemu_slab_alloc:
+ * @size: number of bytes to allocate
+ *
+ * Allocate @size bytes with the same alignment as g_malloc().  Never
+ * returns NULL.  The memory must be released with qemu_slab_free() and
+ * the same @size.
+ */
+void *qemu_slab_alloc(size_t size);
+
+/**
+ * qemu_slab_free:
+ * @ptr: memory returned by qemu_slab_alloc(), or NULL
+ * @size: the size that was passed to qemu_slab_alloc()
+ */
+void qemu_slab_free(void *ptr, size_t size);
+
+typedef struct QemuSlabStats {
+    uint64_t size;          /* object size of the class */
+    uint64_t allocs;        /* objects allocated so far */
+    uint64_t frees;         /* objects freed so far */
+    uint64_t heap_allocs;   /* allocations that found all caches empty */
+    uint64_t heap_frees;    /* frees that found all caches full */
+    uint64_t cached;        /* free objects in the shared cache */
+} QemuSlabStats;
+
+/**
+ * qemu_slab_get_stats:
+ * @stats: array filled with the statistics of each size class
+ *
+ * Threads publish their allocation and free counts in batches, so
+ * the counts can lag behind by a few hundred objects per thread.
+ */
+void qemu_slab_get_stats(QemuSlabStats stats[QEMU_SLAB_CLASSES]);
+
+#endif
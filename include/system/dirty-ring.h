@@ -0,0 +1,79 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Dirty page rings for migration
+ *
+ * When enabled (with "-accel tcg,dirty-ring-size=N"), the first write to a
+ * page that is clean in the DIRTY_MEMORY_MIGRATION bitmap also appends the
+ * page to a ring owned by the writing thread.  Migration then only looks at
+ * the pages in the rings, instead of scanning the whole bitmap.
+ *
+ * The bitmap stays authoritative: whenever a dirty page might be missing
+ * from the rings, because a ring was full or because a large range was
+ * dirtied at once, the rings are marked incomplete and the next
+ * synchronization scans the bitmap as usual.
+ */
+
+#ifndef SYSTEM_DIRTY_RING_H
+#define SYSTEM_DIRTY_RING_H
+
+#include "system/memory.h"
+
+/* Number of pages in each ring, or 0 if the rings are disabled */
+extern uint32_t tcg_dirty_ring_size;
+
+typedef void DirtyRingFunc(unsigned long page, void *opaque);
+
+/**
+ * dirty_ring_init: enable the dirty rings
+ *
+ * @size: number of pages in each ring, a power of two
+ */
+void dirty_ring_init(uint32_t size);
+
+/**
+ * dirty_ring_active: whether writes to RAM are recorded in the rings
+ */
+static inline bool dirty_ring_active(void)
+{
+    return tcg_dirty_ring_size &&
+           (global_dirty_tracking & GLOBAL_DIRTY_MIGRATION);
+}
+
+/**
+ * dirty_ring_set_dirty: mark pages dirty for migration
+ *
+ * @bitmap: a block of the DIRTY_MEMORY_MIGRATION bitmap
+ * @offset: index of the first page in @bitmap
+ * @nr: number of pages
+ * @page: page number of the first page, i.e. its ram_addr_t shifted right
+ *        by TARGET_PAGE_BITS
+ *
+ * Set the bits of the pages in @bitmap, and add the pages that were clean
+ * to the ring of the current thread.
+ */
+void dirty_ring_set_dirty(unsigned long *bitmap, unsigned long offset,
+                          unsigned long nr, unsigned long page);
+
+/**
+ * dirty_ring_invalidate: make the next dirty_ring_collect() fail
+ *
+ * Call this after setting bits in the DIRTY_MEMORY_MIGRATION bitmap
+ * without going through dirty_ring_set_dirty().
+ */
+void dirty_ring_invalidate(void);
+
+/**
+ * dirty_ring_collect: empty the rings
+ *
+ * @func: called for every page in the rings
+ * @opaque: passed to @func
+ *
+ * Pages can be passed to @func more than once, and their bits in the
+ * bitmap may have been cleared since they were added to a ring.
+ *
+ * Returns false if pages may have been dirtied since the previous call
+ * without being added to a ring; the caller must then scan the bitmap.
+ */
+bool dirty_ring_collect(DirtyRingFunc *func, void *opaque);
+
+#endif
@@ -36,5 +36,9 @@ struct EventLoopBase {
     /* AioContext thread pool parameters */
     int64_t thread_pool_min;
     int64_t thread_pool_max;
+    struct ThreadContext *thread_pool_context;
+
+    /* Set once the event loop has been created */
+    bool initialized;
 };
 #endif
@@ -67,6 +67,9 @@ struct HostMemoryBackendClass {
  * @size: amount of memory backend provides
  * @mr: MemoryRegion representing host memory belonging to backend
  * @prealloc_threads: number of threads to be used for preallocatining RAM
+ * @prefault_job: background prefaulting, started when the guest first runs
+ * @prefault_timer: retries starting @prefault_job until incoming postcopy
+ * has completed
  */
 struct HostMemoryBackend {
     /* private */
@@ -79,6 +82,10 @@ struct HostMemoryBackend {
     bool guest_memfd, aligned;
     uint32_t prealloc_threads;
     ThreadContext *prealloc_context;
+    bool prefault, prefault_started;
+    QemuPrefault *prefault_job;
+    VMChangeStateEntry *prefault_vmse;
+    QEMUTimer *prefault_timer;
     DECLARE_BITMAP(host_nodes, MAX_NODES + 1);
     HostMemPolicy policy;
 
@@ -92,6 +99,7 @@ void host_memory_backend_set_mapped(HostMemoryBackend *backend, bool mapped);
 bool host_memory_backend_is_mapped(HostMemoryBackend *backend);
 size_t host_memory_backend_pagesize(HostMemoryBackend *memdev);
 char *host_memory_backend_get_name(HostMemoryBackend *backend);
+MemdevPrefault *host_memory_backend_query_prefault(HostMemoryBackend *backend);
 
 long qemu_minrampagesize(void);
 long qemu_maxrampagesize(void);
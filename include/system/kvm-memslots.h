@@ -0,0 +1,175 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * KVM memory slot bookkeeping
+ *
+ * Each KVMMemoryListener keeps the indices of its used slots in an array
+ * sorted by guest physical address, so that slots can be looked up with a
+ * binary search.  These helpers do not call into KVM and do not depend on
+ * the target, so that they can be unit tested.
+ */
+
+#ifndef SYSTEM_KVM_MEMSLOTS_H
+#define SYSTEM_KVM_MEMSLOTS_H
+
+#include "system/memory.h"
+#include "qemu/queue.h"
+
+typedef struct KVMSlot {
+    hwaddr start_addr;
+    ram_addr_t memory_size;
+    void *ram;
+    int slot;
+    int flags;
+    int old_flags;
+    /* Dirty bitmap cache for the slot */
+    unsigned long *dirty_bmap;
+    unsigned long dirty_bmap_size;
+    /* Cache of the address space ID */
+    int as_id;
+    /* Cache of the offset in ram address space */
+    ram_addr_t ram_start_offset;
+    int guest_memfd;
+    hwaddr guest_memfd_offset;
+} KVMSlot;
+
+typedef struct KVMMemoryUpdate {
+    QSIMPLEQ_ENTRY(KVMMemoryUpdate) next;
+    MemoryRegionSection section;
+} KVMMemoryUpdate;
+
+typedef QSIMPLEQ_HEAD(, KVMMemoryUpdate) KVMMemoryUpdateList;
+
+typedef struct KVMMemoryListener {
+    MemoryListener listener;
+    KVMSlot *slots;
+    unsigned int nr_slots_used;
+    unsigned int nr_slots_allocated;
+    /* Indices of the used slots, sorted by guest physical address */
+    unsigned int *slot_index;
+    /* All slots below this one are in use */
+    unsigned int free_slot_hint;
+    int as_id;
+    KVMMemoryUpdateList transaction_add;
+    KVMMemoryUpdateList transaction_del;
+} KVMMemoryListener;
+
+/*
+ * Called with KVMMemoryListener.slots_lock held.  Return the position in
+ * slot_index of the first used slot that starts at or above @start_addr.
+ */
+static inline unsigned int kvm_slot_index_find(KVMMemoryListener *kml,
+                                               hwaddr start_addr)
+{
+    unsigned int lo = 0, hi = kml->nr_slots_used;
+
+    while (lo < hi) {
+        unsigned int mid = lo + (hi - lo) / 2;
+
+        if (kml->slots[kml->slot_index[mid]].start_addr < start_addr) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+/* Called with KVMMemoryListener.slots_lock held, after registering @mem */
+static inline void kvm_slot_index_insert(KVMMemoryListener *kml,
+                                         KVMSlot *mem)
+{
+    unsigned int pos = kvm_slot_index_find(kml, mem->start_addr);
+
+    memmove(&kml->slot_index[pos + 1], &kml->slot_index[pos],
+            (kml->nr_slots_used - pos) * sizeof(kml->slot_index[0]));
+    kml->slot_index[pos] = mem->slot;
+    kml->nr_slots_used++;
+}
+
+/* Called with KVMMemoryListener.slots_lock held, before unregistering @mem */
+static inline void kvm_slot_index_remove(KVMMemoryListener *kml,
+                                         KVMSlot *mem)
+{
+    unsigned int pos = kvm_slot_index_find(kml, mem->start_addr);
+
+    assert(pos < kml->nr_slots_used && kml->slot_index[pos] == mem->slot);
+    kml->nr_slots_used--;
+    memmove(&kml->slot_index[pos], &kml->slot_index[pos + 1],
+            (kml->nr_slots_used - pos) * sizeof(kml->slot_index[0]));
+    kml->free_slot_hint = MIN(kml->free_slot_hint, mem->slot);
+}
+
+/* Called with KVMMemoryListener.slots_lock held */
+static inline KVMSlot *kvm_lookup_matching_slot(KVMMemoryListener *kml,
+                                                hwaddr start_addr,
+                                                hwaddr size)
+{
+    unsigned int pos = kvm_slot_index_find(kml, start_addr);
+    KVMSlot *mem;
+
+    if (pos == kml->nr_slots_used) {
+        return NULL;
+    }
+
+    mem = &kml->slots[kml->slot_index[pos]];
+    if (start_addr == mem->start_addr && size == mem->memory_size) {
+        return mem;
+    }
+
+    return NULL;
+}
+
+/*
+ * Return true if @old and @new cancel out.  The function then takes
+ * ownership of both updates.
+ */
+typedef bool KVMMemoryUpdateMergeFunc(KVMMemoryListener *kml,
+                                      KVMMemoryUpdate *old,
+                                      KVMMemoryUpdate *new);
+
+/*
+ * Pass each pair of a removed and an added section that start at the same
+ * address to @merge, and drop the pairs that it merged from the
+ * transaction.  The order of the other updates is preserved.
+ */
+static inline void kvm_memory_updates_merge(KVMMemoryListener *kml,
+                                            KVMMemoryUpdateMergeFunc *merge)
+{
+    KVMMemoryUpdateList del = QSIMPLEQ_HEAD_INITIALIZER(del);
+    KVMMemoryUpdateList add = QSIMPLEQ_HEAD_INITIALIZER(add);
+    KVMMemoryUpdate *u1, *u2;
+
+    QSIMPLEQ_CONCAT(&del, &kml->transaction_del);
+    QSIMPLEQ_CONCAT(&add, &kml->transaction_add);
+
+    /* Both lists are ordered by address */
+    while (!QSIMPLEQ_EMPTY(&del) && !QSIMPLEQ_EMPTY(&add)) {
+        u1 = QSIMPLEQ_FIRST(&del);
+        u2 = QSIMPLEQ_FIRST(&add);
+
+        if (u1->section.offset_within_address_space <
+            u2->section.offset_within_address_space) {
+            QSIMPLEQ_REMOVE_HEAD(&del, next);
+            QSIMPLEQ_INSERT_TAIL(&kml->transaction_del, u1, next);
+            continue;
+        }
+        if (u2->section.offset_within_address_space <
+            u1->section.offset_within_address_space) {
+            QSIMPLEQ_REMOVE_HEAD(&add, next);
+            QSIMPLEQ_INSERT_TAIL(&kml->transaction_add, u2, next);
+            continue;
+        }
+
+        QSIMPLEQ_REMOVE_HEAD(&del, next);
+        QSIMPLEQ_REMOVE_HEAD(&add, next);
+        if (!merge(kml, u1, u2)) {
+            QSIMPLEQ_INSERT_TAIL(&kml->transaction_del, u1, next);
+            QSIMPLEQ_INSERT_TAIL(&kml->transaction_add, u2, next);
+        }
+    }
+
+    QSIMPLEQ_CONCAT(&kml->transaction_del, &del);
+    QSIMPLEQ_CONCAT(&kml->transaction_add, &add);
+}
+
+#endif
@@ -17,40 +17,7 @@
 #include "hw/boards.h"
 #include "hw/i386/topology.h"
 #include "io/channel-socket.h"
-
-typedef struct KVMSlot
-{
-    hwaddr start_addr;
-    ram_addr_t memory_size;
-    void *ram;
-    int slot;
-    int flags;
-    int old_flags;
-    /* Dirty bitmap cache for the slot */
-    unsigned long *dirty_bmap;
-    unsigned long dirty_bmap_size;
-    /* Cache of the address space ID */
-    int as_id;
-    /* Cache of the offset in ram address space */
-    ram_addr_t ram_start_offset;
-    int guest_memfd;
-    hwaddr guest_memfd_offset;
-} KVMSlot;
-
-typedef struct KVMMemoryUpdate {
-    QSIMPLEQ_ENTRY(KVMMemoryUpdate) next;
-    MemoryRegionSection section;
-} KVMMemoryUpdate;
-
-typedef struct KVMMemoryListener {
-    MemoryListener listener;
-    KVMSlot *slots;
-    unsigned int nr_slots_used;
-    unsigned int nr_slots_allocated;
-    int as_id;
-    QSIMPLEQ_HEAD(, KVMMemoryUpdate) transaction_add;
-    QSIMPLEQ_HEAD(, KVMMemoryUpdate) transaction_del;
-} KVMMemoryListener;
+#include "system/kvm-memslots.h"
 
 #define KVM_MSI_HASHTAB_SIZE    256
 
@@ -99,7 +66,30 @@ struct KVMDirtyRingReaper {
     QemuThread reaper_thr;
     volatile uint64_t reaper_iteration; /* iteration number of reaper thr */
     volatile enum KVMDirtyRingReaperState reaper_state; /* reap thr state */
+    /* Reaps the rings of groups of vCPUs in parallel */
+    struct ThreadPool *pool;
+    /* Sleep time of the reaper thread, adapted to how full the rings get */
+    int64_t interval_ns;
+    /* Most pages found in one ring by the last reap */
+    uint32_t fill;
+    /* Value of full_exits when the reaper thread last woke up */
+    uint64_t last_full_exits;
+    /* Statistics, protected by the BQL */
+    uint64_t full_exits;        /* KVM_EXIT_DIRTY_RING_FULL exits */
+    uint64_t reaps;             /* KVM_RESET_DIRTY_RINGS calls */
+    uint64_t reaped_pages;
+    uint64_t max_fill;          /* most pages found in one ring */
 };
+
+/* Statistics of memslot updates, protected by the BQL */
+struct KVMMemslotStats {
+    uint64_t commits;           /* memory listener commits with changes */
+    uint64_t ioctls;            /* memslot and memory attribute ioctls */
+    uint64_t updates_in_place;  /* removed and re-added sections merged */
+    uint64_t commit_ns;
+    uint64_t max_commit_ns;
+};
+
 struct KVMState
 {
     AccelState parent_obj;
@@ -158,6 +148,7 @@ struct KVMState
     bool kvm_dirty_ring_with_bitmap;
     uint64_t kvm_eager_split_size;  /* Eager Page Splitting chunk size */
     struct KVMDirtyRingReaper reaper;
+    struct KVMMemslotStats memslot_stats;
     struct KVMMsrEnergy msr_energy;
     NotifyVmexitOption notify_vmexit;
     uint32_t notify_window;
@@ -0,0 +1,40 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Guest memory heat tracking
+ *
+ * While enabled with memory-heat-start, a thread periodically samples which
+ * parts of each RAMBlock the guest wrote, using the dirty log, and which it
+ * only read, using the page idle tracking of Linux.  Each chunk of guest
+ * memory gets a heat value between 0 and 255 that halves every period in
+ * which the chunk was not touched.
+ */
+
+#ifndef SYSTEM_MEMORY_HEAT_H
+#define SYSTEM_MEMORY_HEAT_H
+
+/* Heat values are grouped in buckets of this size for the histogram */
+#define MEMORY_HEAT_BUCKET_SIZE     32
+#define MEMORY_HEAT_BUCKETS         (256 / MEMORY_HEAT_BUCKET_SIZE)
+
+typedef struct MemoryHeatStats {
+    /* Number of periods sampled since memory-heat-start */
+    uint64_t samples;
+
+    /* Bytes written and accessed during the last period sampled */
+    uint64_t written_bytes;
+    uint64_t accessed_bytes;
+
+    /* Bytes of guest memory per bucket of heat values */
+    uint64_t heat_hist[MEMORY_HEAT_BUCKETS];
+} MemoryHeatStats;
+
+/**
+ * memory_heat_get_stats: summarize the heat of guest memory
+ *
+ * @stats: filled with the result of the last period sampled
+ *
+ * Returns false if memory heat tracking was never started.
+ */
+bool memory_heat_get_stats(MemoryHeatStats *stats);
+
+#endif
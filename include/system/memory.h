@@ -23,6 +23,7 @@
 #include "qemu/bswap.h"
 #include "qemu/queue.h"
 #include "qemu/int128.h"
+#include "qemu/log2-histogram.h"
 #include "qemu/range.h"
 #include "qemu/notify.h"
 #include "qom/object.h"
@@ -72,7 +73,10 @@ static inline void fuzz_dma_read_cb(size_t addr,
 /* Dirty tracking enabled because dirty limit */
 #define GLOBAL_DIRTY_LIMIT      (1U << 2)
 
-#define GLOBAL_DIRTY_MASK  (0x7)
+/* Dirty tracking enabled because guest memory heat is tracked */
+#define GLOBAL_DIRTY_HEAT       (1U << 3)
+
+#define GLOBAL_DIRTY_MASK  (0xf)
 
 extern unsigned int global_dirty_tracking;
 
@@ -295,6 +299,14 @@ struct MemoryRegionOps {
                                     unsigned size,
                                     MemTxAttrs attrs);
 
+    /*
+     * For regions set up with memory_region_enable_lockless_io().  If
+     * present, and returns #true, the access is dispatched with the BQL
+     * held.  If absent, no access needs the BQL.
+     */
+    bool (*needs_bql)(void *opaque, hwaddr addr, unsigned size,
+                      bool is_write);
+
     enum device_endian endianness;
     /* Guest-visible constraints: */
     struct {
@@ -340,7 +352,12 @@ typedef struct MemoryRegionClass {
 
 
 enum IOMMUMemoryRegionAttr {
-    IOMMU_ATTR_SPAPR_TCE_FD
+    IOMMU_ATTR_SPAPR_TCE_FD,
+    /*
+     * bool: the IOMMU sends IOMMU_NOTIFIER_UNMAP events whenever the guest
+     * invalidates a mapping, so that translations can be cached by devices
+     */
+    IOMMU_ATTR_NOTIFIES_UNMAP,
 };
 
 /*
@@ -775,6 +792,7 @@ struct MemoryRegion {
     bool nonvolatile;
     bool rom_device;
     bool flush_coalesced_mmio;
+    bool lockless_io;
     bool unmergeable;
     uint8_t dirty_log_mask;
     bool is_iommu;
@@ -2253,6 +2271,24 @@ void memory_region_set_flush_coalesced(MemoryRegion *mr);
  */
 void memory_region_clear_flush_coalesced(MemoryRegion *mr);
 
+/**
+ * memory_region_enable_lockless_io: Dispatch accesses without the BQL
+ *
+ * Accesses from threads that do not hold the BQL, such as KVM vCPU
+ * threads, are dispatched without taking it, unless the needs_bql callback
+ * of the region asks for it.  The callbacks of the region must do their
+ * own locking for the other accesses.  The re-entrancy guard of the device
+ * is protected by the BQL, so only accesses dispatched with the BQL held
+ * check it; callbacks that run without the BQL must not access the memory
+ * of the guest or the regions of other devices.
+ *
+ * TCG still takes the BQL around accesses to the region, and so do
+ * accesses that need to flush coalesced MMIO first.
+ *
+ * @mr: the memory region to be updated.
+ */
+void memory_region_enable_lockless_io(MemoryRegion *mr);
+
 /**
  * memory_region_add_eventfd: Request an eventfd to be triggered when a word
  *                            is written to a location.
@@ -2543,6 +2579,25 @@ void memory_region_transaction_begin(void);
  */
 void memory_region_transaction_commit(void);
 
+/* Statistics for the commits that changed the memory topology */
+typedef struct MemoryCommitStats {
+    uint64_t commits;
+    uint64_t flatviews_rebuilt; /* rendered views with a new dispatch tree */
+    uint64_t flatviews_reused;  /* rendered views identical to the old ones */
+    uint64_t commit_ns;
+    uint64_t max_commit_ns;
+    Log2Histogram commit_hist;
+} MemoryCommitStats;
+
+/**
+ * memory_region_transaction_get_stats: Return the commit statistics.
+ *
+ * @stats: filled with the statistics
+ *
+ * Must be called with the BQL held.
+ */
+void memory_region_transaction_get_stats(MemoryCommitStats *stats);
+
 /**
  * memory_listener_register: register callbacks to be called when memory
  *                           sections are mapped or unmapped into an address
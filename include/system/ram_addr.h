@@ -25,6 +25,7 @@
 #include "exec/ramlist.h"
 #include "system/ramblock.h"
 #include "system/memory.h"
+#include "system/dirty-ring.h"
 #include "exec/target_page.h"
 #include "qemu/rcu.h"
 
@@ -287,6 +288,10 @@ static inline void cpu_physical_memory_set_dirty_flag(ram_addr_t addr,
 
     blocks = qatomic_rcu_read(&ram_list.dirty_memory[client]);
 
+    if (client == DIRTY_MEMORY_MIGRATION && dirty_ring_active()) {
+        dirty_ring_set_dirty(blocks->blocks[idx], offset, 1, page);
+        return;
+    }
     set_bit_atomic(offset, blocks->blocks[idx]);
 }
 
@@ -318,8 +323,14 @@ static inline void cpu_physical_memory_set_dirty_range(ram_addr_t start,
             unsigned long next = MIN(end, base + DIRTY_MEMORY_BLOCK_SIZE);
 
             if (likely(mask & (1 << DIRTY_MEMORY_MIGRATION))) {
-                bitmap_set_atomic(blocks[DIRTY_MEMORY_MIGRATION]->blocks[idx],
-                                  offset, next - page);
+                unsigned long *bitmap =
+                    blocks[DIRTY_MEMORY_MIGRATION]->blocks[idx];
+
+                if (dirty_ring_active()) {
+                    dirty_ring_set_dirty(bitmap, offset, next - page, page);
+                } else {
+                    bitmap_set_atomic(bitmap, offset, next - page);
+                }
             }
             if (unlikely(mask & (1 << DIRTY_MEMORY_VGA))) {
                 bitmap_set_atomic(blocks[DIRTY_MEMORY_VGA]->blocks[idx],
@@ -415,6 +426,9 @@ uint64_t cpu_physical_memory_set_dirty_lebitmap(unsigned long *bitmap,
             }
         }
 
+        if (dirty_ring_active()) {
+            dirty_ring_invalidate();
+        }
         if (xen_enabled()) {
             xen_hvm_modified_memory(start, pages << TARGET_PAGE_BITS);
         }
@@ -482,6 +496,17 @@ static inline void cpu_physical_memory_clear_dirty_range(ram_addr_t start,
 }
 
 
+/*
+ * Move the pages in the dirty rings from the global migration bitmap to
+ * the migration bitmaps of the RAMBlocks.  Returns false if the rings
+ * were incomplete, in which case the caller must also sync the bitmap
+ * of each RAMBlock.  @num_dirty is set to the number of newly dirtied
+ * pages in either case.
+ *
+ * Called with RCU critical section
+ */
+bool cpu_physical_memory_sync_dirty_ring(uint64_t *num_dirty);
+
 /* Called with RCU critical section */
 static inline
 uint64_t cpu_physical_memory_sync_dirty_bitmap(RAMBlock *rb,
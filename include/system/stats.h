@@ -30,6 +30,8 @@ void add_stats_callbacks(StatsProvider provider,
  */
 void add_stats_entry(StatsResultList **, StatsProvider, const char *id,
                      StatsList *stats_list);
+void add_call_site_stats_entry(StatsResultList **, StatsProvider,
+                               const char *call_site, StatsList *stats_list);
 void add_stats_schema(StatsSchemaList **, StatsProvider, StatsTarget,
                       StatsSchemaValueList *);
 
@@ -42,4 +44,80 @@ void add_stats_schema(StatsSchemaList **, StatsProvider, StatsTarget,
  */
 bool apply_str_list_filter(const char *string, strList *list);
 
+/*
+ * Statistics kept by QEMU itself are usually uint64_t fields of a struct.
+ * A table of StatsDesc describes them, so that stats_desc_list() and
+ * stats_desc_schema() can build the results of query-stats and of
+ * query-stats-schemas.
+ */
+typedef enum StatsDescUnit {
+    STATS_DESC_UNIT_NONE,
+    STATS_DESC_UNIT_BYTES,
+    STATS_DESC_UNIT_NS,
+} StatsDescUnit;
+
+typedef struct StatsDesc {
+    const char *name;
+    StatsType type;
+    StatsDescUnit unit;
+    /* Offset of the value, or of the first bucket of a histogram */
+    size_t offset;
+    /* Number of buckets of a histogram, zero for other types */
+    unsigned buckets;
+    /* Width of the buckets of a linear histogram */
+    unsigned bucket_size;
+} StatsDesc;
+
+#define STATS_DESC(_name, _type, _unit, _struct, _field)                  \
+    { .name = (_name), .type = (_type), .unit = (_unit),                   \
+      .offset = offsetof(_struct, _field) }
+
+/* @_field is an array of uint64_t with one element per bucket */
+#define STATS_DESC_LOG2_HISTOGRAM(_name, _unit, _struct, _field)          \
+    { .name = (_name), .type = STATS_TYPE_LOG2_HISTOGRAM, .unit = (_unit), \
+      .offset = offsetof(_struct, _field),                                 \
+      .buckets = sizeof_field(_struct, _field) / sizeof(uint64_t) }
+
+#define STATS_DESC_LINEAR_HISTOGRAM(_name, _unit, _struct, _field, _size) \
+    { .name = (_name), .type = STATS_TYPE_LINEAR_HISTOGRAM,                \
+      .unit = (_unit), .offset = offsetof(_struct, _field),                \
+      .buckets = sizeof_field(_struct, _field) / sizeof(uint64_t),         \
+      .bucket_size = (_size) }
+
+/*
+ * Prepend to @list the statistics in @desc[0..@n-1] that pass the @names
+ * filter, reading their values from @stats.  The result keeps the order of
+ * @desc.
+ */
+StatsList *stats_desc_list(const StatsDesc *desc, size_t n, const void *stats,
+                           strList *names, StatsList *list);
+
+/* Prepend to @list the schema of the statistics in @desc[0..@n-1] */
+StatsSchemaValueList *stats_desc_schema(const StatsDesc *desc, size_t n,
+                                        StatsSchemaValueList *list);
+
+/*
+ * Fill @stats, a struct described by the StatsDesc table of the provider.
+ * Return false if there is nothing to report.
+ */
+typedef bool StatsDescRetrieveFunc(void *stats);
+
+/*
+ * A provider whose statistics are described by a StatsDesc table, and that
+ * only reports them for the "vm" target.
+ */
+typedef struct StatsDescProvider {
+    StatsProvider provider;
+    const StatsDesc *desc;
+    size_t n_desc;
+    size_t size;
+    StatsDescRetrieveFunc *retrieve;
+} StatsDescProvider;
+
+/*
+ * Register @p for query-stats and query-stats-schemas.  Providers call
+ * this from a function registered with stats_init().
+ */
+void add_stats_desc_provider(const StatsDescProvider *p);
+
 #endif /* STATS_H */
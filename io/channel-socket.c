@@ -65,6 +65,7 @@ qio_channel_socket_new(void)
     sioc->fd = -1;
     sioc->zero_copy_queued = 0;
     sioc->zero_copy_sent = 0;
+    sioc->zero_copy_used = false;
 
     ioc = QIO_CHANNEL(sioc);
     qio_channel_set_feature(ioc, QIO_CHANNEL_FEATURE_SHUTDOWN);
@@ -156,6 +157,28 @@ qio_channel_socket_new_fd(int fd,
 }
 
 
+int qio_channel_socket_set_zero_copy(QIOChannelSocket *ioc,
+                                     Error **errp)
+{
+#ifdef QEMU_MSG_ZEROCOPY
+    int v = 1;
+
+    if (setsockopt(ioc->fd, SOL_SOCKET, SO_ZEROCOPY, &v, sizeof(v)) < 0) {
+        error_setg_errno(errp, errno, "Unable to enable zero copy on socket");
+        return -1;
+    }
+
+    /* Zero copy available on host */
+    qio_channel_set_feature(QIO_CHANNEL(ioc),
+                            QIO_CHANNEL_FEATURE_WRITE_ZERO_COPY);
+    return 0;
+#else
+    error_setg(errp, "Zero copy is not supported on this host");
+    return -1;
+#endif
+}
+
+
 int qio_channel_socket_connect_sync(QIOChannelSocket *ioc,
                                     SocketAddress *addr,
                                     Error **errp)
@@ -175,15 +198,8 @@ int qio_channel_socket_connect_sync(QIOChannelSocket *ioc,
         return -1;
     }
 
-#ifdef QEMU_MSG_ZEROCOPY
-    int ret, v = 1;
-    ret = setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &v, sizeof(v));
-    if (ret == 0) {
-        /* Zero copy available on host */
-        qio_channel_set_feature(QIO_CHANNEL(ioc),
-                                QIO_CHANNEL_FEATURE_WRITE_ZERO_COPY);
-    }
-#endif
+    /* Zero copy is opportunistic for outgoing connections */
+    qio_channel_socket_set_zero_copy(ioc, NULL);
 
     qio_channel_set_feature(QIO_CHANNEL(ioc),
                             QIO_CHANNEL_FEATURE_READ_MSG_PEEK);
@@ -736,10 +752,10 @@ static ssize_t qio_channel_socket_writev(QIOChannel *ioc,
 
 
 #ifdef QEMU_MSG_ZEROCOPY
-static int qio_channel_socket_flush(QIOChannel *ioc,
-                                    Error **errp)
+static int qio_channel_socket_flush_internal(QIOChannelSocket *sioc,
+                                             bool block,
+                                             Error **errp)
 {
-    QIOChannelSocket *sioc = QIO_CHANNEL_SOCKET(ioc);
     struct msghdr msg = {};
     struct sock_extended_err *serr;
     struct cmsghdr *cm;
@@ -755,15 +771,16 @@ static int qio_channel_socket_flush(QIOChannel *ioc,
     msg.msg_controllen = sizeof(control);
     memset(control, 0, sizeof(control));
 
-    ret = 1;
-
     while (sioc->zero_copy_sent < sioc->zero_copy_queued) {
         received = recvmsg(sioc->fd, &msg, MSG_ERRQUEUE);
         if (received < 0) {
             switch (errno) {
             case EAGAIN:
+                if (!block) {
+                    return QIO_CHANNEL_ERR_BLOCK;
+                }
                 /* Nothing on errqueue, wait until something is available */
-                qio_channel_wait(ioc, G_IO_ERR);
+                qio_channel_wait(QIO_CHANNEL(sioc), G_IO_ERR);
                 continue;
             case EINTR:
                 continue;
@@ -804,13 +821,36 @@ static int qio_channel_socket_flush(QIOChannel *ioc,
 
         /* If any sendmsg() succeeded using zero copy, return 0 at the end */
         if (serr->ee_code != SO_EE_CODE_ZEROCOPY_COPIED) {
-            ret = 0;
+            sioc->zero_copy_used = true;
         }
     }
 
+    ret = sioc->zero_copy_used ? 0 : 1;
+    sioc->zero_copy_used = false;
     return ret;
 }
 
+static int qio_channel_socket_flush(QIOChannel *ioc,
+                                    Error **errp)
+{
+    return qio_channel_socket_flush_internal(QIO_CHANNEL_SOCKET(ioc), true,
+                                             errp);
+}
+
+int qio_channel_socket_flush_nonblock(QIOChannelSocket *ioc,
+                                      Error **errp)
+{
+    return qio_channel_socket_flush_internal(ioc, false, errp);
+}
+
+#else /* QEMU_MSG_ZEROCOPY */
+
+int qio_channel_socket_flush_nonblock(QIOChannelSocket *ioc,
+                                      Error **errp)
+{
+    return 0;
+}
+
 #endif /* QEMU_MSG_ZEROCOPY */
 
 static int
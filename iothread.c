@@ -36,6 +36,24 @@
 #define IOTHREAD_POLL_MAX_NS_DEFAULT 0ULL
 #endif
 
+/*
+ * Attaching the AioContext to the GMainContext switches it to fd monitoring
+ * that glib can drive, which is slower than io_uring and cannot share its ring
+ * with disk I/O.  Only do it once the GMainContext is actually used.
+ */
+static void iothread_attach_aio_context_source(IOThread *iothread)
+{
+    GSource *source;
+
+    if (g_source_get_context(&iothread->ctx->source)) {
+        return; /* already attached */
+    }
+
+    source = aio_get_g_source(iothread->ctx);
+    g_source_attach(source, iothread->worker_context);
+    g_source_unref(source);
+}
+
 static void *iothread_run(void *opaque)
 {
     IOThread *iothread = opaque;
@@ -67,6 +85,7 @@ static void *iothread_run(void *opaque)
          * changed in previous aio_poll()
          */
         if (iothread->running && qatomic_read(&iothread->run_gcontext)) {
+            iothread_attach_aio_context_source(iothread);
             g_main_loop_run(iothread->main_loop);
         }
     }
@@ -140,14 +159,11 @@ static void iothread_instance_finalize(Object *obj)
 
 static void iothread_init_gcontext(IOThread *iothread, const char *thread_name)
 {
-    GSource *source;
     g_autofree char *name = g_strdup_printf("%s aio-context", thread_name);
 
     iothread->worker_context = g_main_context_new();
-    source = aio_get_g_source(iothread_get_aio_context(iothread));
-    g_source_set_name(source, name);
-    g_source_attach(source, iothread->worker_context);
-    g_source_unref(source);
+    /* Attached by iothread_attach_aio_context_source() */
+    g_source_set_name(&iothread->ctx->source, name);
     iothread->main_loop = g_main_loop_new(iothread->worker_context, TRUE);
 }
 
@@ -172,6 +188,8 @@ static void iothread_set_aio_context_params(EventLoopBase *base, Error **errp)
     aio_context_set_aio_params(iothread->ctx,
                                iothread->parent_obj.aio_max_batch);
 
+    aio_context_set_thread_pool_context(iothread->ctx,
+                                        base->thread_pool_context);
     aio_context_set_thread_pool_params(iothread->ctx, base->thread_pool_min,
                                        base->thread_pool_max, errp);
 }
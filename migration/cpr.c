@@ -13,6 +13,7 @@
 #include "migration/qemu-file.h"
 #include "migration/savevm.h"
 #include "migration/vmstate.h"
+#include "system/memory.h"
 #include "system/runstate.h"
 #include "trace.h"
 
@@ -23,6 +24,7 @@ typedef QLIST_HEAD(CprFdList, CprFd) CprFdList;
 
 typedef struct CprState {
     CprFdList fds;
+    uint32_t mode;
 } CprState;
 
 static CprState cpr_state;
@@ -98,6 +100,25 @@ int cpr_find_fd(const char *name, int id)
 /*************************************************************************/
 #define CPR_STATE "CprState"
 
+static bool cpr_mode_needed(void *opaque)
+{
+    CprState *s = opaque;
+
+    /* Without the subsection, the mode is cpr-transfer */
+    return s->mode != MIG_MODE_CPR_TRANSFER;
+}
+
+static const VMStateDescription vmstate_cpr_mode = {
+    .name = CPR_STATE "/mode",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .needed = cpr_mode_needed,
+    .fields = (VMStateField[]) {
+        VMSTATE_UINT32(mode, CprState),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
 static const VMStateDescription vmstate_cpr_state = {
     .name = CPR_STATE,
     .version_id = 1,
@@ -105,6 +126,10 @@ static const VMStateDescription vmstate_cpr_state = {
     .fields = (VMStateField[]) {
         VMSTATE_QLIST_V(fds, CprState, 1, vmstate_cpr_fd, CprFd, next),
         VMSTATE_END_OF_LIST()
+    },
+    .subsections = (const VMStateDescription * const []) {
+        &vmstate_cpr_mode,
+        NULL
     }
 };
 /*************************************************************************/
@@ -133,6 +158,26 @@ bool cpr_is_incoming(void)
     return incoming_mode != MIG_MODE_NONE;
 }
 
+/* Whether this QEMU is being created as a clone of another one */
+bool cpr_is_clone(void)
+{
+    return incoming_mode == MIG_MODE_CPR_CLONE;
+}
+
+/* Set once the guest RAM of this QEMU has been passed to a clone */
+static bool cpr_cloned;
+
+bool cpr_is_clone_template(void)
+{
+    return cpr_cloned;
+}
+
+/* Whether @mode passes file descriptors to new QEMU over a cpr channel */
+bool cpr_mode_uses_channel(MigMode mode)
+{
+    return mode == MIG_MODE_CPR_TRANSFER || mode == MIG_MODE_CPR_CLONE;
+}
+
 int cpr_state_save(MigrationChannel *channel, Error **errp)
 {
     int ret;
@@ -141,7 +186,7 @@ int cpr_state_save(MigrationChannel *channel, Error **errp)
 
     trace_cpr_state_save(MigMode_str(mode));
 
-    if (mode == MIG_MODE_CPR_TRANSFER) {
+    if (cpr_mode_uses_channel(mode)) {
         g_assert(channel);
         f = cpr_transfer_output(channel, errp);
     } else {
@@ -150,6 +195,7 @@ int cpr_state_save(MigrationChannel *channel, Error **errp)
     if (!f) {
         return -1;
     }
+    cpr_state.mode = mode;
 
     qemu_put_be32(f, QEMU_CPR_FILE_MAGIC);
     qemu_put_be32(f, QEMU_CPR_FILE_VERSION);
@@ -169,6 +215,14 @@ int cpr_state_save(MigrationChannel *channel, Error **errp)
     qio_channel_shutdown(qemu_file_get_ioc(f), QIO_CHANNEL_SHUTDOWN_WRITE,
                          NULL);
     cpr_state_file = f;
+
+    /*
+     * From now on, a clone may map the guest RAM, so it must not change
+     * anymore.
+     */
+    if (mode == MIG_MODE_CPR_CLONE) {
+        cpr_cloned = true;
+    }
     return 0;
 }
 
@@ -190,8 +244,6 @@ int cpr_state_load(MigrationChannel *channel, Error **errp)
         return -1;
     }
 
-    trace_cpr_state_load(MigMode_str(mode));
-
     v = qemu_get_be32(f);
     if (v != QEMU_CPR_FILE_MAGIC) {
         error_setg(errp, "Not a migration stream (bad magic %x)", v);
@@ -205,6 +257,7 @@ int cpr_state_load(MigrationChannel *channel, Error **errp)
         return -ENOTSUP;
     }
 
+    cpr_state.mode = MIG_MODE_CPR_TRANSFER;
     ret = vmstate_load_state(f, &vmstate_cpr_state, &cpr_state, 1);
     if (ret) {
         error_setg(errp, "vmstate_load_state error %d", ret);
@@ -212,6 +265,25 @@ int cpr_state_load(MigrationChannel *channel, Error **errp)
         return ret;
     }
 
+    if (!cpr_mode_uses_channel(cpr_state.mode)) {
+        error_setg(errp, "Unsupported CPR mode %u", cpr_state.mode);
+        qemu_fclose(f);
+        return -EINVAL;
+    }
+    mode = cpr_state.mode;
+    cpr_set_incoming_mode(mode);
+    trace_cpr_state_load(MigMode_str(mode));
+
+    /*
+     * The guest RAM of a clone is a private mapping of the memory of the
+     * template.  Punching holes would free the pages of the template too.
+     */
+    if (mode == MIG_MODE_CPR_CLONE && ram_block_discard_disable(true)) {
+        error_setg(errp, "Cannot disable RAM discard for cpr-clone");
+        qemu_fclose(f);
+        return -EBUSY;
+    }
+
     /*
      * Let the caller decide when to close the socket (and generate a HUP event
      * for the sending side).
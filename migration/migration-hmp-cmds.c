@@ -158,6 +158,10 @@ void hmp_info_migrate(Monitor *mon, const QDict *qdict)
             monitor_printf(mon, ", zerocopy_fallbacks=%" PRIu64,
                            info->ram->dirty_sync_missed_zero_copy);
         }
+        if (info->ram->dirty_sync_ring_count) {
+            monitor_printf(mon, ", dirty_ring_syncs=%" PRIu64,
+                           info->ram->dirty_sync_ring_count);
+        }
         monitor_printf(mon, "\n");
     }
 
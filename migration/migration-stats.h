@@ -55,6 +55,11 @@ typedef struct {
      * copy.
      */
     Stat64 dirty_sync_missed_zero_copy;
+    /*
+     * Number of times we have synchronized from the TCG dirty rings
+     * without scanning the bitmaps.
+     */
+    Stat64 dirty_sync_ring_count;
     /*
      * Number of bytes sent at migration completion stage while the
      * guest is stopped.
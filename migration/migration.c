@@ -78,6 +78,7 @@ static NotifierWithReturnList migration_state_notifiers[] = {
     NOTIFIER_ELEM_INIT(migration_state_notifiers, MIG_MODE_NORMAL),
     NOTIFIER_ELEM_INIT(migration_state_notifiers, MIG_MODE_CPR_REBOOT),
     NOTIFIER_ELEM_INIT(migration_state_notifiers, MIG_MODE_CPR_TRANSFER),
+    NOTIFIER_ELEM_INIT(migration_state_notifiers, MIG_MODE_CPR_CLONE),
 };
 
 /* Messages sent on the return path from destination to source */
@@ -253,7 +254,7 @@ migration_channels_and_transport_compatible(MigrationAddress *addr,
         return false;
     }
 
-    if (migrate_mode() == MIG_MODE_CPR_TRANSFER &&
+    if (cpr_mode_uses_channel(migrate_mode()) &&
         addr->transport == MIGRATION_ADDRESS_TYPE_FILE) {
         error_setg(errp, "Migration requires streamable transport (eg unix)");
         return false;
@@ -1278,6 +1279,8 @@ static void populate_ram_info(MigrationInfo *info, MigrationState *s)
         stat64_get(&mig_stats.dirty_sync_count);
     info->ram->dirty_sync_missed_zero_copy =
         stat64_get(&mig_stats.dirty_sync_missed_zero_copy);
+    info->ram->dirty_sync_ring_count =
+        stat64_get(&mig_stats.dirty_sync_ring_count);
     info->ram->postcopy_requests =
         stat64_get(&mig_stats.postcopy_requests);
     info->ram->page_size = page_size;
@@ -1757,7 +1760,8 @@ bool migrate_mode_is_cpr(MigrationState *s)
 {
     MigMode mode = s->parameters.mode;
     return mode == MIG_MODE_CPR_REBOOT ||
-           mode == MIG_MODE_CPR_TRANSFER;
+           mode == MIG_MODE_CPR_TRANSFER ||
+           mode == MIG_MODE_CPR_CLONE;
 }
 
 int migrate_init(MigrationState *s, Error **errp)
@@ -2094,7 +2098,9 @@ static bool migrate_prepare(MigrationState *s, bool resume, Error **errp)
         return false;
     }
 
-    if (runstate_check(RUN_STATE_POSTMIGRATE)) {
+    /* A template is cloned from the postmigrate state, as often as needed */
+    if (runstate_check(RUN_STATE_POSTMIGRATE) &&
+        s->parameters.mode != MIG_MODE_CPR_CLONE) {
         error_setg(errp, "Can't migrate the vm that was paused due to "
                    "previous migration");
         return false;
@@ -2232,7 +2238,7 @@ void qmp_migrate(const char *uri, bool has_channels,
         return;
     }
 
-    if (s->parameters.mode == MIG_MODE_CPR_TRANSFER && !cpr_channel) {
+    if (cpr_mode_uses_channel(s->parameters.mode) && !cpr_channel) {
         error_setg(errp, "missing 'cpr' migration channel");
         return;
     }
@@ -2257,7 +2263,7 @@ void qmp_migrate(const char *uri, bool has_channels,
      * in which case the target will not listen for the incoming migration
      * connection, so qmp_migrate_finish will fail to connect, and then recover.
      */
-    if (s->parameters.mode == MIG_MODE_CPR_TRANSFER) {
+    if (cpr_mode_uses_channel(s->parameters.mode)) {
         migrate_hup_add(s, cpr_state_ioc(), (GSourceFunc)qmp_migrate_finish_cb,
                         QAPI_CLONE(MigrationAddress, addr));
 
@@ -52,6 +52,7 @@
 #include "exec/target_page.h"
 #include "qemu/rcu_queue.h"
 #include "migration/colo.h"
+#include "migration/cpr.h"
 #include "system/cpu-throttle.h"
 #include "savevm.h"
 #include "qemu/iov.h"
@@ -227,7 +228,7 @@ bool migrate_ram_is_ignored(RAMBlock *block)
 {
     MigMode mode = migrate_mode();
     return !qemu_ram_is_migratable(block) ||
-           mode == MIG_MODE_CPR_TRANSFER ||
+           cpr_mode_uses_channel(mode) ||
            (migrate_ignore_shared() && qemu_ram_is_shared(block)
                                     && qemu_ram_is_named_file(block));
 }
@@ -933,6 +934,28 @@ static void ramblock_sync_dirty_bitmap(RAMState *rs, RAMBlock *rb)
     rs->num_dirty_pages_period += new_dirty_pages;
 }
 
+/*
+ * Called with RCU critical section.  Returns false if the bitmap of each
+ * RAMBlock must be synced as well.
+ */
+static bool ram_sync_dirty_ring(RAMState *rs)
+{
+    uint64_t new_dirty_pages;
+    bool complete;
+
+    if (!dirty_ring_active()) {
+        return false;
+    }
+
+    complete = cpu_physical_memory_sync_dirty_ring(&new_dirty_pages);
+    rs->migration_dirty_pages += new_dirty_pages;
+    rs->num_dirty_pages_period += new_dirty_pages;
+    if (complete) {
+        stat64_add(&mig_stats.dirty_sync_ring_count, 1);
+    }
+    return complete;
+}
+
 /**
  * ram_pagesize_summary: calculate all the pagesizes of a VM
  *
@@ -1068,8 +1091,10 @@ static void migration_bitmap_sync(RAMState *rs, bool last_stage)
 
     WITH_QEMU_LOCK_GUARD(&rs->bitmap_mutex) {
         WITH_RCU_READ_LOCK_GUARD() {
-            RAMBLOCK_FOREACH_NOT_IGNORED(block) {
-                ramblock_sync_dirty_bitmap(rs, block);
+            if (!ram_sync_dirty_ring(rs)) {
+                RAMBLOCK_FOREACH_NOT_IGNORED(block) {
+                    ramblock_sync_dirty_bitmap(rs, block);
+                }
             }
             stat64_set(&mig_stats.dirty_bytes_last_sync, ram_bytes_remaining());
         }
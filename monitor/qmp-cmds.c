@@ -31,6 +31,7 @@
 #include "qapi/type-helpers.h"
 #include "hw/mem/memory-device.h"
 #include "hw/intc/intc.h"
+#include "migration/cpr.h"
 #include "migration/misc.h"
 
 NameInfo *qmp_query_name(Error **errp)
@@ -84,6 +85,9 @@ void qmp_cont(Error **errp)
     } else if (runstate_check(RUN_STATE_FINISH_MIGRATE)) {
         error_setg(errp, "Migration is not finalized yet");
         return;
+    } else if (cpr_is_clone_template()) {
+        error_setg(errp, "The guest RAM is shared with clones of this VM");
+        return;
     }
 
     for (blk = blk_next(NULL); blk; blk = blk_next(blk)) {
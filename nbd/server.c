@@ -29,6 +29,10 @@
 #include "qemu/units.h"
 #include "qemu/memalign.h"
 
+#ifdef CONFIG_LINUX
+#include <sys/resource.h>
+#endif
+
 #define NBD_META_ID_BASE_ALLOCATION 0
 #define NBD_META_ID_ALLOCATION_DEPTH 1
 /* Dirty bitmaps use 'NBD_META_ID_DIRTY_BITMAP + i', so keep this id last. */
@@ -42,6 +46,18 @@
  */
 #define NBD_MAX_BLOCK_STATUS_EXTENTS (1 * MiB / 8)
 
+/*
+ * MSG_ZEROCOPY has a fixed cost for pinning pages and reaping the
+ * completion notifications, so only read payloads of at least
+ * NBD_ZERO_COPY_MIN_SIZE bytes are sent that way.  Buffers handed to
+ * the kernel are kept until qio_channel_flush() confirms that they
+ * were sent, which happens once NBD_ZERO_COPY_FLUSH_SIZE bytes have
+ * been queued.  The kernel charges pages pinned by MSG_ZEROCOPY to
+ * RLIMIT_MEMLOCK, so the flush comes earlier if that limit is lower.
+ */
+#define NBD_ZERO_COPY_MIN_SIZE (64 * KiB)
+#define NBD_ZERO_COPY_FLUSH_SIZE (16 * MiB)
+
 static int system_errno_to_nbd_errno(int err)
 {
     switch (err) {
@@ -83,8 +99,12 @@ struct NBDRequestData {
     NBDClient *client;
     uint8_t *data;
     bool complete;
+    bool zero_copy; /* data was queued with MSG_ZEROCOPY */
+    QSIMPLEQ_ENTRY(NBDRequestData) next;
 };
 
+typedef QSIMPLEQ_HEAD(, NBDRequestData) NBDRequestDataList;
+
 struct NBDExport {
     BlockExport common;
 
@@ -101,6 +121,8 @@ struct NBDExport {
     bool allocation_depth;
     BdrvDirtyBitmap **export_bitmaps;
     size_t nr_export_bitmaps;
+
+    bool zero_copy;
 };
 
 static QTAILQ_HEAD(, NBDExport) exports = QTAILQ_HEAD_INITIALIZER(exports);
@@ -140,6 +162,12 @@ struct NBDClient {
     CoMutex send_lock;
     Coroutine *send_coroutine;
 
+    bool zero_copy; /* send read payloads with MSG_ZEROCOPY */
+    uint64_t zero_copy_limit; /* flush once this many bytes are queued */
+    uint64_t zero_copy_queued; /* protected by send_lock */
+    /* Requests whose data may still be in flight, protected by lock */
+    NBDRequestDataList zero_copy_reqs;
+
     bool read_yielding; /* protected by lock */
     bool quiescing; /* protected by lock */
 
@@ -1560,6 +1588,37 @@ void nbd_client_get(NBDClient *client)
     qatomic_inc(&client->refcount);
 }
 
+/*
+ * How many bytes may be queued with MSG_ZEROCOPY before flushing.  Half
+ * of RLIMIT_MEMLOCK leaves room for the rounding of payloads to whole
+ * pages.  Processes with CAP_IPC_LOCK are not charged; ENOBUFS is still
+ * handled if the limit is shared with other connections.
+ */
+static uint64_t nbd_zero_copy_limit(void)
+{
+    uint64_t limit = NBD_ZERO_COPY_FLUSH_SIZE;
+#ifdef CONFIG_LINUX
+    struct rlimit rlim;
+
+    if (geteuid() != 0 && !getrlimit(RLIMIT_MEMLOCK, &rlim) &&
+        rlim.rlim_cur != RLIM_INFINITY) {
+        limit = MIN(limit, rlim.rlim_cur / 2);
+    }
+#endif
+    return limit;
+}
+
+static void nbd_zero_copy_free(NBDRequestDataList *reqs)
+{
+    NBDRequestData *req, *next_req;
+
+    QSIMPLEQ_FOREACH_SAFE(req, reqs, next, next_req) {
+        qemu_vfree(req->data);
+        g_free(req);
+    }
+    QSIMPLEQ_INIT(reqs);
+}
+
 void nbd_client_put(NBDClient *client)
 {
     assert(qemu_in_main_thread());
@@ -1581,6 +1640,7 @@ void nbd_client_put(NBDClient *client)
             blk_exp_unref(&client->exp->common);
         }
         g_free(client->contexts.bitmaps);
+        nbd_zero_copy_free(&client->zero_copy_reqs);
         qemu_mutex_destroy(&client->lock);
         g_free(client);
     }
@@ -1653,10 +1713,19 @@ static void nbd_request_put(NBDRequestData *req)
 {
     NBDClient *client = req->client;
 
-    if (req->data) {
-        qemu_vfree(req->data);
+    /*
+     * Once zero copy is off, the flush that turned it off has covered
+     * every buffer queued with MSG_ZEROCOPY and none will be flushed again.
+     */
+    if (req->zero_copy && client->zero_copy) {
+        /* The kernel may still read from req->data, keep it until flushed */
+        QSIMPLEQ_INSERT_TAIL(&client->zero_copy_reqs, req, next);
+    } else {
+        if (req->data) {
+            qemu_vfree(req->data);
+        }
+        g_free(req);
     }
-    g_free(req);
 
     client->nb_requests--;
 
@@ -1931,6 +2000,7 @@ static int nbd_export_create(BlockExport *blk_exp, BlockExportOptions *exp_args,
     }
 
     exp->allocation_depth = arg->allocation_depth;
+    exp->zero_copy = arg->zero_copy;
 
     /*
      * We need to inhibit request queuing in the block layer to ensure we can
@@ -2049,6 +2119,153 @@ static int coroutine_fn nbd_co_send_iov(NBDClient *client, struct iovec *iov,
     return ret;
 }
 
+/*
+ * Wait for the kernel to finish transmitting all buffers queued with
+ * MSG_ZEROCOPY and release the requests that owned them.  Every
+ * request on client->zero_copy_reqs was sent before we took
+ * send_lock, so the flush covers all of them.
+ *
+ * Completions arrive on the socket error queue, which makes the fd
+ * report POLLERR; the AioContext wakes up write waiters for that, so
+ * yield for G_IO_OUT until all of them have been reaped.  The socket is
+ * usually writable too, so this can go around the event loop a few
+ * times, but other coroutines and the receive side keep running.
+ *
+ * Called with send_lock held.
+ */
+static int coroutine_fn nbd_co_zero_copy_flush(NBDClient *client,
+                                               Error **errp)
+{
+    NBDRequestDataList reqs = QSIMPLEQ_HEAD_INITIALIZER(reqs);
+    int ret;
+
+    trace_nbd_co_zero_copy_flush(client->zero_copy_queued);
+    while ((ret = qio_channel_socket_flush_nonblock(client->sioc, errp)) ==
+           QIO_CHANNEL_ERR_BLOCK) {
+        qio_channel_yield(client->ioc, G_IO_OUT);
+    }
+    if (ret < 0) {
+        return -EIO;
+    }
+    if (ret == 1) {
+        /*
+         * The kernel copied everything anyway (e.g. loopback or a NIC
+         * without scatter-gather), so stop paying for the completions.
+         */
+        trace_nbd_co_zero_copy_disable();
+        client->zero_copy = false;
+    }
+    client->zero_copy_queued = 0;
+
+    WITH_QEMU_LOCK_GUARD(&client->lock) {
+        QSIMPLEQ_CONCAT(&reqs, &client->zero_copy_reqs);
+    }
+    nbd_zero_copy_free(&reqs);
+    return 0;
+}
+
+/*
+ * Queue @data with MSG_ZEROCOPY.  If the kernel refuses to pin more
+ * pages, typically with ENOBUFS because other connections used up
+ * RLIMIT_MEMLOCK, flush the buffers that are in flight and send the
+ * rest of @data with a regular copy.  A real socket error then shows
+ * up on the copying path.
+ *
+ * Called with send_lock held.
+ */
+static int coroutine_fn nbd_co_write_zero_copy(NBDClient *client,
+                                               struct iovec data,
+                                               Error **errp)
+{
+    Error *local_err = NULL;
+    ssize_t len;
+
+    while (data.iov_len) {
+        len = qio_channel_writev_full(client->ioc, &data, 1, NULL, 0,
+                                      QIO_CHANNEL_WRITE_FLAG_ZERO_COPY,
+                                      &local_err);
+        if (len == QIO_CHANNEL_ERR_BLOCK) {
+            qio_channel_yield(client->ioc, G_IO_OUT);
+            continue;
+        }
+        if (len < 0) {
+            trace_nbd_co_zero_copy_fallback(client->zero_copy_queued,
+                                            error_get_pretty(local_err));
+            error_free(local_err);
+            if (nbd_co_zero_copy_flush(client, errp) < 0 ||
+                qio_channel_write_all(client->ioc, data.iov_base,
+                                      data.iov_len, errp) < 0) {
+                return -EIO;
+            }
+            return 0;
+        }
+        client->zero_copy_queued += len;
+        data.iov_base += len;
+        data.iov_len -= len;
+    }
+    return 0;
+}
+
+/*
+ * Send a reply whose last element in @iov is read payload owned by
+ * an NBDRequestData with zero_copy set.  The headers live on the
+ * caller's stack, so they are always sent with a regular copy; with
+ * the channel corked both parts still leave in the same segment.
+ */
+static int coroutine_fn nbd_co_send_iov_zero_copy(NBDClient *client,
+                                                  struct iovec *iov,
+                                                  unsigned niov,
+                                                  Error **errp)
+{
+    struct iovec *data = &iov[niov - 1];
+    int ret = 0;
+
+    g_assert(qemu_in_coroutine());
+    qemu_co_mutex_lock(&client->send_lock);
+    client->send_coroutine = qemu_coroutine_self();
+
+    /* Keep the pinned pages within the limit, counting this payload */
+    if (client->zero_copy && client->zero_copy_queued &&
+        client->zero_copy_queued + data->iov_len > client->zero_copy_limit) {
+        ret = nbd_co_zero_copy_flush(client, errp);
+        if (ret < 0) {
+            goto out;
+        }
+    }
+
+    /*
+     * A flush, here or while we waited for send_lock, may have turned
+     * zero copy off.  Nothing is flushed after that, so copy the payload.
+     */
+    if (!client->zero_copy) {
+        ret = qio_channel_writev_all(client->ioc, iov, niov, errp) < 0 ?
+              -EIO : 0;
+    } else if (qio_channel_writev_all(client->ioc, iov, niov - 1, errp) < 0) {
+        ret = -EIO;
+    } else {
+        ret = nbd_co_write_zero_copy(client, *data, errp);
+    }
+
+out:
+    client->send_coroutine = NULL;
+    qemu_co_mutex_unlock(&client->send_lock);
+
+    return ret;
+}
+
+/*
+ * Whether the payload of the reply to @request should be sent with
+ * MSG_ZEROCOPY.  nbd_trip() asks first to decide whether the buffer
+ * must outlive the request; client->zero_copy only ever goes from
+ * true to false, so the send path never uses zero copy for a buffer
+ * that nbd_trip() is about to free.
+ */
+static bool nbd_read_use_zero_copy(NBDClient *client, NBDRequest *request)
+{
+    return client->zero_copy && request->type == NBD_CMD_READ &&
+           request->len >= NBD_ZERO_COPY_MIN_SIZE;
+}
+
 static inline void set_be_simple_reply(NBDSimpleReply *reply, uint64_t error,
                                        uint64_t cookie)
 {
@@ -2080,6 +2297,9 @@ static int coroutine_fn nbd_co_send_simple_reply(NBDClient *client,
                                    nbd_err_lookup(nbd_err), len);
     set_be_simple_reply(&reply, nbd_err, request->cookie);
 
+    if (len && nbd_read_use_zero_copy(client, request)) {
+        return nbd_co_send_iov_zero_copy(client, iov, 2, errp);
+    }
     return nbd_co_send_iov(client, iov, 2, errp);
 }
 
@@ -2161,6 +2381,9 @@ static int coroutine_fn nbd_co_send_chunk_read(NBDClient *client,
                  NBD_REPLY_TYPE_OFFSET_DATA, request);
     stq_be_p(&chunk.offset, offset);
 
+    if (nbd_read_use_zero_copy(client, request)) {
+        return nbd_co_send_iov_zero_copy(client, iov, 3, errp);
+    }
     return nbd_co_send_iov(client, iov, 3, errp);
 }
 
@@ -3145,6 +3368,7 @@ static coroutine_fn void nbd_trip(void *opaque)
                                      error_get_pretty(export_err), &local_err);
         error_free(export_err);
     } else {
+        req->zero_copy = nbd_read_use_zero_copy(client, &request);
         ret = nbd_handle_request(client, &request, req->data, &local_err);
     }
     if (request.contexts && request.contexts != &client->contexts) {
@@ -3253,6 +3477,17 @@ static coroutine_fn void nbd_co_client_start(void *opaque)
     }
 
     timer_free(handshake_timer);
+
+    /* MSG_ZEROCOPY cannot see through TLS, which encrypts into a copy */
+    if (client->exp->zero_copy && !client->tlscreds) {
+        client->zero_copy_limit = nbd_zero_copy_limit();
+        client->zero_copy =
+            client->zero_copy_limit >= NBD_ZERO_COPY_MIN_SIZE &&
+            qio_channel_socket_set_zero_copy(client->sioc, NULL) == 0;
+    }
+    trace_nbd_co_client_start_zero_copy(client->exp->name, client->zero_copy,
+                                        client->zero_copy_limit);
+
     WITH_QEMU_LOCK_GUARD(&client->lock) {
         nbd_client_receive_next_request(client);
     }
@@ -3276,6 +3511,7 @@ void nbd_client_new(QIOChannelSocket *sioc,
 
     client = g_new0(NBDClient, 1);
     qemu_mutex_init(&client->lock);
+    QSIMPLEQ_INIT(&client->zero_copy_reqs);
     client->refcount = 1;
     client->tlscreds = tlscreds;
     if (tlscreds) {
@@ -34,6 +34,7 @@
 #include "qapi/qobject-output-visitor.h"
 #include "qobject/qjson.h"
 #include "qobject/qdict.h"
+#include "qemu/bswap.h"
 #include "qemu/cutils.h"
 #include "qemu/config-file.h"
 #include "qemu/option.h"
@@ -50,6 +51,7 @@
 #include "block/blockjob.h"
 #include "block/dirty-bitmap.h"
 #include "block/qapi.h"
+#include "crypto/hash.h"
 #include "crypto/init.h"
 #include "trace/control.h"
 #include "qemu/throttle.h"
@@ -86,6 +88,8 @@ enum {
     OPTION_BITMAPS = 275,
     OPTION_FORCE = 276,
     OPTION_SKIP_BROKEN = 277,
+    OPTION_DEDUP = 278,
+    OPTION_DEDUP_INDEX_SIZE = 279,
 };
 
 typedef enum OutputFormat {
@@ -1667,6 +1671,14 @@ enum ImgConvertBlockStatus {
 #define MAX_COROUTINES 16
 #define CONVERT_THROTTLE_GROUP "img_convert"
 
+#define CONVERT_DEDUP_WAYS 4
+#define CONVERT_DEDUP_DEFAULT_INDEX_SIZE (64 * MiB)
+
+typedef struct ConvertDedupEntry {
+    uint8_t digest[QCRYPTO_HASH_DIGEST_LEN_SHA256];
+    int64_t offset; /* of the cluster in the target, -1 if unused */
+} ConvertDedupEntry;
+
 typedef struct ImgConvertState {
     BlockBackend **src;
     int64_t *src_sectors;
@@ -1689,6 +1701,12 @@ typedef struct ImgConvertState {
     bool copy_range;
     bool salvage;
     bool quiet;
+    bool dedup;
+    int64_t dedup_index_size;
+    /* Set associative, CONVERT_DEDUP_WAYS entries per set */
+    ConvertDedupEntry *dedup_index;
+    uint64_t dedup_sets;
+    unsigned dedup_next_way;
     int min_sparse;
     int alignment;
     size_t cluster_sectors;
@@ -1874,6 +1892,113 @@ static int coroutine_fn convert_co_read(ImgConvertState *s, int64_t sector_num,
 }
 
 
+static void convert_dedup_init(ImgConvertState *s)
+{
+    uint64_t i, nb_entries;
+
+    s->dedup_sets = s->dedup_index_size /
+                    (sizeof(ConvertDedupEntry) * CONVERT_DEDUP_WAYS);
+    s->dedup_sets = pow2floor(MAX(s->dedup_sets, 1));
+    nb_entries = s->dedup_sets * CONVERT_DEDUP_WAYS;
+
+    s->dedup_index = g_new(ConvertDedupEntry, nb_entries);
+    for (i = 0; i < nb_entries; i++) {
+        s->dedup_index[i].offset = -1;
+    }
+}
+
+static ConvertDedupEntry *convert_dedup_set(ImgConvertState *s,
+                                            const uint8_t *digest)
+{
+    uint64_t set = ldq_le_p(digest) & (s->dedup_sets - 1);
+
+    return &s->dedup_index[set * CONVERT_DEDUP_WAYS];
+}
+
+/* Return the target offset of a cluster with the given digest, or -1 */
+static int64_t convert_dedup_lookup(ImgConvertState *s, const uint8_t *digest)
+{
+    ConvertDedupEntry *set = convert_dedup_set(s, digest);
+    int i;
+
+    for (i = 0; i < CONVERT_DEDUP_WAYS; i++) {
+        if (set[i].offset >= 0 &&
+            !memcmp(set[i].digest, digest, sizeof(set[i].digest))) {
+            return set[i].offset;
+        }
+    }
+    return -1;
+}
+
+static void convert_dedup_insert(ImgConvertState *s, const uint8_t *digest,
+                                 int64_t offset)
+{
+    ConvertDedupEntry *set = convert_dedup_set(s, digest);
+    ConvertDedupEntry *entry = NULL;
+    int i;
+
+    for (i = 0; i < CONVERT_DEDUP_WAYS; i++) {
+        if (set[i].offset < 0 ||
+            !memcmp(set[i].digest, digest, sizeof(set[i].digest))) {
+            entry = &set[i];
+            break;
+        }
+    }
+
+    if (!entry) {
+        /* The index is bounded, forget an older cluster */
+        entry = &set[s->dedup_next_way++ % CONVERT_DEDUP_WAYS];
+    }
+
+    memcpy(entry->digest, digest, sizeof(entry->digest));
+    entry->offset = offset;
+}
+
+/*
+ * Write one cluster of data in dedup mode.  If a cluster with the same
+ * content was written before, ask the target to copy it within the image,
+ * which formats like qcow2 do by sharing the cluster.  Otherwise (or if
+ * the target can't do that) write the data and remember the cluster.
+ */
+static int coroutine_fn convert_co_write_dedup(ImgConvertState *s,
+                                               int64_t sector_num,
+                                               uint8_t *buf)
+{
+    uint8_t digest[QCRYPTO_HASH_DIGEST_LEN_SHA256];
+    uint8_t *result = digest;
+    size_t result_len = sizeof(digest);
+    int64_t offset = sector_num << BDRV_SECTOR_BITS;
+    int64_t bytes = s->cluster_sectors << BDRV_SECTOR_BITS;
+    int64_t dup_offset;
+    int ret;
+
+    if (qcrypto_hash_bytes(QCRYPTO_HASH_ALGO_SHA256, (const char *)buf, bytes,
+                           &result, &result_len, NULL) < 0) {
+        return blk_co_pwrite(s->target, offset, bytes, buf, 0);
+    }
+
+    dup_offset = convert_dedup_lookup(s, digest);
+    if (dup_offset >= 0) {
+        ret = blk_co_copy_range(s->target, dup_offset, s->target, offset,
+                                bytes, 0, 0);
+        if (ret != -ENOTSUP) {
+            return ret;
+        }
+    }
+
+    ret = blk_co_pwrite(s->target, offset, bytes, buf, 0);
+    if (ret < 0) {
+        return ret;
+    }
+
+    /*
+     * Only insert once the data has been written, so that the cluster can't
+     * be shared before it holds the data.
+     */
+    convert_dedup_insert(s, digest, offset);
+    return 0;
+}
+
 static int coroutine_fn convert_co_write(ImgConvertState *s, int64_t sector_num,
                                          int nb_sectors, uint8_t *buf,
                                          enum ImgConvertBlockStatus status)
@@ -1884,6 +2009,11 @@ static int coroutine_fn convert_co_write(ImgConvertState *s, int64_t sector_num,
         int n = nb_sectors;
         BdrvRequestFlags flags = s->compressed ? BDRV_REQ_WRITE_COMPRESSED : 0;
 
+        if (s->dedup) {
+            /* Deduplication works on whole clusters */
+            n = MIN(n, s->cluster_sectors - sector_num % s->cluster_sectors);
+        }
+
         switch (status) {
         case BLK_BACKING_FILE:
             /* If we have a backing file, leave clusters unallocated that are
@@ -1893,6 +2023,15 @@ static int coroutine_fn convert_co_write(ImgConvertState *s, int64_t sector_num,
             break;
 
         case BLK_DATA:
+            if (s->dedup && n == s->cluster_sectors &&
+                !buffer_is_zero(buf, n * BDRV_SECTOR_SIZE))
+            {
+                ret = convert_co_write_dedup(s, sector_num, buf);
+                if (ret < 0) {
+                    return ret;
+                }
+                break;
+            }
             /* If we're told to keep the target fully allocated (-S 0) or there
              * is real non-zero data, we must write it. Otherwise we can treat
              * it as zero sectors.
@@ -2129,6 +2268,10 @@ static int convert_do_copy(ImgConvertState *s)
         sector_num += n;
     }
 
+    if (s->dedup) {
+        convert_dedup_init(s);
+    }
+
     /* Do the copy */
     s->sector_next_status = 0;
     s->ret = -EINPROGRESS;
@@ -2144,6 +2287,9 @@ static int convert_do_copy(ImgConvertState *s)
         main_loop_wait(false);
     }
 
+    g_free(s->dedup_index);
+    s->dedup_index = NULL;
+
     if (s->compressed && !s->ret) {
         /* signal EOF to align */
         ret = blk_pwrite_compressed(s->target, 0, 0, NULL);
@@ -2253,6 +2399,7 @@ static int img_convert(int argc, char **argv)
     bool explict_min_sparse = false;
     bool bitmaps = false;
     bool skip_broken = false;
+    bool explicit_dedup_index_size = false;
     int64_t rate_limit = 0;
 
     ImgConvertState s = (ImgConvertState) {
@@ -2262,6 +2409,7 @@ static int img_convert(int argc, char **argv)
         .buf_sectors        = IO_BUF_SIZE / BDRV_SECTOR_SIZE,
         .wr_in_order        = true,
         .num_coroutines     = 8,
+        .dedup_index_size   = CONVERT_DEDUP_DEFAULT_INDEX_SIZE,
     };
 
     for(;;) {
@@ -2275,6 +2423,9 @@ static int img_convert(int argc, char **argv)
             {"target-is-zero", no_argument, 0, OPTION_TARGET_IS_ZERO},
             {"bitmaps", no_argument, 0, OPTION_BITMAPS},
             {"skip-broken-bitmaps", no_argument, 0, OPTION_SKIP_BROKEN},
+            {"dedup", no_argument, 0, OPTION_DEDUP},
+            {"dedup-index-size", required_argument, 0,
+             OPTION_DEDUP_INDEX_SIZE},
             {0, 0, 0, 0}
         };
         c = getopt_long(argc, argv, ":hf:O:B:CcF:o:l:S:pt:T:qnm:WUr:",
@@ -2409,6 +2560,16 @@ static int img_convert(int argc, char **argv)
         case OPTION_SKIP_BROKEN:
             skip_broken = true;
             break;
+        case OPTION_DEDUP:
+            s.dedup = true;
+            break;
+        case OPTION_DEDUP_INDEX_SIZE:
+            s.dedup_index_size = cvtnum("dedup index size", optarg);
+            if (s.dedup_index_size < 0) {
+                goto fail_getopt;
+            }
+            explicit_dedup_index_size = true;
+            break;
         }
     }
 
@@ -2436,6 +2597,16 @@ static int img_convert(int argc, char **argv)
         goto fail_getopt;
     }
 
+    if (explicit_dedup_index_size && !s.dedup) {
+        error_report("Use of --dedup-index-size requires --dedup");
+        goto fail_getopt;
+    }
+
+    if (s.dedup && s.copy_range) {
+        error_report("Cannot enable copy offloading when --dedup is used");
+        goto fail_getopt;
+    }
+
     if (tgt_image_opts && !skip_create) {
         error_report("--target-image-opts requires use of -n flag");
         goto fail_getopt;
@@ -2779,6 +2950,21 @@ static int img_convert(int argc, char **argv)
         s.cluster_sectors = bdi.cluster_size / BDRV_SECTOR_SIZE;
     }
 
+    if (s.dedup) {
+        if (s.compressed) {
+            error_report("Deduplication and compression not supported at "
+                         "the same time");
+            ret = -1;
+            goto out;
+        }
+        if (s.cluster_sectors <= 0) {
+            error_report("Deduplication requires a target format with "
+                         "clusters");
+            ret = -1;
+            goto out;
+        }
+    }
+
     if (rate_limit) {
         set_rate_limit(s.target, rate_limit);
     }
@@ -228,7 +228,7 @@ DEF("accel", HAS_ARG, QEMU_OPTION_accel,
     "                one-insn-per-tb=on|off (one guest instruction per TCG translation block)\n"
     "                split-wx=on|off (enable TCG split w^x mapping)\n"
     "                tb-size=n (TCG translation block cache size)\n"
-    "                dirty-ring-size=n (KVM dirty ring GFN count, default 0)\n"
+    "                dirty-ring-size=n (KVM/TCG dirty ring page count, default 0)\n"
     "                eager-split-size=n (KVM Eager Page Split chunk size, default 0, disabled. ARM only)\n"
     "                notify-vmexit=run|internal-error|disable,notify-window=n (enable notify VM exit and set notify window, x86 only)\n"
     "                thread=single|multi (enable multi-threaded TCG)\n"
@@ -289,6 +289,13 @@ SRST
         is disabled (dirty-ring-size=0).  When enabled, KVM will instead
         record dirty pages in a bitmap.
 
+        With the TCG accelerator, it controls the size of the per-thread
+        rings in which pages dirtied by vCPUs and devices are recorded during
+        migration, so that migration does not have to scan the whole dirty
+        bitmap on every iteration.  It should be a power of two; pages that
+        do not fit in the rings are found by scanning the bitmap instead.
+        By default the rings are disabled (dirty-ring-size=0).
+
     ``eager-split-size=n``
         KVM implements dirty page logging at the PAGE_SIZE granularity and
         enabling dirty-logging on a huge-page requires breaking it into
@@ -5404,6 +5411,13 @@ SRST
 
         The ``prealloc`` boolean option enables memory preallocation.
 
+        The ``prefault`` boolean option populates the memory in background
+        threads once the guest starts running, instead of before, so that
+        large guests can boot immediately. Memory that the guest already
+        touched is populated first. The progress is reported by the
+        ``query-memdev`` QMP command. It cannot be combined with
+        ``prealloc``.
+
         The ``host-nodes`` option binds the memory range to a list of
         NUMA host nodes.
 
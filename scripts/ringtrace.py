@@ -0,0 +1,154 @@
+#!/usr/bin/env python3
+# SPDX-License-Identifier: GPL-2.0-or-later
+#
+# Merge the per-thread rings of the "ring" trace backend into a trace file
+# in the format of the "simple" backend, which simpletrace.py can format.
+#
+# For help see docs/devel/tracing.rst
+
+import argparse
+import glob
+import heapq
+import struct
+import sys
+
+import simpletrace
+
+# This is the binary format of the QEMU "ring" trace backend, see
+# trace/ring.h.  Like the "simple" format it is not guaranteed to be stable.
+ring_magic = 0x676e6972756d6571
+ring_version = 1
+ring_header_size = 4096
+ring_header_fmt = '=QQQQQQQQ2Q2Q'
+ring_entry_fmt = '=QQII'
+ring_entry_len = struct.calcsize(ring_entry_fmt)
+pad_event_id = 0xffffffffffffffff
+
+
+class RingException(Exception):
+    pass
+
+
+class Ring:
+    """The records of one thread"""
+
+    def __init__(self, path):
+        with open(path, 'rb') as fobj:
+            hdr = self._read_header(fobj, path)
+            fobj.seek(ring_header_size)
+            data = fobj.read(hdr['size'])
+            # Records before the tail may have been overwritten while the
+            # ring was copied, if QEMU is still running
+            tail = max(hdr['tail'], self._read_header(fobj, path)['tail'])
+
+        self.path = path
+        self.pid = hdr['pid']
+        self.tid = hdr['tid']
+        self.lost = hdr['lost']
+        self.calib = list(zip(hdr['calib_ticks'], hdr['calib_ns']))
+        self.records = list(self._parse(data, hdr['size'], tail, hdr['head']))
+
+    @staticmethod
+    def _read_header(fobj, path):
+        fobj.seek(0)
+        buf = fobj.read(struct.calcsize(ring_header_fmt))
+        if len(buf) != struct.calcsize(ring_header_fmt):
+            raise RingException(f'{path}: truncated ring header')
+        fields = struct.unpack(ring_header_fmt, buf)
+        magic, version, size, pid, tid, head, tail, lost = fields[:8]
+        if magic != ring_magic:
+            raise RingException(f'{path}: not a trace ring')
+        if version != ring_version:
+            raise RingException(f'{path}: unknown ring version {version}')
+        return {'size': size, 'pid': pid, 'tid': tid, 'head': head,
+                'tail': tail, 'lost': lost,
+                'calib_ticks': fields[8:10], 'calib_ns': fields[10:12]}
+
+    @staticmethod
+    def _parse(data, size, pos, head):
+        """Yield (ticks, event_id, args) for the records in [pos, head)"""
+        while pos < head:
+            off = pos % size
+            rest = size - off
+            if rest < ring_entry_len:
+                pos += rest
+                continue
+            event_id, ticks, length, _ = \
+                struct.unpack_from(ring_entry_fmt, data, off)
+            if event_id == pad_event_id:
+                pos += rest
+                continue
+            if length < ring_entry_len or length > rest:
+                raise RingException(f'corrupted record at offset {pos}')
+            yield (ticks, event_id, data[off + ring_entry_len:off + length])
+            pos += length
+
+
+def ticks_to_ns(rings):
+    """Return a function that converts host ticks to get_clock() time.
+
+    This uses the earliest and latest calibration points of all rings, and
+    assumes that the tick counter runs at the same constant rate on all
+    host CPUs.
+    """
+    points = [p for ring in rings for p in ring.calib]
+    t0, ns0 = min(points)
+    t1, ns1 = max(points)
+    rate = (ns1 - ns0) / (t1 - t0) if t1 > t0 else 1.0
+    return lambda ticks: ns0 + int((ticks - t0) * rate)
+
+
+def merge(mappings_path, out, use_tid):
+    rings = [Ring(path) for path in sorted(glob.glob(mappings_path + '.*'))]
+    if not rings:
+        raise RingException(f'no rings found for {mappings_path}')
+    to_ns = ticks_to_ns(rings)
+
+    with open(mappings_path, 'rb') as fobj:
+        simpletrace.read_trace_header(fobj)
+        out.write(struct.pack(simpletrace.log_header_fmt,
+                              simpletrace.header_event_id,
+                              simpletrace.header_magic, 4))
+        out.write(fobj.read())
+
+    def records(ring):
+        pid = ring.tid if use_tid else ring.pid
+        if ring.lost and ring.records:
+            count = struct.pack('=Q', ring.lost)
+            yield (ring.records[0][0], simpletrace.dropped_event_id, pid,
+                   count)
+        for ticks, event_id, args in ring.records:
+            yield (ticks, event_id, pid, args)
+
+    for ticks, event_id, pid, args in \
+            heapq.merge(*[records(ring) for ring in rings]):
+        out.write(struct.pack('=Q', simpletrace.record_type_event))
+        out.write(struct.pack(simpletrace.rec_header_fmt, event_id,
+                              to_ns(ticks),
+                              simpletrace.rec_header_fmt_len + len(args),
+                              pid & 0xffffffff))
+        out.write(args)
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description='Merge the rings of the "ring" trace backend into a '
+                    'trace file for simpletrace.py')
+    parser.add_argument('--tid', action='store_true',
+                        help='store thread IDs instead of the process ID '
+                             'in the pid field of the records')
+    parser.add_argument('mappings', metavar='TRACE-FILE.ring',
+                        help='event ID mappings written by QEMU; the rings '
+                             'are read from TRACE-FILE.ring.<tid>')
+    parser.add_argument('output', help='merged trace file')
+    args = parser.parse_args()
+
+    try:
+        with open(args.output, 'wb') as out:
+            merge(args.mappings, out, args.tid)
+    except (OSError, RingException, ValueError) as e:
+        sys.exit(f'{sys.argv[0]}: {e}')
+
+
+if __name__ == '__main__':
+    main()
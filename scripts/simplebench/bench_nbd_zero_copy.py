@@ -0,0 +1,122 @@
+#!/usr/bin/env python3
+#
+# Benchmark qemu-nbd sequential reads with and without --zero-copy
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#
+
+
+import sys
+import os
+import subprocess
+import re
+import json
+import time
+
+import simplebench
+from results_to_text import results_to_text
+
+
+PORT = 10820
+IMAGE_SIZE = '4G'
+
+
+def qemu_img_bench(args):
+    p = subprocess.run(args, stdout=subprocess.PIPE, stderr=subprocess.STDOUT,
+                       universal_newlines=True)
+
+    if p.returncode == 0:
+        try:
+            m = re.search(r'Run completed in (\d+.\d+) seconds.', p.stdout)
+            return {'seconds': float(m.group(1))}
+        except Exception:
+            return {'error': f'failed to parse qemu-img output: {p.stdout}'}
+    else:
+        return {'error': f'qemu-img failed: {p.returncode}: {p.stdout}'}
+
+
+def bench_func(env, case):
+    """
+    Serve case['image'] with qemu-nbd and read it sequentially with
+    qemu-img bench.  Note that zero copy sends over loopback are always
+    copied by the kernel, so @addr should be the address of a real NIC.
+    """
+    args = [env['qemu-nbd-binary'], '-f', 'raw', '-r', '-t', '-e', '8',
+            '-b', case['addr'], '-p', str(PORT), '--cache=none',
+            '--aio=native']
+    if env['zero-copy']:
+        args.append('--zero-copy')
+    args.append(case['image'])
+
+    server = subprocess.Popen(args, stdout=subprocess.DEVNULL,
+                              stderr=subprocess.DEVNULL)
+    try:
+        time.sleep(1)
+        count = case['bytes'] // case['block-size']
+        return qemu_img_bench([env['qemu-img-binary'], 'bench', '-f', 'raw',
+                               '-c', str(count), '-d', '8',
+                               '-s', str(case['block-size']),
+                               f"nbd://{case['addr']}:{PORT}"])
+    finally:
+        server.terminate()
+        server.wait()
+
+
+if __name__ == '__main__':
+    if len(sys.argv) < 5:
+        print(f'USAGE: {sys.argv[0]} <qemu-nbd binary> <qemu-img binary> '
+              'ADDR DIR_PATH')
+        exit(1)
+
+    qemu_nbd, qemu_img, addr, path = sys.argv[1:5]
+
+    image = os.path.join(path, 'nbd-zero-copy-test.raw')
+    subprocess.run([qemu_img, 'create', '-f', 'raw', image, IMAGE_SIZE],
+                   stdout=subprocess.DEVNULL, check=True)
+    # Write real data, holes would be answered without any payload
+    subprocess.run([qemu_img, 'bench', '-w', '-f', 'raw', '-c', '2048',
+                    '-s', '2M', '-P', '0x5a', image],
+                   stdout=subprocess.DEVNULL, check=True)
+
+    envs = [
+        {
+            'id': 'copy',
+            'qemu-nbd-binary': qemu_nbd,
+            'qemu-img-binary': qemu_img,
+            'zero-copy': False
+        },
+        {
+            'id': 'zero-copy',
+            'qemu-nbd-binary': qemu_nbd,
+            'qemu-img-binary': qemu_img,
+            'zero-copy': True
+        }
+    ]
+
+    cases = []
+    for size in (64 * 1024, 1024 * 1024, 4 * 1024 * 1024):
+        cases.append({
+            'id': f'sequential read {size // 1024}k',
+            'block-size': size,
+            'bytes': 4 * 1024 * 1024 * 1024,
+            'image': image,
+            'addr': addr
+        })
+
+    result = simplebench.bench(bench_func, envs, cases, count=3)
+    print(results_to_text(result))
+    with open('results.json', 'w') as f:
+        json.dump(result, f, indent=4)
+
+    os.remove(image)
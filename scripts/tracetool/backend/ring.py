@@ -0,0 +1,93 @@
+# SPDX-License-Identifier: GPL-2.0-or-later
+
+"""
+Per-thread ring buffer built-in backend.
+"""
+
+__maintainer__ = "Stefan Hajnoczi"
+__email__      = "stefanha@redhat.com"
+
+
+from tracetool import out
+from tracetool.backend.simple import is_string
+
+
+PUBLIC = True
+
+
+def generate_h_begin(events, group):
+    for event in events:
+        out('void _ring_%(api)s(%(args)s);',
+            api=event.api(),
+            args=event.args)
+    out('')
+
+
+def generate_h(event, group):
+    event_id = 'TRACE_' + event.name.upper()
+    if "vcpu" in event.properties:
+        # already checked on the generic format code
+        cond = "true"
+    else:
+        cond = "trace_event_get_state(%s)" % event_id
+    out('    if (%(cond)s) {',
+        '        _ring_%(api)s(%(args)s);',
+        '    }',
+        api=event.api(),
+        cond=cond,
+        args=", ".join(event.args.names()))
+
+
+def generate_h_backend_dstate(event, group):
+    out('    trace_event_get_state_dynamic_by_id(%(event_id)s) || \\',
+        event_id="TRACE_" + event.name.upper())
+
+
+def generate_c_begin(events, group):
+    out('#include "qemu/osdep.h"',
+        '#include "trace/control.h"',
+        '#include "trace/ring.h"',
+        '')
+
+
+def generate_c(event, group):
+    out('void _ring_%(api)s(%(args)s)',
+        '{',
+        '    TraceRingRecord rec;',
+        api=event.api(),
+        args=event.args)
+    sizes = []
+    for type_, name in event.args:
+        if is_string(type_):
+            out('    size_t arg%(name)s_len = %(name)s ?',
+                '        MIN(strlen(%(name)s), TRACE_RING_MAX_STRLEN) : 0;',
+                name=name)
+            sizes.append("4 + arg%s_len" % name)
+        else:
+            sizes.append("8")
+    sizestr = " + ".join(sizes)
+    if len(event.args) == 0:
+        sizestr = '0'
+
+    out('',
+        '    if (!trace_ring_record_start(&rec, %(event_obj)s.id,',
+        '                                 %(size_str)s)) {',
+        '        return;',
+        '    }',
+        event_obj=event.api(event.QEMU_EVENT),
+        size_str=sizestr)
+
+    for type_, name in event.args:
+        if is_string(type_):
+            out('    trace_ring_write_str(&rec, %(name)s, arg%(name)s_len);',
+                name=name)
+        elif type_.endswith('*'):
+            out('    trace_ring_write_u64(&rec, (uintptr_t)%(name)s);',
+                name=name)
+        else:
+            out('    trace_ring_write_u64(&rec, (uint64_t)%(name)s);',
+                name=name)
+
+    out('    trace_ring_record_finish(&rec);',
+        '}',
+        '')
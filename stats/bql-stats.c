@@ -0,0 +1,112 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * query-stats provider for the Big QEMU Lock
+ *
+ * The "vm" target reports the totals over all callers of bql_lock(), the
+ * "call-site" target reports each caller separately.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/main-loop.h"
+#include "qemu/module.h"
+#include "qapi/qapi-types-stats.h"
+#include "system/stats.h"
+
+static const StatsDesc bql_stats_desc[] = {
+    STATS_DESC("acquisitions", STATS_TYPE_CUMULATIVE, STATS_DESC_UNIT_NONE,
+               BQLCallSiteStats, acquisitions),
+    STATS_DESC("contended-acquisitions", STATS_TYPE_CUMULATIVE,
+               STATS_DESC_UNIT_NONE, BQLCallSiteStats, contended),
+    STATS_DESC("wait-time", STATS_TYPE_CUMULATIVE, STATS_DESC_UNIT_NS,
+               BQLCallSiteStats, wait_ns),
+    STATS_DESC("max-wait-time", STATS_TYPE_PEAK, STATS_DESC_UNIT_NS,
+               BQLCallSiteStats, max_wait_ns),
+    STATS_DESC_LOG2_HISTOGRAM("wait-time-histogram", STATS_DESC_UNIT_NS,
+                              BQLCallSiteStats, wait_hist.buckets),
+    STATS_DESC("hold-time", STATS_TYPE_CUMULATIVE, STATS_DESC_UNIT_NS,
+               BQLCallSiteStats, hold_ns),
+    STATS_DESC("max-hold-time", STATS_TYPE_PEAK, STATS_DESC_UNIT_NS,
+               BQLCallSiteStats, max_hold_ns),
+    STATS_DESC_LOG2_HISTOGRAM("hold-time-histogram", STATS_DESC_UNIT_NS,
+                              BQLCallSiteStats, hold_hist.buckets),
+};
+
+static void bql_stats_sum(BQLCallSiteStats *total,
+                          const BQLCallSiteStats *site)
+{
+    total->acquisitions += site->acquisitions;
+    total->contended += site->contended;
+    total->wait_ns += site->wait_ns;
+    total->max_wait_ns = MAX(total->max_wait_ns, site->max_wait_ns);
+    total->hold_ns += site->hold_ns;
+    total->max_hold_ns = MAX(total->max_hold_ns, site->max_hold_ns);
+    log2_histogram_merge(&total->wait_hist, &site->wait_hist);
+    log2_histogram_merge(&total->hold_hist, &site->hold_hist);
+}
+
+static StatsList *bql_stats_list(const BQLCallSiteStats *site,
+                                 strList *names)
+{
+    return stats_desc_list(bql_stats_desc, ARRAY_SIZE(bql_stats_desc), site,
+                           names, NULL);
+}
+
+static void bql_stats_cb(StatsResultList **result, StatsTarget target,
+                         strList *names, strList *targets, Error **errp)
+{
+    g_autofree BQLCallSiteStats *sites = NULL;
+    BQLCallSiteStats total = {};
+    StatsList *stats_list;
+    size_t n;
+
+    if (target != STATS_TARGET_VM && target != STATS_TARGET_CALL_SITE) {
+        return;
+    }
+
+    sites = bql_get_call_site_stats(&n);
+    if (target == STATS_TARGET_VM) {
+        for (size_t i = 0; i < n; i++) {
+            bql_stats_sum(&total, &sites[i]);
+        }
+        stats_list = bql_stats_list(&total, names);
+        if (stats_list) {
+            add_stats_entry(result, STATS_PROVIDER_BQL, NULL, stats_list);
+        }
+        return;
+    }
+
+    for (size_t i = 0; i < n; i++) {
+        g_autofree char *call_site = g_strdup_printf("%s:%d", sites[i].file,
+                                                     sites[i].line);
+
+        if (!apply_str_list_filter(call_site, targets)) {
+            continue;
+        }
+        stats_list = bql_stats_list(&sites[i], names);
+        if (stats_list) {
+            add_call_site_stats_entry(result, STATS_PROVIDER_BQL, call_site,
+                                      stats_list);
+        }
+    }
+}
+
+static StatsSchemaValueList *bql_stats_schema_list(void)
+{
+    return stats_desc_schema(bql_stats_desc, ARRAY_SIZE(bql_stats_desc), NULL);
+}
+
+static void bql_stats_schemas_cb(StatsSchemaList **result, Error **errp)
+{
+    add_stats_schema(result, STATS_PROVIDER_BQL, STATS_TARGET_VM,
+                     bql_stats_schema_list());
+    add_stats_schema(result, STATS_PROVIDER_BQL, STATS_TARGET_CALL_SITE,
+                     bql_stats_schema_list());
+}
+
+static void bql_stats_init(void)
+{
+    add_stats_callbacks(STATS_PROVIDER_BQL, bql_stats_cb,
+                        bql_stats_schemas_cb);
+}
+
+stats_init(bql_stats_init);
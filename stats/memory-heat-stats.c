@@ -0,0 +1,42 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * query-stats provider for guest memory heat tracking
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/module.h"
+#include "system/memory-heat.h"
+#include "qapi/qapi-types-stats.h"
+#include "system/stats.h"
+
+static const StatsDesc memory_heat_stats_desc[] = {
+    STATS_DESC("samples", STATS_TYPE_CUMULATIVE, STATS_DESC_UNIT_NONE,
+               MemoryHeatStats, samples),
+    STATS_DESC("written-bytes", STATS_TYPE_INSTANT, STATS_DESC_UNIT_BYTES,
+               MemoryHeatStats, written_bytes),
+    STATS_DESC("accessed-bytes", STATS_TYPE_INSTANT, STATS_DESC_UNIT_BYTES,
+               MemoryHeatStats, accessed_bytes),
+    STATS_DESC_LINEAR_HISTOGRAM("heat-histogram", STATS_DESC_UNIT_BYTES,
+                                MemoryHeatStats, heat_hist,
+                                MEMORY_HEAT_BUCKET_SIZE),
+};
+
+static bool memory_heat_stats_retrieve(void *stats)
+{
+    return memory_heat_get_stats(stats);
+}
+
+static const StatsDescProvider memory_heat_stats_provider = {
+    .provider = STATS_PROVIDER_MEMORY_HEAT,
+    .desc = memory_heat_stats_desc,
+    .n_desc = ARRAY_SIZE(memory_heat_stats_desc),
+    .size = sizeof(MemoryHeatStats),
+    .retrieve = memory_heat_stats_retrieve,
+};
+
+static void memory_heat_stats_init(void)
+{
+    add_stats_desc_provider(&memory_heat_stats_provider);
+}
+
+stats_init(memory_heat_stats_init);
@@ -0,0 +1,46 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * query-stats provider for memory topology updates
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/module.h"
+#include "system/memory.h"
+#include "qapi/qapi-types-stats.h"
+#include "system/stats.h"
+
+static const StatsDesc memory_stats_desc[] = {
+    STATS_DESC("commits", STATS_TYPE_CUMULATIVE, STATS_DESC_UNIT_NONE,
+               MemoryCommitStats, commits),
+    STATS_DESC("flatviews-rebuilt", STATS_TYPE_CUMULATIVE,
+               STATS_DESC_UNIT_NONE, MemoryCommitStats, flatviews_rebuilt),
+    STATS_DESC("flatviews-reused", STATS_TYPE_CUMULATIVE,
+               STATS_DESC_UNIT_NONE, MemoryCommitStats, flatviews_reused),
+    STATS_DESC("commit-time", STATS_TYPE_CUMULATIVE, STATS_DESC_UNIT_NS,
+               MemoryCommitStats, commit_ns),
+    STATS_DESC("max-commit-time", STATS_TYPE_PEAK, STATS_DESC_UNIT_NS,
+               MemoryCommitStats, max_commit_ns),
+    STATS_DESC_LOG2_HISTOGRAM("commit-time-histogram", STATS_DESC_UNIT_NS,
+                              MemoryCommitStats, commit_hist.buckets),
+};
+
+static bool memory_stats_retrieve(void *stats)
+{
+    memory_region_transaction_get_stats(stats);
+    return true;
+}
+
+static const StatsDescProvider memory_stats_provider = {
+    .provider = STATS_PROVIDER_MEMORY,
+    .desc = memory_stats_desc,
+    .n_desc = ARRAY_SIZE(memory_stats_desc),
+    .size = sizeof(MemoryCommitStats),
+    .retrieve = memory_stats_retrieve,
+};
+
+static void memory_stats_init(void)
+{
+    add_stats_desc_provider(&memory_stats_provider);
+}
+
+stats_init(memory_stats_init);
@@ -0,0 +1,48 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * query-stats provider for the call_rcu thread
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/module.h"
+#include "qemu/rcu.h"
+#include "qapi/qapi-types-stats.h"
+#include "system/stats.h"
+
+static const StatsDesc rcu_stats_desc[] = {
+    STATS_DESC("pending", STATS_TYPE_INSTANT, STATS_DESC_UNIT_NONE,
+               RCUCallStats, pending),
+    STATS_DESC("queues", STATS_TYPE_INSTANT, STATS_DESC_UNIT_NONE,
+               RCUCallStats, queues),
+    STATS_DESC("callbacks", STATS_TYPE_CUMULATIVE, STATS_DESC_UNIT_NONE,
+               RCUCallStats, callbacks),
+    STATS_DESC("batches", STATS_TYPE_CUMULATIVE, STATS_DESC_UNIT_NONE,
+               RCUCallStats, batches),
+    STATS_DESC("max-batch", STATS_TYPE_PEAK, STATS_DESC_UNIT_NONE,
+               RCUCallStats, max_batch),
+    STATS_DESC("grace-period-time", STATS_TYPE_CUMULATIVE, STATS_DESC_UNIT_NS,
+               RCUCallStats, gp_ns_total),
+    STATS_DESC("max-grace-period-time", STATS_TYPE_PEAK, STATS_DESC_UNIT_NS,
+               RCUCallStats, gp_ns_max),
+};
+
+static bool rcu_stats_retrieve(void *stats)
+{
+    rcu_call_get_stats(stats);
+    return true;
+}
+
+static const StatsDescProvider rcu_stats_provider = {
+    .provider = STATS_PROVIDER_RCU,
+    .desc = rcu_stats_desc,
+    .n_desc = ARRAY_SIZE(rcu_stats_desc),
+    .size = sizeof(RCUCallStats),
+    .retrieve = rcu_stats_retrieve,
+};
+
+static void rcu_stats_init(void)
+{
+    add_stats_desc_provider(&rcu_stats_provider);
+}
+
+stats_init(rcu_stats_init);
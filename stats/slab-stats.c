@@ -0,0 +1,69 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * query-stats provider for the size-class allocator
+ *
+ * Per-class counters are reported as log2 histograms, where bucket N
+ * counts objects of the 2^N bytes size class.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/module.h"
+#include "qemu/slab.h"
+#include "qapi/qapi-types-stats.h"
+#include "system/stats.h"
+
+#define SLAB_STATS_BUCKETS      (QEMU_SLAB_MAX_SHIFT + 1)
+
+typedef struct SlabStats {
+    uint64_t cached_bytes;
+    uint64_t allocs[SLAB_STATS_BUCKETS];
+    uint64_t frees[SLAB_STATS_BUCKETS];
+    uint64_t heap_allocs[SLAB_STATS_BUCKETS];
+    uint64_t heap_frees[SLAB_STATS_BUCKETS];
+} SlabStats;
+
+static const StatsDesc slab_stats_desc[] = {
+    STATS_DESC("cached-bytes", STATS_TYPE_INSTANT, STATS_DESC_UNIT_BYTES,
+               SlabStats, cached_bytes),
+    STATS_DESC_LOG2_HISTOGRAM("allocations", STATS_DESC_UNIT_NONE,
+                              SlabStats, allocs),
+    STATS_DESC_LOG2_HISTOGRAM("frees", STATS_DESC_UNIT_NONE,
+                              SlabStats, frees),
+    STATS_DESC_LOG2_HISTOGRAM("heap-allocations", STATS_DESC_UNIT_NONE,
+                              SlabStats, heap_allocs),
+    STATS_DESC_LOG2_HISTOGRAM("heap-frees", STATS_DESC_UNIT_NONE,
+                              SlabStats, heap_frees),
+};
+
+static bool slab_stats_retrieve(void *opaque)
+{
+    QemuSlabStats classes[QEMU_SLAB_CLASSES];
+    SlabStats *stats = opaque;
+
+    qemu_slab_get_stats(classes);
+    for (int i = 0; i < QEMU_SLAB_CLASSES; i++) {
+        int bucket = i + QEMU_SLAB_MIN_SHIFT;
+
+        stats->cached_bytes += classes[i].cached * classes[i].size;
+        stats->allocs[bucket] = classes[i].allocs;
+        stats->frees[bucket] = classes[i].frees;
+        stats->heap_allocs[bucket] = classes[i].heap_allocs;
+        stats->heap_frees[bucket] = classes[i].heap_frees;
+    }
+    return true;
+}
+
+static const StatsDescProvider slab_stats_provider = {
+    .provider = STATS_PROVIDER_SLAB,
+    .desc = slab_stats_desc,
+    .n_desc = ARRAY_SIZE(slab_stats_desc),
+    .size = sizeof(SlabStats),
+    .retrieve = slab_stats_retrieve,
+};
+
+static void slab_stats_init(void)
+{
+    add_stats_desc_provider(&slab_stats_provider);
+}
+
+stats_init(slab_stats_init);
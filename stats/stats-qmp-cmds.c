@@ -15,6 +15,7 @@ typedef struct StatsCallbacks {
     StatsProvider provider;
     StatRetrieveFunc *stats_cb;
     SchemaRetrieveFunc *schemas_cb;
+    const StatsDescProvider *desc_provider;
     QTAILQ_ENTRY(StatsCallbacks) next;
 } StatsCallbacks;
 
@@ -25,7 +26,7 @@ void add_stats_callbacks(StatsProvider provider,
                          StatRetrieveFunc *stats_fn,
                          SchemaRetrieveFunc *schemas_fn)
 {
-    StatsCallbacks *entry = g_new(StatsCallbacks, 1);
+    StatsCallbacks *entry = g_new0(StatsCallbacks, 1);
     entry->provider = provider;
     entry->stats_cb = stats_fn;
     entry->schemas_cb = schemas_fn;
@@ -33,6 +34,39 @@ void add_stats_callbacks(StatsProvider provider,
     QTAILQ_INSERT_TAIL(&stats_callbacks, entry, next);
 }
 
+void add_stats_desc_provider(const StatsDescProvider *p)
+{
+    StatsCallbacks *entry = g_new0(StatsCallbacks, 1);
+    entry->provider = p->provider;
+    entry->desc_provider = p;
+
+    QTAILQ_INSERT_TAIL(&stats_callbacks, entry, next);
+}
+
+static void stats_desc_provider_cb(const StatsDescProvider *p,
+                                   StatsResultList **result,
+                                   StatsTarget target, strList *names)
+{
+    g_autofree void *stats = g_malloc0(p->size);
+    StatsList *stats_list;
+
+    if (target != STATS_TARGET_VM || !p->retrieve(stats)) {
+        return;
+    }
+
+    stats_list = stats_desc_list(p->desc, p->n_desc, stats, names, NULL);
+    if (stats_list) {
+        add_stats_entry(result, p->provider, NULL, stats_list);
+    }
+}
+
+static void stats_desc_provider_schemas_cb(const StatsDescProvider *p,
+                                           StatsSchemaList **result)
+{
+    add_stats_schema(result, p->provider, STATS_TARGET_VM,
+                     stats_desc_schema(p->desc, p->n_desc, NULL));
+}
+
 static bool invoke_stats_cb(StatsCallbacks *entry,
                             StatsResultList **stats_results,
                             StatsFilter *filter, StatsRequest *request,
@@ -66,10 +100,25 @@ static bool invoke_stats_cb(StatsCallbacks *entry,
         break;
     case STATS_TARGET_CRYPTODEV:
         break;
+    case STATS_TARGET_CALL_SITE:
+        if (filter->u.call_site.has_call_sites) {
+            if (!filter->u.call_site.call_sites) {
+                /* No targets allowed?  Return no statistics.  */
+                return true;
+            }
+            targets = filter->u.call_site.call_sites;
+        }
+        break;
     default:
         abort();
     }
 
+    if (entry->desc_provider) {
+        stats_desc_provider_cb(entry->desc_provider, stats_results,
+                               filter->target, names);
+        return true;
+    }
+
     entry->stats_cb(stats_results, filter->target, names, targets, errp);
     if (*errp) {
         qapi_free_StatsResultList(*stats_results);
@@ -112,6 +161,13 @@ StatsSchemaList *qmp_query_stats_schemas(bool has_provider,
     StatsCallbacks *entry;
 
     QTAILQ_FOREACH(entry, &stats_callbacks, next) {
+        if (entry->desc_provider) {
+            if (!has_provider || provider == entry->provider) {
+                stats_desc_provider_schemas_cb(entry->desc_provider,
+                                               &stats_results);
+            }
+            continue;
+        }
         if (!has_provider || provider == entry->provider) {
             entry->schemas_cb(&stats_results, errp);
             if (*errp) {
@@ -136,6 +192,19 @@ void add_stats_entry(StatsResultList **stats_results, StatsProvider provider,
     QAPI_LIST_PREPEND(*stats_results, entry);
 }
 
+void add_call_site_stats_entry(StatsResultList **stats_results,
+                               StatsProvider provider, const char *call_site,
+                               StatsList *stats_list)
+{
+    StatsResult *entry = g_new0(StatsResult, 1);
+
+    entry->provider = provider;
+    entry->call_site = g_strdup(call_site);
+    entry->stats = stats_list;
+
+    QAPI_LIST_PREPEND(*stats_results, entry);
+}
+
 void add_stats_schema(StatsSchemaList **schema_results,
                       StatsProvider provider, StatsTarget target,
                       StatsSchemaValueList *stats_list)
@@ -162,3 +231,68 @@ bool apply_str_list_filter(const char *string, strList *list)
     }
     return false;
 }
+
+StatsList *stats_desc_list(const StatsDesc *desc, size_t n, const void *stats,
+                           strList *names, StatsList *list)
+{
+    for (size_t i = n; i-- > 0; ) {
+        const uint64_t *value = (const void *)((const char *)stats +
+                                               desc[i].offset);
+        Stats *s;
+
+        if (!apply_str_list_filter(desc[i].name, names)) {
+            continue;
+        }
+        s = g_new0(Stats, 1);
+        s->name = g_strdup(desc[i].name);
+        s->value = g_new0(StatsValue, 1);
+        if (desc[i].buckets) {
+            uint64List *buckets = NULL;
+
+            for (size_t j = desc[i].buckets; j-- > 0; ) {
+                QAPI_LIST_PREPEND(buckets, value[j]);
+            }
+            s->value->type = QTYPE_QLIST;
+            s->value->u.list = buckets;
+        } else {
+            s->value->type = QTYPE_QNUM;
+            s->value->u.scalar = *value;
+        }
+        QAPI_LIST_PREPEND(list, s);
+    }
+    return list;
+}
+
+StatsSchemaValueList *stats_desc_schema(const StatsDesc *desc, size_t n,
+                                        StatsSchemaValueList *list)
+{
+    for (size_t i = n; i-- > 0; ) {
+        StatsSchemaValue *value = g_new0(StatsSchemaValue, 1);
+
+        value->name = g_strdup(desc[i].name);
+        value->type = desc[i].type;
+        switch (desc[i].unit) {
+        case STATS_DESC_UNIT_NONE:
+            break;
+        case STATS_DESC_UNIT_BYTES:
+            value->has_unit = true;
+            value->unit = STATS_UNIT_BYTES;
+            break;
+        case STATS_DESC_UNIT_NS:
+            value->has_unit = true;
+            value->unit = STATS_UNIT_SECONDS;
+            value->has_base = true;
+            value->base = 10;
+            value->exponent = -9;
+            break;
+        default:
+            g_assert_not_reached();
+        }
+        if (desc[i].type == STATS_TYPE_LINEAR_HISTOGRAM) {
+            value->has_bucket_size = true;
+            value->bucket_size = desc[i].bucket_size;
+        }
+        QAPI_LIST_PREPEND(list, value);
+    }
+    return list;
+}
@@ -37,6 +37,9 @@
 #include "qemu/thread.h"
 #include "qemu/main-loop.h"
 #include "qemu/plugin.h"
+#include "qemu/host-utils.h"
+#include "qemu/timer.h"
+#include "qemu/xxhash.h"
 #include "system/cpus.h"
 #include "qemu/guest-random.h"
 #include "hw/nmi.h"
@@ -69,6 +72,80 @@
 /* The Big QEMU Lock (BQL) */
 static QemuMutex bql;
 
+/*
+ * BQL wait and hold times for each caller of bql_lock().  Like the
+ * variables below, the statistics are only accessed with the BQL held.
+ */
+#define BQL_CALL_SITES 1024
+
+static BQLCallSiteStats *bql_call_sites[BQL_CALL_SITES];
+static unsigned int bql_nr_call_sites;
+
+/* Used once bql_call_sites is 3/4 full */
+static BQLCallSiteStats bql_other_call_site = { .file = "<other>" };
+
+/* Call site and start time of the current BQL critical section */
+static BQLCallSiteStats *bql_holder;
+static int64_t bql_hold_start_ns;
+
+static BQLCallSiteStats *bql_call_site(const char *file, int line)
+{
+    /*
+     * Different translation units may have different copies of @file, so
+     * hash and compare its contents rather than the pointer.
+     */
+    uint32_t hash = qemu_xxhash4(g_str_hash(file), line);
+    BQLCallSiteStats **slot;
+
+    for (;; hash++) {
+        slot = &bql_call_sites[hash % BQL_CALL_SITES];
+        if (!*slot) {
+            break;
+        }
+        if ((*slot)->line == line &&
+            ((*slot)->file == file || !strcmp((*slot)->file, file))) {
+            return *slot;
+        }
+    }
+
+    if (bql_nr_call_sites >= BQL_CALL_SITES / 4 * 3) {
+        return &bql_other_call_site;
+    }
+    *slot = g_new0(BQLCallSiteStats, 1);
+    (*slot)->file = file;
+    (*slot)->line = line;
+    bql_nr_call_sites++;
+    return *slot;
+}
+
+static void bql_stats_add(Log2Histogram *hist, uint64_t *total,
+                          uint64_t *max, int64_t ns)
+{
+    log2_histogram_add(hist, ns);
+    *total += ns;
+    *max = MAX(*max, ns);
+}
+
+/* Start a critical section, with the BQL held */
+static void bql_hold_begin(BQLCallSiteStats *site)
+{
+    bql_holder = site;
+    bql_hold_start_ns = get_clock();
+}
+
+/* End a critical section, with the BQL held, and return its call site */
+static BQLCallSiteStats *bql_hold_end(void)
+{
+    BQLCallSiteStats *site = bql_holder;
+
+    if (site) {
+        bql_stats_add(&site->hold_hist, &site->hold_ns, &site->max_hold_ns,
+                      get_clock() - bql_hold_start_ns);
+        bql_holder = NULL;
+    }
+    return site;
+}
+
 /*
  * The chosen accelerator is supposed to register this.
  */
@@ -432,7 +509,11 @@ void qemu_init_cpu_loop(void)
 
 void run_on_cpu(CPUState *cpu, run_on_cpu_func func, run_on_cpu_data data)
 {
+    /* do_run_on_cpu() waits with the BQL released */
+    BQLCallSiteStats *site = bql_hold_end();
+
     do_run_on_cpu(cpu, func, data, &bql);
+    bql_hold_begin(site);
 }
 
 static void qemu_cpu_stop(CPUState *cpu, bool exit)
@@ -464,7 +545,7 @@ void qemu_wait_io_event(CPUState *cpu)
             slept = true;
             qemu_plugin_vcpu_idle_cb(cpu);
         }
-        qemu_cond_wait(cpu->halt_cond, &bql);
+        qemu_cond_wait_bql(cpu->halt_cond);
     }
     if (slept) {
         qemu_plugin_vcpu_resume_cb(cpu);
@@ -549,6 +630,25 @@ void rust_bql_mock_lock(void)
     abort();
 }
 
+BQLCallSiteStats *bql_get_call_site_stats(size_t *n)
+{
+    BQLCallSiteStats *stats;
+    size_t i = 0;
+
+    assert(bql_locked());
+    stats = g_new(BQLCallSiteStats, bql_nr_call_sites + 1);
+    for (int j = 0; j < BQL_CALL_SITES; j++) {
+        if (bql_call_sites[j]) {
+            stats[i++] = *bql_call_sites[j];
+        }
+    }
+    if (bql_other_call_site.acquisitions) {
+        stats[i++] = bql_other_call_site;
+    }
+    *n = i;
+    return stats;
+}
+
 /*
  * The BQL is taken from so many places that it is worth profiling the
  * callers directly, instead of funneling them all through a single function.
@@ -556,28 +656,57 @@ void rust_bql_mock_lock(void)
 void bql_lock_impl(const char *file, int line)
 {
     QemuMutexLockFunc bql_lock_fn = qatomic_read(&bql_mutex_lock_func);
+    QemuMutexTrylockFunc bql_trylock_fn =
+        qatomic_read(&bql_mutex_trylock_func);
+    BQLCallSiteStats *site;
+    int64_t wait_start_ns = 0;
 
     g_assert(!bql_locked());
-    bql_lock_fn(&bql, file, line);
+
+    /*
+     * Only time the acquisitions that have to wait.  With sync-profile
+     * enabled both functions go through qsp, which still sees every
+     * acquisition.
+     */
+    if (bql_trylock_fn(&bql, file, line)) {
+        wait_start_ns = get_clock();
+        bql_lock_fn(&bql, file, line);
+    }
     set_bql_locked(true);
+
+    site = bql_call_site(file, line);
+    bql_hold_begin(site);
+    site->acquisitions++;
+    if (wait_start_ns) {
+        site->contended++;
+        bql_stats_add(&site->wait_hist, &site->wait_ns, &site->max_wait_ns,
+                      bql_hold_start_ns - wait_start_ns);
+    }
 }
 
 void bql_unlock(void)
 {
     g_assert(bql_locked());
     g_assert(!bql_unlock_blocked);
+    bql_hold_end();
     set_bql_locked(false);
     qemu_mutex_unlock(&bql);
 }
 
 void qemu_cond_wait_bql(QemuCond *cond)
 {
+    BQLCallSiteStats *site = bql_hold_end();
+
     qemu_cond_wait(cond, &bql);
+    bql_hold_begin(site);
 }
 
 void qemu_cond_timedwait_bql(QemuCond *cond, int ms)
 {
+    BQLCallSiteStats *site = bql_hold_end();
+
     qemu_cond_timedwait(cond, &bql, ms);
+    bql_hold_begin(site);
 }
 
 /* signal CPU creation */
@@ -639,7 +768,7 @@ void pause_all_vcpus(void)
     replay_mutex_unlock();
 
     while (!all_vcpus_paused()) {
-        qemu_cond_wait(&qemu_pause_cond, &bql);
+        qemu_cond_wait_bql(&qemu_pause_cond);
         CPU_FOREACH(cpu) {
             qemu_cpu_kick(cpu);
         }
@@ -709,7 +838,7 @@ void qemu_init_vcpu(CPUState *cpu)
     cpus_accel->create_vcpu_thread(cpu);
 
     while (!cpu->created) {
-        qemu_cond_wait(&qemu_cpu_cond, &bql);
+        qemu_cond_wait_bql(&qemu_cpu_cond);
     }
 }
 
@@ -0,0 +1,175 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Dirty page rings for migration
+ *
+ * Each thread that dirties guest memory gets its own ring, so adding a page
+ * takes no locks: the owner thread is the only producer and the migration
+ * thread, which holds dirty_ring_lock while it empties the rings, is the
+ * only consumer.  With MTTCG this means one ring per vCPU; DMA from the
+ * main loop and from IOThreads goes to the rings of those threads.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/atomic.h"
+#include "qemu/bitops.h"
+#include "qemu/bitmap.h"
+#include "qemu/coroutine-tls.h"
+#include "qemu/host-utils.h"
+#include "qemu/lockable.h"
+#include "qemu/notify.h"
+#include "qemu/queue.h"
+#include "qemu/thread.h"
+#include "system/dirty-ring.h"
+#include "trace.h"
+
+typedef struct DirtyRing DirtyRing;
+struct DirtyRing {
+    /* Free-running indices, pages[head & mask] is the next free entry */
+    uint32_t head;
+    uint32_t tail;
+
+    /* Set when the owner thread exits; the collector frees the ring */
+    bool exited;
+
+    QSLIST_ENTRY(DirtyRing) next;
+    Notifier exit_notifier;
+    unsigned long pages[];
+};
+
+typedef struct DirtyRingLocal {
+    DirtyRing *ring;
+
+    /* The thread is exiting, do not create another ring */
+    bool exiting;
+} DirtyRingLocal;
+
+QEMU_DEFINE_STATIC_CO_TLS(DirtyRingLocal, dirty_ring_local);
+
+uint32_t tcg_dirty_ring_size;
+
+/* Pages are missing from the rings, the bitmap must be scanned */
+static bool dirty_ring_incomplete = true;
+
+/* Protects dirty_rings and the tail of the rings */
+static QemuMutex dirty_ring_lock;
+static QSLIST_HEAD(, DirtyRing) dirty_rings =
+    QSLIST_HEAD_INITIALIZER(dirty_rings);
+
+void dirty_ring_init(uint32_t size)
+{
+    assert(is_power_of_2(size));
+    tcg_dirty_ring_size = size;
+}
+
+void dirty_ring_invalidate(void)
+{
+    qatomic_set(&dirty_ring_incomplete, true);
+}
+
+static void dirty_ring_thread_exit(Notifier *n, void *opaque)
+{
+    DirtyRing *ring = container_of(n, DirtyRing, exit_notifier);
+    DirtyRingLocal *local = get_ptr_dirty_ring_local();
+
+    local->ring = NULL;
+    local->exiting = true;
+    qatomic_store_release(&ring->exited, true);
+}
+
+static DirtyRing *dirty_ring_get_local(void)
+{
+    DirtyRingLocal *local = get_ptr_dirty_ring_local();
+    DirtyRing *ring = local->ring;
+
+    if (likely(ring) || local->exiting) {
+        return ring;
+    }
+
+    ring = g_malloc0(sizeof(*ring) +
+                     tcg_dirty_ring_size * sizeof(ring->pages[0]));
+    ring->exit_notifier.notify = dirty_ring_thread_exit;
+    qemu_thread_atexit_add(&ring->exit_notifier);
+    WITH_QEMU_LOCK_GUARD(&dirty_ring_lock) {
+        QSLIST_INSERT_HEAD(&dirty_rings, ring, next);
+    }
+    local->ring = ring;
+    return ring;
+}
+
+static void dirty_ring_push(unsigned long page)
+{
+    DirtyRing *ring = dirty_ring_get_local();
+    uint32_t head;
+
+    if (unlikely(!ring)) {
+        dirty_ring_invalidate();
+        return;
+    }
+
+    head = ring->head;
+    if (unlikely(head - qatomic_load_acquire(&ring->tail) ==
+                 tcg_dirty_ring_size)) {
+        /* Full, leave the page to the next scan of the bitmap */
+        dirty_ring_invalidate();
+        return;
+    }
+    ring->pages[head & (tcg_dirty_ring_size - 1)] = page;
+    qatomic_store_release(&ring->head, head + 1);
+}
+
+void dirty_ring_set_dirty(unsigned long *bitmap, unsigned long offset,
+                          unsigned long nr, unsigned long page)
+{
+    unsigned long i;
+
+    /* Large ranges would only fill the ring, scan the bitmap instead */
+    if (nr > tcg_dirty_ring_size / 4) {
+        bitmap_set_atomic(bitmap, offset, nr);
+        dirty_ring_invalidate();
+        return;
+    }
+
+    for (i = 0; i < nr; i++) {
+        unsigned long *p = bitmap + BIT_WORD(offset + i);
+        unsigned long mask = BIT_MASK(offset + i);
+
+        if (!(qatomic_read(p) & mask) &&
+            !(qatomic_fetch_or(p, mask) & mask)) {
+            dirty_ring_push(page + i);
+        }
+    }
+}
+
+bool dirty_ring_collect(DirtyRingFunc *func, void *opaque)
+{
+    bool complete = !qatomic_xchg(&dirty_ring_incomplete, false);
+    DirtyRing *ring, *next_ring;
+    uint64_t pages = 0;
+
+    QEMU_LOCK_GUARD(&dirty_ring_lock);
+    QSLIST_FOREACH_SAFE(ring, &dirty_rings, next, next_ring) {
+        /* Read exited first, the owner does not push after setting it */
+        bool exited = qatomic_load_acquire(&ring->exited);
+        uint32_t head = qatomic_load_acquire(&ring->head);
+        uint32_t tail;
+
+        for (tail = ring->tail; tail != head; tail++) {
+            func(ring->pages[tail & (tcg_dirty_ring_size - 1)], opaque);
+        }
+        pages += head - ring->tail;
+        qatomic_store_release(&ring->tail, head);
+
+        if (exited) {
+            QSLIST_REMOVE(&dirty_rings, ring, DirtyRing, next);
+            g_free(ring);
+        }
+    }
+
+    trace_dirty_ring_collect(pages, complete);
+    return complete;
+}
+
+static void __attribute__((constructor)) dirty_ring_init_lock(void)
+{
+    qemu_mutex_init(&dirty_ring_lock);
+}
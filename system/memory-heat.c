@@ -0,0 +1,553 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Guest memory heat tracking
+ *
+ * Writes are found in the DIRTY_MEMORY_MIGRATION bitmap, which has no other
+ * user while dirty tracking is enabled only for GLOBAL_DIRTY_HEAT.  While
+ * migration or dirty rate measurement is running the sampler leaves the
+ * bitmap alone, and only tracks accesses until it is the only user again.
+ *
+ * Accesses are found with the page idle tracking of Linux.  In every period
+ * one page of each chunk is marked idle, and checked in the next period: the
+ * kernel clears the idle flag when the page is accessed, including by the
+ * guest through the secondary page tables of KVM.  This needs CAP_SYS_ADMIN,
+ * without which /proc/self/pagemap does not expose physical frame numbers.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/lockable.h"
+#include "qemu/main-loop.h"
+#include "qemu/queue.h"
+#include "qemu/rcu.h"
+#include "qemu/thread.h"
+#include "qemu/units.h"
+#include "qapi/error.h"
+#include "qapi/qapi-commands-machine.h"
+#include "system/memory.h"
+#include "system/memory-heat.h"
+#include "system/ramblock.h"
+#include "system/runstate.h"
+#include "trace.h"
+
+#define MEMORY_HEAT_DEFAULT_PERIOD      1000
+#define MEMORY_HEAT_DEFAULT_GRANULARITY (2 * MiB)
+
+/* Heat added to a chunk that was written, or only accessed, in a period */
+#define MEMORY_HEAT_WRITTEN             128
+#define MEMORY_HEAT_ACCESSED            64
+
+/* Fields of /proc/self/pagemap entries */
+#define PAGEMAP_PRESENT                 (1ULL << 63)
+#define PAGEMAP_PFN_MASK                ((1ULL << 55) - 1)
+
+typedef struct MemoryHeatBlock {
+    char *id;
+    uint64_t size;
+    uint64_t nr_chunks;
+
+    /* Written by the sampler thread with memory_heat.lock held */
+    uint8_t *heat;
+
+    /* Only used by the sampler thread */
+    uint8_t *next_heat;
+    RAMBlock *rb;
+    DirtyBitmapSnapshot *snap;
+    bool primed;
+
+    QLIST_ENTRY(MemoryHeatBlock) next;
+} MemoryHeatBlock;
+
+typedef struct MemoryHeat {
+    /* Protected by the BQL */
+    bool started;
+    bool running;
+    uint32_t period;
+    uint64_t granularity;
+
+    QemuThread thread;
+    QemuSemaphore sem;
+    bool stopping;
+
+    /* Only used by the sampler thread */
+    int pagemap_fd;
+    int idle_fd;
+    uint32_t round;
+    bool written_primed;
+
+    QemuMutex lock;
+    /* Protected by lock */
+    QLIST_HEAD(, MemoryHeatBlock) blocks;
+    MemoryHeatStats stats;
+    bool written_tracking;
+    bool accessed_tracking;
+} MemoryHeat;
+
+static MemoryHeat memory_heat = {
+    .pagemap_fd = -1,
+    .idle_fd = -1,
+};
+
+#ifdef CONFIG_LINUX
+static void memory_heat_close_idle(MemoryHeat *mh)
+{
+    if (mh->pagemap_fd >= 0) {
+        close(mh->pagemap_fd);
+        mh->pagemap_fd = -1;
+    }
+    if (mh->idle_fd >= 0) {
+        close(mh->idle_fd);
+        mh->idle_fd = -1;
+    }
+}
+
+static void memory_heat_open_idle(MemoryHeat *mh)
+{
+    mh->pagemap_fd = open("/proc/self/pagemap", O_RDONLY | O_CLOEXEC);
+    mh->idle_fd = open("/sys/kernel/mm/page_idle/bitmap", O_RDWR | O_CLOEXEC);
+    if (mh->pagemap_fd < 0 || mh->idle_fd < 0) {
+        memory_heat_close_idle(mh);
+    }
+}
+
+static int memory_heat_pread(int fd, uint64_t *val, off_t offset)
+{
+    ssize_t ret = pread(fd, val, sizeof(*val), offset);
+
+    if (ret != sizeof(*val)) {
+        return ret < 0 ? -errno : -EIO;
+    }
+    return 0;
+}
+
+/*
+ * If @check, return 1 if the page at @host was accessed since it was marked
+ * idle and 0 otherwise.  Then mark the page idle again.
+ */
+static int memory_heat_page_idle(MemoryHeat *mh, uint8_t *host, bool check)
+{
+    uint64_t entry, pfn, word, mask;
+    int accessed = 0;
+    off_t offset;
+    int ret;
+
+    offset = (uintptr_t)host / qemu_real_host_page_size() * sizeof(entry);
+    ret = memory_heat_pread(mh->pagemap_fd, &entry, offset);
+    if (ret < 0) {
+        return ret;
+    }
+    if (!(entry & PAGEMAP_PRESENT)) {
+        /* Never touched, or swapped out since it was marked */
+        return 0;
+    }
+    pfn = entry & PAGEMAP_PFN_MASK;
+    if (!pfn) {
+        /* Frame numbers are hidden without CAP_SYS_ADMIN */
+        return -EPERM;
+    }
+
+    offset = pfn / 64 * sizeof(word);
+    mask = 1ULL << (pfn % 64);
+    if (check) {
+        ret = memory_heat_pread(mh->idle_fd, &word, offset);
+        if (ret < 0) {
+            return ret;
+        }
+        accessed = !(word & mask);
+    }
+    if (pwrite(mh->idle_fd, &mask, sizeof(mask), offset) != sizeof(mask)) {
+        return -errno;
+    }
+    return accessed;
+}
+
+/* Spread the pages checked in consecutive periods over the chunk */
+static uint8_t *memory_heat_sample_page(uint8_t *host, uint64_t len,
+                                        uint32_t round)
+{
+    uint64_t npages = len / qemu_real_host_page_size();
+
+    return host + (round * 0x9e3779b1ULL) % npages *
+                  qemu_real_host_page_size();
+}
+
+/*
+ * Check the page of the chunk that was marked idle in the previous period,
+ * and mark the one to check in the next period.
+ */
+static bool memory_heat_chunk_accessed(MemoryHeat *mh, uint8_t *host,
+                                       uint64_t len, bool check)
+{
+    int accessed = 0;
+    int ret = 0;
+
+    if (check) {
+        accessed = memory_heat_page_idle(mh, memory_heat_sample_page(
+                                             host, len, mh->round), true);
+    }
+    if (accessed >= 0) {
+        ret = memory_heat_page_idle(mh, memory_heat_sample_page(
+                                        host, len, mh->round + 1), false);
+    }
+    if (accessed < 0 || ret < 0) {
+        trace_memory_heat_idle_error(accessed < 0 ? accessed : ret);
+        memory_heat_close_idle(mh);
+        return false;
+    }
+    return accessed;
+}
+#else
+static void memory_heat_close_idle(MemoryHeat *mh)
+{
+}
+
+static void memory_heat_open_idle(MemoryHeat *mh)
+{
+}
+
+static bool memory_heat_chunk_accessed(MemoryHeat *mh, uint8_t *host,
+                                       uint64_t len, bool check)
+{
+    g_assert_not_reached();
+}
+#endif
+
+static void memory_heat_free_block(MemoryHeatBlock *blk)
+{
+    g_free(blk->id);
+    g_free(blk->heat);
+    g_free(blk->next_heat);
+    g_free(blk);
+}
+
+static void memory_heat_free_blocks(MemoryHeat *mh)
+{
+    MemoryHeatBlock *blk, *next_blk;
+
+    QEMU_LOCK_GUARD(&mh->lock);
+    QLIST_FOREACH_SAFE(blk, &mh->blocks, next, next_blk) {
+        QLIST_REMOVE(blk, next);
+        memory_heat_free_block(blk);
+    }
+}
+
+/* Called with the BQL held */
+static MemoryHeatBlock *memory_heat_get_block(MemoryHeat *mh, RAMBlock *rb)
+{
+    MemoryHeatBlock *blk, *last = NULL;
+    const char *id = rb->idstr;
+
+    /* Memory backends that are not used by the machine have no idstr */
+    if (!id[0]) {
+        id = memory_region_name(rb->mr);
+    }
+
+    QLIST_FOREACH(blk, &mh->blocks, next) {
+        if (!blk->rb && blk->size == rb->used_length && !strcmp(blk->id, id)) {
+            return blk;
+        }
+        last = blk;
+    }
+
+    blk = g_new0(MemoryHeatBlock, 1);
+    blk->id = g_strdup(id);
+    blk->size = rb->used_length;
+    blk->nr_chunks = DIV_ROUND_UP(blk->size, mh->granularity);
+    blk->heat = g_malloc0(blk->nr_chunks);
+    blk->next_heat = g_malloc0(blk->nr_chunks);
+
+    QEMU_LOCK_GUARD(&mh->lock);
+    if (last) {
+        QLIST_INSERT_AFTER(last, blk, next);
+    } else {
+        QLIST_INSERT_HEAD(&mh->blocks, blk, next);
+    }
+    return blk;
+}
+
+static void memory_heat_sample_block(MemoryHeat *mh, MemoryHeatBlock *blk,
+                                     bool accessed_tracking,
+                                     MemoryHeatStats *stats)
+{
+    RAMBlock *rb = blk->rb;
+    uint64_t i;
+
+    /* Hugetlbfs pages are not on the LRU lists and never become idle */
+    accessed_tracking &= qemu_ram_pagesize(rb) == qemu_real_host_page_size();
+
+    for (i = 0; i < blk->nr_chunks; i++) {
+        uint64_t offset = i * mh->granularity;
+        uint64_t len = MIN(mh->granularity, blk->size - offset);
+        bool written = false, accessed = false;
+        uint8_t heat;
+
+        if (blk->snap) {
+            written = memory_region_snapshot_get_dirty(rb->mr, blk->snap,
+                                                       offset, len);
+        }
+        if (accessed_tracking) {
+            accessed = memory_heat_chunk_accessed(mh, rb->host + offset, len,
+                                                  blk->primed);
+            accessed_tracking = mh->idle_fd >= 0;
+        }
+        if (!blk->primed) {
+            written = accessed = false;
+        }
+
+        heat = blk->heat[i] >> 1;
+        if (written) {
+            heat += MEMORY_HEAT_WRITTEN;
+            stats->written_bytes += len;
+            stats->accessed_bytes += len;
+        } else if (accessed) {
+            heat += MEMORY_HEAT_ACCESSED;
+            stats->accessed_bytes += len;
+        }
+        blk->next_heat[i] = heat;
+        stats->heat_hist[heat / MEMORY_HEAT_BUCKET_SIZE] += len;
+    }
+    blk->primed = true;
+}
+
+static void memory_heat_sample(MemoryHeat *mh)
+{
+    MemoryHeatStats stats = { };
+    MemoryHeatBlock *blk, *next_blk;
+    bool written_tracking;
+    uint8_t *heat;
+    RAMBlock *rb;
+
+    bql_lock();
+    if (!runstate_is_running() || qatomic_read(&mh->stopping)) {
+        bql_unlock();
+        return;
+    }
+
+    /* Do not steal the bits of migration and dirty rate measurement */
+    written_tracking = !(global_dirty_tracking & ~GLOBAL_DIRTY_HEAT);
+
+    /* RAM blocks stay valid until the whole period has been sampled */
+    rcu_read_lock();
+    RAMBLOCK_FOREACH(rb) {
+        if (!rb->host) {
+            continue;
+        }
+        blk = memory_heat_get_block(mh, rb);
+        blk->rb = rb;
+        if (written_tracking) {
+            blk->snap = memory_region_snapshot_and_clear_dirty(
+                rb->mr, 0, blk->size, DIRTY_MEMORY_MIGRATION);
+        }
+    }
+    bql_unlock();
+
+    /* Writes before the first snapshot are stale, only clear the bitmap */
+    if (!mh->written_primed) {
+        QLIST_FOREACH(blk, &mh->blocks, next) {
+            g_clear_pointer(&blk->snap, g_free);
+        }
+    }
+
+    QLIST_FOREACH(blk, &mh->blocks, next) {
+        if (blk->rb) {
+            memory_heat_sample_block(mh, blk, mh->idle_fd >= 0, &stats);
+            g_clear_pointer(&blk->snap, g_free);
+        }
+    }
+    rcu_read_unlock();
+
+    mh->written_primed = written_tracking;
+    mh->round++;
+
+    WITH_QEMU_LOCK_GUARD(&mh->lock) {
+        QLIST_FOREACH_SAFE(blk, &mh->blocks, next, next_blk) {
+            if (!blk->rb) {
+                /* The RAM block was removed or resized */
+                QLIST_REMOVE(blk, next);
+                memory_heat_free_block(blk);
+                continue;
+            }
+            blk->rb = NULL;
+            heat = blk->heat;
+            blk->heat = blk->next_heat;
+            blk->next_heat = heat;
+        }
+        stats.samples = mh->stats.samples + 1;
+        mh->stats = stats;
+        mh->written_tracking = written_tracking;
+        mh->accessed_tracking = mh->idle_fd >= 0;
+    }
+
+    trace_memory_heat_sample(stats.samples, written_tracking,
+                             stats.written_bytes, stats.accessed_bytes);
+}
+
+/* Reap the sampler thread once it has stopped sampling */
+static void memory_heat_stopped_bh(void *opaque)
+{
+    MemoryHeat *mh = opaque;
+
+    qemu_thread_join(&mh->thread);
+    qemu_sem_destroy(&mh->sem);
+    memory_heat_close_idle(mh);
+    mh->running = false;
+    trace_memory_heat_stop();
+}
+
+static void *memory_heat_thread(void *opaque)
+{
+    MemoryHeat *mh = opaque;
+
+    rcu_register_thread();
+    for (;;) {
+        qemu_sem_timedwait(&mh->sem, mh->period);
+        if (qatomic_read(&mh->stopping)) {
+            break;
+        }
+        memory_heat_sample(mh);
+    }
+    rcu_unregister_thread();
+
+    /* Only the main loop may join the thread, without waiting for the BQL */
+    aio_bh_schedule_oneshot(qemu_get_aio_context(), memory_heat_stopped_bh,
+                            mh);
+    return NULL;
+}
+
+bool memory_heat_get_stats(MemoryHeatStats *stats)
+{
+    MemoryHeat *mh = &memory_heat;
+
+    if (!mh->started) {
+        return false;
+    }
+
+    QEMU_LOCK_GUARD(&mh->lock);
+    *stats = mh->stats;
+    return true;
+}
+
+void qmp_memory_heat_start(bool has_period, uint32_t period,
+                           bool has_granularity, uint64_t granularity,
+                           Error **errp)
+{
+    MemoryHeat *mh = &memory_heat;
+
+    if (mh->running) {
+        error_setg(errp, mh->stopping ?
+                   "Memory heat tracking is still stopping" :
+                   "Memory heat tracking is already running");
+        return;
+    }
+    if (!has_period) {
+        period = MEMORY_HEAT_DEFAULT_PERIOD;
+    } else if (!period) {
+        error_setg(errp, "Parameter 'period' must be greater than 0");
+        return;
+    }
+    if (!has_granularity) {
+        granularity = MEMORY_HEAT_DEFAULT_GRANULARITY;
+    } else if (!is_power_of_2(granularity) ||
+               granularity < qemu_real_host_page_size()) {
+        error_setg(errp, "Parameter 'granularity' must be a power of two "
+                   "and at least the host page size");
+        return;
+    }
+
+    if (!memory_global_dirty_log_start(GLOBAL_DIRTY_HEAT, errp)) {
+        return;
+    }
+
+    memory_heat_free_blocks(mh);
+    mh->period = period;
+    mh->granularity = granularity;
+    mh->round = 0;
+    mh->written_primed = false;
+    memory_heat_open_idle(mh);
+    WITH_QEMU_LOCK_GUARD(&mh->lock) {
+        memset(&mh->stats, 0, sizeof(mh->stats));
+        mh->written_tracking = false;
+        mh->accessed_tracking = mh->idle_fd >= 0;
+    }
+
+    trace_memory_heat_start(period, granularity, mh->idle_fd >= 0);
+    mh->started = true;
+    mh->running = true;
+    mh->stopping = false;
+    qemu_sem_init(&mh->sem, 0);
+    qemu_thread_create(&mh->thread, "memory-heat", memory_heat_thread, mh,
+                       QEMU_THREAD_JOINABLE);
+}
+
+void qmp_memory_heat_stop(Error **errp)
+{
+    MemoryHeat *mh = &memory_heat;
+
+    if (!mh->running || mh->stopping) {
+        error_setg(errp, "Memory heat tracking is not running");
+        return;
+    }
+
+    /*
+     * The thread takes the BQL to sample guest memory, so it cannot be
+     * joined here.  Once it sees @stopping under the BQL it does not sample
+     * again, and memory_heat_stopped_bh() reaps it.
+     */
+    qatomic_set(&mh->stopping, true);
+    qemu_sem_post(&mh->sem);
+    memory_global_dirty_log_stop(GLOBAL_DIRTY_HEAT);
+}
+
+MemoryHeatInfo *qmp_query_memory_heat(const char *id, Error **errp)
+{
+    MemoryHeat *mh = &memory_heat;
+    RAMBlockHeatList **tail;
+    MemoryHeatBlock *blk;
+    MemoryHeatInfo *info;
+    bool found = false;
+
+    if (!mh->started) {
+        error_setg(errp, "Memory heat tracking was never started");
+        return NULL;
+    }
+
+    info = g_new0(MemoryHeatInfo, 1);
+    info->active = mh->running && !mh->stopping;
+    info->period = mh->period;
+    info->granularity = mh->granularity;
+    tail = &info->blocks;
+
+    QEMU_LOCK_GUARD(&mh->lock);
+    info->samples = mh->stats.samples;
+    info->written_tracking = mh->written_tracking;
+    info->accessed_tracking = mh->accessed_tracking;
+    QLIST_FOREACH(blk, &mh->blocks, next) {
+        RAMBlockHeat *value;
+        uint8List **heat_tail;
+
+        if (id && strcmp(id, blk->id)) {
+            continue;
+        }
+        found = true;
+
+        value = g_new0(RAMBlockHeat, 1);
+        value->id = g_strdup(blk->id);
+        value->size = blk->size;
+        heat_tail = &value->heat;
+        for (uint64_t i = 0; i < blk->nr_chunks; i++) {
+            QAPI_LIST_APPEND(heat_tail, blk->heat[i]);
+        }
+        QAPI_LIST_APPEND(tail, value);
+    }
+
+    if (id && !found) {
+        error_setg(errp, "RAM block '%s' not found", id);
+        qapi_free_MemoryHeatInfo(info);
+        return NULL;
+    }
+    return info;
+}
+
+static void __attribute__((constructor)) memory_heat_init_lock(void)
+{
+    qemu_mutex_init(&memory_heat.lock);
+}
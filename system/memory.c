@@ -20,8 +20,10 @@
 #include "qapi/visitor.h"
 #include "qemu/bitops.h"
 #include "qemu/error-report.h"
+#include "qemu/host-utils.h"
 #include "qemu/main-loop.h"
 #include "qemu/qemu-print.h"
+#include "qemu/timer.h"
 #include "qom/object.h"
 #include "trace.h"
 #include "system/ram_addr.h"
@@ -42,6 +44,9 @@ static bool memory_region_update_pending;
 static bool ioeventfd_update_pending;
 unsigned int global_dirty_tracking;
 
+/* Protected by the BQL */
+static MemoryCommitStats memory_commit_stats;
+
 static QTAILQ_HEAD(, MemoryListener) memory_listeners
     = QTAILQ_HEAD_INITIALIZER(memory_listeners);
 
@@ -256,6 +261,21 @@ static bool flatrange_equal(FlatRange *a, FlatRange *b)
         && a->unmergeable == b->unmergeable;
 }
 
+/* Like flatrange_equal(), but also compare the dirty logging mask */
+static bool flatview_ranges_equal(const FlatView *a, const FlatView *b)
+{
+    if (a->nr != b->nr) {
+        return false;
+    }
+    for (unsigned i = 0; i < a->nr; i++) {
+        if (!flatrange_equal(&a->ranges[i], &b->ranges[i]) ||
+            a->ranges[i].dirty_log_mask != b->ranges[i].dirty_log_mask) {
+            return false;
+        }
+    }
+    return true;
+}
+
 static FlatView *flatview_new(MemoryRegion *mr_root)
 {
     FlatView *view;
@@ -538,8 +558,12 @@ static MemTxResult access_with_adjusted_size(hwaddr addr,
         access_size_max = 4;
     }
 
-    /* Do not allow more than one simultaneous access to a device's IO Regions */
+    /*
+     * Do not allow more than one simultaneous access to a device's IO Regions.
+     * The guard is protected by the BQL, lockless accesses do not use it.
+     */
     if (mr->dev && !mr->disable_reentrancy_guard &&
+        (!mr->lockless_io || bql_locked()) &&
         !mr->ram_device && !mr->ram && !mr->rom_device && !mr->readonly) {
         if (mr->dev->mem_reentrancy_guard.engaged_in_io) {
             warn_report_once("Blocked re-entrant IO on MemoryRegion: "
@@ -740,8 +764,18 @@ static MemoryRegion *memory_region_get_flatview_root(MemoryRegion *mr)
     return NULL;
 }
 
-/* Render a memory topology into a list of disjoint absolute ranges. */
-static FlatView *generate_memory_topology(MemoryRegion *mr)
+/*
+ * Render a memory topology into a list of disjoint absolute ranges.
+ *
+ * If the result has exactly the same ranges as @old_view, @old_view is
+ * used again.  This saves rebuilding its dispatch tree, and lets
+ * address_space_set_flatview() skip the diff against the old topology.
+ * Most commits only change a few of the views, for example the one for
+ * system memory when a BAR moves, while the views of IOMMU address spaces
+ * and of devices with bus mastering disabled stay the same.
+ */
+static FlatView *generate_memory_topology(MemoryRegion *mr,
+                                          FlatView *old_view)
 {
     int i;
     FlatView *view;
@@ -755,6 +789,17 @@ static FlatView *generate_memory_topology(MemoryRegion *mr)
     }
     flatview_simplify(view);
 
+    if (old_view && flatview_ranges_equal(old_view, view)) {
+        /* @view was never visible to anyone, free it right away */
+        flatview_destroy(view);
+        trace_flatview_reuse(old_view, mr);
+        memory_commit_stats.flatviews_reused++;
+        flatview_ref(old_view);
+        g_hash_table_replace(flat_views, mr, old_view);
+        return old_view;
+    }
+
+    memory_commit_stats.flatviews_rebuilt++;
     view->dispatch = address_space_dispatch_new(view);
     for (i = 0; i < view->nr; i++) {
         MemoryRegionSection mrs =
@@ -1044,7 +1089,7 @@ static void flatviews_init(void)
     flat_views = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL,
                                        (GDestroyNotify) flatview_unref);
     if (!empty_view) {
-        empty_view = generate_memory_topology(NULL);
+        empty_view = generate_memory_topology(NULL, NULL);
         /* We keep it alive forever in the global variable.  */
         flatview_ref(empty_view);
     } else {
@@ -1055,12 +1100,10 @@ static void flatviews_init(void)
 
 static void flatviews_reset(void)
 {
+    g_autoptr(GHashTable) old_views = flat_views;
     AddressSpace *as;
 
-    if (flat_views) {
-        g_hash_table_unref(flat_views);
-        flat_views = NULL;
-    }
+    flat_views = NULL;
     flatviews_init();
 
     /* Render unique FVs */
@@ -1071,7 +1114,27 @@ static void flatviews_reset(void)
             continue;
         }
 
-        generate_memory_topology(physmr);
+        generate_memory_topology(physmr, old_views ?
+                                 g_hash_table_lookup(old_views, physmr) :
+                                 NULL);
+    }
+}
+
+/*
+ * Listeners such as vhost rebuild their list of sections from scratch on
+ * every commit, so they must hear about the ranges of a view that was
+ * reused by generate_memory_topology().
+ */
+static void address_space_update_topology_nop(AddressSpace *as,
+                                              const FlatView *view)
+{
+    FlatRange *fr;
+
+    if (QTAILQ_EMPTY(&as->listeners)) {
+        return;
+    }
+    FOR_EACH_FLAT_RANGE(fr, view) {
+        MEMORY_LISTENER_UPDATE_REGION(fr, as, Forward, region_nop);
     }
 }
 
@@ -1126,11 +1189,28 @@ static void address_space_update_topology(AddressSpace *as)
 
     flatviews_init();
     if (!g_hash_table_lookup(flat_views, physmr)) {
-        generate_memory_topology(physmr);
+        generate_memory_topology(physmr, NULL);
     }
     address_space_set_flatview(as);
 }
 
+static void memory_region_transaction_account(int64_t ns)
+{
+    MemoryCommitStats *stats = &memory_commit_stats;
+
+    stats->commits++;
+    log2_histogram_add(&stats->commit_hist, ns);
+    stats->commit_ns += ns;
+    stats->max_commit_ns = MAX(stats->max_commit_ns, ns);
+    trace_memory_region_transaction_commit(ns);
+}
+
+void memory_region_transaction_get_stats(MemoryCommitStats *stats)
+{
+    assert(bql_locked());
+    *stats = memory_commit_stats;
+}
+
 void memory_region_transaction_begin(void)
 {
     qemu_flush_coalesced_mmio_buffer();
@@ -1147,17 +1227,26 @@ void memory_region_transaction_commit(void)
     --memory_region_transaction_depth;
     if (!memory_region_transaction_depth) {
         if (memory_region_update_pending) {
+            int64_t start_ns = get_clock();
+
             flatviews_reset();
 
             MEMORY_LISTENER_CALL_GLOBAL(begin, Forward);
 
             QTAILQ_FOREACH(as, &address_spaces, address_spaces_link) {
+                FlatView *old_view = address_space_to_flatview(as);
+
                 address_space_set_flatview(as);
+                if (address_space_to_flatview(as) == old_view) {
+                    address_space_update_topology_nop(as, old_view);
+                }
                 address_space_update_ioeventfds(as);
             }
             memory_region_update_pending = false;
             ioeventfd_update_pending = false;
             MEMORY_LISTENER_CALL_GLOBAL(commit, Forward);
+
+            memory_region_transaction_account(get_clock() - start_ns);
         } else if (ioeventfd_update_pending) {
             QTAILQ_FOREACH(as, &address_spaces, address_spaces_link) {
                 address_space_update_ioeventfds(as);
@@ -1460,6 +1549,14 @@ static MemTxResult memory_region_dispatch_read1(MemoryRegion *mr,
     }
 }
 
+/* Take the BQL for accesses to lockless regions that need it */
+static bool memory_region_access_needs_bql(MemoryRegion *mr, hwaddr addr,
+                                           unsigned size, bool is_write)
+{
+    return mr->lockless_io && mr->ops->needs_bql && !bql_locked() &&
+           mr->ops->needs_bql(mr->opaque, addr, size, is_write);
+}
+
 MemTxResult memory_region_dispatch_read(MemoryRegion *mr,
                                         hwaddr addr,
                                         uint64_t *pval,
@@ -1479,7 +1576,12 @@ MemTxResult memory_region_dispatch_read(MemoryRegion *mr,
         return MEMTX_DECODE_ERROR;
     }
 
-    r = memory_region_dispatch_read1(mr, addr, pval, size, attrs);
+    if (memory_region_access_needs_bql(mr, addr, size, false)) {
+        BQL_LOCK_GUARD();
+        r = memory_region_dispatch_read1(mr, addr, pval, size, attrs);
+    } else {
+        r = memory_region_dispatch_read1(mr, addr, pval, size, attrs);
+    }
     adjust_endianness(mr, pval, op);
     return r;
 }
@@ -1510,6 +1612,28 @@ static bool memory_region_dispatch_write_eventfds(MemoryRegion *mr,
     return false;
 }
 
+static MemTxResult memory_region_dispatch_write1(MemoryRegion *mr,
+                                                 hwaddr addr,
+                                                 uint64_t data,
+                                                 unsigned size,
+                                                 MemTxAttrs attrs)
+{
+    if (mr->ops->write) {
+        return access_with_adjusted_size(addr, &data, size,
+                                         mr->ops->impl.min_access_size,
+                                         mr->ops->impl.max_access_size,
+                                         memory_region_write_accessor, mr,
+                                         attrs);
+    } else {
+        return
+            access_with_adjusted_size(addr, &data, size,
+                                      mr->ops->impl.min_access_size,
+                                      mr->ops->impl.max_access_size,
+                                      memory_region_write_with_attrs_accessor,
+                                      mr, attrs);
+    }
+}
+
 MemTxResult memory_region_dispatch_write(MemoryRegion *mr,
                                          hwaddr addr,
                                          uint64_t data,
@@ -1540,20 +1664,11 @@ MemTxResult memory_region_dispatch_write(MemoryRegion *mr,
         return MEMTX_OK;
     }
 
-    if (mr->ops->write) {
-        return access_with_adjusted_size(addr, &data, size,
-                                         mr->ops->impl.min_access_size,
-                                         mr->ops->impl.max_access_size,
-                                         memory_region_write_accessor, mr,
-                                         attrs);
-    } else {
-        return
-            access_with_adjusted_size(addr, &data, size,
-                                      mr->ops->impl.min_access_size,
-                                      mr->ops->impl.max_access_size,
-                                      memory_region_write_with_attrs_accessor,
-                                      mr, attrs);
+    if (memory_region_access_needs_bql(mr, addr, size, true)) {
+        BQL_LOCK_GUARD();
+        return memory_region_dispatch_write1(mr, addr, data, size, attrs);
     }
+    return memory_region_dispatch_write1(mr, addr, data, size, attrs);
 }
 
 void memory_region_init_io(MemoryRegion *mr,
@@ -2558,6 +2673,11 @@ void memory_region_clear_flush_coalesced(MemoryRegion *mr)
     }
 }
 
+void memory_region_enable_lockless_io(MemoryRegion *mr)
+{
+    mr->lockless_io = true;
+}
+
 void memory_region_add_eventfd(MemoryRegion *mr,
                                hwaddr addr,
                                unsigned size,
@@ -2962,6 +3082,11 @@ bool memory_global_dirty_log_start(unsigned int flags, Error **errp)
     global_dirty_tracking |= flags;
     trace_global_dirty_changed(global_dirty_tracking);
 
+    if (flags & GLOBAL_DIRTY_MIGRATION) {
+        /* Pages dirtied so far are only in the bitmap */
+        dirty_ring_invalidate();
+    }
+
     if (!old_flags) {
         if (!memory_global_dirty_log_do_start(errp)) {
             global_dirty_tracking &= ~flags;
@@ -956,6 +956,119 @@ bool cpu_physical_memory_test_and_clear_dirty(ram_addr_t start,
     return dirty;
 }
 
+typedef struct DirtyRingSyncBlock {
+    RAMBlock *rb;
+
+    /* Range of pages whose bits were cleared, empty if first > last */
+    unsigned long first;
+    unsigned long last;
+} DirtyRingSyncBlock;
+
+typedef struct DirtyRingSync {
+    unsigned long * const *src;
+    GArray *blocks;
+    DirtyRingSyncBlock *cur;
+    uint64_t num_dirty;
+} DirtyRingSync;
+
+static DirtyRingSyncBlock *dirty_ring_sync_find_block(DirtyRingSync *sync,
+                                                      ram_addr_t addr)
+{
+    DirtyRingSyncBlock *b;
+    RAMBlock *rb;
+    guint i;
+
+    for (i = 0; i < sync->blocks->len; i++) {
+        b = &g_array_index(sync->blocks, DirtyRingSyncBlock, i);
+        if (addr - b->rb->offset < b->rb->used_length) {
+            return b;
+        }
+    }
+
+    /* Ignored blocks have no migration bitmap */
+    RAMBLOCK_FOREACH(rb) {
+        if (addr - rb->offset < rb->used_length && rb->bmap) {
+            DirtyRingSyncBlock new = {
+                .rb = rb, .first = ULONG_MAX, .last = 0,
+            };
+
+            g_array_append_val(sync->blocks, new);
+            return &g_array_index(sync->blocks, DirtyRingSyncBlock,
+                                  sync->blocks->len - 1);
+        }
+    }
+
+    /* The block was removed, or the page is beyond its used length */
+    return NULL;
+}
+
+static void dirty_ring_sync_page(unsigned long page, void *opaque)
+{
+    DirtyRingSync *sync = opaque;
+    ram_addr_t addr = (ram_addr_t)page << TARGET_PAGE_BITS;
+    DirtyRingSyncBlock *b = sync->cur;
+    unsigned long k;
+
+    if (!b || addr - b->rb->offset >= b->rb->used_length) {
+        b = dirty_ring_sync_find_block(sync, addr);
+        if (!b) {
+            return;
+        }
+        sync->cur = b;
+    }
+
+    /* Already moved by an earlier entry or by a scan of the bitmap */
+    if (!bitmap_test_and_clear_atomic(sync->src[page / DIRTY_MEMORY_BLOCK_SIZE],
+                                      page % DIRTY_MEMORY_BLOCK_SIZE, 1)) {
+        return;
+    }
+
+    k = (addr - b->rb->offset) >> TARGET_PAGE_BITS;
+    b->first = MIN(b->first, k);
+    b->last = MAX(b->last, k);
+    if (!test_and_set_bit(k, b->rb->bmap)) {
+        sync->num_dirty++;
+    }
+    if (b->rb->clear_bmap) {
+        clear_bmap_set(b->rb, k, 1);
+    }
+}
+
+bool cpu_physical_memory_sync_dirty_ring(uint64_t *num_dirty)
+{
+    g_autoptr(GArray) blocks = g_array_new(false, false,
+                                           sizeof(DirtyRingSyncBlock));
+    DirtyRingSync sync = {
+        .src = qatomic_rcu_read(
+                &ram_list.dirty_memory[DIRTY_MEMORY_MIGRATION])->blocks,
+        .blocks = blocks,
+    };
+    bool complete;
+    guint i;
+
+    complete = dirty_ring_collect(dirty_ring_sync_page, &sync);
+
+    for (i = 0; i < blocks->len; i++) {
+        DirtyRingSyncBlock *b = &g_array_index(blocks, DirtyRingSyncBlock, i);
+        ram_addr_t start, length;
+
+        if (b->first > b->last) {
+            continue;
+        }
+        start = (ram_addr_t)b->first << TARGET_PAGE_BITS;
+        length = (ram_addr_t)(b->last - b->first + 1) << TARGET_PAGE_BITS;
+
+        /* Catch the next write to the pages */
+        cpu_physical_memory_dirty_bits_cleared(b->rb->offset + start, length);
+        if (!b->rb->clear_bmap) {
+            memory_region_clear_dirty_bitmap(b->rb->mr, start, length);
+        }
+    }
+
+    *num_dirty = sync.num_dirty;
+    return complete;
+}
+
 DirtyBitmapSnapshot *cpu_physical_memory_snapshot_and_clear_dirty
     (MemoryRegion *mr, hwaddr offset, hwaddr length, unsigned client)
 {
@@ -1941,7 +2054,8 @@ static void ram_block_add(RAMBlock *new_block, Error **errp)
                        "which is not supported with CPR.",
                        memory_region_name(new_block->mr));
             migrate_add_blocker_modes(&new_block->cpr_blocker, errp,
-                                      MIG_MODE_CPR_TRANSFER, -1);
+                                      MIG_MODE_CPR_TRANSFER,
+                                      MIG_MODE_CPR_CLONE, -1);
         }
     }
 
@@ -2197,6 +2311,15 @@ RAMBlock *qemu_ram_alloc_internal(ram_addr_t size, ram_addr_t max_size,
             /* Use same alignment as qemu_anon_ram_alloc */
             mr->align = QEMU_VMALLOC_ALIGN;
 
+            /*
+             * A clone maps the memory of its template copy-on-write, and
+             * must not resize it.
+             */
+            if (reused && cpr_is_clone()) {
+                ram_flags &= ~RAM_SHARED;
+                reused = false;
+            }
+
             /*
              * This can fail if the shm mount size is too small, or alloc from
              * fd is not supported, but previous QEMU versions that called
@@ -2885,7 +3008,8 @@ bool prepare_mmio_access(MemoryRegion *mr)
 {
     bool release_lock = false;
 
-    if (!bql_locked()) {
+    /* Flushing coalesced MMIO needs the BQL even for lockless regions */
+    if (!bql_locked() && (!mr->lockless_io || mr->flush_coalesced_mmio)) {
         bql_lock();
         release_lock = true;
     }
@@ -4166,7 +4290,7 @@ void ram_block_add_cpr_blocker(RAMBlock *rb, Error **errp)
                "required for memory-backend objects, and aux-ram-share=on is "
                "required.", memory_region_name(rb->mr));
     migrate_add_blocker_modes(&rb->cpr_blocker, errp, MIG_MODE_CPR_TRANSFER,
-                              -1);
+                              MIG_MODE_CPR_CLONE, -1);
 }
 
 void ram_block_del_cpr_blocker(RAMBlock *rb)
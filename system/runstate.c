@@ -962,6 +962,7 @@ void qemu_init_subsystems(void)
     module_call_init(MODULE_INIT_MIGRATION);
 
     runstate_init();
+    module_call_init(MODULE_INIT_STATS);
     precopy_infrastructure_init();
     postcopy_infrastructure_init();
     monitor_init_globals();
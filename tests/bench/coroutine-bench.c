@@ -0,0 +1,151 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Cost of the basic coroutine operations, to compare coroutine backends
+ * (configure --with-coroutine=...) against each other.
+ */
+#include "qemu/osdep.h"
+#include "qemu/coroutine.h"
+#include "qemu/timer.h"
+
+enum co_op {
+    OP_ENTER_YIELD,
+    OP_LIFECYCLE,
+    OP_NESTING,
+    OP_FUNCTION_CALL,
+};
+
+struct benchmark {
+    const char * const name;
+    enum co_op op;
+    /* Number of coroutine switches per iteration */
+    unsigned int switches;
+};
+
+#define NESTING_DEPTH 16
+
+static const struct benchmark benchmarks[] = {
+    {
+        .name = "Enter+Yield",
+        .op = OP_ENTER_YIELD,
+        .switches = 2,
+    },
+    {
+        .name = "Lifecycle",
+        .op = OP_LIFECYCLE,
+        .switches = 2,
+    },
+    {
+        .name = "Nesting",
+        .op = OP_NESTING,
+        .switches = 2 * NESTING_DEPTH,
+    },
+    {
+        .name = "Call",
+        .op = OP_FUNCTION_CALL,
+        .switches = 0,
+    },
+};
+
+static void coroutine_fn yield_loop(void *opaque)
+{
+    unsigned int *counter = opaque;
+
+    while ((*counter)-- > 0) {
+        qemu_coroutine_yield();
+    }
+}
+
+static void coroutine_fn empty_coroutine(void *opaque)
+{
+}
+
+static void coroutine_fn nest(void *opaque)
+{
+    unsigned int *depth = opaque;
+
+    if (--*depth > 0) {
+        Coroutine *child = qemu_coroutine_create(nest, depth);
+
+        qemu_coroutine_enter(child);
+    }
+}
+
+static void __attribute__((noinline)) dummy(unsigned int *counter)
+{
+    asm volatile("" : : "r"(counter) : "memory");
+    (*counter)--;
+}
+
+static int64_t run_benchmark(const struct benchmark *bench, unsigned int n)
+{
+    int64_t start_ns = get_clock();
+    Coroutine *co;
+    unsigned int i;
+
+    switch (bench->op) {
+    case OP_ENTER_YIELD:
+        i = n;
+        co = qemu_coroutine_create(yield_loop, &i);
+        while (i > 0) {
+            qemu_coroutine_enter(co);
+        }
+        /* let the coroutine terminate */
+        qemu_coroutine_enter(co);
+        break;
+    case OP_LIFECYCLE:
+        for (i = 0; i < n; i++) {
+            co = qemu_coroutine_create(empty_coroutine, NULL);
+            qemu_coroutine_enter(co);
+        }
+        break;
+    case OP_NESTING:
+        for (i = 0; i < n; i++) {
+            unsigned int depth = NESTING_DEPTH;
+
+            co = qemu_coroutine_create(nest, &depth);
+            qemu_coroutine_enter(co);
+        }
+        break;
+    case OP_FUNCTION_CALL:
+        i = n;
+        while (i > 0) {
+            dummy(&i);
+        }
+        break;
+    default:
+        g_assert_not_reached();
+    }
+    return get_clock() - start_ns;
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned int n = 1000000;
+
+    printf("# Units: Mops/s and ns per operation, "
+           "ns per switch for coroutine operations\n");
+    printf("%12s %10s %10s %10s\n", "Op", "Mops/s", "ns/op", "ns/switch");
+    printf("----------------------------------------------\n");
+    for (int i = 0; i < ARRAY_SIZE(benchmarks); i++) {
+        const struct benchmark *bench = &benchmarks[i];
+        int64_t total_ns = 0;
+        int64_t n_runs = 0;
+
+        /* warm-up run, which also fills the coroutine pool */
+        run_benchmark(bench, n / 10);
+
+        while (total_ns < 5e8 || n_runs < 5) {
+            total_ns += run_benchmark(bench, n);
+            n_runs++;
+        }
+
+        double ns_per_op = (double)total_ns / n_runs / n;
+        printf("%12s %10.2f %10.2f ", bench->name, 1e3 / ns_per_op, ns_per_op);
+        if (bench->switches) {
+            printf("%10.2f\n", ns_per_op / bench->switches);
+        } else {
+            printf("%10s\n", "-");
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,212 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Event loop overhead of io_uring disk I/O: IOPS per CPU core for random
+ * 4 KiB reads from the page cache, with disk I/O sharing the AioContext's fd
+ * monitoring ring, with a separate disk I/O ring, and with glib-compatible
+ * fd monitoring (ppoll/epoll) plus a separate disk I/O ring.
+ *
+ * CPU time is that of the event loop thread, io-wq kernel workers are not
+ * accounted.  Reads are served from the page cache so that the event loop
+ * rather than the disk is the bottleneck.
+ */
+#include "qemu/osdep.h"
+#include "block/aio.h"
+#include "block/raw-aio.h"
+#include "qapi/error.h"
+#include "qemu/coroutine.h"
+#include "qemu/iov.h"
+#include "qemu/main-loop.h"
+#include "qemu/rcu.h"
+#include "qemu/thread.h"
+#include "qemu/timer.h"
+
+#define FILE_SIZE (64 * 1024 * 1024)
+#define BLOCK_SIZE 4096
+#define QUEUE_DEPTH 32
+
+enum ring_config {
+    CONFIG_SHARED,
+    CONFIG_SPLIT,
+    CONFIG_GLIB,
+};
+
+struct configuration {
+    const char * const name;
+    enum ring_config type;
+};
+
+static const struct configuration configs[] = {
+    {
+        .name = "Shared",
+        .type = CONFIG_SHARED,
+    },
+    {
+        .name = "Split",
+        .type = CONFIG_SPLIT,
+    },
+    {
+        .name = "Glib",
+        .type = CONFIG_GLIB,
+    },
+};
+
+typedef struct {
+    const struct configuration *config;
+    int fd;
+    unsigned setup_flags;
+    uint64_t remaining;
+    unsigned active;
+
+    /* Results */
+    bool supported;
+    int64_t wall_ns;
+    int64_t cpu_ns;
+} BenchRun;
+
+static int64_t thread_cpu_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec * NANOSECONDS_PER_SECOND + ts.tv_nsec;
+}
+
+static void coroutine_fn reader(void *opaque)
+{
+    BenchRun *run = opaque;
+    void *buf = qemu_memalign(BLOCK_SIZE, BLOCK_SIZE);
+    QEMUIOVector qiov;
+    int ret;
+
+    qemu_iovec_init_buf(&qiov, buf, BLOCK_SIZE);
+
+    while (run->remaining > 0) {
+        uint64_t offset = g_random_int_range(0, FILE_SIZE / BLOCK_SIZE) *
+                          (uint64_t)BLOCK_SIZE;
+
+        run->remaining--;
+        ret = luring_co_submit(NULL, run->fd, offset, &qiov, QEMU_AIO_READ, 0,
+                               run->setup_flags, 0);
+        g_assert_cmpint(ret, ==, 0);
+    }
+
+    qemu_vfree(buf);
+    run->active--;
+}
+
+/* Runs the event loop in its own thread, like an IOThread */
+static void *bench_thread(void *opaque)
+{
+    BenchRun *run = opaque;
+    AioContext *ctx = aio_context_new(&error_abort);
+    int64_t start_ns, start_cpu_ns;
+
+    rcu_register_thread();
+    qemu_set_current_aio_context(ctx);
+
+    switch (run->config->type) {
+    case CONFIG_SHARED:
+        run->supported = aio_has_io_uring(ctx);
+        run->setup_flags = 0;
+        break;
+    case CONFIG_SPLIT:
+        run->supported = true;
+        run->setup_flags = LURING_SETUP_OWN_RING;
+        break;
+    case CONFIG_GLIB:
+        /* The GSource is unused, but getting it switches the fd monitoring */
+        g_source_unref(aio_get_g_source(ctx));
+        run->supported = true;
+        run->setup_flags = 0;
+        break;
+    default:
+        g_assert_not_reached();
+    }
+
+    if (run->supported) {
+        aio_setup_linux_io_uring(ctx, run->setup_flags, &error_abort);
+
+        start_ns = get_clock();
+        start_cpu_ns = thread_cpu_ns();
+
+        for (int i = 0; i < QUEUE_DEPTH; i++) {
+            run->active++;
+            qemu_coroutine_enter(qemu_coroutine_create(reader, run));
+        }
+        while (run->active > 0) {
+            aio_poll(ctx, true);
+        }
+
+        run->cpu_ns = thread_cpu_ns() - start_cpu_ns;
+        run->wall_ns = get_clock() - start_ns;
+    }
+
+    aio_context_unref(ctx);
+    rcu_unregister_thread();
+    return NULL;
+}
+
+static void run_benchmark(BenchRun *run)
+{
+    QemuThread thread;
+
+    qemu_thread_create(&thread, "io_uring-bench", bench_thread, run,
+                       QEMU_THREAD_JOINABLE);
+    qemu_thread_join(&thread);
+}
+
+static int create_file(void)
+{
+    g_autofree char *path = NULL;
+    g_autofree char *buf = g_malloc(1024 * 1024);
+    int fd;
+
+    fd = g_file_open_tmp("io_uring-bench-XXXXXX", &path, NULL);
+    g_assert(fd >= 0);
+    unlink(path);
+
+    /* Real data so that reads do not just hit holes */
+    memset(buf, 0x5a, 1024 * 1024);
+    for (int i = 0; i < FILE_SIZE / (1024 * 1024); i++) {
+        g_assert(write(fd, buf, 1024 * 1024) == 1024 * 1024);
+    }
+    return fd;
+}
+
+int main(int argc, char *argv[])
+{
+    uint64_t n = 1000000;
+    int fd;
+
+    qemu_init_main_loop(&error_abort);
+    fd = create_file();
+
+    printf("# %d KiB random reads at queue depth %d from the page cache\n",
+           BLOCK_SIZE / 1024, QUEUE_DEPTH);
+    printf("# Units: kIOPS, and kIOPS per CPU core of the event loop thread\n");
+    printf("%8s %10s %10s\n", "Ring", "kIOPS", "kIOPS/core");
+    printf("--------------------------------\n");
+    for (int i = 0; i < ARRAY_SIZE(configs); i++) {
+        BenchRun run = {
+            .config = &configs[i],
+            .fd = fd,
+        };
+
+        /* warm-up run */
+        run.remaining = n / 10;
+        run_benchmark(&run);
+
+        run.remaining = n;
+        run_benchmark(&run);
+
+        if (!run.supported) {
+            printf("%8s %10s %10s\n", configs[i].name, "-", "-");
+            continue;
+        }
+        printf("%8s %10.1f %10.1f\n", configs[i].name,
+               n * 1e6 / run.wall_ns, n * 1e6 / run.cpu_ns);
+    }
+
+    close(fd);
+    return 0;
+}
@@ -11,6 +11,7 @@
 #include "qemu/rcu.h"
 #include "qemu/xxhash.h"
 #include "qemu/memalign.h"
+#include "qemu/timer.h"
 
 struct thread_stats {
     size_t rd;
@@ -21,6 +22,7 @@ struct thread_stats {
     size_t not_rm;
     size_t rz;
     size_t not_rz;
+    int64_t max_update_ns;
 };
 
 struct thread_info {
@@ -61,6 +63,8 @@ static double resize_rate; /* 0.0 to 1.0 */
 static unsigned int n_rz_threads = 1;
 static QemuThread *rz_threads;
 static bool precompute_hash;
+/* track the worst-case update latency, which resizes used to dominate */
+static bool measure_update_latency;
 
 static double update_rate; /* 0.0 to 1.0 */
 static uint64_t update_threshold;
@@ -175,6 +179,8 @@ static void do_rw(struct thread_info *info)
             stats->not_rd++;
         }
     } else {
+        int64_t start_ns = measure_update_latency ? get_clock() : 0;
+
         p = &keys[r & (update_range - 1)];
         hash = hfunc(*p);
         if (info->write_op) {
@@ -201,6 +207,10 @@ static void do_rw(struct thread_info *info)
             }
         }
         info->write_op = !info->write_op;
+        if (measure_update_latency) {
+            stats->max_update_ns = MAX(stats->max_update_ns,
+                                       get_clock() - start_ns);
+        }
     }
 }
 
@@ -334,6 +344,7 @@ static void htable_init(void)
     do_threshold(update_rate, &update_threshold);
     do_threshold(resize_rate, &resize_threshold);
 
+    measure_update_latency = resize_rate || (qht_mode & QHT_MODE_AUTO_RESIZE);
     if (resize_rate) {
         resize_min = n / 2;
         resize_max = n;
@@ -384,6 +395,8 @@ static void add_stats(struct thread_stats *s, struct thread_info *info, int n)
 
         s->rz += stats->rz;
         s->not_rz += stats->not_rz;
+
+        s->max_update_ns = MAX(s->max_update_ns, stats->max_update_ns);
     }
 }
 
@@ -418,6 +431,9 @@ static void pr_stats(void)
     tx = (s.rd + s.not_rd + s.in + s.not_in + s.rm + s.not_rm) / 1e6 / duration;
     printf(" Throughput:        %.2f MT/s\n", tx);
     printf(" Throughput/thread: %.2f MT/s/thread\n", tx / n_rw_threads);
+    if (measure_update_latency) {
+        printf(" Max update time:   %.2f us\n", s.max_update_ns / 1e3);
+    }
 }
 
 static void run_test(void)
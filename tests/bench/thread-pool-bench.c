@@ -0,0 +1,125 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Throughput of the AioContext thread pool, and the CPU time that the
+ * submitting event loop thread spends per request, i.e. the cost that
+ * thread_pool_submit_aio() and the completion bottom half add on top of
+ * the work itself.  Requests are resubmitted from their completion
+ * callback to keep a fixed number of them in flight.
+ */
+#include "qemu/osdep.h"
+#include "block/aio.h"
+#include "block/thread-pool.h"
+#include "qapi/error.h"
+#include "qemu/main-loop.h"
+#include "qemu/timer.h"
+
+struct benchmark {
+    const char * const name;
+    /* Busy-wait time of each request in the worker thread */
+    int64_t work_ns;
+};
+
+static const struct benchmark benchmarks[] = {
+    {
+        .name = "Empty",
+        .work_ns = 0,
+    },
+    {
+        .name = "2us",
+        .work_ns = 2 * SCALE_US,
+    },
+    {
+        .name = "20us",
+        .work_ns = 20 * SCALE_US,
+    },
+};
+
+static const unsigned int depths[] = { 1, 8, 64, 256 };
+
+typedef struct {
+    const struct benchmark *bench;
+    uint64_t remaining;
+    unsigned int active;
+} BenchRun;
+
+static int64_t thread_cpu_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec * NANOSECONDS_PER_SECOND + ts.tv_nsec;
+}
+
+static int work_fn(void *opaque)
+{
+    const struct benchmark *bench = opaque;
+    int64_t deadline = get_clock() + bench->work_ns;
+
+    while (get_clock() < deadline) {
+        cpu_relax();
+    }
+    return 0;
+}
+
+static void done_cb(void *opaque, int ret)
+{
+    BenchRun *run = opaque;
+
+    g_assert_cmpint(ret, ==, 0);
+    if (run->remaining > 0) {
+        run->remaining--;
+        thread_pool_submit_aio(work_fn, (void *)run->bench, done_cb, run);
+    } else {
+        run->active--;
+    }
+}
+
+static void run_benchmark(const struct benchmark *bench, unsigned int depth,
+                          uint64_t n, int64_t *wall_ns, int64_t *cpu_ns)
+{
+    AioContext *ctx = qemu_get_aio_context();
+    BenchRun run = {
+        .bench = bench,
+        .remaining = n - depth,
+        .active = depth,
+    };
+    int64_t start_ns = get_clock();
+    int64_t start_cpu_ns = thread_cpu_ns();
+
+    for (unsigned int i = 0; i < depth; i++) {
+        thread_pool_submit_aio(work_fn, (void *)bench, done_cb, &run);
+    }
+    while (run.active > 0) {
+        aio_poll(ctx, true);
+    }
+
+    *cpu_ns = thread_cpu_ns() - start_cpu_ns;
+    *wall_ns = get_clock() - start_ns;
+}
+
+int main(int argc, char *argv[])
+{
+    uint64_t n = 200000;
+
+    qemu_init_main_loop(&error_abort);
+
+    printf("# Units: kreq/s, and ns of event loop thread CPU time per "
+           "request\n");
+    printf("%8s %6s %10s %10s\n", "Work", "Depth", "kreq/s", "ns/req");
+    printf("-----------------------------------\n");
+    for (int i = 0; i < ARRAY_SIZE(benchmarks); i++) {
+        const struct benchmark *bench = &benchmarks[i];
+
+        for (int j = 0; j < ARRAY_SIZE(depths); j++) {
+            int64_t wall_ns, cpu_ns;
+
+            /* warm-up run, which also spawns the worker threads */
+            run_benchmark(bench, depths[j], n / 10, &wall_ns, &cpu_ns);
+
+            run_benchmark(bench, depths[j], n, &wall_ns, &cpu_ns);
+            printf("%8s %6u %10.1f %10.1f\n", bench->name, depths[j],
+                   n * 1e6 / wall_ns, (double)cpu_ns / n);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,267 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Compare the QEMUTimerList heap against the sorted linked list it
+ * replaced, for workloads with many armed timers.
+ */
+#include "qemu/osdep.h"
+#include "qemu/timer.h"
+
+enum timer_op {
+    OP_ARM,
+    OP_REARM,
+    OP_DEL,
+    OP_DEADLINE,
+};
+
+struct benchmark {
+    const char * const name;
+    enum timer_op op;
+};
+
+enum impl_type {
+    IMPL_LIST,
+    IMPL_HEAP,
+};
+
+struct timer_implementation {
+    const char * const name;
+    enum impl_type type;
+};
+
+static const struct benchmark benchmarks[] = {
+    {
+        .name = "Arm",
+        .op = OP_ARM,
+    },
+    {
+        .name = "Rearm",
+        .op = OP_REARM,
+    },
+    {
+        .name = "Del",
+        .op = OP_DEL,
+    },
+    {
+        .name = "Deadline",
+        .op = OP_DEADLINE,
+    },
+};
+
+static const struct timer_implementation impls[] = {
+    {
+        .name = "List",
+        .type = IMPL_LIST,
+    },
+    {
+        .name = "Heap",
+        .type = IMPL_HEAP,
+    },
+};
+
+/* The previous implementation: a list sorted by expiry time */
+typedef struct ListTimer {
+    int64_t expire_time;
+    struct ListTimer *next;
+} ListTimer;
+
+static ListTimer *list_head;
+
+static void list_timer_del(ListTimer *ts)
+{
+    ListTimer **pt, *t;
+
+    ts->expire_time = -1;
+    for (pt = &list_head; (t = *pt); pt = &t->next) {
+        if (t == ts) {
+            *pt = t->next;
+            break;
+        }
+    }
+}
+
+static void list_timer_mod(ListTimer *ts, int64_t expire_time)
+{
+    ListTimer **pt, *t;
+
+    list_timer_del(ts);
+    for (pt = &list_head; (t = *pt); pt = &t->next) {
+        if (t->expire_time > expire_time) {
+            break;
+        }
+    }
+    ts->expire_time = expire_time;
+    ts->next = *pt;
+    *pt = ts;
+}
+
+static void notify_cb(void *opaque, QEMUClockType type)
+{
+}
+
+static void timer_cb(void *opaque)
+{
+}
+
+static int64_t run_benchmark(const struct benchmark *bench,
+                             enum impl_type impl,
+                             size_t n_elems)
+{
+    QEMUTimerListGroup tlg = {};
+    QEMUTimer *timers = NULL;
+    ListTimer *list_timers = NULL;
+    int64_t *expire = g_new(int64_t, n_elems);
+    int64_t base = qemu_clock_get_ns(QEMU_CLOCK_REALTIME) +
+                   3600 * NANOSECONDS_PER_SECOND;
+    int64_t sink = 0;
+
+    for (size_t i = 0; i < n_elems; i++) {
+        expire[i] = base + g_random_int_range(0, INT32_MAX);
+    }
+
+    switch (impl) {
+    case IMPL_LIST:
+        list_head = NULL;
+        list_timers = g_new0(ListTimer, n_elems);
+        break;
+    case IMPL_HEAP:
+        timerlistgroup_init(&tlg, notify_cb, NULL);
+        timers = g_new0(QEMUTimer, n_elems);
+        for (size_t i = 0; i < n_elems; i++) {
+            timer_init_full(&timers[i], &tlg, QEMU_CLOCK_REALTIME, SCALE_NS,
+                            0, timer_cb, NULL);
+        }
+        break;
+    default:
+        g_assert_not_reached();
+    }
+
+    if (bench->op != OP_ARM) {
+        for (size_t i = 0; i < n_elems; i++) {
+            if (impl == IMPL_LIST) {
+                list_timer_mod(&list_timers[i], expire[i]);
+            } else {
+                timer_mod_ns(&timers[i], expire[i]);
+            }
+        }
+        /* Rearm moves every timer to a new random position */
+        for (size_t i = 0; i < n_elems; i++) {
+            expire[i] = base + g_random_int_range(0, INT32_MAX);
+        }
+    }
+
+    int64_t start_ns = get_clock();
+    for (size_t i = 0; i < n_elems; i++) {
+        switch (bench->op) {
+        case OP_ARM:
+        case OP_REARM:
+            if (impl == IMPL_LIST) {
+                list_timer_mod(&list_timers[i], expire[i]);
+            } else {
+                timer_mod_ns(&timers[i], expire[i]);
+            }
+            break;
+        case OP_DEL:
+            if (impl == IMPL_LIST) {
+                list_timer_del(&list_timers[i]);
+            } else {
+                timer_del(&timers[i]);
+            }
+            break;
+        case OP_DEADLINE:
+            if (impl == IMPL_LIST) {
+                sink += list_head->expire_time - get_clock();
+            } else {
+                sink += timerlist_deadline_ns(tlg.tl[QEMU_CLOCK_REALTIME]);
+            }
+            break;
+        default:
+            g_assert_not_reached();
+        }
+    }
+    int64_t ns = get_clock() - start_ns;
+    (void)sink;
+
+    if (impl == IMPL_HEAP) {
+        for (size_t i = 0; i < n_elems; i++) {
+            timer_del(&timers[i]);
+        }
+        timerlistgroup_deinit(&tlg);
+    }
+    g_free(timers);
+    g_free(list_timers);
+    g_free(expire);
+
+    return ns;
+}
+
+int main(int argc, char *argv[])
+{
+    size_t sizes[] = {
+        32,
+        256,
+        1024,
+        1024 * 4,
+        1024 * 16,
+    };
+
+    init_clocks(NULL);
+
+    double res[ARRAY_SIZE(benchmarks)][ARRAY_SIZE(impls)][ARRAY_SIZE(sizes)];
+    for (int i = 0; i < ARRAY_SIZE(sizes); i++) {
+        size_t size = sizes[i];
+        for (int j = 0; j < ARRAY_SIZE(impls); j++) {
+            const struct timer_implementation *impl = &impls[j];
+            for (int k = 0; k < ARRAY_SIZE(benchmarks); k++) {
+                const struct benchmark *bench = &benchmarks[k];
+
+                /* warm-up run */
+                run_benchmark(bench, impl->type, size);
+
+                int64_t total_ns = 0;
+                int64_t n_runs = 0;
+                while (total_ns < 2e8 || n_runs < 5) {
+                    total_ns += run_benchmark(bench, impl->type, size);
+                    n_runs++;
+                }
+                double ns_per_run = (double)total_ns / n_runs;
+
+                /* Throughput, in Mops/s */
+                res[k][j][i] = size / ns_per_run * 1e3;
+            }
+        }
+    }
+
+    printf("# Results' breakdown: Impl, Op and #Timers. Units: Mops/s\n");
+    printf("%5s %10s ", "Impl", "Op");
+    for (int i = 0; i < ARRAY_SIZE(sizes); i++) {
+        printf("%7zu         ", sizes[i]);
+    }
+    printf("\n");
+    char separator[97];
+    for (int i = 0; i < ARRAY_SIZE(separator) - 1; i++) {
+        separator[i] = '-';
+    }
+    separator[ARRAY_SIZE(separator) - 1] = '\0';
+    printf("%s\n", separator);
+    for (int i = 0; i < ARRAY_SIZE(benchmarks); i++) {
+        for (int j = 0; j < ARRAY_SIZE(impls); j++) {
+            printf("%5s %10s ", impls[j].name, benchmarks[i].name);
+            for (int k = 0; k < ARRAY_SIZE(sizes); k++) {
+                printf("%7.2f ", res[i][j][k]);
+                if (j == 0) {
+                    printf("        ");
+                } else {
+                    if (res[i][0][k] != 0) {
+                        double speedup = res[i][j][k] / res[i][0][k];
+                        printf("(%4.2fx) ", speedup);
+                    } else {
+                        printf("(     ) ");
+                    }
+                }
+            }
+            printf("\n");
+        }
+    }
+    printf("%s\n", separator);
+    return 0;
+}
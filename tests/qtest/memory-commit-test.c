@@ -0,0 +1,119 @@
+/*
+ * QTest testcase for memory topology updates
+ *
+ * Toggle the memory decoding of many PCI devices and check that the
+ * views of the address spaces that did not change are reused.  The
+ * average commit latency is printed with --verbose.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "qemu/osdep.h"
+#include "libqtest.h"
+#include "qobject/qdict.h"
+#include "qobject/qlist.h"
+#include "qobject/qnum.h"
+#include "libqos/pci.h"
+#include "libqos/pci-pc.h"
+#include "hw/pci/pci_regs.h"
+
+#define NR_DEVICES      16
+#define FIRST_SLOT      4
+#define ITERATIONS      50
+
+static uint64_t get_memory_stat(QTestState *qts, const char *name)
+{
+    QDict *resp;
+    QList *results, *stats;
+    QDict *result, *stat;
+    uint64_t value;
+
+    resp = qtest_qmp(qts, "{ 'execute': 'query-stats', 'arguments': {"
+                     "  'target': 'vm',"
+                     "  'providers': [ { 'provider': 'memory',"
+                     "                   'names': [ %s ] } ] } }", name);
+    g_assert(qdict_haskey(resp, "return"));
+    results = qdict_get_qlist(resp, "return");
+    g_assert_cmpint(qlist_size(results), ==, 1);
+
+    result = qobject_to(QDict, qlist_peek(results));
+    g_assert_cmpstr(qdict_get_str(result, "provider"), ==, "memory");
+    stats = qdict_get_qlist(result, "stats");
+    g_assert_cmpint(qlist_size(stats), ==, 1);
+
+    stat = qobject_to(QDict, qlist_peek(stats));
+    g_assert_cmpstr(qdict_get_str(stat, "name"), ==, name);
+    value = qnum_get_uint(qobject_to(QNum, qdict_get(stat, "value")));
+    qobject_unref(resp);
+    return value;
+}
+
+static void test_toggle_bars(void)
+{
+    QPCIDevice *devs[NR_DEVICES];
+    g_autoptr(GString) cmdline = g_string_new("-nodefaults");
+    uint64_t commits, reused, commit_ns;
+    QTestState *qts;
+    QPCIBus *pcibus;
+    int i, j;
+
+    for (i = 0; i < NR_DEVICES; i++) {
+        g_string_append_printf(cmdline, " -device pci-testdev,addr=%02x.0",
+                               FIRST_SLOT + i);
+    }
+    qts = qtest_init(cmdline->str);
+    pcibus = qpci_new_pc(qts, NULL);
+    for (i = 0; i < NR_DEVICES; i++) {
+        devs[i] = qpci_device_find(pcibus, QPCI_DEVFN(FIRST_SLOT + i, 0));
+        g_assert(devs[i]);
+        qpci_device_enable(devs[i]);
+        qpci_iomap(devs[i], 0, NULL);
+    }
+
+    commits = get_memory_stat(qts, "commits");
+    reused = get_memory_stat(qts, "flatviews-reused");
+    commit_ns = get_memory_stat(qts, "commit-time");
+
+    for (j = 0; j < ITERATIONS; j++) {
+        for (i = 0; i < NR_DEVICES; i++) {
+            uint16_t cmd = qpci_config_readw(devs[i], PCI_COMMAND);
+
+            qpci_config_writew(devs[i], PCI_COMMAND,
+                               cmd & ~PCI_COMMAND_MEMORY);
+            qpci_config_writew(devs[i], PCI_COMMAND, cmd);
+        }
+    }
+
+    commits = get_memory_stat(qts, "commits") - commits;
+    reused = get_memory_stat(qts, "flatviews-reused") - reused;
+    commit_ns = get_memory_stat(qts, "commit-time") - commit_ns;
+
+    /* Each write to the command register changes the topology */
+    g_assert_cmpuint(commits, >=, 2 * NR_DEVICES * ITERATIONS);
+
+    /* At least the I/O address space did not change */
+    g_assert_cmpuint(reused, >=, commits);
+
+    if (g_test_verbose()) {
+        g_test_message("%" PRIu64 " commits, %" PRIu64 " ns on average, "
+                       "%" PRIu64 " views reused", commits,
+                       commit_ns / commits, reused);
+    }
+
+    for (i = 0; i < NR_DEVICES; i++) {
+        g_free(devs[i]);
+    }
+    qpci_free_pc(pcibus);
+    qtest_quit(qts);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    if (qtest_has_device("pci-testdev")) {
+        qtest_add_func("memory/commit/toggle-bars", test_toggle_bars);
+    }
+
+    return g_test_run();
+}
@@ -50,12 +50,27 @@ static void *test_mode_transfer_start(QTestState *from, QTestState *to)
     return NULL;
 }
 
+static void *test_mode_clone_start(QTestState *from, QTestState *to)
+{
+    migrate_set_parameter_str(from, "mode", "cpr-clone");
+    return NULL;
+}
+
+static void test_mode_clone_end(QTestState *from, QTestState *to,
+                                void *opaque)
+{
+    /* The clone uses the RAM of the source, which must not run again */
+    qobject_unref(qtest_qmp_assert_failure_ref(from, "{'execute': 'cont'}"));
+    qobject_unref(qtest_qmp_assert_failure_ref(from,
+                                               "{'execute': 'system_reset'}"));
+}
+
 /*
  * cpr-transfer mode cannot use the target monitor prior to starting the
  * migration, and cannot connect synchronously to the monitor, so defer
  * the target connection.
  */
-static void test_mode_transfer_common(bool incoming_defer)
+static void test_mode_transfer_common(bool incoming_defer, bool clone)
 {
     g_autofree char *cpr_path = g_strdup_printf("%s/cpr.sock", tmpfs);
     g_autofree char *mig_path = g_strdup_printf("%s/migsocket", tmpfs);
@@ -84,7 +99,8 @@ static void test_mode_transfer_common(bool incoming_defer)
         .listen_uri = incoming_defer ? "defer" : uri,
         .connect_channels = connect_channels,
         .cpr_channel = cpr_channel,
-        .start_hook = test_mode_transfer_start,
+        .start_hook = clone ? test_mode_clone_start : test_mode_transfer_start,
+        .end_hook = clone ? test_mode_clone_end : NULL,
     };
 
     test_precopy_common(&args);
@@ -92,12 +108,17 @@ static void test_mode_transfer_common(bool incoming_defer)
 
 static void test_mode_transfer(void)
 {
-    test_mode_transfer_common(NULL);
+    test_mode_transfer_common(false, false);
 }
 
 static void test_mode_transfer_defer(void)
 {
-    test_mode_transfer_common(true);
+    test_mode_transfer_common(true, false);
+}
+
+static void test_mode_clone(void)
+{
+    test_mode_transfer_common(false, true);
 }
 
 void migration_test_add_cpr(MigrationTestEnv *env)
@@ -122,5 +143,6 @@ void migration_test_add_cpr(MigrationTestEnv *env)
         migration_test_add("/migration/mode/transfer", test_mode_transfer);
         migration_test_add("/migration/mode/transfer/defer",
                            test_mode_transfer_defer);
+        migration_test_add("/migration/mode/clone", test_mode_clone);
     }
 }
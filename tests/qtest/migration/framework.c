@@ -264,6 +264,7 @@ int migrate_start(QTestState **from, QTestState **to, const char *uri,
     g_autofree char *shmem_opts = NULL;
     g_autofree char *shmem_path = NULL;
     const char *kvm_opts = NULL;
+    g_autofree char *accel_opts = NULL;
     const char *arch = qtest_get_arch();
     const char *memory_size;
     const char *machine_alias, *machine_opts = "";
@@ -357,6 +358,18 @@ int migrate_start(QTestState **from, QTestState **to, const char *uri,
         kvm_opts = ",dirty-ring-size=4096";
     }
 
+    if (args->use_tcg_dirty_ring) {
+        /*
+         * Do not use KVM, the test is about the TCG dirty rings.  The
+         * rings hold more pages than the guest has, so that they never
+         * overflow and the test can check that they were used.
+         */
+        accel_opts = g_strdup("-accel tcg,dirty-ring-size=262144");
+    } else {
+        accel_opts = g_strdup_printf("-accel kvm%s -accel tcg",
+                                     kvm_opts ? kvm_opts : "");
+    }
+
     if (!qtest_has_machine(machine_alias)) {
         g_autofree char *msg = g_strdup_printf("machine %s not supported", machine_alias);
         g_test_skip(msg);
@@ -368,13 +381,13 @@ int migrate_start(QTestState **from, QTestState **to, const char *uri,
 
     g_test_message("Using machine type: %s", machine);
 
-    cmd_source = g_strdup_printf("-accel kvm%s -accel tcg "
+    cmd_source = g_strdup_printf("%s "
                                  "-machine %s,%s "
                                  "-name source,debug-threads=on "
                                  "%s "
                                  "-serial file:%s/src_serial "
                                  "%s %s %s %s",
-                                 kvm_opts ? kvm_opts : "",
+                                 accel_opts,
                                  machine, machine_opts,
                                  memory_backend, tmpfs,
                                  arch_opts ? arch_opts : "",
@@ -395,14 +408,14 @@ int migrate_start(QTestState **from, QTestState **to, const char *uri,
      */
     events = args->defer_target_connect ? "-global migration.x-events=on" : "";
 
-    cmd_target = g_strdup_printf("-accel kvm%s -accel tcg "
+    cmd_target = g_strdup_printf("%s "
                                  "-machine %s,%s "
                                  "-name target,debug-threads=on "
                                  "%s "
                                  "-serial file:%s/dest_serial "
                                  "-incoming %s "
                                  "%s %s %s %s %s",
-                                 kvm_opts ? kvm_opts : "",
+                                 accel_opts,
                                  machine, machine_opts,
                                  memory_backend, tmpfs, uri,
                                  events,
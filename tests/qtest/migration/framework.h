@@ -107,6 +107,8 @@ typedef struct {
     bool only_target;
     /* Use dirty ring if true; dirty logging otherwise */
     bool use_dirty_ring;
+    /* Use TCG with its dirty rings instead of KVM or TCG with bitmaps */
+    bool use_tcg_dirty_ring;
     const char *opts_source;
     const char *opts_target;
     /* suspend the src before migrating to dest. */
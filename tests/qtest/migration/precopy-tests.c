@@ -99,6 +99,31 @@ static void test_precopy_unix_dirty_ring(void)
     test_precopy_common(&args);
 }
 
+static void tcg_dirty_ring_end(QTestState *from, QTestState *to,
+                               void *opaque)
+{
+    /* The first sync scans the bitmaps, later ones must use the rings */
+    g_assert_cmpint(read_ram_property_int(from, "dirty-sync-ring-count"),
+                    >, 0);
+}
+
+static void test_precopy_unix_tcg_dirty_ring(void)
+{
+    g_autofree char *uri = g_strdup_printf("unix:%s/migsocket", tmpfs);
+    MigrateCommon args = {
+        .start = {
+            .use_tcg_dirty_ring = true,
+        },
+        .listen_uri = uri,
+        .connect_uri = uri,
+        /* Check that the rings do not lose pages that the guest dirties */
+        .live = true,
+        .end_hook = tcg_dirty_ring_end,
+    };
+
+    test_precopy_common(&args);
+}
+
 #ifdef CONFIG_RDMA
 
 #include <sys/resource.h>
@@ -1314,6 +1339,10 @@ void migration_test_add_precopy(MigrationTestEnv *env)
                                test_vcpu_dirty_limit);
         }
     }
+    if (env->has_tcg) {
+        migration_test_add("/migration/tcg_dirty_ring",
+                           test_precopy_unix_tcg_dirty_ring);
+    }
 
     /* ensure new status don't go unnoticed */
     assert(MIGRATION_STATUS__MAX == 15);
@@ -15,6 +15,7 @@
 #include "qapi/error.h"
 #include "qapi/qapi-visit-introspect.h"
 #include "qobject/qdict.h"
+#include "qobject/qlist.h"
 #include "qapi/qobject-input-visitor.h"
 
 const char common_args[] = "-nodefaults -machine none";
@@ -53,6 +54,8 @@ static int query_error_class(const char *cmd)
         { "x-query-jit", ERROR_CLASS_GENERIC_ERROR },
         { "x-query-opcount", ERROR_CLASS_GENERIC_ERROR },
         { "xen-event-list", ERROR_CLASS_GENERIC_ERROR },
+        /* Only valid after memory-heat-start */
+        { "query-memory-heat", ERROR_CLASS_GENERIC_ERROR },
         { NULL, -1 }
     };
     int i;
@@ -342,6 +345,150 @@ static void test_object_add_failure_modes(void)
     qtest_quit(qts);
 }
 
+static char *query_memdev_prefault(QTestState *qts, uint64_t *populated)
+{
+    QDict *resp, *prefault;
+    QList *ret;
+    char *status;
+
+    resp = qtest_qmp(qts, "{'execute': 'query-memdev'}");
+    ret = qdict_get_qlist(resp, "return");
+    g_assert_cmpint(qlist_size(ret), ==, 1);
+    prefault = qdict_get_qdict(qobject_to(QDict, qlist_peek(ret)), "prefault");
+    g_assert_nonnull(prefault);
+
+    status = g_strdup(qdict_get_str(prefault, "status"));
+    *populated = qdict_get_int(prefault, "populated");
+    qobject_unref(resp);
+    return status;
+}
+
+static void test_memdev_prefault(void)
+{
+    QTestState *qts;
+    QDict *resp;
+    uint64_t populated;
+    char *status;
+
+    qts = qtest_initf("%s -S", common_args);
+
+    /* prefault and prealloc are exclusive */
+    resp = qtest_qmp(qts, "{'execute': 'object-add', 'arguments':"
+                     " {'qom-type': 'memory-backend-ram', 'id': 'ram1',"
+                     " 'size': 8388608, 'prealloc': true, 'prefault': true } }");
+    g_assert_nonnull(resp);
+    qmp_expect_error_and_unref(resp, "GenericError");
+
+    resp = qtest_qmp(qts, "{'execute': 'object-add', 'arguments':"
+                     " {'qom-type': 'memory-backend-ram', 'id': 'ram1',"
+                     " 'size': 8388608, 'prefault': true } }");
+    g_assert_nonnull(resp);
+    g_assert(qdict_haskey(resp, "return"));
+    qobject_unref(resp);
+
+    /* nothing happens until the guest runs */
+    status = query_memdev_prefault(qts, &populated);
+    g_assert_cmpstr(status, ==, "pending");
+    g_assert_cmpint(populated, ==, 0);
+    g_free(status);
+
+    qtest_qmp_assert_success(qts, "{'execute': 'cont'}");
+
+    /* "failed" if the host lacks MADV_POPULATE_WRITE */
+    for (;;) {
+        status = query_memdev_prefault(qts, &populated);
+        if (strcmp(status, "active")) {
+            break;
+        }
+        g_free(status);
+        g_usleep(1000);
+    }
+    if (!strcmp(status, "completed")) {
+        g_assert_cmpint(populated, ==, 8388608);
+    } else {
+        g_assert_cmpstr(status, ==, "failed");
+    }
+    g_free(status);
+
+    resp = qtest_qmp(qts, "{'execute': 'object-del', 'arguments':"
+                     " {'id': 'ram1' } }");
+    g_assert_nonnull(resp);
+    g_assert(qdict_haskey(resp, "return"));
+    qobject_unref(resp);
+
+    qtest_quit(qts);
+}
+
+static void test_memory_heat(void)
+{
+    QTestState *qts;
+    QDict *resp, *ret, *block;
+    QList *blocks;
+
+    qts = qtest_initf("%s -object memory-backend-ram,id=ram1,size=8M",
+                      common_args);
+
+    resp = qtest_qmp(qts, "{'execute': 'memory-heat-stop'}");
+    qmp_expect_error_and_unref(resp, "GenericError");
+
+    resp = qtest_qmp(qts, "{'execute': 'memory-heat-start', 'arguments':"
+                     " {'granularity': 12345 } }");
+    qmp_expect_error_and_unref(resp, "GenericError");
+
+    qtest_qmp_assert_success(qts, "{'execute': 'memory-heat-start',"
+                             " 'arguments': {'period': 10 } }");
+    resp = qtest_qmp(qts, "{'execute': 'memory-heat-start'}");
+    qmp_expect_error_and_unref(resp, "GenericError");
+
+    for (;;) {
+        resp = qtest_qmp(qts, "{'execute': 'query-memory-heat',"
+                         " 'arguments': {'id': 'ram1' } }");
+        ret = qdict_get_qdict(resp, "return");
+        g_assert_nonnull(ret);
+        if (qdict_get_int(ret, "samples")) {
+            break;
+        }
+        qobject_unref(resp);
+        g_usleep(1000);
+    }
+    g_assert(qdict_get_bool(ret, "active"));
+    g_assert_cmpint(qdict_get_int(ret, "granularity"), ==, 2097152);
+    blocks = qdict_get_qlist(ret, "blocks");
+    g_assert_cmpint(qlist_size(blocks), ==, 1);
+    block = qobject_to(QDict, qlist_peek(blocks));
+    g_assert_cmpstr(qdict_get_str(block, "id"), ==, "ram1");
+    g_assert_cmpint(qlist_size(qdict_get_qlist(block, "heat")), ==, 4);
+    qobject_unref(resp);
+
+    resp = qtest_qmp(qts, "{'execute': 'query-memory-heat', 'arguments':"
+                     " {'id': 'nonexistent' } }");
+    qmp_expect_error_and_unref(resp, "GenericError");
+
+    qtest_qmp_assert_success(qts, "{'execute': 'memory-heat-stop'}");
+
+    /* the last heat sampled can still be queried */
+    resp = qtest_qmp(qts, "{'execute': 'query-memory-heat'}");
+    ret = qdict_get_qdict(resp, "return");
+    g_assert_nonnull(ret);
+    g_assert(!qdict_get_bool(ret, "active"));
+    g_assert_cmpint(qdict_get_int(ret, "samples"), >, 0);
+    qobject_unref(resp);
+
+    /* tracking can start again once the sampler thread has been reaped */
+    for (;;) {
+        resp = qtest_qmp(qts, "{'execute': 'memory-heat-start'}");
+        if (qdict_haskey(resp, "return")) {
+            qobject_unref(resp);
+            break;
+        }
+        qmp_expect_error_and_unref(resp, "GenericError");
+        g_usleep(1000);
+    }
+    qtest_qmp_assert_success(qts, "{'execute': 'memory-heat-stop'}");
+
+    qtest_quit(qts);
+}
+
 int main(int argc, char *argv[])
 {
     QmpSchema schema;
@@ -354,6 +501,8 @@ int main(int argc, char *argv[])
 
     qtest_add_func("qmp/object-add-failure-modes",
                    test_object_add_failure_modes);
+    qtest_add_func("qmp/memdev-prefault", test_memdev_prefault);
+    qtest_add_func("qmp/memory-heat", test_memory_heat);
 
     ret = g_test_run();
 
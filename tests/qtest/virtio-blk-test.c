@@ -802,6 +802,10 @@ static void register_virtio_blk_test(void)
     qos_add_test("nxvirtq", "virtio-blk-pci",
                       test_nonexistent_virtqueue, &opts);
     qos_add_test("hotplug", "virtio-blk-pci", pci_hotplug, &opts);
+
+    /* EVENT_IDX must still be honoured when interrupts are coalesced */
+    opts.edge.extra_device_opts = "irq-coalesce-usecs=100,irq-coalesce-max=4";
+    qos_add_test("idx-coalesced", "virtio-blk-pci", idx, &opts);
 }
 
 libqos_init(register_virtio_blk_test);
@@ -17,10 +17,22 @@
 #include "libqos/qgraph.h"
 #include "libqos/virtio-iommu.h"
 #include "hw/virtio/virtio-iommu.h"
+#include "standard-headers/linux/virtio_blk.h"
+#include "standard-headers/linux/virtio_config.h"
+#include "standard-headers/linux/virtio_ids.h"
 
 #define PCI_SLOT_HP             0x06
 #define QVIRTIO_IOMMU_TIMEOUT_US (30 * 1000 * 1000)
 
+/* virtio-blk-pci device translated by the virtio-iommu */
+#define BLK_PCI_SLOT            0x05
+#define BLK_EP                  QPCI_DEVFN(BLK_PCI_SLOT, 0)
+#define BLK_PATTERN             0xa5
+
+/* Identity map covering guest RAM, and a separate window above it */
+#define IDENTITY_END            0xFFFFFFFFFULL
+#define WINDOW_IOVA             0x1000000000ULL
+
 static QGuestAllocator *alloc;
 
 static void pci_config(void *obj, void *data, QGuestAllocator *t_alloc)
@@ -318,11 +330,152 @@ static void test_map_unmap(void *obj, void *data, QGuestAllocator *t_alloc)
     g_assert_cmpint(ret, ==, VIRTIO_IOMMU_S_INVAL); /* 10-14 still is mapped */
 }
 
+static void blk_image_destroy(void *path)
+{
+    unlink(path);
+    g_free(path);
+    qos_invalidate_command_line();
+}
+
+static void *iova_cache_test_setup(GString *cmd_line, void *arg)
+{
+    char *t_path;
+    char buf[512];
+    int fd;
+
+    /* Create a raw image whose first sector holds a known pattern */
+    fd = g_file_open_tmp("qtest.XXXXXX", &t_path, NULL);
+    g_assert_cmpint(fd, >=, 0);
+    memset(buf, BLK_PATTERN, sizeof(buf));
+    g_assert_cmpint(write(fd, buf, sizeof(buf)), ==, sizeof(buf));
+    close(fd);
+    g_test_queue_destroy(blk_image_destroy, t_path);
+
+    g_string_append_printf(cmd_line,
+                           " -drive if=none,id=drv0,file=%s,format=raw"
+                           " -device virtio-blk-pci,drive=drv0,addr=%02x.0,"
+                           "disable-legacy=on,iommu_platform=on",
+                           t_path, BLK_PCI_SLOT);
+    return arg;
+}
+
+/* Read the first sector of the disk into @iova */
+static void blk_read_sector(QTestState *qts, QVirtioDevice *dev,
+                            QVirtQueue *vq, uint64_t iova)
+{
+    struct virtio_blk_outhdr hdr = {
+        .type = cpu_to_le32(VIRTIO_BLK_T_IN),
+        .sector = 0,
+    };
+    uint64_t req_addr;
+    uint32_t free_head;
+
+    req_addr = guest_alloc(alloc, sizeof(hdr) + 1);
+    qtest_memwrite(qts, req_addr, &hdr, sizeof(hdr));
+    qtest_writeb(qts, req_addr + sizeof(hdr), 0xff);
+
+    free_head = qvirtqueue_add(qts, vq, req_addr, sizeof(hdr), false, true);
+    qvirtqueue_add(qts, vq, iova, 512, true, true);
+    qvirtqueue_add(qts, vq, req_addr + sizeof(hdr), 1, true, false);
+    qvirtqueue_kick(qts, dev, vq, free_head);
+    qvirtio_wait_used_elem(qts, dev, vq, free_head, NULL,
+                           QVIRTIO_IOMMU_TIMEOUT_US);
+    g_assert_cmpint(qtest_readb(qts, req_addr + sizeof(hdr)), ==,
+                    VIRTIO_BLK_S_OK);
+    guest_free(alloc, req_addr);
+}
+
+static void check_buffer(QTestState *qts, uint64_t addr, uint8_t value)
+{
+    uint8_t buf[512];
+    size_t i;
+
+    qtest_memread(qts, addr, buf, sizeof(buf));
+    for (i = 0; i < sizeof(buf); i++) {
+        g_assert_cmphex(buf[i], ==, value);
+    }
+}
+
+/*
+ * virtio devices cache IOVA translations in each virtqueue.  Check that
+ * the cache is invalidated when the guest unmaps the IOVA, so that the
+ * next request that uses it goes to the new mapping.
+ */
+static void test_iova_cache_invalidate(void *obj, void *data,
+                                       QGuestAllocator *t_alloc)
+{
+    QVirtioIOMMU *v_iommu = obj;
+    QVirtioIOMMUPCI *iommu_pci = container_of(v_iommu, QVirtioIOMMUPCI, iommu);
+    QTestState *qts = global_qtest;
+    uint32_t flags = VIRTIO_IOMMU_MAP_F_READ | VIRTIO_IOMMU_MAP_F_WRITE;
+    uint64_t wanted = (1ull << VIRTIO_F_VERSION_1) |
+                      (1ull << VIRTIO_F_ACCESS_PLATFORM);
+    QVirtioPCIDevice *blk;
+    QVirtQueue *vq;
+    uint64_t buf_a, buf_b;
+    int ret;
+
+    alloc = t_alloc;
+
+    buf_a = guest_alloc(alloc, 0x1000);
+    buf_b = guest_alloc(alloc, 0x1000);
+    qtest_memset(qts, buf_a, 0, 0x1000);
+    qtest_memset(qts, buf_b, 0, 0x1000);
+
+    /* Guest RAM is identity mapped, the window points to buf_a */
+    ret = send_attach_detach(qts, v_iommu, VIRTIO_IOMMU_T_ATTACH, 1, BLK_EP);
+    g_assert_cmpint(ret, ==, 0);
+    ret = send_map(qts, v_iommu, 1, 0, IDENTITY_END, 0, flags);
+    g_assert_cmpint(ret, ==, 0);
+    ret = send_map(qts, v_iommu, 1, WINDOW_IOVA, WINDOW_IOVA + 0xFFF,
+                   buf_a, flags);
+    g_assert_cmpint(ret, ==, 0);
+
+    blk = virtio_pci_new(iommu_pci->pci_vdev.pdev->bus,
+                         &(QPCIAddress) { .devfn = BLK_EP });
+    g_assert_nonnull(blk);
+    g_assert_cmpint(blk->vdev.device_type, ==, VIRTIO_ID_BLOCK);
+    qvirtio_pci_device_enable(blk);
+    qvirtio_start_device(&blk->vdev);
+    g_assert_cmphex(qvirtio_get_features(&blk->vdev) & wanted, ==, wanted);
+    qvirtio_set_features(&blk->vdev, wanted);
+    vq = qvirtqueue_setup(&blk->vdev, alloc, 0);
+    qvirtio_set_driver_ok(&blk->vdev);
+
+    blk_read_sector(qts, &blk->vdev, vq, WINDOW_IOVA);
+    check_buffer(qts, buf_a, BLK_PATTERN);
+    check_buffer(qts, buf_b, 0);
+
+    /* Move the window to buf_b; the cached translation must be dropped */
+    ret = send_unmap(qts, v_iommu, 1, WINDOW_IOVA, WINDOW_IOVA + 0xFFF);
+    g_assert_cmpint(ret, ==, 0);
+    ret = send_map(qts, v_iommu, 1, WINDOW_IOVA, WINDOW_IOVA + 0xFFF,
+                   buf_b, flags);
+    g_assert_cmpint(ret, ==, 0);
+    qtest_memset(qts, buf_a, 0, 0x1000);
+
+    blk_read_sector(qts, &blk->vdev, vq, WINDOW_IOVA);
+    check_buffer(qts, buf_b, BLK_PATTERN);
+    check_buffer(qts, buf_a, 0);
+
+    qvirtqueue_cleanup(blk->vdev.bus, vq, alloc);
+    qvirtio_pci_device_disable(blk);
+    qos_object_destroy((QOSGraphObject *)blk);
+    guest_free(alloc, buf_a);
+    guest_free(alloc, buf_b);
+}
+
 static void register_virtio_iommu_test(void)
 {
+    QOSGraphTestOptions opts = {
+        .before = iova_cache_test_setup,
+    };
+
     qos_add_test("config", "virtio-iommu", pci_config, NULL);
     qos_add_test("attach_detach", "virtio-iommu", test_attach_detach, NULL);
     qos_add_test("map_unmap", "virtio-iommu", test_map_unmap, NULL);
+    qos_add_test("iova_cache_invalidate", "virtio-iommu",
+                 test_iova_cache_invalidate, &opts);
 }
 
 libqos_init(register_virtio_iommu_test);
@@ -16,6 +16,7 @@
 #include "libqos/libqos-spapr.h"
 #include "libqos/virtio.h"
 #include "libqos/virtio-pci.h"
+#include "standard-headers/linux/virtio_config.h"
 #include "standard-headers/linux/virtio_ids.h"
 #include "standard-headers/linux/virtio_pci.h"
 #include "standard-headers/linux/virtio_scsi.h"
@@ -311,6 +312,70 @@ fail:
     unlink(tmp_path);
 }
 
+/*
+ * The common config, ISR and device config regions of virtio-pci are
+ * dispatched without the BQL unless x-lockless-io=off; qtest accesses come
+ * from the main loop, so this checks the results of those paths rather
+ * than their concurrency.
+ */
+static void test_lockless_io(void *obj, void *data, QGuestAllocator *t_alloc)
+{
+    QVirtioSCSIPCI *scsi_pci = obj;
+    QVirtioPCIDevice *dev = &scsi_pci->pci_vdev;
+    QVirtioDevice *vdev = &dev->vdev;
+    uint64_t common = dev->common_cfg_offset;
+    uint64_t sense_size = dev->device_cfg_offset +
+        offsetof(struct virtio_scsi_config, sense_size);
+    uint16_t num_queues;
+    uint8_t generation;
+
+    if (!(qvirtio_get_features(vdev) & (1ull << VIRTIO_F_VERSION_1))) {
+        g_test_skip("virtio 1.0 layout not available");
+        return;
+    }
+
+    /* Device config reads do not take the BQL for virtio-scsi */
+    g_assert_cmpint(qvirtio_config_readl(vdev,
+                        offsetof(struct virtio_scsi_config, num_queues)),
+                    ==, 4);
+
+    /* Device config writes take it, and leave the generation alone */
+    generation = qpci_io_readb(dev->pdev, dev->bar, common +
+        offsetof(struct virtio_pci_common_cfg, config_generation));
+    qpci_io_writel(dev->pdev, dev->bar, sense_size, 64);
+    g_assert_cmpint(qpci_io_readl(dev->pdev, dev->bar, sense_size), ==, 64);
+    g_assert_cmpint(qpci_io_readb(dev->pdev, dev->bar, common +
+        offsetof(struct virtio_pci_common_cfg, config_generation)),
+                    ==, generation);
+
+    /* Queue addresses are latched per queue without the BQL */
+    num_queues = qpci_io_readw(dev->pdev, dev->bar, common +
+        offsetof(struct virtio_pci_common_cfg, num_queues));
+    g_assert_cmpint(num_queues, ==, 4 + 2);
+    for (uint16_t i = 0; i < num_queues; i++) {
+        qpci_io_writew(dev->pdev, dev->bar, common +
+            offsetof(struct virtio_pci_common_cfg, queue_select), i);
+        qpci_io_writel(dev->pdev, dev->bar, common +
+            offsetof(struct virtio_pci_common_cfg, queue_desc_lo),
+            0x1000 * (i + 1));
+        qpci_io_writel(dev->pdev, dev->bar, common +
+            offsetof(struct virtio_pci_common_cfg, queue_used_hi), i);
+    }
+    for (uint16_t i = 0; i < num_queues; i++) {
+        qpci_io_writew(dev->pdev, dev->bar, common +
+            offsetof(struct virtio_pci_common_cfg, queue_select), i);
+        g_assert_cmphex(qpci_io_readl(dev->pdev, dev->bar, common +
+            offsetof(struct virtio_pci_common_cfg, queue_desc_lo)),
+                        ==, 0x1000 * (i + 1));
+        g_assert_cmphex(qpci_io_readl(dev->pdev, dev->bar, common +
+            offsetof(struct virtio_pci_common_cfg, queue_used_hi)), ==, i);
+    }
+
+    /* Nothing is pending, reading the ISR leaves INTx alone */
+    g_assert_cmpint(qpci_io_readb(dev->pdev, dev->bar,
+                                  dev->isr_cfg_offset), ==, 0);
+}
+
 static void *virtio_scsi_hotplug_setup(GString *cmd_line, void *arg)
 {
     g_string_append(cmd_line,
@@ -383,6 +448,17 @@ static void register_virtio_scsi_test(void)
     };
     qos_add_test("iothread-attach-node", "virtio-scsi-pci",
                  test_iothread_attach_node, &opts);
+
+    opts.before = NULL;
+    opts.edge = (QOSGraphEdgeOptions) {
+        .extra_device_opts = "num_queues=4",
+    };
+    qos_add_test("lockless-io", "virtio-scsi-pci", test_lockless_io, &opts);
+
+    opts.edge = (QOSGraphEdgeOptions) {
+        .extra_device_opts = "num_queues=4,x-lockless-io=off",
+    };
+    qos_add_test("locked-io", "virtio-scsi-pci", test_lockless_io, &opts);
 }
 
 libqos_init(register_virtio_scsi_test);
@@ -7,19 +7,33 @@
 #include "qemu/osdep.h"
 
 #define TEST_QHT_STRING "tests/qht-bench 1>/dev/null 2>&1 -R -S0.1 -D10000 -N1 "
+/* resize a large table back and forth, so that writers race with migrations */
+#define TEST_QHT_RESIZE_STRING \
+    "tests/qht-bench 1>/dev/null 2>&1 -R -S100 -D100 -N1 -g 65536 "
 
-static void test_qht(int n_threads, int update_rate, int duration)
+static void do_test_qht(const char *cmd, int n_threads, int update_rate,
+                        int duration)
 {
     char *str;
     int rc;
 
-    str = g_strdup_printf(TEST_QHT_STRING "-n %d -u %d -d %d",
+    str = g_strdup_printf("%s-n %d -u %d -d %d", cmd,
                           n_threads, update_rate, duration);
     rc = system(str);
     g_free(str);
     g_assert_cmpint(rc, ==, 0);
 }
 
+static void test_qht(int n_threads, int update_rate, int duration)
+{
+    do_test_qht(TEST_QHT_STRING, n_threads, update_rate, duration);
+}
+
+static void test_qht_resize(int n_threads, int update_rate, int duration)
+{
+    do_test_qht(TEST_QHT_RESIZE_STRING, n_threads, update_rate, duration);
+}
+
 static void test_2th0u1s(void)
 {
     test_qht(2, 0, 1);
@@ -40,6 +54,16 @@ static void test_2th20u5s(void)
     test_qht(2, 20, 5);
 }
 
+static void test_2th20u1s_resize(void)
+{
+    test_qht_resize(2, 20, 1);
+}
+
+static void test_2th20u5s_resize(void)
+{
+    test_qht_resize(2, 20, 5);
+}
+
 int main(int argc, char *argv[])
 {
     g_test_init(&argc, &argv, NULL);
@@ -47,9 +71,13 @@ int main(int argc, char *argv[])
     if (g_test_quick()) {
         g_test_add_func("/qht/parallel/2threads-0%updates-1s", test_2th0u1s);
         g_test_add_func("/qht/parallel/2threads-20%updates-1s", test_2th20u1s);
+        g_test_add_func("/qht/parallel/2threads-20%updates-1s-resize",
+                        test_2th20u1s_resize);
     } else {
         g_test_add_func("/qht/parallel/2threads-0%updates-5s", test_2th0u5s);
         g_test_add_func("/qht/parallel/2threads-20%updates-5s", test_2th20u5s);
+        g_test_add_func("/qht/parallel/2threads-20%updates-5s-resize",
+                        test_2th20u5s_resize);
     }
     return g_test_run();
 }
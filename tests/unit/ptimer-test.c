@@ -27,18 +27,21 @@ static void ptimer_test_expire_qemu_timers(int64_t expire_time,
                                            QEMUClockType type)
 {
     QEMUTimerList *timer_list = main_loop_tlg.tl[type];
-    QEMUTimer *t = timer_list->active_timers.next;
+    g_autoptr(GSList) timers = g_slist_copy(timer_list->active_timers);
+    GSList *l;
 
-    while (t != NULL) {
-        if (t->expire_time == expire_time) {
+    /* Callbacks may re-arm timers, walk the timers that were armed now */
+    for (l = timers; l; l = l->next) {
+        QEMUTimer *t = l->data;
+
+        if (t->expire_time == expire_time &&
+            g_slist_find(timer_list->active_timers, t)) {
             timer_del(t);
 
             if (t->cb != NULL) {
                 t->cb(t->opaque);
             }
         }
-
-        t = t->next;
     }
 }
 
@@ -18,6 +18,7 @@
 #include "qemu/error-report.h"
 #include "qemu/coroutine-core.h"
 #include "qemu/main-loop.h"
+#include "qemu/rcu.h"
 
 static AioContext *ctx;
 
@@ -825,6 +826,144 @@ static void test_worker_thread_co_enter(void)
     g_assert(!aio_poll(ctx, false));
 }
 
+#ifdef CONFIG_LINUX_IO_URING
+typedef struct {
+    CqeHandler cqe_handler;
+    AioContext *ctx;
+    int completed;
+    /* Add another request from the completion callback */
+    bool chain;
+} SqeTestRequest;
+
+typedef struct {
+    void (*fn)(AioContext *ctx);
+    bool has_io_uring;
+} SqeTestData;
+
+static void prep_nop(struct io_uring_sqe *sqe, void *opaque)
+{
+    io_uring_prep_nop(sqe);
+}
+
+static void sqe_test_submit(SqeTestRequest *req)
+{
+    aio_add_sqe(req->ctx, prep_nop, NULL, &req->cqe_handler);
+}
+
+static void sqe_test_cb(CqeHandler *cqe_handler)
+{
+    SqeTestRequest *req = container_of(cqe_handler, SqeTestRequest,
+                                       cqe_handler);
+
+    g_assert_cmpint(cqe_handler->cqe.res, ==, 0);
+    req->completed++;
+    if (req->chain) {
+        req->chain = false;
+        sqe_test_submit(req);
+    }
+}
+
+/* aio_add_sqe() needs an io_uring AioContext that is current in its thread */
+static void *sqe_test_thread(void *opaque)
+{
+    SqeTestData *data = opaque;
+    AioContext *sqe_ctx;
+
+    rcu_register_thread();
+    sqe_ctx = aio_context_new(&error_abort);
+    qemu_set_current_aio_context(sqe_ctx);
+
+    data->has_io_uring = aio_has_io_uring(sqe_ctx);
+    if (data->has_io_uring) {
+        data->fn(sqe_ctx);
+    }
+
+    aio_context_unref(sqe_ctx);
+    rcu_unregister_thread();
+    return NULL;
+}
+
+static void run_sqe_test(void (*fn)(AioContext *ctx))
+{
+    SqeTestData data = { .fn = fn };
+    QemuThread thread;
+
+    qemu_thread_create(&thread, "test_aio_sqe", sqe_test_thread, &data,
+                       QEMU_THREAD_JOINABLE);
+    qemu_thread_join(&thread);
+
+    if (!data.has_io_uring) {
+        g_test_skip("io_uring fd monitoring is not available");
+    }
+}
+
+static void sqe_poll(AioContext *sqe_ctx)
+{
+    SqeTestRequest reqs[3];
+    int i;
+
+    for (i = 0; i < ARRAY_SIZE(reqs); i++) {
+        reqs[i] = (SqeTestRequest) {
+            .cqe_handler.cb = sqe_test_cb,
+            .ctx = sqe_ctx,
+        };
+        sqe_test_submit(&reqs[i]);
+    }
+
+    /* The requests are submitted and reaped by aio_poll() */
+    for (i = 0; i < ARRAY_SIZE(reqs); i++) {
+        g_assert_cmpint(reqs[i].completed, ==, 0);
+    }
+    while (reqs[0].completed + reqs[1].completed + reqs[2].completed < 3) {
+        g_assert(aio_poll(sqe_ctx, true));
+    }
+    for (i = 0; i < ARRAY_SIZE(reqs); i++) {
+        g_assert_cmpint(reqs[i].completed, ==, 1);
+    }
+}
+
+static void test_sqe_poll(void)
+{
+    run_sqe_test(sqe_poll);
+}
+
+static void sqe_drain(AioContext *sqe_ctx)
+{
+    SqeTestRequest reqs[2];
+    BHTestData bh_data = { .n = 0 };
+    int i;
+
+    for (i = 0; i < ARRAY_SIZE(reqs); i++) {
+        reqs[i] = (SqeTestRequest) {
+            .cqe_handler.cb = sqe_test_cb,
+            .ctx = sqe_ctx,
+            .chain = i == 0,
+        };
+        sqe_test_submit(&reqs[i]);
+    }
+    bh_data.bh = aio_bh_new(sqe_ctx, bh_test_cb, &bh_data);
+    qemu_bh_schedule(bh_data.bh);
+
+    /* Waits for the chained request too, but does not run bottom halves */
+    aio_drain_sqes(sqe_ctx);
+    g_assert_cmpint(reqs[0].completed, ==, 2);
+    g_assert_cmpint(reqs[1].completed, ==, 1);
+    g_assert_cmpint(bh_data.n, ==, 0);
+
+    g_assert(aio_poll(sqe_ctx, false));
+    g_assert_cmpint(bh_data.n, ==, 1);
+    qemu_bh_delete(bh_data.bh);
+
+    /* Nothing in flight */
+    aio_drain_sqes(sqe_ctx);
+}
+
+static void test_sqe_drain(void)
+{
+    run_sqe_test(sqe_drain);
+}
+#endif
+
 /* End of tests.  */
 
 int main(int argc, char **argv)
@@ -850,6 +989,10 @@ int main(int argc, char **argv)
 
     g_test_add_func("/aio/coroutine/queue-chaining", test_queue_chaining);
     g_test_add_func("/aio/coroutine/worker-thread-co-enter", test_worker_thread_co_enter);
+#ifdef CONFIG_LINUX_IO_URING
+    g_test_add_func("/aio/sqe/poll",                test_sqe_poll);
+    g_test_add_func("/aio/sqe/drain",               test_sqe_drain);
+#endif
 
     g_test_add_func("/aio-gsource/flush",                   test_source_flush);
     g_test_add_func("/aio-gsource/bh/schedule",             test_source_bh_schedule);
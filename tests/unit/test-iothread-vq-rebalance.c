@@ -0,0 +1,137 @@
+/*
+ * Unit tests for the rebalancing of virtqueues between IOThreads
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "qemu/osdep.h"
+#include "hw/virtio/iothread-vq-mapping.h"
+
+/*
+ * Rebalance @num_queues virtqueues between @num_iothreads IOThreads and
+ * check the number of moves and the resulting assignment.
+ */
+static void check_rebalance(size_t num_iothreads, const uint64_t *vq_load,
+                            unsigned *vq_iothread, uint16_t num_queues,
+                            unsigned expected_moved,
+                            const unsigned *expected_iothread)
+{
+    g_autofree uint64_t *iothread_load = g_new0(uint64_t, num_iothreads);
+    g_autofree uint64_t *expected_load = g_new0(uint64_t, num_iothreads);
+    unsigned moved;
+    uint16_t i;
+
+    for (i = 0; i < num_queues; i++) {
+        iothread_load[vq_iothread[i]] += vq_load[i];
+    }
+
+    moved = iothread_vq_rebalance_loads(iothread_load, num_iothreads, vq_load,
+                                        vq_iothread, num_queues);
+    g_assert_cmpuint(moved, ==, expected_moved);
+    g_assert_cmpuint(moved, <=, num_iothreads);
+
+    for (i = 0; i < num_queues; i++) {
+        g_assert_cmpuint(vq_iothread[i], ==, expected_iothread[i]);
+        expected_load[vq_iothread[i]] += vq_load[i];
+    }
+
+    /* The loads must follow the virtqueues that were moved */
+    for (i = 0; i < num_iothreads; i++) {
+        g_assert_cmpuint(iothread_load[i], ==, expected_load[i]);
+    }
+}
+
+/* Round-robin assignment, as done by iothread_vq_mapping_apply() */
+static void round_robin(unsigned *vq_iothread, uint16_t num_queues,
+                        size_t num_iothreads)
+{
+    for (uint16_t i = 0; i < num_queues; i++) {
+        vq_iothread[i] = i % num_iothreads;
+    }
+}
+
+static void test_more_queues(void)
+{
+    uint64_t vq_load[] = { 100, 10, 100, 10, 100 };
+    unsigned vq_iothread[ARRAY_SIZE(vq_load)];
+
+    /*
+     * 300 vs 20: one busy virtqueue moves.  Moving a second one would only
+     * make the other IOThread the busiest.
+     */
+    round_robin(vq_iothread, ARRAY_SIZE(vq_load), 2);
+    check_rebalance(2, vq_load, vq_iothread, ARRAY_SIZE(vq_load), 1,
+                    (unsigned[]) { 1, 1, 0, 1, 0 });
+}
+
+static void test_uneven(void)
+{
+    uint64_t vq_load[] = { 40, 10, 5, 40, 10, 5, 40 };
+    unsigned vq_iothread[ARRAY_SIZE(vq_load)];
+
+    /* 120, 20 and 10 end up as 50 each, after one move per IOThread */
+    round_robin(vq_iothread, ARRAY_SIZE(vq_load), 3);
+    check_rebalance(3, vq_load, vq_iothread, ARRAY_SIZE(vq_load), 3,
+                    (unsigned[]) { 2, 0, 2, 1, 1, 2, 0 });
+}
+
+static void test_more_iothreads(void)
+{
+    uint64_t vq_load[] = { 60, 40, 10 };
+    unsigned vq_iothread[] = { 0, 0, 1 };
+
+    /* Two IOThreads are idle, but splitting the busy pair is enough */
+    check_rebalance(4, vq_load, vq_iothread, ARRAY_SIZE(vq_load), 1,
+                    (unsigned[]) { 2, 0, 1 });
+
+    /* One virtqueue per IOThread, nothing to improve */
+    round_robin(vq_iothread, ARRAY_SIZE(vq_load), 4);
+    check_rebalance(4, (uint64_t[]) { 50, 50, 50 }, vq_iothread,
+                    ARRAY_SIZE(vq_load), 0, (unsigned[]) { 0, 1, 2 });
+}
+
+static void test_balanced(void)
+{
+    uint64_t vq_load[] = { 100, 90, 100, 90 };
+    unsigned vq_iothread[ARRAY_SIZE(vq_load)];
+
+    /* 200 vs 180 is within the slack */
+    round_robin(vq_iothread, ARRAY_SIZE(vq_load), 2);
+    check_rebalance(2, vq_load, vq_iothread, ARRAY_SIZE(vq_load), 0,
+                    (unsigned[]) { 0, 1, 0, 1 });
+}
+
+static void test_idle_queues(void)
+{
+    uint64_t vq_load[] = { 100, 0, 0 };
+    unsigned vq_iothread[] = { 0, 0, 1 };
+
+    /* Idle virtqueues are not moved, and moving the busy one cannot help */
+    check_rebalance(2, vq_load, vq_iothread, ARRAY_SIZE(vq_load), 0,
+                    (unsigned[]) { 0, 0, 1 });
+}
+
+static void test_single_iothread(void)
+{
+    uint64_t vq_load[] = { 100, 10, 1 };
+    unsigned vq_iothread[] = { 0, 0, 0 };
+
+    check_rebalance(1, vq_load, vq_iothread, ARRAY_SIZE(vq_load), 0,
+                    (unsigned[]) { 0, 0, 0 });
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/iothread-vq-rebalance/more-queues", test_more_queues);
+    g_test_add_func("/iothread-vq-rebalance/uneven", test_uneven);
+    g_test_add_func("/iothread-vq-rebalance/more-iothreads",
+                    test_more_iothreads);
+    g_test_add_func("/iothread-vq-rebalance/balanced", test_balanced);
+    g_test_add_func("/iothread-vq-rebalance/idle-queues", test_idle_queues);
+    g_test_add_func("/iothread-vq-rebalance/single-iothread",
+                    test_single_iothread);
+
+    return g_test_run();
+}
@@ -0,0 +1,177 @@
+/*
+ * Unit tests for the KVM memory slot bookkeeping
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "qemu/osdep.h"
+#include "system/kvm-memslots.h"
+
+#define NR_SLOTS    8
+
+static void add_slot(KVMMemoryListener *kml, int n, hwaddr start_addr,
+                     hwaddr size)
+{
+    kml->slots[n].slot = n;
+    kml->slots[n].start_addr = start_addr;
+    kml->slots[n].memory_size = size;
+    kvm_slot_index_insert(kml, &kml->slots[n]);
+}
+
+static void check_index(KVMMemoryListener *kml, const unsigned int *expected,
+                        unsigned int n)
+{
+    unsigned int i;
+
+    g_assert_cmpuint(kml->nr_slots_used, ==, n);
+    for (i = 0; i < n; i++) {
+        g_assert_cmpuint(kml->slot_index[i], ==, expected[i]);
+    }
+}
+
+static void test_slot_index(void)
+{
+    KVMSlot slots[NR_SLOTS] = { };
+    unsigned int slot_index[NR_SLOTS];
+    KVMMemoryListener kml = {
+        .slots = slots,
+        .slot_index = slot_index,
+        .nr_slots_allocated = NR_SLOTS,
+    };
+
+    /* Insert out of order, at the start, in the middle and at the end */
+    add_slot(&kml, 0, 0x30000, 0x10000);
+    add_slot(&kml, 1, 0x10000, 0x10000);
+    add_slot(&kml, 2, 0x50000, 0x20000);
+    add_slot(&kml, 3, 0x20000, 0x8000);
+    add_slot(&kml, 4, 0x0, 0x10000);
+    kml.free_slot_hint = 5;
+    check_index(&kml, (unsigned int[]) { 4, 1, 3, 0, 2 }, 5);
+
+    g_assert_cmpuint(kvm_slot_index_find(&kml, 0x0), ==, 0);
+    g_assert_cmpuint(kvm_slot_index_find(&kml, 0x20000), ==, 2);
+    g_assert_cmpuint(kvm_slot_index_find(&kml, 0x20001), ==, 3);
+    g_assert_cmpuint(kvm_slot_index_find(&kml, 0x50000), ==, 4);
+    g_assert_cmpuint(kvm_slot_index_find(&kml, 0x60000), ==, 5);
+
+    /* Only exact matches of address and size are found */
+    g_assert(kvm_lookup_matching_slot(&kml, 0x20000, 0x8000) == &slots[3]);
+    g_assert(kvm_lookup_matching_slot(&kml, 0x50000, 0x20000) == &slots[2]);
+    g_assert(!kvm_lookup_matching_slot(&kml, 0x20000, 0x10000));
+    g_assert(!kvm_lookup_matching_slot(&kml, 0x28000, 0x8000));
+    g_assert(!kvm_lookup_matching_slot(&kml, 0x60000, 0x10000));
+
+    /* Remove from the middle, the start and the end */
+    kvm_slot_index_remove(&kml, &slots[3]);
+    check_index(&kml, (unsigned int[]) { 4, 1, 0, 2 }, 4);
+    g_assert_cmpuint(kml.free_slot_hint, ==, 3);
+    g_assert(!kvm_lookup_matching_slot(&kml, 0x20000, 0x8000));
+    g_assert(kvm_lookup_matching_slot(&kml, 0x30000, 0x10000) == &slots[0]);
+
+    kvm_slot_index_remove(&kml, &slots[4]);
+    check_index(&kml, (unsigned int[]) { 1, 0, 2 }, 3);
+    g_assert_cmpuint(kml.free_slot_hint, ==, 3);
+
+    kvm_slot_index_remove(&kml, &slots[2]);
+    check_index(&kml, (unsigned int[]) { 1, 0 }, 2);
+    g_assert(!kvm_lookup_matching_slot(&kml, 0x50000, 0x20000));
+
+    /* A new slot can reuse a freed address */
+    add_slot(&kml, 3, 0x0, 0x8000);
+    check_index(&kml, (unsigned int[]) { 3, 1, 0 }, 3);
+
+    kvm_slot_index_remove(&kml, &slots[1]);
+    check_index(&kml, (unsigned int[]) { 3, 0 }, 2);
+    g_assert_cmpuint(kml.free_slot_hint, ==, 1);
+}
+
+static unsigned int merge_calls;
+
+static void add_update(KVMMemoryUpdateList *list, hwaddr addr,
+                       uint64_t size)
+{
+    KVMMemoryUpdate *u = g_new0(KVMMemoryUpdate, 1);
+
+    u->section.offset_within_address_space = addr;
+    u->section.size = int128_make64(size);
+    QSIMPLEQ_INSERT_TAIL(list, u, next);
+}
+
+static void check_updates(KVMMemoryUpdateList *list,
+                          const hwaddr *expected, unsigned int n)
+{
+    KVMMemoryUpdate *u, *tmp;
+    unsigned int i = 0;
+
+    QSIMPLEQ_FOREACH_SAFE(u, list, next, tmp) {
+        g_assert_cmpuint(i, <, n);
+        g_assert_cmphex(u->section.offset_within_address_space, ==,
+                        expected[i]);
+        i++;
+        g_free(u);
+    }
+    g_assert_cmpuint(i, ==, n);
+    QSIMPLEQ_INIT(list);
+}
+
+/* Pretend that the slots are unchanged if the size is the same */
+static bool merge_same_size(KVMMemoryListener *kml, KVMMemoryUpdate *old,
+                            KVMMemoryUpdate *new)
+{
+    merge_calls++;
+    g_assert_cmphex(old->section.offset_within_address_space, ==,
+                    new->section.offset_within_address_space);
+    if (int128_ne(old->section.size, new->section.size)) {
+        return false;
+    }
+    g_free(old);
+    g_free(new);
+    return true;
+}
+
+static void test_merge_updates(void)
+{
+    KVMMemoryListener kml = { };
+
+    QSIMPLEQ_INIT(&kml.transaction_add);
+    QSIMPLEQ_INIT(&kml.transaction_del);
+
+    add_update(&kml.transaction_del, 0x0, 0x10000);
+    add_update(&kml.transaction_del, 0x10000, 0x10000);
+    add_update(&kml.transaction_del, 0x30000, 0x10000);
+    add_update(&kml.transaction_del, 0x40000, 0x10000);
+    add_update(&kml.transaction_del, 0x60000, 0x10000);
+
+    add_update(&kml.transaction_add, 0x10000, 0x10000);
+    add_update(&kml.transaction_add, 0x20000, 0x10000);
+    add_update(&kml.transaction_add, 0x30000, 0x8000);
+    add_update(&kml.transaction_add, 0x50000, 0x10000);
+    add_update(&kml.transaction_add, 0x60000, 0x10000);
+
+    merge_calls = 0;
+    kvm_memory_updates_merge(&kml, merge_same_size);
+
+    /* Only the pairs at 0x10000, 0x30000 and 0x60000 are candidates */
+    g_assert_cmpuint(merge_calls, ==, 3);
+    check_updates(&kml.transaction_del,
+                  (hwaddr[]) { 0x0, 0x30000, 0x40000 }, 3);
+    check_updates(&kml.transaction_add,
+                  (hwaddr[]) { 0x20000, 0x30000, 0x50000 }, 3);
+
+    /* Nothing to do with only one of the lists */
+    add_update(&kml.transaction_add, 0x0, 0x10000);
+    kvm_memory_updates_merge(&kml, merge_same_size);
+    g_assert_cmpuint(merge_calls, ==, 3);
+    g_assert(QSIMPLEQ_EMPTY(&kml.transaction_del));
+    check_updates(&kml.transaction_add, (hwaddr[]) { 0x0 }, 1);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/kvm/memslots/slot-index", test_slot_index);
+    g_test_add_func("/kvm/memslots/merge-updates", test_merge_updates);
+
+    return g_test_run();
+}
@@ -251,10 +251,51 @@ static void test_resize(void)
     qht_test(QHT_MODE_AUTO_RESIZE);
 }
 
+/*
+ * Auto-resizing migrates buckets lazily as the table is written to, so check
+ * the table after every write to cover lookups, iteration, removals and
+ * statistics while a migration is in progress.
+ */
+static void test_resize_incremental(void)
+{
+    int i;
+
+    qht_init(&ht, is_equal, 0, QHT_MODE_AUTO_RESIZE);
+    for (i = 0; i < N * 2; i++) {
+        insert(i, i + 1);
+        check_n(i + 1);
+        if (i % 64 == 0) {
+            check(0, i + 1, true);
+            iter_check(i + 1);
+        }
+    }
+    check(0, N * 2, true);
+
+    for (i = 0; i < N * 2; i += 2) {
+        rm(i, i + 1);
+        rm_nonexist(i, i + 1);
+        if (i % 128 == 0) {
+            check(i + 1, N * 2, true);
+        }
+    }
+    check_n(N);
+    iter_rm_mod(1);
+    check_n(0);
+
+    qht_resize(&ht, N * 16);
+    check(0, N * 2, false);
+    insert(0, N);
+    check_n(N);
+    check(0, N, true);
+
+    qht_destroy(&ht);
+}
+
 int main(int argc, char *argv[])
 {
     g_test_init(&argc, &argv, NULL);
     g_test_add_func("/qht/mode/default", test_default);
     g_test_add_func("/qht/mode/resize", test_resize);
+    g_test_add_func("/qht/resize/incremental", test_resize_incremental);
     return g_test_run();
 }
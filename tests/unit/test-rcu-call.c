@@ -0,0 +1,97 @@
+/*
+ * call_rcu unit tests
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/atomic.h"
+#include "qemu/rcu.h"
+#include "qemu/thread.h"
+
+#define NR_THREADS 8
+#define NR_CALLBACKS 10000
+
+typedef struct TestCallback {
+    struct rcu_head rcu;
+    int thread;
+    int seq;
+} TestCallback;
+
+/* Sequence number of the last callback run for each thread */
+static int last_seq[NR_THREADS];
+static int nr_out_of_order;
+static int nr_run;
+
+static void test_callback(struct rcu_head *head)
+{
+    TestCallback *cb = container_of(head, TestCallback, rcu);
+
+    /* Callbacks all run on the call_rcu thread */
+    if (cb->seq != last_seq[cb->thread] + 1) {
+        nr_out_of_order++;
+    }
+    last_seq[cb->thread] = cb->seq;
+    nr_run++;
+    g_free(cb);
+}
+
+static void *call_thread(void *opaque)
+{
+    int thread = (intptr_t)opaque;
+    int i;
+
+    for (i = 1; i <= NR_CALLBACKS; i++) {
+        TestCallback *cb = g_new(TestCallback, 1);
+
+        cb->thread = thread;
+        cb->seq = i;
+        call_rcu1(&cb->rcu, test_callback);
+    }
+    return NULL;
+}
+
+/*
+ * Callbacks from each thread run in FIFO order, and drain_call_rcu()
+ * after the threads have exited waits for all of them.
+ */
+static void test_per_thread_order(void)
+{
+    QemuThread threads[NR_THREADS];
+    RCUCallStats before, after;
+    int i;
+
+    rcu_call_get_stats(&before);
+    for (i = 0; i < NR_THREADS; i++) {
+        qemu_thread_create(&threads[i], "call-rcu-test", call_thread,
+                           (void *)(intptr_t)i, QEMU_THREAD_JOINABLE);
+    }
+    for (i = 0; i < NR_THREADS; i++) {
+        qemu_thread_join(&threads[i]);
+    }
+    drain_call_rcu();
+
+    g_assert_cmpint(nr_out_of_order, ==, 0);
+    g_assert_cmpint(nr_run, ==, NR_THREADS * NR_CALLBACKS);
+    for (i = 0; i < NR_THREADS; i++) {
+        g_assert_cmpint(last_seq[i], ==, NR_CALLBACKS);
+    }
+
+    rcu_call_get_stats(&after);
+    /* The exited threads' queues are gone, only this thread's is left */
+    g_assert_cmpuint(after.queues, ==, 1);
+    g_assert_cmpuint(after.pending, ==, 0);
+    /* The drain callback counts too */
+    g_assert_cmpuint(after.callbacks - before.callbacks, ==,
+                     NR_THREADS * NR_CALLBACKS + 1);
+    g_assert_cmpuint(after.batches, >, before.batches);
+    g_assert_cmpuint(after.max_batch, >, 0);
+    g_assert_cmpuint(after.gp_ns_max, <=, after.gp_ns_total);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_func("/rcu/call/per-thread-order", test_per_thread_order);
+    return g_test_run();
+}
@@ -0,0 +1,127 @@
+/*
+ * Size-class allocator unit tests
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/slab.h"
+#include "qemu/thread.h"
+
+#define NR_OBJS 4096
+
+static void get_totals(uint64_t *allocs, uint64_t *frees)
+{
+    QemuSlabStats stats[QEMU_SLAB_CLASSES];
+
+    qemu_slab_get_stats(stats);
+    *allocs = *frees = 0;
+    for (int i = 0; i < QEMU_SLAB_CLASSES; i++) {
+        *allocs += stats[i].allocs;
+        *frees += stats[i].frees;
+    }
+}
+
+static void test_sizes(void)
+{
+    static const size_t sizes[] = {
+        1, 255, 256, 257, 4000, 4096, 65535, 65536, 65537, 1024 * 1024,
+    };
+
+    for (int i = 0; i < ARRAY_SIZE(sizes); i++) {
+        uint8_t *p = qemu_slab_alloc(sizes[i]);
+
+        /* The whole object must be usable */
+        memset(p, 0xa5, sizes[i]);
+        g_assert_cmpint(p[sizes[i] - 1], ==, 0xa5);
+        qemu_slab_free(p, sizes[i]);
+    }
+    qemu_slab_free(NULL, 256);
+}
+
+static void test_reuse(void)
+{
+    void *p = qemu_slab_alloc(1000);
+    void *q;
+
+    /* A freed object is at the head of the thread cache */
+    qemu_slab_free(p, 1000);
+    q = qemu_slab_alloc(1000);
+    g_assert(p == q);
+    qemu_slab_free(q, 1000);
+}
+
+static void *free_thread(void *opaque)
+{
+    void **objs = opaque;
+
+    for (int i = 0; i < NR_OBJS; i++) {
+        memset(objs[i], 0, 512);
+        qemu_slab_free(objs[i], 512);
+    }
+    return NULL;
+}
+
+static void test_cross_thread(void)
+{
+    void **objs = g_new(void *, NR_OBJS);
+    QemuSlabStats stats[QEMU_SLAB_CLASSES];
+    QemuThread thread;
+
+    for (int i = 0; i < NR_OBJS; i++) {
+        objs[i] = qemu_slab_alloc(512);
+    }
+
+    /* Frees go to the other thread's cache, then to the shared cache */
+    qemu_thread_create(&thread, "free", free_thread, objs,
+                       QEMU_THREAD_JOINABLE);
+    qemu_thread_join(&thread);
+
+    qemu_slab_get_stats(stats);
+    g_assert_cmpint(stats[1].size, ==, 512);
+    g_assert_cmpint(stats[1].cached, >, 0);
+
+    /* And come back to this thread in batches */
+    for (int i = 0; i < NR_OBJS; i++) {
+        objs[i] = qemu_slab_alloc(512);
+    }
+    for (int i = 0; i < NR_OBJS; i++) {
+        qemu_slab_free(objs[i], 512);
+    }
+    g_free(objs);
+}
+
+static void *stats_thread(void *opaque)
+{
+    for (int i = 0; i < NR_OBJS; i++) {
+        qemu_slab_free(qemu_slab_alloc(300), 300);
+    }
+    return NULL;
+}
+
+static void test_stats(void)
+{
+    uint64_t allocs, frees, new_allocs, new_frees;
+    QemuThread thread;
+
+    get_totals(&allocs, &frees);
+
+    /* Counts are published at thread exit at the latest */
+    qemu_thread_create(&thread, "stats", stats_thread, NULL,
+                       QEMU_THREAD_JOINABLE);
+    qemu_thread_join(&thread);
+
+    get_totals(&new_allocs, &new_frees);
+    g_assert_cmpint(new_allocs - allocs, ==, NR_OBJS);
+    g_assert_cmpint(new_frees - frees, ==, NR_OBJS);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_func("/slab/sizes", test_sizes);
+    g_test_add_func("/slab/reuse", test_reuse);
+    g_test_add_func("/slab/cross-thread", test_cross_thread);
+    g_test_add_func("/slab/stats", test_stats);
+    return g_test_run();
+}
@@ -112,28 +112,39 @@ static void test_submit_co(void)
     g_assert_cmpint(data.ret, ==, 0);
 }
 
-static void test_submit_many(void)
+static void submit_many(int n)
 {
-    WorkerTestData data[100];
+    g_autofree WorkerTestData *data = g_new(WorkerTestData, n);
     int i;
 
-    /* Start more work items than there will be threads.  */
-    for (i = 0; i < 100; i++) {
+    for (i = 0; i < n; i++) {
         data[i].n = 0;
         data[i].ret = -EINPROGRESS;
         thread_pool_submit_aio(worker_cb, &data[i], done_cb, &data[i]);
     }
 
-    active = 100;
+    active = n;
     while (active > 0) {
         aio_poll(ctx, true);
     }
-    for (i = 0; i < 100; i++) {
+    for (i = 0; i < n; i++) {
         g_assert_cmpint(data[i].n, ==, 1);
         g_assert_cmpint(data[i].ret, ==, 0);
     }
 }
 
+static void test_submit_many(void)
+{
+    /* Start more work items than there will be threads.  */
+    submit_many(100);
+}
+
+static void test_submit_overflow(void)
+{
+    /* Start more work items than fit in the submission ring.  */
+    submit_many(10000);
+}
+
 static void do_test_cancel(bool sync)
 {
     WorkerTestData data[100];
@@ -240,6 +251,7 @@ int main(int argc, char **argv)
     g_test_add_func("/thread-pool/submit-aio", test_submit_aio);
     g_test_add_func("/thread-pool/submit-co", test_submit_co);
     g_test_add_func("/thread-pool/submit-many", test_submit_many);
+    g_test_add_func("/thread-pool/submit-overflow", test_submit_overflow);
     g_test_add_func("/thread-pool/cancel", test_cancel);
     g_test_add_func("/thread-pool/cancel-async", test_cancel_async);
 
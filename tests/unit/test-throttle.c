@@ -734,6 +734,70 @@ static void test_accounting(void)
                                 (64.0 / 13)));
 }
 
+static void test_budget(void)
+{
+    double size, units;
+    int64_t now = 0;
+
+    throttle_config_init(&cfg);
+    cfg.buckets[THROTTLE_BPS_READ].avg = 1000000;
+    cfg.buckets[THROTTLE_OPS_TOTAL].avg = 1000;
+    throttle_init(&ts);
+    throttle_config(&ts, QEMU_CLOCK_VIRTUAL, &cfg);
+    ts.previous_leak = now;
+
+    /* Limited by the average rate over max_ns */
+    g_assert(throttle_compute_budget(&ts, THROTTLE_READ, now,
+                                     NANOSECONDS_PER_SECOND / 100,
+                                     &size, &units));
+    g_assert(double_cmp(size, 10000));
+    g_assert(double_cmp(units, 10));
+
+    /* Limited by what is left in the bucket (avg / 10 without a max) */
+    g_assert(throttle_compute_budget(&ts, THROTTLE_READ, now,
+                                     NANOSECONDS_PER_SECOND,
+                                     &size, &units));
+    g_assert(double_cmp(size, 100000));
+    g_assert(double_cmp(units, 100));
+
+    /* No bps limit for writes */
+    g_assert(throttle_compute_budget(&ts, THROTTLE_WRITE, now,
+                                     NANOSECONDS_PER_SECOND,
+                                     &size, &units));
+    g_assert(size < 0);
+    g_assert(double_cmp(units, 100));
+
+    /* A reserved batch reduces the budget like individual requests do */
+    throttle_account_batch(&ts, THROTTLE_READ, 40000, 40);
+    g_assert(double_cmp(ts.cfg.buckets[THROTTLE_BPS_READ].level, 40000));
+    g_assert(double_cmp(ts.cfg.buckets[THROTTLE_OPS_TOTAL].level, 40));
+    g_assert(double_cmp(ts.cfg.buckets[THROTTLE_OPS_READ].level, 40));
+    g_assert(double_cmp(ts.cfg.buckets[THROTTLE_BPS_WRITE].level, 0));
+    g_assert(throttle_compute_budget(&ts, THROTTLE_READ, now,
+                                     NANOSECONDS_PER_SECOND,
+                                     &size, &units));
+    g_assert(double_cmp(size, 60000));
+    g_assert(double_cmp(units, 60));
+
+    /* Returning unused units never makes the level negative */
+    throttle_account_batch(&ts, THROTTLE_READ, -50000, -50);
+    g_assert(double_cmp(ts.cfg.buckets[THROTTLE_BPS_READ].level, 0));
+    g_assert(double_cmp(ts.cfg.buckets[THROTTLE_OPS_TOTAL].level, 0));
+
+    /* A full bucket has no budget */
+    throttle_account_batch(&ts, THROTTLE_WRITE, 0, 101);
+    g_assert(!throttle_compute_budget(&ts, THROTTLE_READ, now,
+                                      NANOSECONDS_PER_SECOND,
+                                      &size, &units));
+
+    /* ... until it leaks */
+    now += NANOSECONDS_PER_SECOND / 100;
+    g_assert(throttle_compute_budget(&ts, THROTTLE_READ, now,
+                                     NANOSECONDS_PER_SECOND,
+                                     &size, &units));
+    g_assert(double_cmp(units, 9));
+}
+
 static void test_groups(void)
 {
     ThrottleConfig cfg1, cfg2;
@@ -801,6 +865,82 @@ static void test_groups(void)
     g_assert(tgm3->throttle_state == NULL);
 }
 
+typedef struct {
+    ThrottleGroupMember *tgm;
+    int64_t bytes;
+    bool done;
+} GroupRequest;
+
+static void coroutine_fn group_request_entry(void *opaque)
+{
+    GroupRequest *req = opaque;
+
+    throttle_group_co_io_limits_intercept(req->tgm, req->bytes,
+                                          THROTTLE_READ);
+    req->done = true;
+}
+
+static void group_request_start(GroupRequest *req, ThrottleGroupMember *tgm,
+                                int64_t bytes)
+{
+    *req = (GroupRequest) { .tgm = tgm, .bytes = bytes };
+    qemu_coroutine_enter(qemu_coroutine_create(group_request_entry, req));
+}
+
+static void test_group_local_budget(void)
+{
+    ThrottleConfig cfg1;
+    BlockBackend *blk;
+    ThrottleGroupMember *tgm1;
+    LeakyBucket *bkt1;
+    GroupRequest req;
+    double level;
+    int i;
+
+    blk = blk_new(qemu_get_aio_context(), 0, BLK_PERM_ALL);
+    tgm1 = &blk_get_public(blk)->throttle_group_member;
+    throttle_group_register_tgm(tgm1, "budget", blk_get_aio_context(blk));
+
+    /* 100000 bytes per 10 ms slice, and a bucket of 1000000 bytes */
+    throttle_config_init(&cfg1);
+    cfg1.buckets[THROTTLE_BPS_READ].avg = 10000000;
+    throttle_group_config(tgm1, &cfg1);
+    bkt1 = &tgm1->throttle_state->cfg.buckets[THROTTLE_BPS_READ];
+
+    /* The first request takes the lock and reserves a budget */
+    group_request_start(&req, tgm1, 4096);
+    g_assert(req.done);
+    g_assert(bkt1->level > 4096);
+    level = bkt1->level;
+
+    /* The next ones are charged to the budget, not to the bucket */
+    for (i = 0; i < 10; i++) {
+        group_request_start(&req, tgm1, 4096);
+        g_assert(req.done);
+        g_assert(bkt1->level == level);
+        g_assert_cmpuint(tgm1->pending_reqs[THROTTLE_READ], ==, 0);
+    }
+
+    /* Too large for the budget: it goes through the bucket and fills it */
+    group_request_start(&req, tgm1, 2000000);
+    g_assert(req.done);
+    g_assert(bkt1->level > 2000000);
+
+    /* With the bucket full there is no budget left, so this one waits */
+    group_request_start(&req, tgm1, 4096);
+    g_assert(!req.done);
+    g_assert_cmpuint(tgm1->pending_reqs[THROTTLE_READ], ==, 1);
+
+    /* ... until the bucket leaks */
+    while (!req.done) {
+        aio_poll(ctx, true);
+    }
+    g_assert_cmpuint(tgm1->pending_reqs[THROTTLE_READ], ==, 0);
+
+    throttle_group_unregister_tgm(tgm1);
+    blk_unref(blk);
+}
+
 int main(int argc, char **argv)
 {
     qemu_init_main_loop(&error_fatal);
@@ -829,7 +969,10 @@ int main(int argc, char **argv)
                     test_iops_size_is_missing_limit);
     g_test_add_func("/throttle/config_functions",   test_config_functions);
     g_test_add_func("/throttle/accounting",         test_accounting);
+    g_test_add_func("/throttle/budget",             test_budget);
     g_test_add_func("/throttle/groups",             test_groups);
+    g_test_add_func("/throttle/groups/local_budget",
+                    test_group_local_budget);
     return g_test_run();
 }
 
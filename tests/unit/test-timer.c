@@ -0,0 +1,185 @@
+/*
+ * QEMUTimerList unit tests
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/timer.h"
+
+#define NR_TIMERS 1000
+
+typedef struct {
+    QEMUTimer timer;
+    int id;
+} TestTimer;
+
+static int fired[NR_TIMERS];
+static int nr_fired;
+
+static void notify_cb(void *opaque, QEMUClockType type)
+{
+}
+
+static void timer_cb(void *opaque)
+{
+    TestTimer *t = opaque;
+
+    fired[nr_fired++] = t->id;
+}
+
+static TestTimer *test_timers_new(QEMUTimerListGroup *tlg, int n)
+{
+    TestTimer *timers = g_new0(TestTimer, n);
+    int i;
+
+    timerlistgroup_init(tlg, notify_cb, NULL);
+    for (i = 0; i < n; i++) {
+        timers[i].id = i;
+        timer_init_full(&timers[i].timer, tlg, QEMU_CLOCK_REALTIME,
+                        SCALE_NS, 0, timer_cb, &timers[i]);
+    }
+    nr_fired = 0;
+    return timers;
+}
+
+/* Timers fire in expiry order, and in arming order for equal expiry */
+static void test_order(void)
+{
+    QEMUTimerListGroup tlg;
+    TestTimer *timers = test_timers_new(&tlg, NR_TIMERS);
+    int i;
+
+    /* Expiry times in the past, so that every timer is due */
+    for (i = 0; i < NR_TIMERS; i++) {
+        timer_mod_ns(&timers[i].timer, 1 + (i * 7919) % 100);
+    }
+    g_assert(timerlist_has_timers(tlg.tl[QEMU_CLOCK_REALTIME]));
+    g_assert_cmpint(timerlist_deadline_ns(tlg.tl[QEMU_CLOCK_REALTIME]),
+                    ==, 0);
+
+    g_assert(timerlistgroup_run_timers(&tlg));
+    g_assert_cmpint(nr_fired, ==, NR_TIMERS);
+    for (i = 1; i < NR_TIMERS; i++) {
+        int64_t prev = 1 + (fired[i - 1] * 7919) % 100;
+        int64_t cur = 1 + (fired[i] * 7919) % 100;
+
+        g_assert_cmpint(prev, <=, cur);
+        if (prev == cur) {
+            g_assert_cmpint(fired[i - 1], <, fired[i]);
+        }
+    }
+    g_assert(!timerlist_has_timers(tlg.tl[QEMU_CLOCK_REALTIME]));
+
+    timerlistgroup_deinit(&tlg);
+    g_free(timers);
+}
+
+/* Deleting and re-arming timers keeps the heap consistent */
+static void test_mod_del(void)
+{
+    QEMUTimerListGroup tlg;
+    TestTimer *timers = test_timers_new(&tlg, NR_TIMERS);
+    QEMUTimerList *tl = tlg.tl[QEMU_CLOCK_REALTIME];
+    int64_t far = qemu_clock_get_ns(QEMU_CLOCK_REALTIME) +
+                  1000 * NANOSECONDS_PER_SECOND;
+    int i;
+
+    for (i = 0; i < NR_TIMERS; i++) {
+        timer_mod_ns(&timers[i].timer, far + i);
+    }
+
+    /* Odd timers go away, even timers move to the past in reverse */
+    for (i = 0; i < NR_TIMERS; i++) {
+        if (i & 1) {
+            timer_del(&timers[i].timer);
+            g_assert(!timer_pending(&timers[i].timer));
+        } else {
+            timer_mod_ns(&timers[i].timer, NR_TIMERS - i);
+        }
+    }
+
+    g_assert(timerlistgroup_run_timers(&tlg));
+    g_assert_cmpint(nr_fired, ==, NR_TIMERS / 2);
+    for (i = 0; i < nr_fired; i++) {
+        g_assert_cmpint(fired[i], ==, NR_TIMERS - 2 - 2 * i);
+    }
+    g_assert(!timerlist_has_timers(tl));
+    g_assert_cmpint(timerlist_deadline_ns(tl), ==, -1);
+
+    timerlistgroup_deinit(&tlg);
+    g_free(timers);
+}
+
+/* timer_mod_anticipate_ns() only ever moves a deadline earlier */
+static void test_anticipate(void)
+{
+    QEMUTimerListGroup tlg;
+    TestTimer *timers = test_timers_new(&tlg, 2);
+    QEMUTimerList *tl = tlg.tl[QEMU_CLOCK_REALTIME];
+    int64_t now = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    int64_t deadline;
+
+    timer_mod_ns(&timers[0].timer, now + 10 * NANOSECONDS_PER_SECOND);
+    timer_mod_ns(&timers[1].timer, now + 20 * NANOSECONDS_PER_SECOND);
+    timer_mod_anticipate_ns(&timers[1].timer,
+                            now + 30 * NANOSECONDS_PER_SECOND);
+    g_assert_cmpuint(timer_expire_time_ns(&timers[1].timer), ==,
+                     now + 20 * NANOSECONDS_PER_SECOND);
+
+    timer_mod_anticipate_ns(&timers[1].timer,
+                            now + 5 * NANOSECONDS_PER_SECOND);
+    deadline = timerlist_deadline_ns(tl);
+    g_assert_cmpint(deadline, >, 0);
+    g_assert_cmpint(deadline, <=, 5 * NANOSECONDS_PER_SECOND);
+
+    timer_del(&timers[0].timer);
+    timer_del(&timers[1].timer);
+    timerlistgroup_deinit(&tlg);
+    g_free(timers);
+}
+
+/* The deadline for a subset of attributes skips the other timers */
+static void test_deadline_attributes(void)
+{
+    QEMUTimerListGroup tlg;
+    QEMUTimer *timers[16];
+    int64_t now = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    int64_t deadline;
+    int i;
+
+    timerlistgroup_init(&tlg, notify_cb, NULL);
+    for (i = 0; i < ARRAY_SIZE(timers); i++) {
+        /* Only the last timer to expire is not external */
+        timers[i] = timer_new_full(&tlg, QEMU_CLOCK_REALTIME, SCALE_NS,
+                                   i == 0 ? 0 : QEMU_TIMER_ATTR_EXTERNAL,
+                                   timer_cb, NULL);
+        timer_mod_ns(timers[i], now + (100 - i) * NANOSECONDS_PER_SECOND);
+    }
+
+    deadline = qemu_clock_deadline_ns_all(QEMU_CLOCK_REALTIME,
+                                          QEMU_TIMER_ATTR_ALL);
+    g_assert_cmpint(deadline, <=, 85 * NANOSECONDS_PER_SECOND);
+    deadline = qemu_clock_deadline_ns_all(QEMU_CLOCK_REALTIME,
+                                          ~QEMU_TIMER_ATTR_EXTERNAL);
+    g_assert_cmpint(deadline, >, 85 * NANOSECONDS_PER_SECOND);
+    g_assert_cmpint(deadline, <=, 100 * NANOSECONDS_PER_SECOND);
+
+    for (i = 0; i < ARRAY_SIZE(timers); i++) {
+        timer_free(timers[i]);
+    }
+    timerlistgroup_deinit(&tlg);
+}
+
+int main(int argc, char **argv)
+{
+    init_clocks(NULL);
+
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_func("/timer/order", test_order);
+    g_test_add_func("/timer/mod-del", test_mod_del);
+    g_test_add_func("/timer/anticipate", test_anticipate);
+    g_test_add_func("/timer/deadline-attributes", test_deadline_attributes);
+    return g_test_run();
+}
@@ -17,6 +17,9 @@
 #ifdef CONFIG_TRACE_FTRACE
 #include "trace/ftrace.h"
 #endif
+#ifdef CONFIG_TRACE_RING
+#include "trace/ring.h"
+#endif
 #ifdef CONFIG_TRACE_LOG
 #include "qemu/log.h"
 #endif
@@ -75,6 +78,9 @@ void trace_event_register_group(TraceEvent **events)
 #ifdef CONFIG_TRACE_SIMPLE
     st_init_group(nevent_groups - 1);
 #endif
+#ifdef CONFIG_TRACE_RING
+    trace_ring_init_group(nevent_groups - 1);
+#endif
 }
 
 
@@ -237,15 +243,21 @@ static void trace_init_events(const char *fname)
 
 void trace_init_file(void)
 {
+#if defined CONFIG_TRACE_SIMPLE || defined CONFIG_TRACE_RING
 #ifdef CONFIG_TRACE_SIMPLE
     st_set_trace_file(trace_opts_file);
     if (init_trace_on_startup) {
         st_set_trace_file_enabled(true);
     }
+#endif
+#ifdef CONFIG_TRACE_RING
+    /* The rings are written to <file>.ring.<tid> */
+    trace_ring_set_file(trace_opts_file);
+#endif
 #elif defined CONFIG_TRACE_LOG
     /*
-     * If both the simple and the log backends are enabled, "--trace file"
-     * only applies to the simple backend; use "-D" for the log
+     * If the simple or ring backend is enabled together with the log
+     * backend, "--trace file" only applies to the former; use "-D" for the log
      * backend. However we should only override -D if we actually have
      * something to override it with.
      */
@@ -270,6 +282,13 @@ bool trace_init_backends(void)
     }
 #endif
 
+#ifdef CONFIG_TRACE_RING
+    if (!trace_ring_init()) {
+        fprintf(stderr, "failed to initialize ring tracing backend.\n");
+        return false;
+    }
+#endif
+
 #ifdef CONFIG_TRACE_FTRACE
     if (!ftrace_init()) {
         fprintf(stderr, "failed to initialize ftrace backend.\n");
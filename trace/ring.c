@@ -0,0 +1,386 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Per-thread ring buffer trace backend
+ *
+ * Rings are created lazily, the first time a thread emits an event after
+ * the file name has been set.  Each ring is a file named
+ * <trace-file>.ring.<tid>; the event ID mappings are written once to
+ * <trace-file>.ring in the format of the "simple" backend.
+ *
+ * Like the "simple" backend, the code that records events must not call
+ * functions that emit trace events or that may take locks held by code that
+ * emits trace events.  Therefore it uses libc rather than glib and QEMU
+ * wrappers.
+ */
+
+#include "qemu/osdep.h"
+#include <sys/mman.h>
+#include "qemu/coroutine-tls.h"
+#include "qemu/notify.h"
+#include "qemu/thread.h"
+#include "trace/control.h"
+#include "trace/ring.h"
+
+/* Bytes of records in each ring */
+#define TRACE_RING_SIZE         (4 * 1024 * 1024)
+
+/* Header of the mappings file, as in the "simple" backend */
+#define HEADER_EVENT_ID         (~(uint64_t)0)
+#define HEADER_MAGIC            0xf2b177cb0aa429b4ULL
+#define HEADER_VERSION          4
+#define TRACE_RECORD_TYPE_MAPPING 0
+
+struct TraceRing {
+    TraceRingHeader *hdr;
+    uint8_t *data;
+    uint64_t size;
+
+    /* Private copies of the header fields, only the owner thread uses them */
+    uint64_t head;
+    uint64_t tail;
+    uint64_t lost;
+
+    /* Set while a record is being written, to catch signal handlers */
+    bool busy;
+
+    Notifier exit_notifier;
+};
+
+typedef struct TraceRingLocal {
+    TraceRing *ring;
+
+    /* Do not try again to create a ring for this thread */
+    bool failed;
+} TraceRingLocal;
+
+QEMU_DEFINE_STATIC_CO_TLS(TraceRingLocal, trace_ring_local);
+
+/* Protects trace_ring_prefix and mappings_fd */
+static GMutex trace_ring_lock;
+static char *trace_ring_prefix;
+static int mappings_fd = -1;
+static uint32_t trace_ring_pid;
+static bool trace_ring_initialized;
+
+static void trace_ring_calibrate(TraceRingHeader *hdr, int i)
+{
+    qatomic_set(&hdr->calib_ns[i], get_clock());
+    qatomic_set(&hdr->calib_ticks[i], cpu_get_host_ticks());
+}
+
+static bool write_full(int fd, const void *buf, size_t len)
+{
+    return qemu_write_full(fd, buf, len) == len;
+}
+
+static bool trace_ring_write_mappings(TraceEventIter *iter)
+{
+    uint64_t type = TRACE_RECORD_TYPE_MAPPING;
+    TraceEvent *ev;
+
+    while ((ev = trace_event_iter_next(iter)) != NULL) {
+        uint64_t id = trace_event_get_id(ev);
+        const char *name = trace_event_get_name(ev);
+        uint32_t len = strlen(name);
+
+        if (!write_full(mappings_fd, &type, sizeof(type)) ||
+            !write_full(mappings_fd, &id, sizeof(id)) ||
+            !write_full(mappings_fd, &len, sizeof(len)) ||
+            !write_full(mappings_fd, name, len)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Called with trace_ring_lock held */
+static void trace_ring_open_mappings(void)
+{
+    static const uint64_t header[] = {
+        HEADER_EVENT_ID, HEADER_MAGIC, HEADER_VERSION,
+    };
+    char path[PATH_MAX];
+    TraceEventIter iter;
+    int fd;
+
+    if (mappings_fd >= 0) {
+        close(mappings_fd);
+        qatomic_set(&mappings_fd, -1);
+    }
+    if (!trace_ring_initialized || !trace_ring_prefix) {
+        return;
+    }
+
+    snprintf(path, sizeof(path), "%s.ring", trace_ring_prefix);
+    fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        fprintf(stderr, "failed to create trace file %s: %s\n",
+                path, strerror(errno));
+        return;
+    }
+
+    mappings_fd = fd;
+    trace_event_iter_init_all(&iter);
+    if (!write_full(fd, header, sizeof(header)) ||
+        !trace_ring_write_mappings(&iter)) {
+        fprintf(stderr, "failed to write trace file %s: %s\n",
+                path, strerror(errno));
+        close(fd);
+        mappings_fd = -1;
+        return;
+    }
+
+    /* Threads can now create their rings */
+    qatomic_set(&mappings_fd, fd);
+}
+
+static void trace_ring_thread_exit(Notifier *n, void *opaque)
+{
+    TraceRing *ring = container_of(n, TraceRing, exit_notifier);
+    TraceRingLocal *local = get_ptr_trace_ring_local();
+
+    trace_ring_calibrate(ring->hdr, 1);
+    munmap(ring->hdr, TRACE_RING_HEADER_SIZE + ring->size);
+    free(ring);
+
+    /* Events emitted later by the exiting thread are dropped */
+    local->ring = NULL;
+    local->failed = true;
+}
+
+static TraceRing *trace_ring_create(TraceRingLocal *local)
+{
+    size_t map_size = TRACE_RING_HEADER_SIZE + TRACE_RING_SIZE;
+    char path[PATH_MAX];
+    TraceRingHeader *hdr;
+    TraceRing *ring;
+    void *mem;
+    int fd;
+
+    /* Try again after trace_ring_init() and trace_ring_set_file() */
+    if (qatomic_read(&mappings_fd) < 0) {
+        return NULL;
+    }
+
+    g_mutex_lock(&trace_ring_lock);
+    if (mappings_fd < 0) {
+        g_mutex_unlock(&trace_ring_lock);
+        return NULL;
+    }
+    snprintf(path, sizeof(path), "%s.ring.%d", trace_ring_prefix,
+             qemu_get_thread_id());
+    g_mutex_unlock(&trace_ring_lock);
+
+    local->failed = true;
+    fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        fprintf(stderr, "failed to create trace file %s: %s\n",
+                path, strerror(errno));
+        return NULL;
+    }
+    if (ftruncate(fd, map_size) < 0) {
+        fprintf(stderr, "failed to resize trace file %s: %s\n",
+                path, strerror(errno));
+        close(fd);
+        return NULL;
+    }
+    mem = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mem == MAP_FAILED) {
+        fprintf(stderr, "failed to map trace file %s: %s\n",
+                path, strerror(errno));
+        return NULL;
+    }
+
+    hdr = mem;
+    hdr->magic = TRACE_RING_MAGIC;
+    hdr->version = TRACE_RING_VERSION;
+    hdr->size = TRACE_RING_SIZE;
+    hdr->pid = trace_ring_pid;
+    hdr->tid = qemu_get_thread_id();
+    trace_ring_calibrate(hdr, 0);
+    trace_ring_calibrate(hdr, 1);
+
+    ring = calloc(1, sizeof(*ring));
+    if (!ring) {
+        munmap(mem, map_size);
+        return NULL;
+    }
+    ring->hdr = hdr;
+    ring->data = (uint8_t *)mem + TRACE_RING_HEADER_SIZE;
+    ring->size = TRACE_RING_SIZE;
+    ring->exit_notifier.notify = trace_ring_thread_exit;
+    qemu_thread_atexit_add(&ring->exit_notifier);
+
+    local->ring = ring;
+    local->failed = false;
+    return ring;
+}
+
+/* Return the position of the record after the one at @pos */
+static uint64_t trace_ring_next(TraceRing *ring, uint64_t pos)
+{
+    uint64_t off = pos % ring->size;
+    uint64_t rest = ring->size - off;
+    TraceRingEntry *entry = (TraceRingEntry *)(ring->data + off);
+
+    if (rest < sizeof(TraceRingEntry) ||
+        entry->event == TRACE_RING_PAD_EVENT_ID) {
+        return pos + rest;
+    }
+    ring->lost++;
+    return pos + entry->length;
+}
+
+/* Overwrite the oldest records until @len bytes are free after the head */
+static void trace_ring_make_room(TraceRing *ring, uint64_t len)
+{
+    uint64_t tail = ring->tail;
+
+    if (likely(ring->head + len - tail <= ring->size)) {
+        return;
+    }
+    do {
+        tail = trace_ring_next(ring, tail);
+    } while (ring->head + len - tail > ring->size);
+
+    ring->tail = tail;
+    qatomic_set(&ring->hdr->lost, ring->lost);
+    qatomic_set(&ring->hdr->tail, tail);
+
+    /* Readers must see the new tail before the records are overwritten */
+    smp_wmb();
+}
+
+/* Skip to the beginning of the ring, padding the space that is left */
+static void trace_ring_wrap(TraceRing *ring, uint64_t off)
+{
+    uint64_t rest = ring->size - off;
+
+    trace_ring_make_room(ring, rest);
+    if (rest >= sizeof(TraceRingEntry)) {
+        TraceRingEntry *entry = (TraceRingEntry *)(ring->data + off);
+
+        entry->event = TRACE_RING_PAD_EVENT_ID;
+        entry->ticks = 0;
+        entry->length = rest;
+        entry->reserved = 0;
+    }
+    ring->head += rest;
+    qatomic_store_release(&ring->hdr->head, ring->head);
+    trace_ring_calibrate(ring->hdr, 1);
+}
+
+bool trace_ring_record_start(TraceRingRecord *rec, uint32_t event,
+                             size_t arglen)
+{
+    TraceRingLocal *local = get_ptr_trace_ring_local();
+    TraceRing *ring = local->ring;
+    uint64_t len = ROUND_UP(sizeof(TraceRingEntry) + arglen, 8);
+    TraceRingEntry *entry;
+    uint64_t off;
+
+    if (unlikely(!ring)) {
+        ring = local->failed ? NULL : trace_ring_create(local);
+        if (!ring) {
+            return false;
+        }
+    }
+    if (unlikely(ring->busy)) {
+        /* A signal handler interrupted the writing of another record */
+        return false;
+    }
+    ring->busy = true;
+    signal_barrier();
+
+    off = ring->head % ring->size;
+    if (unlikely(off + len > ring->size)) {
+        trace_ring_wrap(ring, off);
+        off = 0;
+    }
+    trace_ring_make_room(ring, len);
+
+    entry = (TraceRingEntry *)(ring->data + off);
+    entry->event = event;
+    entry->ticks = cpu_get_host_ticks();
+    entry->length = len;
+    entry->reserved = 0;
+
+    rec->ring = ring;
+    rec->ptr = (uint8_t *)entry->arguments;
+    rec->end = ring->head + len;
+    return true;
+}
+
+void trace_ring_record_finish(TraceRingRecord *rec)
+{
+    TraceRing *ring = rec->ring;
+
+    ring->head = rec->end;
+    qatomic_store_release(&ring->hdr->head, rec->end);
+
+    signal_barrier();
+    ring->busy = false;
+}
+
+/**
+ * Set the file name prefix of the rings
+ *
+ * @file        The prefix or NULL for the default name-<pid> set at config
+ *              time
+ *
+ * Threads that already have a ring keep writing to it.
+ */
+void trace_ring_set_file(const char *file)
+{
+    char *prefix;
+
+    if (!file) {
+        /* Type cast needed for Windows where getpid() returns an int. */
+        prefix = g_strdup_printf(CONFIG_TRACE_FILE "-" FMT_pid,
+                                 (pid_t)getpid());
+    } else {
+        prefix = g_strdup(file);
+    }
+
+    g_mutex_lock(&trace_ring_lock);
+    g_free(trace_ring_prefix);
+    trace_ring_prefix = prefix;
+    trace_ring_open_mappings();
+    g_mutex_unlock(&trace_ring_lock);
+}
+
+void trace_ring_init_group(size_t group)
+{
+    TraceEventIter iter;
+
+    g_mutex_lock(&trace_ring_lock);
+    if (mappings_fd >= 0) {
+        trace_event_iter_init_group(&iter, group);
+        trace_ring_write_mappings(&iter);
+    }
+    g_mutex_unlock(&trace_ring_lock);
+}
+
+/* Leave a late calibration point in the ring of the exiting thread */
+static void trace_ring_exit(void)
+{
+    TraceRingLocal *local = get_ptr_trace_ring_local();
+
+    if (local->ring) {
+        trace_ring_calibrate(local->ring->hdr, 1);
+    }
+}
+
+bool trace_ring_init(void)
+{
+    trace_ring_pid = getpid();
+
+    g_mutex_lock(&trace_ring_lock);
+    trace_ring_initialized = true;
+    trace_ring_open_mappings();
+    g_mutex_unlock(&trace_ring_lock);
+
+    atexit(trace_ring_exit);
+    return true;
+}
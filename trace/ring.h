@@ -0,0 +1,108 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Per-thread ring buffer trace backend
+ *
+ * Each thread that emits trace events gets its own ring buffer, a file
+ * mapped with MAP_SHARED so that its contents survive the QEMU process.
+ * Only the owning thread writes to a ring, so recording an event takes
+ * no locks and no atomic read-modify-write operations.  When a ring is
+ * full the oldest records are overwritten.
+ *
+ * scripts/ringtrace.py merges the rings into a file that can be read
+ * by scripts/simpletrace.py.
+ */
+
+#ifndef TRACE_RING_H
+#define TRACE_RING_H
+
+#include "qemu/atomic.h"
+#include "qemu/timer.h"
+
+#define TRACE_RING_MAGIC        0x676e6972756d6571ULL /* "qemuring" */
+#define TRACE_RING_VERSION      1
+
+/* Offset of the first record in a ring file */
+#define TRACE_RING_HEADER_SIZE  4096
+
+/* Event ID of the records that fill the space up to the end of a ring */
+#define TRACE_RING_PAD_EVENT_ID (~(uint64_t)0)
+
+#define TRACE_RING_MAX_STRLEN   512
+
+/*
+ * Header of a ring file.  @head and @tail are byte counts that only grow,
+ * the record at @tail is at (@tail % @size) bytes into the ring.
+ * @calib_ticks and @calib_ns are pairs of timestamps taken at the same
+ * time with cpu_get_host_ticks() and get_clock(); [0] when the ring is
+ * created and [1] whenever the ring wraps around and on thread exit.
+ */
+typedef struct TraceRingHeader {
+    uint64_t magic;
+    uint64_t version;
+    uint64_t size;              /* bytes of records after the header */
+    uint64_t pid;
+    uint64_t tid;
+    uint64_t head;              /* end of the newest complete record */
+    uint64_t tail;              /* start of the oldest record */
+    uint64_t lost;              /* overwritten records */
+    uint64_t calib_ticks[2];
+    uint64_t calib_ns[2];
+} TraceRingHeader;
+
+/* Header of a record, followed by the arguments */
+typedef struct TraceRingEntry {
+    uint64_t event;
+    uint64_t ticks;             /* cpu_get_host_ticks() */
+    uint32_t length;            /* including the header */
+    uint32_t reserved;
+    uint64_t arguments[];
+} TraceRingEntry;
+
+typedef struct TraceRing TraceRing;
+
+typedef struct TraceRingRecord {
+    TraceRing *ring;
+    uint8_t *ptr;               /* where the next argument goes */
+    uint64_t end;               /* new head */
+} TraceRingRecord;
+
+/**
+ * trace_ring_record_start:
+ * @rec: the record to start
+ * @event: event ID
+ * @arglen: number of bytes required for the arguments
+ *
+ * Claim space for a record in the current thread's ring.  Returns false
+ * if the event is dropped, in which case nothing must be written.
+ */
+bool trace_ring_record_start(TraceRingRecord *rec, uint32_t event,
+                             size_t arglen);
+
+/**
+ * trace_ring_record_finish:
+ *
+ * Make the record visible to readers.
+ */
+void trace_ring_record_finish(TraceRingRecord *rec);
+
+static inline void trace_ring_write_u64(TraceRingRecord *rec, uint64_t val)
+{
+    memcpy(rec->ptr, &val, sizeof(val));
+    rec->ptr += sizeof(val);
+}
+
+static inline void trace_ring_write_str(TraceRingRecord *rec, const char *s,
+                                        uint32_t slen)
+{
+    memcpy(rec->ptr, &slen, sizeof(slen));
+    if (slen) {
+        memcpy(rec->ptr + sizeof(slen), s, slen);
+    }
+    rec->ptr += sizeof(slen) + slen;
+}
+
+bool trace_ring_init(void);
+void trace_ring_init_group(size_t group);
+void trace_ring_set_file(const char *file);
+
+#endif /* TRACE_RING_H */
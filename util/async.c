@@ -32,6 +32,7 @@
 #include "qemu/atomic.h"
 #include "qemu/lockcnt.h"
 #include "qemu/rcu_queue.h"
+#include "qemu/thread-context.h"
 #include "block/raw-aio.h"
 #include "qemu/coroutine_int.h"
 #include "qemu/coroutine-tls.h"
@@ -299,6 +300,17 @@ aio_compute_timeout(AioContext *ctx)
     }
 }
 
+#ifdef CONFIG_LINUX_IO_URING
+static void aio_free_linux_io_uring(AioContext *ctx, unsigned setup_flags)
+{
+    if (ctx->linux_io_uring[setup_flags]) {
+        luring_detach_aio_context(ctx->linux_io_uring[setup_flags], ctx);
+        luring_cleanup(ctx->linux_io_uring[setup_flags]);
+        ctx->linux_io_uring[setup_flags] = NULL;
+    }
+}
+#endif
+
 static gboolean
 aio_ctx_prepare(GSource *source, gint    *timeout)
 {
@@ -370,6 +382,9 @@ aio_ctx_finalize(GSource     *source)
     unsigned flags;
 
     thread_pool_free_aio(ctx->thread_pool);
+    if (ctx->thread_pool_context) {
+        object_unref(OBJECT(ctx->thread_pool_context));
+    }
 
 #ifdef CONFIG_LINUX_AIO
     if (ctx->linux_aio) {
@@ -380,10 +395,8 @@ aio_ctx_finalize(GSource     *source)
 #endif
 
 #ifdef CONFIG_LINUX_IO_URING
-    if (ctx->linux_io_uring) {
-        luring_detach_aio_context(ctx->linux_io_uring, ctx);
-        luring_cleanup(ctx->linux_io_uring);
-        ctx->linux_io_uring = NULL;
+    for (unsigned i = 0; i < LURING_SETUP_MAX; i++) {
+        aio_free_linux_io_uring(ctx, i);
     }
 #endif
 
@@ -430,6 +443,16 @@ static GSourceFuncs aio_source_funcs = {
 
 GSource *aio_get_g_source(AioContext *ctx)
 {
+#ifdef CONFIG_LINUX_IO_URING
+    /*
+     * glib cannot drive io_uring fd monitoring, so aio_context_use_g_source()
+     * tears down the ring.  The default disk I/O ring shares it and must go
+     * first, it is recreated with its own ring when needed again.
+     */
+    if (aio_has_io_uring(ctx)) {
+        aio_free_linux_io_uring(ctx, 0);
+    }
+#endif
     aio_context_use_g_source(ctx);
     g_source_ref(&ctx->source);
     return &ctx->source;
@@ -463,25 +486,29 @@ LinuxAioState *aio_get_linux_aio(AioContext *ctx)
 #endif
 
 #ifdef CONFIG_LINUX_IO_URING
-LuringState *aio_setup_linux_io_uring(AioContext *ctx, Error **errp)
+LuringState *aio_setup_linux_io_uring(AioContext *ctx, unsigned setup_flags,
+                                      Error **errp)
 {
-    if (ctx->linux_io_uring) {
-        return ctx->linux_io_uring;
+    assert(setup_flags < LURING_SETUP_MAX);
+
+    if (ctx->linux_io_uring[setup_flags]) {
+        return ctx->linux_io_uring[setup_flags];
     }
 
-    ctx->linux_io_uring = luring_init(errp);
-    if (!ctx->linux_io_uring) {
+    ctx->linux_io_uring[setup_flags] = luring_init(ctx, setup_flags, errp);
+    if (!ctx->linux_io_uring[setup_flags]) {
         return NULL;
     }
 
-    luring_attach_aio_context(ctx->linux_io_uring, ctx);
-    return ctx->linux_io_uring;
+    luring_attach_aio_context(ctx->linux_io_uring[setup_flags], ctx);
+    return ctx->linux_io_uring[setup_flags];
 }
 
-LuringState *aio_get_linux_io_uring(AioContext *ctx)
+LuringState *aio_get_linux_io_uring(AioContext *ctx, unsigned setup_flags)
 {
-    assert(ctx->linux_io_uring);
-    return ctx->linux_io_uring;
+    assert(setup_flags < LURING_SETUP_MAX);
+    assert(ctx->linux_io_uring[setup_flags]);
+    return ctx->linux_io_uring[setup_flags];
 }
 #endif
 
@@ -602,7 +629,7 @@ AioContext *aio_context_new(Error **errp)
 #endif
 
 #ifdef CONFIG_LINUX_IO_URING
-    ctx->linux_io_uring = NULL;
+    memset(ctx->linux_io_uring, 0, sizeof(ctx->linux_io_uring));
 #endif
 
     ctx->thread_pool = NULL;
@@ -617,6 +644,7 @@ AioContext *aio_context_new(Error **errp)
 
     ctx->thread_pool_min = 0;
     ctx->thread_pool_max = THREAD_POOL_MAX_THREADS_DEFAULT;
+    ctx->thread_pool_context = NULL;
 
     register_aiocontext(ctx);
 
@@ -758,3 +786,25 @@ void aio_context_set_thread_pool_params(AioContext *ctx, int64_t min,
         thread_pool_update_params(ctx->thread_pool, ctx);
     }
 }
+
+void aio_context_set_thread_pool_context(AioContext *ctx, ThreadContext *tc)
+{
+    ThreadContext *old = ctx->thread_pool_context;
+
+    if (tc == old) {
+        return;
+    }
+
+    if (tc) {
+        object_ref(OBJECT(tc));
+    }
+    ctx->thread_pool_context = tc;
+
+    /* The pool must stop using the old context before it can go away */
+    if (ctx->thread_pool) {
+        thread_pool_update_params(ctx->thread_pool, ctx);
+    }
+    if (old) {
+        object_unref(OBJECT(old));
+    }
+}
@@ -0,0 +1,409 @@
+/*
+ * Coroutine switching with a hand-written context switch
+ *
+ * Copyright (C) 2006  Anthony Liguori <anthony@codemonkey.ws>
+ * Copyright (C) 2011  Kevin Wolf <kwolf@redhat.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.0-or-later
+ */
+
+/*
+ * Unlike the ucontext backend, switching coroutines does not go through
+ * sigsetjmp()/siglongjmp(): only the callee-saved registers are pushed on
+ * the stack of the coroutine being switched out, and the stack pointer is
+ * stored in the coroutine.  Caller-saved registers are taken care of by
+ * the compiler, because qemu_co_asm_switch() is called like any other
+ * function.
+ *
+ * A new coroutine starts with a stack that looks as if it had switched out
+ * from the beginning of coroutine_trampoline(), so the first switch to it
+ * "returns" into the trampoline.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/coroutine_int.h"
+#include "qemu/coroutine-tls.h"
+
+#ifdef CONFIG_VALGRIND_H
+#include <valgrind/valgrind.h>
+#endif
+
+#ifdef QEMU_SANITIZE_ADDRESS
+#ifdef CONFIG_ASAN_IFACE_FIBER
+#define CONFIG_ASAN 1
+#include <sanitizer/asan_interface.h>
+#endif
+#endif
+
+#ifdef CONFIG_TSAN
+#include <sanitizer/tsan_interface.h>
+#endif
+
+#if defined(__CET__) && (__CET__ & 2)
+#error The asm coroutine backend does not support shadow stacks
+#endif
+
+typedef struct {
+    Coroutine base;
+    /* Stack pointer of the coroutine while it is switched out */
+    void *sp;
+    void *stack;
+    size_t stack_size;
+#ifdef CONFIG_SAFESTACK
+    /* Need an unsafe stack for each coroutine */
+    void *unsafe_stack;
+    size_t unsafe_stack_size;
+    void *unsafe_sp;
+#endif
+
+#ifdef CONFIG_TSAN
+    void *tsan_co_fiber;
+#endif
+
+#ifdef CONFIG_VALGRIND_H
+    unsigned int valgrind_stack_id;
+#endif
+
+} CoroutineAsm;
+
+/**
+ * Per-thread coroutine bookkeeping
+ */
+QEMU_DEFINE_STATIC_CO_TLS(Coroutine *, current);
+QEMU_DEFINE_STATIC_CO_TLS(CoroutineAsm, leader);
+
+/*
+ * Save the callee-saved registers on the current stack and store the stack
+ * pointer in *@from_sp, then switch to @to_sp and restore the registers
+ * that were saved there.  Returns @action, as passed by whoever switched
+ * back to us.
+ */
+int qemu_co_asm_switch(void **from_sp, void *to_sp, int action);
+
+#if defined(__x86_64__)
+
+#if defined(__CET__) && (__CET__ & 1)
+#define CO_ASM_ENDBR "endbr64\n\t"
+#else
+#define CO_ASM_ENDBR ""
+#endif
+
+/* %rdi = from_sp, %rsi = to_sp, %edx = action */
+asm(".pushsection .text\n\t"
+    ".p2align 4\n\t"
+    ".globl qemu_co_asm_switch\n\t"
+    ".hidden qemu_co_asm_switch\n\t"
+    ".type qemu_co_asm_switch, @function\n"
+    "qemu_co_asm_switch:\n\t"
+    CO_ASM_ENDBR
+    "pushq %rbp\n\t"
+    "pushq %rbx\n\t"
+    "pushq %r12\n\t"
+    "pushq %r13\n\t"
+    "pushq %r14\n\t"
+    "pushq %r15\n\t"
+    "movq %rsp, (%rdi)\n\t"
+    "movq %rsi, %rsp\n\t"
+    "popq %r15\n\t"
+    "popq %r14\n\t"
+    "popq %r13\n\t"
+    "popq %r12\n\t"
+    "popq %rbx\n\t"
+    "popq %rbp\n\t"
+    "movl %edx, %eax\n\t"
+    "ret\n\t"
+    ".size qemu_co_asm_switch, .-qemu_co_asm_switch\n\t"
+    ".popsection\n");
+
+/*
+ * Registers pushed by qemu_co_asm_switch, plus its return address.  One
+ * more word above the frame makes the trampoline start with the stack
+ * aligned as if it had been called.
+ */
+#define CO_ASM_FRAME_WORDS  7
+#define CO_ASM_FRAME_RET    6
+#define CO_ASM_FRAME_PAD    1
+
+#elif defined(__aarch64__)
+
+#if defined(__ARM_FEATURE_BTI_DEFAULT) && __ARM_FEATURE_BTI_DEFAULT
+#define CO_ASM_BTI "bti c\n\t"
+#else
+#define CO_ASM_BTI ""
+#endif
+
+/* x0 = from_sp, x1 = to_sp, w2 = action */
+asm(".pushsection .text\n\t"
+    ".p2align 4\n\t"
+    ".globl qemu_co_asm_switch\n\t"
+    ".hidden qemu_co_asm_switch\n\t"
+    ".type qemu_co_asm_switch, %function\n"
+    "qemu_co_asm_switch:\n\t"
+    CO_ASM_BTI
+    "sub sp, sp, #160\n\t"
+    "stp x19, x20, [sp, #0]\n\t"
+    "stp x21, x22, [sp, #16]\n\t"
+    "stp x23, x24, [sp, #32]\n\t"
+    "stp x25, x26, [sp, #48]\n\t"
+    "stp x27, x28, [sp, #64]\n\t"
+    "stp x29, x30, [sp, #80]\n\t"
+    "stp d8, d9, [sp, #96]\n\t"
+    "stp d10, d11, [sp, #112]\n\t"
+    "stp d12, d13, [sp, #128]\n\t"
+    "stp d14, d15, [sp, #144]\n\t"
+    "mov x3, sp\n\t"
+    "str x3, [x0]\n\t"
+    "mov sp, x1\n\t"
+    "ldp x19, x20, [sp, #0]\n\t"
+    "ldp x21, x22, [sp, #16]\n\t"
+    "ldp x23, x24, [sp, #32]\n\t"
+    "ldp x25, x26, [sp, #48]\n\t"
+    "ldp x27, x28, [sp, #64]\n\t"
+    "ldp x29, x30, [sp, #80]\n\t"
+    "ldp d8, d9, [sp, #96]\n\t"
+    "ldp d10, d11, [sp, #112]\n\t"
+    "ldp d12, d13, [sp, #128]\n\t"
+    "ldp d14, d15, [sp, #144]\n\t"
+    "add sp, sp, #160\n\t"
+    "mov w0, w2\n\t"
+    "ret\n\t"
+    ".size qemu_co_asm_switch, .-qemu_co_asm_switch\n\t"
+    ".popsection\n");
+
+/*
+ * Registers saved by qemu_co_asm_switch; x30 is the return address.  The
+ * padding keeps the stack 16-byte aligned.
+ */
+#define CO_ASM_FRAME_WORDS  20
+#define CO_ASM_FRAME_RET    11
+#define CO_ASM_FRAME_PAD    2
+
+#else
+#error The asm coroutine backend only supports x86_64 and aarch64 hosts
+#endif
+
+/*
+ * QEMU_ALWAYS_INLINE only does so if __OPTIMIZE__, so we cannot use it.
+ * always_inline is required to avoid TSan runtime fatal errors.
+ */
+static inline __attribute__((always_inline))
+void on_new_fiber(CoroutineAsm *co)
+{
+#ifdef CONFIG_TSAN
+    co->tsan_co_fiber = __tsan_create_fiber(0); /* flags: sync on switch */
+#endif
+}
+
+/* always_inline is required to avoid TSan runtime fatal errors. */
+static inline __attribute__((always_inline))
+void finish_switch_fiber(void *fake_stack_save)
+{
+#ifdef CONFIG_ASAN
+    CoroutineAsm *leaderp = get_ptr_leader();
+    const void *bottom_old;
+    size_t size_old;
+
+    __sanitizer_finish_switch_fiber(fake_stack_save, &bottom_old, &size_old);
+
+    if (!leaderp->stack) {
+        leaderp->stack = (void *)bottom_old;
+        leaderp->stack_size = size_old;
+    }
+#endif
+#ifdef CONFIG_TSAN
+    if (fake_stack_save) {
+        __tsan_release(fake_stack_save);
+        __tsan_switch_to_fiber(fake_stack_save, 0);  /* 0=synchronize */
+    }
+#endif
+}
+
+/* always_inline is required to avoid TSan runtime fatal errors. */
+static inline __attribute__((always_inline))
+void start_switch_fiber_asan(void **fake_stack_save,
+                             const void *bottom, size_t size)
+{
+#ifdef CONFIG_ASAN
+    __sanitizer_start_switch_fiber(fake_stack_save, bottom, size);
+#endif
+}
+
+/* always_inline is required to avoid TSan runtime fatal errors. */
+static inline __attribute__((always_inline))
+void start_switch_fiber_tsan(void **fake_stack_save, CoroutineAsm *co)
+{
+#ifdef CONFIG_TSAN
+    void *new_fiber = co->tsan_co_fiber;
+    void *curr_fiber = __tsan_get_current_fiber();
+    __tsan_acquire(curr_fiber);
+
+    *fake_stack_save = curr_fiber;
+    __tsan_switch_to_fiber(new_fiber, 0);  /* 0=synchronize */
+#endif
+}
+
+/*
+ * Entered from qemu_co_asm_switch() the first time a coroutine runs,
+ * after qemu_coroutine_switch() has set it as the current coroutine.
+ */
+static G_NORETURN void coroutine_trampoline(void)
+{
+    Coroutine *co = get_current();
+
+    finish_switch_fiber(NULL);
+
+    while (true) {
+        co->entry(co->entry_arg);
+        qemu_coroutine_switch(co, co->caller, COROUTINE_TERMINATE);
+    }
+}
+
+Coroutine *qemu_coroutine_new(void)
+{
+    CoroutineAsm *co;
+    uintptr_t *sp;
+
+    co = g_malloc0(sizeof(*co));
+    co->stack_size = COROUTINE_STACK_SIZE;
+    co->stack = qemu_alloc_stack(&co->stack_size);
+#ifdef CONFIG_SAFESTACK
+    /*
+     * The unsafe stack grows just like the normal stack, so start from
+     * the last usable location of the memory area.
+     */
+    co->unsafe_stack_size = COROUTINE_STACK_SIZE;
+    co->unsafe_stack = qemu_alloc_stack(&co->unsafe_stack_size);
+    co->unsafe_sp = co->unsafe_stack + co->unsafe_stack_size;
+#endif
+
+#ifdef CONFIG_VALGRIND_H
+    co->valgrind_stack_id =
+        VALGRIND_STACK_REGISTER(co->stack, co->stack + co->stack_size);
+#endif
+
+    on_new_fiber(co);
+
+    /*
+     * Build the frame that qemu_co_asm_switch() pops, with all registers
+     * zeroed (including the frame pointer, which terminates backtraces)
+     * and coroutine_trampoline() as the return address.
+     */
+    sp = (uintptr_t *)QEMU_ALIGN_PTR_DOWN(co->stack + co->stack_size, 16);
+    sp -= CO_ASM_FRAME_WORDS + CO_ASM_FRAME_PAD;
+    memset(sp, 0, (CO_ASM_FRAME_WORDS + CO_ASM_FRAME_PAD) * sizeof(*sp));
+    sp[CO_ASM_FRAME_RET] = (uintptr_t)coroutine_trampoline;
+    co->sp = sp;
+
+    return &co->base;
+}
+
+#ifdef CONFIG_VALGRIND_H
+/* Work around an unused variable in the valgrind.h macro... */
+#if !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-but-set-variable"
+#endif
+static inline void valgrind_stack_deregister(CoroutineAsm *co)
+{
+    VALGRIND_STACK_DEREGISTER(co->valgrind_stack_id);
+}
+#if !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+#endif
+
+#if defined(CONFIG_ASAN) && defined(CONFIG_COROUTINE_POOL)
+static void coroutine_fn terminate_asan(void *opaque)
+{
+    CoroutineAsm *to = DO_UPCAST(CoroutineAsm, base, opaque);
+    void *unused_sp;
+
+    set_current(opaque);
+    start_switch_fiber_asan(NULL, to->stack, to->stack_size);
+    G_STATIC_ASSERT(!IS_ENABLED(CONFIG_TSAN));
+    qemu_co_asm_switch(&unused_sp, to->sp, COROUTINE_ENTER);
+    g_assert_not_reached();
+}
+#endif
+
+void qemu_coroutine_delete(Coroutine *co_)
+{
+    CoroutineAsm *co = DO_UPCAST(CoroutineAsm, base, co_);
+
+#if defined(CONFIG_ASAN) && defined(CONFIG_COROUTINE_POOL)
+    co_->entry_arg = qemu_coroutine_self();
+    co_->entry = terminate_asan;
+    qemu_coroutine_switch(co_->entry_arg, co_, COROUTINE_ENTER);
+#endif
+
+#ifdef CONFIG_VALGRIND_H
+    valgrind_stack_deregister(co);
+#endif
+
+    qemu_free_stack(co->stack, co->stack_size);
+#ifdef CONFIG_SAFESTACK
+    qemu_free_stack(co->unsafe_stack, co->unsafe_stack_size);
+#endif
+    g_free(co);
+}
+
+/*
+ * This function is marked noinline for the same reason as in the ucontext
+ * backend: qemu_co_asm_switch() may return in a different thread, so the
+ * address of TLS variables must not be cached across it.
+ */
+CoroutineAction __attribute__((noinline))
+qemu_coroutine_switch(Coroutine *from_, Coroutine *to_,
+                      CoroutineAction action)
+{
+    CoroutineAsm *from = DO_UPCAST(CoroutineAsm, base, from_);
+    CoroutineAsm *to = DO_UPCAST(CoroutineAsm, base, to_);
+    void *fake_stack_save = NULL;
+    int ret;
+
+    set_current(to_);
+
+#ifdef CONFIG_SAFESTACK
+    /*
+     * The compiler does not know that the unsafe stack changes, so do it
+     * by hand.  Whoever switches back to us restores from->unsafe_sp.
+     */
+    from->unsafe_sp = __safestack_unsafe_stack_ptr;
+    __safestack_unsafe_stack_ptr = to->unsafe_sp;
+#endif
+
+    start_switch_fiber_asan(IS_ENABLED(CONFIG_COROUTINE_POOL) ||
+                            action != COROUTINE_TERMINATE ?
+                                &fake_stack_save : NULL,
+                            to->stack, to->stack_size);
+    start_switch_fiber_tsan(&fake_stack_save, to);
+    ret = qemu_co_asm_switch(&from->sp, to->sp, action);
+
+    finish_switch_fiber(fake_stack_save);
+
+    return ret;
+}
+
+Coroutine *qemu_coroutine_self(void)
+{
+    Coroutine *self = get_current();
+    CoroutineAsm *leaderp = get_ptr_leader();
+
+    if (!self) {
+        self = &leaderp->base;
+        set_current(self);
+    }
+#ifdef CONFIG_TSAN
+    if (!leaderp->tsan_co_fiber) {
+        leaderp->tsan_co_fiber = __tsan_get_current_fiber();
+    }
+#endif
+    return self;
+}
+
+bool qemu_in_coroutine(void)
+{
+    Coroutine *self = get_current();
+
+    return self && self->caller;
+}
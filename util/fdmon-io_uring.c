@@ -19,9 +19,12 @@
  * 4. Nanosecond timeouts are supported so it requires fewer syscalls than
  *    epoll(7).
  *
- * This code only monitors file descriptors and does not do asynchronous disk
- * I/O.  Implementing disk I/O efficiently has other requirements and should
- * use a separate io_uring so it does not make sense to unify the code.
+ * Other subsystems can add their own requests to the ring with aio_add_sqe(),
+ * for example block/io_uring.c does this for disk I/O.  Fd monitoring
+ * changes, the timer deadline and these requests are then submitted by a
+ * single io_uring_enter(2) call per aio_poll() iteration, which also reaps
+ * their completions.  The user_data field of these requests points to a
+ * CqeHandler and has CQE_HANDLER_TAG set to tell it apart from AioHandlers.
  *
  * File descriptor monitoring is implemented using the following operations:
  *
@@ -37,14 +40,16 @@
  * io_uring calls the submission queue the "sq ring" and the completion queue
  * the "cq ring".  Ring entries are called "sqe" and "cqe", respectively.
  *
- * The code is structured so that sq/cq rings are only modified within
- * fdmon_io_uring_wait().  Changes to AioHandlers are made by enqueuing them on
- * ctx->submit_list so that fdmon_io_uring_wait() can submit IORING_OP_POLL_ADD
- * and/or IORING_OP_POLL_REMOVE sqes for them.
+ * The code is structured so that sq/cq rings are only modified by the
+ * AioContext home thread, within fdmon_io_uring_wait() and aio_add_sqe().
+ * Changes to AioHandlers may come from any thread, so they are made by
+ * enqueuing them on ctx->submit_list so that fdmon_io_uring_wait() can submit
+ * IORING_OP_POLL_ADD and/or IORING_OP_POLL_REMOVE sqes for them.
  */
 
 #include "qemu/osdep.h"
 #include <poll.h>
+#include "qemu/defer-call.h"
 #include "qemu/rcu_queue.h"
 #include "aio-posix.h"
 
@@ -57,6 +62,9 @@ enum {
     FDMON_IO_URING_REMOVE   = (1 << 2),
 };
 
+/* Set in the user_data field of aio_add_sqe() requests */
+#define CQE_HANDLER_TAG ((uintptr_t)1)
+
 static inline int poll_events_from_pfd(int pfd_events)
 {
     return (pfd_events & G_IO_IN ? POLLIN : 0) |
@@ -74,8 +82,8 @@ static inline int pfd_events_from_poll(int poll_events)
 }
 
 /*
- * Returns an sqe for submitting a request.  Only be called within
- * fdmon_io_uring_wait().
+ * Returns an sqe for submitting a request.  Only be called from the
+ * AioContext home thread.
  */
 static struct io_uring_sqe *get_sqe(AioContext *ctx)
 {
@@ -234,6 +242,14 @@ static bool process_cqe(AioContext *ctx,
         return false;
     }
 
+    if ((uintptr_t)node & CQE_HANDLER_TAG) {
+        CqeHandler *cqe_handler = (void *)((uintptr_t)node & ~CQE_HANDLER_TAG);
+
+        cqe_handler->cqe = *cqe;
+        QSIMPLEQ_INSERT_TAIL(&ctx->cqe_handler_ready_list, cqe_handler, next);
+        return true;
+    }
+
     /*
      * Deletion can only happen when IORING_OP_POLL_ADD completes.  If we race
      * with enqueue() here then we can safely clear the FDMON_IO_URING_REMOVE
@@ -278,7 +294,8 @@ static int fdmon_io_uring_wait(AioContext *ctx, AioHandlerList *ready_list,
     unsigned wait_nr = 1; /* block until at least one cqe is ready */
     int ret;
 
-    if (timeout == 0) {
+    /* Don't block if a nested aio_poll() has completion callbacks to run */
+    if (timeout == 0 || !QSIMPLEQ_EMPTY(&ctx->cqe_handler_ready_list)) {
         wait_nr = 0; /* non-blocking */
     } else if (timeout > 0) {
         add_timeout_sqe(ctx, timeout);
@@ -295,6 +312,26 @@ static int fdmon_io_uring_wait(AioContext *ctx, AioHandlerList *ready_list,
     return process_cq_ring(ctx, ready_list);
 }
 
+static bool fdmon_io_uring_dispatch(AioContext *ctx)
+{
+    CqeHandler *cqe_handler;
+    bool progress = false;
+
+    /* Batch up the notifications that completion callbacks trigger */
+    defer_call_begin();
+
+    /* Callbacks may run a nested aio_poll(), which continues from here */
+    while ((cqe_handler = QSIMPLEQ_FIRST(&ctx->cqe_handler_ready_list))) {
+        QSIMPLEQ_REMOVE_HEAD(&ctx->cqe_handler_ready_list, next);
+        ctx->cqe_handlers_in_flight--;
+        cqe_handler->cb(cqe_handler);
+        progress = true;
+    }
+
+    defer_call_end();
+    return progress;
+}
+
 static bool fdmon_io_uring_need_wait(AioContext *ctx)
 {
     /* Have io_uring events completed? */
@@ -302,6 +339,11 @@ static bool fdmon_io_uring_need_wait(AioContext *ctx)
         return true;
     }
 
+    /* Are there completion callbacks left over from a nested aio_poll()? */
+    if (!QSIMPLEQ_EMPTY(&ctx->cqe_handler_ready_list)) {
+        return true;
+    }
+
     /* Are there pending sqes to submit? */
     if (io_uring_sq_ready(&ctx->fdmon_io_uring)) {
         return true;
@@ -319,8 +361,67 @@ static const FDMonOps fdmon_io_uring_ops = {
     .update = fdmon_io_uring_update,
     .wait = fdmon_io_uring_wait,
     .need_wait = fdmon_io_uring_need_wait,
+    .dispatch = fdmon_io_uring_dispatch,
 };
 
+bool aio_has_io_uring(AioContext *ctx)
+{
+    return ctx->fdmon_ops == &fdmon_io_uring_ops;
+}
+
+void aio_add_sqe(AioContext *ctx,
+                 void (*prep_sqe)(struct io_uring_sqe *sqe, void *opaque),
+                 void *opaque, CqeHandler *cqe_handler)
+{
+    struct io_uring_sqe *sqe;
+
+    assert(aio_has_io_uring(ctx));
+    assert(ctx == qemu_get_current_aio_context());
+
+    sqe = get_sqe(ctx);
+    prep_sqe(sqe, opaque);
+    io_uring_sqe_set_data(sqe, (void *)((uintptr_t)cqe_handler |
+                                        CQE_HANDLER_TAG));
+    ctx->cqe_handlers_in_flight++;
+}
+
+void aio_drain_sqes(AioContext *ctx)
+{
+    AioHandlerList ready_list = QLIST_HEAD_INITIALIZER(ready_list);
+    AioHandler *node;
+    int ret;
+
+    if (!aio_has_io_uring(ctx) || ctx->cqe_handlers_in_flight == 0) {
+        return;
+    }
+
+    assert(ctx == qemu_get_current_aio_context());
+    qemu_lockcnt_inc(&ctx->list_lock);
+
+    while (ctx->cqe_handlers_in_flight > 0) {
+        if (QSIMPLEQ_EMPTY(&ctx->cqe_handler_ready_list)) {
+            do {
+                ret = io_uring_submit_and_wait(&ctx->fdmon_io_uring, 1);
+            } while (ret == -EINTR);
+            assert(ret >= 0);
+
+            process_cq_ring(ctx, &ready_list);
+
+            /*
+             * Ready AioHandlers are not dispatched here.  process_cqe() has
+             * re-armed their IORING_OP_POLL_ADD, so they are reported again
+             * once aio_poll() runs.
+             */
+            while ((node = QLIST_FIRST(&ready_list))) {
+                QLIST_REMOVE(node, node_ready);
+            }
+        }
+        fdmon_io_uring_dispatch(ctx);
+    }
+
+    qemu_lockcnt_dec(&ctx->list_lock);
+}
+
 bool fdmon_io_uring_setup(AioContext *ctx)
 {
     int ret;
@@ -331,6 +432,8 @@ bool fdmon_io_uring_setup(AioContext *ctx)
     }
 
     QSLIST_INIT(&ctx->submit_list);
+    QSIMPLEQ_INIT(&ctx->cqe_handler_ready_list);
+    ctx->cqe_handlers_in_flight = 0;
     ctx->fdmon_ops = &fdmon_io_uring_ops;
     return true;
 }
@@ -340,6 +443,9 @@ void fdmon_io_uring_destroy(AioContext *ctx)
     if (ctx->fdmon_ops == &fdmon_io_uring_ops) {
         AioHandler *node;
 
+        /* The callbacks of aio_add_sqe() requests would never run */
+        assert(ctx->cqe_handlers_in_flight == 0);
+
         io_uring_queue_exit(&ctx->fdmon_io_uring);
 
         /* Move handlers due to be removed onto the deleted list */
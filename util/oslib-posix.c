@@ -39,7 +39,9 @@
 #include "qemu/sockets.h"
 #include "qemu/thread.h"
 #include <libgen.h>
+#include "qemu/bitmap.h"
 #include "qemu/cutils.h"
+#include "qemu/stats64.h"
 #include "qemu/units.h"
 #include "qemu/thread-context.h"
 #include "qemu/main-loop.h"
@@ -674,6 +676,203 @@ bool qemu_prealloc_mem(int fd, char *area, size_t sz, int max_threads,
     return rv;
 }
 
+/* Granularity of background prefaulting, rounded up to the page size */
+#define PREFAULT_CHUNK_SIZE     (32 * MiB)
+
+/* Unclaimed chunks inspected for guest accesses before each linear pick */
+#define PREFAULT_PROBE_CHUNKS   16
+
+struct QemuPrefault {
+    char *area;
+    size_t size;
+    size_t chunk_size;
+    size_t nr_chunks;
+    int advice;
+    QemuThread *threads;
+    int num_threads;
+
+    /* Protects claimed, next, probe and vec */
+    QemuMutex lock;
+    unsigned long *claimed;
+    size_t next;
+    size_t probe;
+    unsigned char *vec;
+
+    /* Accessed atomically */
+    bool stopping;
+    int error;
+    int running;
+    Stat64 populated;
+};
+
+static size_t prefault_chunk_len(QemuPrefault *pf, size_t chunk)
+{
+    return MIN(pf->chunk_size, pf->size - chunk * pf->chunk_size);
+}
+
+/*
+ * Whether the guest already faulted in part of @chunk.  The rest of such a
+ * chunk is likely to be accessed soon, so it is populated first.
+ */
+static bool prefault_chunk_touched(QemuPrefault *pf, size_t chunk)
+{
+#ifdef CONFIG_LINUX
+    size_t len = prefault_chunk_len(pf, chunk);
+    size_t i, n = DIV_ROUND_UP(len, qemu_real_host_page_size());
+
+    if (mincore(pf->area + chunk * pf->chunk_size, len, pf->vec)) {
+        return false;
+    }
+    for (i = 0; i < n; i++) {
+        if (pf->vec[i] & 1) {
+            return true;
+        }
+    }
+#endif
+    return false;
+}
+
+static bool prefault_claim(QemuPrefault *pf, size_t *chunk)
+{
+    size_t c;
+    int i;
+
+    QEMU_LOCK_GUARD(&pf->lock);
+    for (i = 0; i < PREFAULT_PROBE_CHUNKS; i++) {
+        c = find_next_zero_bit(pf->claimed, pf->nr_chunks, pf->probe);
+        if (c >= pf->nr_chunks) {
+            c = find_first_zero_bit(pf->claimed, pf->nr_chunks);
+            if (c >= pf->nr_chunks) {
+                return false;
+            }
+        }
+        pf->probe = c + 1;
+        if (prefault_chunk_touched(pf, c)) {
+            goto found;
+        }
+    }
+
+    /* Chunks before pf->next are all claimed */
+    c = find_next_zero_bit(pf->claimed, pf->nr_chunks, pf->next);
+    if (c >= pf->nr_chunks) {
+        return false;
+    }
+    pf->next = c + 1;
+
+found:
+    set_bit(c, pf->claimed);
+    *chunk = c;
+    return true;
+}
+
+static void *do_prefault_pages(void *arg)
+{
+    QemuPrefault *pf = arg;
+    size_t chunk, len;
+
+    while (!qatomic_read(&pf->stopping) && prefault_claim(pf, &chunk)) {
+        len = prefault_chunk_len(pf, chunk);
+        if (qemu_madvise(pf->area + chunk * pf->chunk_size, len,
+                         pf->advice)) {
+            qatomic_cmpxchg(&pf->error, 0, -errno);
+            qatomic_set(&pf->stopping, true);
+            break;
+        }
+        stat64_add(&pf->populated, len);
+    }
+
+    if (qatomic_fetch_dec(&pf->running) == 1) {
+        trace_qemu_prefault_mem_done(pf->area, stat64_get(&pf->populated),
+                                     qatomic_read(&pf->error));
+    }
+    return NULL;
+}
+
+QemuPrefault *qemu_prefault_mem_start(int fd, char *area, size_t sz,
+                                      bool populate_read, int max_threads,
+                                      ThreadContext *tc, Error **errp)
+{
+#ifndef EMSCRIPTEN
+    size_t hpagesize = qemu_fd_getpagesize(fd);
+#else
+    size_t hpagesize = qemu_real_host_page_size();
+#endif
+    int advice = populate_read ? QEMU_MADV_POPULATE_READ :
+                                 QEMU_MADV_POPULATE_WRITE;
+    QemuPrefault *pf;
+    int i;
+
+    /*
+     * Unlike touching the pages, MADV_POPULATE_(READ|WRITE) does not modify
+     * memory and can therefore run while the guest is already using it.
+     */
+    if (qemu_madvise(area, hpagesize, advice) && errno == EINVAL) {
+        error_setg(errp, "qemu_prefault_mem: %s is not supported for this"
+                   " memory", populate_read ? "MADV_POPULATE_READ" :
+                   "MADV_POPULATE_WRITE");
+        return NULL;
+    }
+
+    pf = g_new0(QemuPrefault, 1);
+    pf->area = area;
+    pf->advice = advice;
+    pf->size = ROUND_UP(sz, hpagesize);
+    pf->chunk_size = ROUND_UP(PREFAULT_CHUNK_SIZE, hpagesize);
+    pf->nr_chunks = DIV_ROUND_UP(pf->size, pf->chunk_size);
+    pf->claimed = bitmap_new(pf->nr_chunks);
+    pf->vec = g_malloc(DIV_ROUND_UP(pf->chunk_size,
+                                    qemu_real_host_page_size()));
+    qemu_mutex_init(&pf->lock);
+
+    pf->num_threads = get_memset_num_threads(hpagesize,
+                                             pf->size / hpagesize,
+                                             max_threads);
+    pf->threads = g_new0(QemuThread, pf->num_threads);
+    pf->running = pf->num_threads;
+    trace_qemu_prefault_mem_start(area, pf->size, pf->num_threads);
+
+    for (i = 0; i < pf->num_threads; i++) {
+        if (tc) {
+            thread_context_create_thread(tc, &pf->threads[i], "prefault_pages",
+                                         do_prefault_pages, pf,
+                                         QEMU_THREAD_JOINABLE);
+        } else {
+            qemu_thread_create(&pf->threads[i], "prefault_pages",
+                               do_prefault_pages, pf, QEMU_THREAD_JOINABLE);
+        }
+    }
+    return pf;
+}
+
+bool qemu_prefault_mem_progress(QemuPrefault *pf, uint64_t *populated,
+                                int *error)
+{
+    *populated = stat64_get(&pf->populated);
+    *error = qatomic_read(&pf->error);
+    return !qatomic_read(&pf->running);
+}
+
+void qemu_prefault_mem_stop(QemuPrefault *pf)
+{
+    int i;
+
+    if (!pf) {
+        return;
+    }
+
+    /* Threads finish the chunk they are populating */
+    qatomic_set(&pf->stopping, true);
+    for (i = 0; i < pf->num_threads; i++) {
+        qemu_thread_join(&pf->threads[i]);
+    }
+
+    qemu_mutex_destroy(&pf->lock);
+    g_free(pf->threads);
+    g_free(pf->claimed);
+    g_free(pf->vec);
+    g_free(pf);
+}
+
 char *qemu_get_pid_name(pid_t pid)
 {
     char *name = NULL;
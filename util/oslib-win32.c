@@ -284,6 +284,25 @@ bool qemu_finish_async_prealloc_mem(Error **errp)
     return true;
 }
 
+QemuPrefault *qemu_prefault_mem_start(int fd, char *area, size_t sz,
+                                      bool populate_read, int max_threads,
+                                      ThreadContext *tc, Error **errp)
+{
+    error_setg(errp, "qemu_prefault_mem: not supported on this host");
+    return NULL;
+}
+
+bool qemu_prefault_mem_progress(QemuPrefault *pf, uint64_t *populated,
+                                int *error)
+{
+    g_assert_not_reached();
+}
+
+void qemu_prefault_mem_stop(QemuPrefault *pf)
+{
+    assert(!pf);
+}
+
 char *qemu_get_pid_name(pid_t pid)
 {
     /* XXX Implement me */
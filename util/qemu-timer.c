@@ -62,12 +62,21 @@ static QEMUClock qemu_clocks[QEMU_CLOCK_MAX];
  * used by different AioContexts / threads. Each clock also has
  * a list of the QEMUTimerLists associated with it, in order that
  * reenabling the clock can call all the notifiers.
+ *
+ * The active timers are kept in a binary min-heap ordered by expiry
+ * time, so that arming and deleting a timer is O(log n) and the next
+ * deadline is always active_timers[0].  Timers with the same expiry
+ * time fire in the order they were armed, as record/replay depends
+ * on a deterministic order.
  */
 
 struct QEMUTimerList {
     QEMUClock *clock;
     QemuMutex active_timers_lock;
-    QEMUTimer *active_timers;
+    QEMUTimer **active_timers;
+    size_t nr_active_timers;    /* may be read without the lock */
+    size_t max_active_timers;
+    uint64_t timer_seq;
     QLIST_ENTRY(QEMUTimerList) list;
     QEMUTimerListNotifyCB *notify_cb;
     void *notify_opaque;
@@ -94,6 +103,91 @@ static bool timer_expired_ns(QEMUTimer *timer_head, int64_t current_time)
     return timer_head && (timer_head->expire_time <= current_time);
 }
 
+static bool timer_before(QEMUTimer *a, QEMUTimer *b)
+{
+    return a->expire_time < b->expire_time ||
+           (a->expire_time == b->expire_time && a->seq < b->seq);
+}
+
+/* Returns the timer that expires first, or NULL.  Caller holds the lock. */
+static QEMUTimer *timerlist_first(QEMUTimerList *timer_list)
+{
+    return timer_list->nr_active_timers ? timer_list->active_timers[0] : NULL;
+}
+
+static void timer_heap_set(QEMUTimerList *timer_list, size_t i, QEMUTimer *ts)
+{
+    timer_list->active_timers[i] = ts;
+    ts->heap_index = i;
+}
+
+static void timer_heap_sift_up(QEMUTimerList *timer_list, size_t i)
+{
+    QEMUTimer *ts = timer_list->active_timers[i];
+
+    while (i > 0) {
+        size_t parent = (i - 1) / 2;
+
+        if (!timer_before(ts, timer_list->active_timers[parent])) {
+            break;
+        }
+        timer_heap_set(timer_list, i, timer_list->active_timers[parent]);
+        i = parent;
+    }
+    timer_heap_set(timer_list, i, ts);
+}
+
+static void timer_heap_sift_down(QEMUTimerList *timer_list, size_t i)
+{
+    QEMUTimer *ts = timer_list->active_timers[i];
+    size_t n = timer_list->nr_active_timers;
+
+    for (;;) {
+        size_t child = 2 * i + 1;
+
+        if (child >= n) {
+            break;
+        }
+        if (child + 1 < n &&
+            timer_before(timer_list->active_timers[child + 1],
+                         timer_list->active_timers[child])) {
+            child++;
+        }
+        if (!timer_before(timer_list->active_timers[child], ts)) {
+            break;
+        }
+        timer_heap_set(timer_list, i, timer_list->active_timers[child]);
+        i = child;
+    }
+    timer_heap_set(timer_list, i, ts);
+}
+
+/*
+ * Find the first timer in the subtree rooted at @i whose attributes are
+ * all in @attr_mask.  A subtree never holds a timer that expires before
+ * its root, so the search stops descending at the first match and at
+ * any root that is not earlier than the best match found so far.
+ */
+static void timer_heap_find(QEMUTimerList *timer_list, size_t i,
+                            int attr_mask, QEMUTimer **best)
+{
+    QEMUTimer *ts;
+
+    if (i >= timer_list->nr_active_timers) {
+        return;
+    }
+    ts = timer_list->active_timers[i];
+    if (*best && !timer_before(ts, *best)) {
+        return;
+    }
+    if (!(ts->attributes & ~attr_mask)) {
+        *best = ts;
+        return;
+    }
+    timer_heap_find(timer_list, 2 * i + 1, attr_mask, best);
+    timer_heap_find(timer_list, 2 * i + 2, attr_mask, best);
+}
+
 QEMUTimerList *timerlist_new(QEMUClockType type,
                              QEMUTimerListNotifyCB *cb,
                              void *opaque)
@@ -118,6 +212,7 @@ void timerlist_free(QEMUTimerList *timer_list)
         QLIST_REMOVE(timer_list, list);
     }
     qemu_mutex_destroy(&timer_list->active_timers_lock);
+    g_free(timer_list->active_timers);
     g_free(timer_list);
 }
 
@@ -172,7 +267,7 @@ void qemu_clock_enable(QEMUClockType type, bool enabled)
 
 bool timerlist_has_timers(QEMUTimerList *timer_list)
 {
-    return !!qatomic_read(&timer_list->active_timers);
+    return !!qatomic_read(&timer_list->nr_active_timers);
 }
 
 bool qemu_clock_has_timers(QEMUClockType type)
@@ -185,15 +280,15 @@ bool timerlist_expired(QEMUTimerList *timer_list)
 {
     int64_t expire_time = 0;
 
-    if (!qatomic_read(&timer_list->active_timers)) {
+    if (!qatomic_read(&timer_list->nr_active_timers)) {
         return false;
     }
 
     WITH_QEMU_LOCK_GUARD(&timer_list->active_timers_lock) {
-        if (!timer_list->active_timers) {
+        if (!timer_list->nr_active_timers) {
             return false;
         }
-        expire_time = timer_list->active_timers->expire_time;
+        expire_time = timerlist_first(timer_list)->expire_time;
     }
 
     return expire_time <= qemu_clock_get_ns(timer_list->clock->type);
@@ -215,7 +310,7 @@ int64_t timerlist_deadline_ns(QEMUTimerList *timer_list)
     int64_t delta;
     int64_t expire_time = 0;
 
-    if (!qatomic_read(&timer_list->active_timers)) {
+    if (!qatomic_read(&timer_list->nr_active_timers)) {
         return -1;
     }
 
@@ -228,10 +323,10 @@ int64_t timerlist_deadline_ns(QEMUTimerList *timer_list)
      * the caller should notice the change and there is no race condition.
      */
     WITH_QEMU_LOCK_GUARD(&timer_list->active_timers_lock) {
-        if (!timer_list->active_timers) {
+        if (!timer_list->nr_active_timers) {
             return -1;
         }
-        expire_time = timer_list->active_timers->expire_time;
+        expire_time = timerlist_first(timer_list)->expire_time;
     }
 
     delta = expire_time - qemu_clock_get_ns(timer_list->clock->type);
@@ -262,15 +357,13 @@ int64_t qemu_clock_deadline_ns_all(QEMUClockType type, int attr_mask)
     }
 
     QLIST_FOREACH(timer_list, &clock->timerlists, list) {
-        if (!qatomic_read(&timer_list->active_timers)) {
+        if (!qatomic_read(&timer_list->nr_active_timers)) {
             continue;
         }
         qemu_mutex_lock(&timer_list->active_timers_lock);
-        ts = timer_list->active_timers;
         /* Skip all external timers */
-        while (ts && (ts->attributes & ~attr_mask)) {
-            ts = ts->next;
-        }
+        ts = NULL;
+        timer_heap_find(timer_list, 0, attr_mask, &ts);
         if (!ts) {
             qemu_mutex_unlock(&timer_list->active_timers_lock);
             continue;
@@ -371,41 +464,53 @@ void timer_deinit(QEMUTimer *ts)
 
 static void timer_del_locked(QEMUTimerList *timer_list, QEMUTimer *ts)
 {
-    QEMUTimer **pt, *t;
+    size_t i = ts->heap_index;
+    size_t n;
+    QEMUTimer *last;
 
+    /* Only armed timers are in the heap */
+    if (ts->expire_time == -1) {
+        return;
+    }
     ts->expire_time = -1;
-    pt = &timer_list->active_timers;
-    for(;;) {
-        t = *pt;
-        if (!t)
-            break;
-        if (t == ts) {
-            qatomic_set(pt, t->next);
-            break;
-        }
-        pt = &t->next;
+
+    assert(timer_list->active_timers[i] == ts);
+    n = timer_list->nr_active_timers - 1;
+    qatomic_set(&timer_list->nr_active_timers, n);
+    if (i == n) {
+        return;
+    }
+
+    /* Fill the hole with the last leaf and restore the heap order */
+    last = timer_list->active_timers[n];
+    timer_heap_set(timer_list, i, last);
+    if (i > 0 && timer_before(last, timer_list->active_timers[(i - 1) / 2])) {
+        timer_heap_sift_up(timer_list, i);
+    } else {
+        timer_heap_sift_down(timer_list, i);
     }
 }
 
 static bool timer_mod_ns_locked(QEMUTimerList *timer_list,
                                 QEMUTimer *ts, int64_t expire_time)
 {
-    QEMUTimer **pt, *t;
+    size_t n = timer_list->nr_active_timers;
 
-    /* add the timer in the sorted list */
-    pt = &timer_list->active_timers;
-    for (;;) {
-        t = *pt;
-        if (!timer_expired_ns(t, expire_time)) {
-            break;
-        }
-        pt = &t->next;
+    if (n == timer_list->max_active_timers) {
+        timer_list->max_active_timers = MAX(16, n * 2);
+        timer_list->active_timers = g_renew(QEMUTimer *,
+                                            timer_list->active_timers,
+                                            timer_list->max_active_timers);
     }
+
+    /* add the timer to the heap */
     ts->expire_time = MAX(expire_time, 0);
-    ts->next = *pt;
-    qatomic_set(pt, ts);
+    ts->seq = timer_list->timer_seq++;
+    timer_list->active_timers[n] = ts;
+    qatomic_set(&timer_list->nr_active_timers, n + 1);
+    timer_heap_sift_up(timer_list, n);
 
-    return pt == &timer_list->active_timers;
+    return ts->heap_index == 0;
 }
 
 static void timerlist_rearm(QEMUTimerList *timer_list)
@@ -493,7 +598,7 @@ bool timerlist_run_timers(QEMUTimerList *timer_list)
     QEMUTimerCB *cb;
     void *opaque;
 
-    if (!qatomic_read(&timer_list->active_timers)) {
+    if (!qatomic_read(&timer_list->nr_active_timers)) {
         return false;
     }
 
@@ -532,7 +637,7 @@ bool timerlist_run_timers(QEMUTimerList *timer_list)
      */
     current_time = qemu_clock_get_ns(timer_list->clock->type);
     qemu_mutex_lock(&timer_list->active_timers_lock);
-    while ((ts = timer_list->active_timers)) {
+    while ((ts = timerlist_first(timer_list))) {
         if (!timer_expired_ns(ts, current_time)) {
             /* No expired timers left.  The checkpoint can be skipped
              * if no timers fired or they were all external.
@@ -552,9 +657,7 @@ bool timerlist_run_timers(QEMUTimerList *timer_list)
         }
 
         /* remove timer from the list before calling the callback */
-        timer_list->active_timers = ts->next;
-        ts->next = NULL;
-        ts->expire_time = -1;
+        timer_del_locked(timer_list, ts);
         cb = ts->cb;
         opaque = ts->opaque;
 
@@ -22,8 +22,8 @@
  * - Writes (i.e. insertions/removals) can be concurrent with writes to
  *   different buckets; writes to the same bucket are serialized through a lock.
  * - Optional auto-resizing: the hash table resizes up if the load surpasses
- *   a certain threshold. Resizing is done concurrently with readers; writes
- *   are serialized with the resize operation.
+ *   a certain threshold. Resizing is done concurrently with both readers and
+ *   writers; writes are only serialized with the migration of their bucket.
  *
  * The key structure is the bucket, which is cacheline-sized. Buckets
  * contain a few hash values and pointers; the u32 hash values are stored in
@@ -43,14 +43,29 @@
  * just-removed entry. This makes lookups slightly faster, since the moment an
  * invalid entry is found, the (failed) lookup is over.
  *
- * Resizing is done by taking all bucket spinlocks (so that no other writers can
- * race with us) and then copying all entries into a new hash map. Then, the
- * ht->map pointer is set, and the old map is freed once no RCU readers can see
- * it anymore.
+ * Resizing is incremental. The resizer publishes a new, empty map that points
+ * to the old one through new->old, and buckets are then migrated one at a
+ * time: the old bucket is locked, its entries are inserted into the new map
+ * and the old bucket is emptied and flagged as migrated. Before touching a
+ * bucket of the new map, writers migrate the old bucket(s) that can hold
+ * entries for the same hash, plus a small batch of other buckets so that the
+ * resize eventually completes even if some old buckets are never written to.
+ * Whoever migrates the last bucket frees the old map once no RCU readers can
+ * see it anymore; writers therefore walk the old map, and the statistics
+ * code reads it, inside an RCU read-side critical section. Only a single old
+ * map is live at any time: starting a new resize first completes the
+ * migration of the previous one.
+ *
+ * While a migration is in progress, lookups check the old bucket first and
+ * then the new one. Entries only ever move from the old map to the new one,
+ * and they are inserted into the new map before being removed from the old
+ * map, so a lookup that misses in the old bucket is guaranteed to see the
+ * entry in the new bucket. A lookup that misses in both maps re-reads ht->map
+ * to make sure that no newer resize has emptied the buckets it looked at.
  *
  * Writers check for concurrent resizes by comparing ht->map before and after
- * acquiring their bucket lock. If they don't match, a resize has occurred
- * while the bucket spinlock was being acquired.
+ * acquiring their bucket lock, and by checking that the bucket has not been
+ * migrated to a newer map while they were waiting for the lock.
  *
  * Related Work:
  * - Idea of cacheline-sized buckets with full hashes taken from:
@@ -155,8 +170,9 @@ QEMU_BUILD_BUG_ON(sizeof(struct qht_bucket) > QHT_BUCKET_ALIGN);
  * Under TSAN, we use striped locks instead of one lock per bucket chain.
  * This avoids crashing under TSAN, since TSAN aborts the program if more than
  * 64 locks are held (this is a hardcoded limit in TSAN).
- * When resizing a QHT we grab all the buckets' locks, which can easily
- * go over TSAN's limit. By using striped locks, we avoid this problem.
+ * When resetting or iterating over a QHT we grab all the buckets' locks, which
+ * can easily go over TSAN's limit. By using striped locks, we avoid this
+ * problem.
  *
  * Note: this number must be a power of two for easy index computation.
  */
@@ -176,6 +192,11 @@ struct qht_tsan_lock {
  * @n_added_buckets: number of added (i.e. "non-head") buckets
  * @n_added_buckets_threshold: threshold to trigger an upward resize once the
  *                             number of added buckets surpasses it.
+ * @old: map whose entries are being migrated into this one, or NULL.
+ * @migrated: per-bucket flags, set once a bucket has been migrated to the
+ *            next map. NULL unless this map is the old map of a resize.
+ * @n_migrated: number of buckets that have been migrated to the next map.
+ * @migrate_next: next bucket to be migrated by writers helping with a resize.
  * @tsan_bucket_locks: Array of striped locks to be used only under TSAN.
  *
  * Buckets are tracked in what we call a "map", i.e. this structure.
@@ -186,6 +207,10 @@ struct qht_map {
     size_t n_buckets;
     size_t n_added_buckets;
     size_t n_added_buckets_threshold;
+    struct qht_map *old;
+    bool *migrated;
+    size_t n_migrated;
+    size_t migrate_next;
 #ifdef CONFIG_TSAN
     struct qht_tsan_lock tsan_bucket_locks[QHT_TSAN_BUCKET_LOCKS];
 #endif
@@ -194,9 +219,21 @@ struct qht_map {
 /* trigger a resize when n_added_buckets > n_buckets / div */
 #define QHT_NR_ADDED_BUCKETS_THRESHOLD_DIV 8
 
-static void qht_do_resize_reset(struct qht *ht, struct qht_map *new,
-                                bool reset);
+/*
+ * Number of old buckets that each write migrates on top of its own bucket
+ * while a resize is in progress. A doubled map needs n_buckets / 8 added
+ * buckets to grow again, i.e. at least that many insertions, and by then a
+ * batch of this size has completed the migration of its n_buckets / 2 old
+ * buckets.
+ */
+#define QHT_MIGRATE_BATCH 8
+
+static void qht_do_resize(struct qht *ht, struct qht_map *new);
+static void qht_do_resize_and_reset(struct qht *ht, struct qht_map *new);
 static void qht_grow_maybe(struct qht *ht);
+static void qht_map_migrate_maybe(struct qht *ht, struct qht_map *map,
+                                  uint32_t hash);
+static void qht_map_migrate_all__htlocked(struct qht *ht, struct qht_map *map);
 
 #ifdef QHT_DEBUG
 
@@ -332,50 +369,32 @@ static void qht_map_unlock_buckets(struct qht_map *map)
 }
 
 /*
- * Call with at least a bucket lock held.
- * @map should be the value read before acquiring the lock (or locks).
- */
-static inline bool qht_map_is_stale__locked(const struct qht *ht,
-                                            const struct qht_map *map)
-{
-    return map != ht->map;
-}
-
-/*
- * Grab all bucket locks, and set @pmap after making sure the map isn't stale.
- *
- * Pairs with qht_map_unlock_buckets(), hence the pass-by-reference.
+ * Call with @b's lock held.
+ * @map should be the value read before acquiring the lock.
  *
- * Note: callers cannot have ht->lock held.
+ * Resets swap ht->map with all bucket locks held, while migrations flag the
+ * bucket under its lock; either way, a stale map is detected here.
  */
-static inline
-void qht_map_lock_buckets__no_stale(struct qht *ht, struct qht_map **pmap)
+static inline bool qht_map_is_stale__locked(const struct qht *ht,
+                                            const struct qht_map *map,
+                                            const struct qht_bucket *b)
 {
-    struct qht_map *map;
+    bool *migrated;
 
-    map = qatomic_rcu_read(&ht->map);
-    qht_map_lock_buckets(map);
-    if (likely(!qht_map_is_stale__locked(ht, map))) {
-        *pmap = map;
-        return;
+    if (map != qatomic_read(&ht->map)) {
+        return true;
     }
-    qht_map_unlock_buckets(map);
-
-    /* we raced with a resize; acquire ht->lock to see the updated ht->map */
-    qht_lock(ht);
-    map = ht->map;
-    qht_map_lock_buckets(map);
-    qht_unlock(ht);
-    *pmap = map;
+    migrated = qatomic_load_acquire(&map->migrated);
+    return migrated && migrated[b - map->buckets];
 }
 
 /*
  * Get a head bucket and lock it, making sure its parent map is not stale.
+ * If a resize is in progress, the entries for @hash are migrated to the new
+ * map first.
  * @pmap is filled with a pointer to the bucket's parent map.
  *
  * Unlock with qht_bucket_unlock.
- *
- * Note: callers cannot have ht->lock held.
  */
 static inline
 struct qht_bucket *qht_bucket_lock__no_stale(struct qht *ht, uint32_t hash,
@@ -384,24 +403,21 @@ struct qht_bucket *qht_bucket_lock__no_stale(struct qht *ht, uint32_t hash,
     struct qht_bucket *b;
     struct qht_map *map;
 
-    map = qatomic_rcu_read(&ht->map);
-    b = qht_map_to_bucket(map, hash);
+    for (;;) {
+        map = qatomic_rcu_read(&ht->map);
+        if (unlikely(qatomic_read(&map->old))) {
+            qht_map_migrate_maybe(ht, map, hash);
+        }
+        b = qht_map_to_bucket(map, hash);
 
-    qht_bucket_lock(map, b);
-    if (likely(!qht_map_is_stale__locked(ht, map))) {
-        *pmap = map;
-        return b;
+        qht_bucket_lock(map, b);
+        if (likely(!qht_map_is_stale__locked(ht, map, b))) {
+            *pmap = map;
+            return b;
+        }
+        /* we raced with a resize; try again with the updated ht->map */
+        qht_bucket_unlock(map, b);
     }
-    qht_bucket_unlock(map, b);
-
-    /* we raced with a resize; acquire ht->lock to see the updated ht->map */
-    qht_lock(ht);
-    map = ht->map;
-    b = qht_map_to_bucket(map, hash);
-    qht_bucket_lock(map, b);
-    qht_unlock(ht);
-    *pmap = map;
-    return b;
 }
 
 static inline bool qht_map_needs_resize(const struct qht_map *map)
@@ -433,6 +449,7 @@ static void qht_map_destroy(struct qht_map *map)
         qht_chain_destroy(map, &map->buckets[i]);
     }
     qemu_vfree(map->buckets);
+    g_free(map->migrated);
     g_free(map);
 }
 
@@ -445,6 +462,10 @@ static struct qht_map *qht_map_create(size_t n_buckets)
     map->n_buckets = n_buckets;
 
     map->n_added_buckets = 0;
+    map->old = NULL;
+    map->migrated = NULL;
+    map->n_migrated = 0;
+    map->migrate_next = 0;
     map->n_added_buckets_threshold = n_buckets /
         QHT_NR_ADDED_BUCKETS_THRESHOLD_DIV;
 
@@ -478,6 +499,9 @@ void qht_init(struct qht *ht, qht_cmp_func_t cmp, size_t n_elems,
 /* call only when there are no readers/writers left */
 void qht_destroy(struct qht *ht)
 {
+    if (ht->map->old) {
+        qht_map_destroy(ht->map->old);
+    }
     qht_map_destroy(ht->map);
     memset(ht, 0, sizeof(*ht));
 }
@@ -515,21 +539,9 @@ static void qht_map_reset__all_locked(struct qht_map *map)
 
 void qht_reset(struct qht *ht)
 {
-    struct qht_map *map;
-
-    qht_map_lock_buckets__no_stale(ht, &map);
-    qht_map_reset__all_locked(map);
-    qht_map_unlock_buckets(map);
-}
-
-static inline void qht_do_resize(struct qht *ht, struct qht_map *new)
-{
-    qht_do_resize_reset(ht, new, false);
-}
-
-static inline void qht_do_resize_and_reset(struct qht *ht, struct qht_map *new)
-{
-    qht_do_resize_reset(ht, new, true);
+    qht_lock(ht);
+    qht_do_resize_and_reset(ht, NULL);
+    qht_unlock(ht);
 }
 
 bool qht_reset_size(struct qht *ht, size_t n_elems)
@@ -592,17 +604,14 @@ void *qht_lookup__slowpath(const struct qht_bucket *b, qht_lookup_func_t func,
     return ret;
 }
 
-void *qht_lookup_custom(const struct qht *ht, const void *userp, uint32_t hash,
-                        qht_lookup_func_t func)
+static inline
+void *qht_map_lookup(const struct qht_map *map, qht_lookup_func_t func,
+                     const void *userp, uint32_t hash)
 {
-    const struct qht_bucket *b;
-    const struct qht_map *map;
+    const struct qht_bucket *b = qht_map_to_bucket(map, hash);
     unsigned int version;
     void *ret;
 
-    map = qatomic_rcu_read(&ht->map);
-    b = qht_map_to_bucket(map, hash);
-
     version = seqlock_read_begin(&b->sequence);
     ret = qht_do_lookup(b, func, userp, hash);
     if (likely(!seqlock_read_retry(&b->sequence, version))) {
@@ -615,6 +624,40 @@ void *qht_lookup_custom(const struct qht *ht, const void *userp, uint32_t hash,
     return qht_lookup__slowpath(b, func, userp, hash);
 }
 
+void *qht_lookup_custom(const struct qht *ht, const void *userp, uint32_t hash,
+                        qht_lookup_func_t func)
+{
+    const struct qht_map *map;
+    const struct qht_map *old;
+    void *ret;
+
+    map = qatomic_rcu_read(&ht->map);
+    for (;;) {
+        /* entries move from @old to @map, so look them up in that order */
+        old = qatomic_rcu_read(&map->old);
+        if (unlikely(old)) {
+            ret = qht_map_lookup(old, func, userp, hash);
+            if (ret) {
+                return ret;
+            }
+        }
+        ret = qht_map_lookup(map, func, userp, hash);
+        if (likely(ret)) {
+            return ret;
+        }
+        /*
+         * A miss is only valid if no resize has started migrating entries
+         * out of @map in the meantime. Pairs with the seqlock write in
+         * qht_map_migrate_bucket(), which happens after the new map is set.
+         */
+        smp_rmb();
+        if (likely(qatomic_read(&ht->map) == map)) {
+            return NULL;
+        }
+        map = qatomic_rcu_read(&ht->map);
+    }
+}
+
 void *qht_lookup(const struct qht *ht, const void *userp, uint32_t hash)
 {
     return qht_lookup_custom(ht, userp, hash, ht->cmp);
@@ -682,8 +725,12 @@ static __attribute__((noinline)) void qht_grow_maybe(struct qht *ht)
         return;
     }
     map = ht->map;
-    /* another thread might have just performed the resize we were after */
-    if (qht_map_needs_resize(map)) {
+    /*
+     * Another thread might have just performed the resize we were after.
+     * Also let writers finish migrating the previous resize before starting
+     * another one; the next insertion that needs a new bucket will retry.
+     */
+    if (qht_map_needs_resize(map) && !qatomic_read(&map->old)) {
         struct qht_map *new = qht_map_create(map->n_buckets * 2);
 
         qht_do_resize(ht, new);
@@ -866,13 +913,22 @@ static inline void qht_map_iter__all_locked(struct qht_map *map,
     }
 }
 
-static inline void
-do_qht_iter(struct qht *ht, const struct qht_iter *iter, void *userp)
+static inline
+void do_qht_iter(struct qht *ht, const struct qht_iter *iter, void *userp)
 {
     struct qht_map *map;
 
-    map = qatomic_rcu_read(&ht->map);
+    /*
+     * Holding ht->lock, complete any pending resize so that all entries are
+     * in @map. Once all of its buckets are locked, a concurrent resize will
+     * not be able to migrate entries out of @map until we are done.
+     */
+    qht_lock(ht);
+    map = ht->map;
+    qht_map_migrate_all__htlocked(ht, map);
     qht_map_lock_buckets(map);
+    qht_unlock(ht);
+
     qht_map_iter__all_locked(map, iter, userp);
     qht_map_unlock_buckets(map);
 }
@@ -909,29 +965,139 @@ static void qht_map_copy(void *p, uint32_t hash, void *userp)
     struct qht_map *new = data->new;
     struct qht_bucket *b = qht_map_to_bucket(new, hash);
 
-    /* no need to acquire b->lock because no thread has seen this map yet */
+    /* writers might be using the new map already */
+    qht_bucket_lock(new, b);
     qht_insert__locked(ht, new, b, p, hash, NULL);
+    qht_bucket_unlock(new, b);
+}
+
+/* free @old once @map no longer needs it; safe to call more than once */
+static void qht_map_retire_old(struct qht_map *map, struct qht_map *old)
+{
+    if (qatomic_cmpxchg(&map->old, old, NULL) == old) {
+        call_rcu(old, qht_map_destroy, rcu);
+    }
 }
 
 /*
- * Atomically perform a resize and/or reset.
- * Call with ht->lock held.
+ * Move the entries in bucket @idx of @old to @map, unless another thread
+ * has done so already. The old bucket lock is taken before the new one;
+ * writers never hold a bucket lock while migrating, so this can't deadlock.
+ *
+ * Returns true if this completed the migration of @old.
  */
-static void qht_do_resize_reset(struct qht *ht, struct qht_map *new, bool reset)
+static bool qht_map_migrate_bucket(struct qht *ht, struct qht_map *map,
+                                   struct qht_map *old, size_t idx)
 {
-    struct qht_map *old;
+    struct qht_bucket *head = &old->buckets[idx];
     const struct qht_iter iter = {
         .f.retvoid = qht_map_copy,
         .type = QHT_ITER_VOID,
     };
-    struct qht_map_copy_data data;
+    struct qht_map_copy_data data = {
+        .ht = ht,
+        .new = map,
+    };
 
-    old = ht->map;
-    qht_map_lock_buckets(old);
+    if (qatomic_load_acquire(&old->migrated[idx])) {
+        return false;
+    }
+    qht_bucket_lock(old, head);
+    if (old->migrated[idx]) {
+        qht_bucket_unlock(old, head);
+        return false;
+    }
+    qht_bucket_iter(head, &iter, &data);
+    /* lookups that miss in the emptied bucket will find the entries in @map */
+    qht_bucket_reset__locked(head);
+    qatomic_store_release(&old->migrated[idx], true);
+    qht_bucket_unlock(old, head);
+
+    return qatomic_fetch_inc(&old->n_migrated) + 1 == old->n_buckets;
+}
+
+/*
+ * Help with an ongoing resize: migrate the old bucket that @hash maps to, so
+ * that all entries for @hash are in @map, plus a batch of other buckets so
+ * that the old map is eventually freed.
+ */
+static __attribute__((noinline))
+void qht_map_migrate_maybe(struct qht *ht, struct qht_map *map, uint32_t hash)
+{
+    struct qht_map *old;
+    bool done;
+    size_t start;
+    size_t i;
 
-    if (reset) {
-        qht_map_reset__all_locked(old);
+    /* another writer may retire @old while we are migrating its buckets */
+    RCU_READ_LOCK_GUARD();
+    old = qatomic_rcu_read(&map->old);
+    if (old == NULL) {
+        return;
+    }
+    done = qht_map_migrate_bucket(ht, map, old, hash & (old->n_buckets - 1));
+    if (qatomic_read(&old->migrate_next) < old->n_buckets) {
+        start = qatomic_fetch_add(&old->migrate_next, QHT_MIGRATE_BATCH);
+        for (i = start; i < MIN(start + QHT_MIGRATE_BATCH, old->n_buckets);
+             i++) {
+            done |= qht_map_migrate_bucket(ht, map, old, i);
+        }
+    }
+    if (done) {
+        qht_map_retire_old(map, old);
     }
+}
+
+/*
+ * Complete the migration of @map's old map, if any.
+ * Call with ht->lock held, so that no other resize can start meanwhile.
+ */
+static void qht_map_migrate_all__htlocked(struct qht *ht, struct qht_map *map)
+{
+    struct qht_map *old;
+    size_t i;
+
+    RCU_READ_LOCK_GUARD();
+    old = qatomic_rcu_read(&map->old);
+    if (old == NULL) {
+        return;
+    }
+    for (i = 0; i < old->n_buckets; i++) {
+        qht_map_migrate_bucket(ht, map, old, i);
+    }
+    qht_map_retire_old(map, old);
+}
+
+/*
+ * Start a resize: publish @new, whose buckets are then filled in lazily
+ * by writers or by qht_map_migrate_all__htlocked().
+ * Call with ht->lock held.
+ */
+static void qht_do_resize(struct qht *ht, struct qht_map *new)
+{
+    struct qht_map *old = ht->map;
+
+    /* only one resize can be in flight */
+    qht_map_migrate_all__htlocked(ht, old);
+
+    g_assert(new->n_buckets != old->n_buckets);
+    /* pairs with qatomic_load_acquire() in qht_map_is_stale__locked() */
+    qatomic_store_release(&old->migrated, g_new0(bool, old->n_buckets));
+    new->old = old;
+    qatomic_rcu_set(&ht->map, new);
+}
+
+/*
+ * Atomically perform a reset, and optionally a resize to an empty @new.
+ * Call with ht->lock held.
+ */
+static void qht_do_resize_and_reset(struct qht *ht, struct qht_map *new)
+{
+    struct qht_map *old = ht->map;
+
+    qht_map_migrate_all__htlocked(ht, old);
+    qht_map_lock_buckets(old);
+    qht_map_reset__all_locked(old);
 
     if (new == NULL) {
         qht_map_unlock_buckets(old);
@@ -939,11 +1105,6 @@ static void qht_do_resize_reset(struct qht *ht, struct qht_map *new, bool reset)
     }
 
     g_assert(new->n_buckets != old->n_buckets);
-    data.ht = ht;
-    data.new = new;
-    qht_map_iter__all_locked(old, &iter, &data);
-    qht_map_debug__all_locked(new);
-
     qatomic_rcu_set(&ht->map, new);
     qht_map_unlock_buckets(old);
     call_rcu(old, qht_map_destroy, rcu);
@@ -960,6 +1121,8 @@ bool qht_resize(struct qht *ht, size_t n_elems)
 
         new = qht_map_create(n_buckets);
         qht_do_resize(ht, new);
+        /* writers keep going, only waiting for the bucket being migrated */
+        qht_map_migrate_all__htlocked(ht, new);
         ret = true;
     }
     qht_unlock(ht);
@@ -967,12 +1130,52 @@ bool qht_resize(struct qht *ht, size_t n_elems)
     return ret;
 }
 
-/* pass @stats to qht_statistics_destroy() when done */
+static void qht_bucket_count(const struct qht_bucket *head, size_t *pbuckets,
+                             size_t *pentries)
+{
+    const struct qht_bucket *b;
+    unsigned int version;
+    size_t buckets;
+    size_t entries;
+    int j;
+
+    do {
+        version = seqlock_read_begin(&head->sequence);
+        buckets = 0;
+        entries = 0;
+        b = head;
+        do {
+            for (j = 0; j < QHT_BUCKET_ENTRIES; j++) {
+                if (qatomic_read(&b->pointers[j]) == NULL) {
+                    break;
+                }
+                entries++;
+            }
+            buckets++;
+            b = qatomic_rcu_read(&b->next);
+        } while (b);
+    } while (seqlock_read_retry(&head->sequence, version));
+
+    *pbuckets = buckets;
+    *pentries = entries;
+}
+
+/*
+ * pass @stats to qht_statistics_destroy() when done
+ *
+ * Entries that have yet to be migrated by an ongoing resize are included in
+ * @stats->entries, but not in the bucket statistics. Entries might be counted
+ * twice or not at all if they are migrated while we look at the buckets.
+ */
 void qht_statistics_init(const struct qht *ht, struct qht_stats *stats)
 {
     const struct qht_map *map;
+    const struct qht_map *old;
+    size_t buckets;
+    size_t entries;
     int i;
 
+    RCU_READ_LOCK_GUARD();
     map = qatomic_rcu_read(&ht->map);
 
     stats->used_head_buckets = 0;
@@ -986,31 +1189,16 @@ void qht_statistics_init(const struct qht *ht, struct qht_stats *stats)
     }
     stats->head_buckets = map->n_buckets;
 
-    for (i = 0; i < map->n_buckets; i++) {
-        const struct qht_bucket *head = &map->buckets[i];
-        const struct qht_bucket *b;
-        unsigned int version;
-        size_t buckets;
-        size_t entries;
-        int j;
-
-        do {
-            version = seqlock_read_begin(&head->sequence);
-            buckets = 0;
-            entries = 0;
-            b = head;
-            do {
-                for (j = 0; j < QHT_BUCKET_ENTRIES; j++) {
-                    if (qatomic_read(&b->pointers[j]) == NULL) {
-                        break;
-                    }
-                    entries++;
-                }
-                buckets++;
-                b = qatomic_rcu_read(&b->next);
-            } while (b);
-        } while (seqlock_read_retry(&head->sequence, version));
+    old = qatomic_rcu_read(&map->old);
+    if (unlikely(old)) {
+        for (i = 0; i < old->n_buckets; i++) {
+            qht_bucket_count(&old->buckets[i], &buckets, &entries);
+            stats->entries += entries;
+        }
+    }
 
+    for (i = 0; i < map->n_buckets; i++) {
+        qht_bucket_count(&map->buckets[i], &buckets, &entries);
         if (entries) {
             qdist_inc(&stats->chain, buckets);
             qdist_inc(&stats->occupancy,
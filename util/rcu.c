@@ -32,6 +32,7 @@
 #include "qemu/thread.h"
 #include "qemu/main-loop.h"
 #include "qemu/lockable.h"
+#include "qemu/timer.h"
 #if defined(CONFIG_MALLOC_TRIM)
 #include <malloc.h>
 #endif
@@ -176,96 +177,145 @@ void synchronize_rcu(void)
 
 #define RCU_CALL_MIN_SIZE        30
 
-/* Multi-producer, single-consumer queue based on urcu/static/wfqueue.h
- * from liburcu.  Note that head is only used by the consumer.
+/*
+ * Callbacks are queued on a per-thread list, so that call_rcu1() never
+ * bounces a shared cache line between the threads that retire objects.
+ * The lock is only ever contended by the call_rcu thread when it splices
+ * the list into the next batch.
+ *
+ * A queue is created the first time a thread calls call_rcu1(), and
+ * freed by the call_rcu thread once its owner has exited and the list
+ * is empty.
+ */
+typedef struct RCUCallQueue {
+    QemuSpin lock;
+    struct rcu_head *head;
+    struct rcu_head **tail;
+    int count;
+    bool dead;
+    Notifier exit_notifier;
+    QSLIST_ENTRY(RCUCallQueue) next;
+} RCUCallQueue;
+
+QEMU_DEFINE_STATIC_CO_TLS(RCUCallQueue *, rcu_call_queue)
+
+/* Protects rcu_call_queues and rcu_call_stats.  */
+static QemuMutex rcu_call_lock;
+static QSLIST_HEAD(, RCUCallQueue) rcu_call_queues =
+    QSLIST_HEAD_INITIALIZER(rcu_call_queues);
+static RCUCallStats rcu_call_stats;
+
+/*
+ * Number of callbacks that were queued but not yet collected.  Incremented
+ * under the lock of the queue, so that it never goes below zero.
  */
-static struct rcu_head dummy;
-static struct rcu_head *head = &dummy, **tail = &dummy.next;
 static int rcu_call_count;
 static QemuEvent rcu_call_ready_event;
 
-static void enqueue(struct rcu_head *node)
+static void rcu_call_queue_exit(Notifier *n, void *unused)
 {
-    struct rcu_head **old_tail;
-
-    node->next = NULL;
+    RCUCallQueue *q = container_of(n, RCUCallQueue, exit_notifier);
 
-    /*
-     * Make this node the tail of the list.  The node will be
-     * used by further enqueue operations, but it will not
-     * be dequeued yet...
-     */
-    old_tail = qatomic_xchg(&tail, &node->next);
-
-    /*
-     * ... until it is pointed to from another item in the list.
-     * In the meantime, try_dequeue() will find a NULL next pointer
-     * and loop.
-     *
-     * Synchronizes with qatomic_load_acquire() in try_dequeue().
-     */
-    qatomic_store_release(old_tail, node);
+    set_rcu_call_queue(NULL);
+    qatomic_store_release(&q->dead, true);
 }
 
-static struct rcu_head *try_dequeue(void)
+static RCUCallQueue *rcu_call_queue_get(void)
 {
-    struct rcu_head *node, *next;
+    RCUCallQueue *q = get_rcu_call_queue();
+
+    if (unlikely(!q)) {
+        q = g_new0(RCUCallQueue, 1);
+        qemu_spin_init(&q->lock);
+        q->tail = &q->head;
+        q->exit_notifier.notify = rcu_call_queue_exit;
+        qemu_thread_atexit_add(&q->exit_notifier);
+
+        WITH_QEMU_LOCK_GUARD(&rcu_call_lock) {
+            QSLIST_INSERT_HEAD(&rcu_call_queues, q, next);
+            rcu_call_stats.queues++;
+        }
+        set_rcu_call_queue(q);
+    }
+    return q;
+}
 
-retry:
-    /* Head is only written by this thread, so no need for barriers.  */
-    node = head;
+/*
+ * Append the callbacks of all threads to *tail, and free the queues of
+ * the threads that have exited.  Callbacks from the same thread stay in
+ * the order in which they were queued.
+ */
+static struct rcu_head **rcu_call_splice(struct rcu_head **tail, int *n)
+{
+    RCUCallQueue *q, *prev = NULL, *tmp;
+
+    QSLIST_FOREACH_SAFE(q, &rcu_call_queues, next, tmp) {
+        bool dead = qatomic_load_acquire(&q->dead);
+
+        qemu_spin_lock(&q->lock);
+        if (q->head) {
+            *tail = q->head;
+            tail = q->tail;
+            *n += q->count;
+            q->head = NULL;
+            q->tail = &q->head;
+            q->count = 0;
+        }
+        qemu_spin_unlock(&q->lock);
 
-    /*
-     * If the head node has NULL in its next pointer, the value is
-     * wrong and we need to wait until its enqueuer finishes the update.
-     */
-    next = qatomic_load_acquire(&node->next);
-    if (!next) {
-        return NULL;
+        /*
+         * The owner does not queue callbacks after setting q->dead, so
+         * the list that was just spliced was the last one.
+         */
+        if (dead) {
+            if (prev) {
+                QSLIST_REMOVE_AFTER(prev, next);
+            } else {
+                QSLIST_REMOVE_HEAD(&rcu_call_queues, next);
+            }
+            rcu_call_stats.queues--;
+            g_free(q);
+        } else {
+            prev = q;
+        }
     }
+    return tail;
+}
 
-    /*
-     * Test for an empty list, which we do not expect.  Note that for
-     * the consumer head and tail are always consistent.  The head
-     * is consistent because only the consumer reads/writes it.
-     * The tail, because it is the first step in the enqueuing.
-     * It is only the next pointers that might be inconsistent.
-     */
-    if (head == &dummy && qatomic_read(&tail) == &dummy.next) {
-        abort();
-    }
+static struct rcu_head *rcu_call_collect(int *n)
+{
+    struct rcu_head *batch = NULL, **tail = &batch;
+
+    *n = 0;
+    QEMU_LOCK_GUARD(&rcu_call_lock);
+    tail = rcu_call_splice(tail, n);
 
     /*
-     * Since we are the sole consumer, and we excluded the empty case
-     * above, the queue will always have at least two nodes: the
-     * dummy node, and the one being removed.  So we do not need to update
-     * the tail pointer.
+     * The queues are not all spliced at the same instant, so the batch
+     * may include drain_call_rcu()'s callback but miss callbacks that
+     * another thread queued just before it, on a queue that had already
+     * been visited.  Another pass picks those up.
      */
-    head = next;
-
-    /* If we dequeued the dummy node, add it back at the end and retry.  */
-    if (node == &dummy) {
-        enqueue(node);
-        goto retry;
+    if (qatomic_read(&in_drain_call_rcu)) {
+        rcu_call_splice(tail, n);
     }
-
-    return node;
+    return batch;
 }
 
+static void drain_rcu_callback(struct rcu_head *node);
+
 static void *call_rcu_thread(void *opaque)
 {
-    struct rcu_head *node;
+    struct rcu_head *node, *next, *drain = NULL;
 
     rcu_register_thread();
 
     for (;;) {
         int tries = 0;
         int n = qatomic_read(&rcu_call_count);
+        int64_t gp_start, gp_ns;
 
-        /* Heuristically wait for a decent number of callbacks to pile up.
-         * Fetch rcu_call_count now, we only must process elements that were
-         * added before synchronize_rcu() starts.
-         */
+        /* Heuristically wait for a decent number of callbacks to pile up.  */
         while (n == 0 || (n < RCU_CALL_MIN_SIZE && ++tries <= 5)) {
             g_usleep(10000);
             if (n == 0) {
@@ -281,24 +331,47 @@ static void *call_rcu_thread(void *opaque)
             n = qatomic_read(&rcu_call_count);
         }
 
+        /*
+         * Collect the callbacks now; only those that were queued before
+         * synchronize_rcu() starts may be run after it returns.  A single
+         * grace period covers the whole batch, however many threads
+         * contributed to it.
+         */
+        node = rcu_call_collect(&n);
         qatomic_sub(&rcu_call_count, n);
+
+        gp_start = get_clock();
         synchronize_rcu();
+        gp_ns = get_clock() - gp_start;
+
+        WITH_QEMU_LOCK_GUARD(&rcu_call_lock) {
+            rcu_call_stats.callbacks += n;
+            rcu_call_stats.batches++;
+            rcu_call_stats.max_batch = MAX(rcu_call_stats.max_batch,
+                                           (uint64_t)n);
+            rcu_call_stats.gp_ns_total += gp_ns;
+            rcu_call_stats.gp_ns_max = MAX(rcu_call_stats.gp_ns_max,
+                                           (uint64_t)gp_ns);
+        }
+
+        /*
+         * Within the batch, callbacks from different threads are not
+         * ordered.  Run drain_call_rcu()'s callbacks last, so that they
+         * also wait for whatever the other threads had queued.
+         */
         bql_lock();
-        while (n > 0) {
-            node = try_dequeue();
-            while (!node) {
-                bql_unlock();
-                qemu_event_reset(&rcu_call_ready_event);
-                node = try_dequeue();
-                if (!node) {
-                    qemu_event_wait(&rcu_call_ready_event);
-                    node = try_dequeue();
-                }
-                bql_lock();
+        for (; node; node = next) {
+            next = node->next;
+            if (node->func == drain_rcu_callback) {
+                node->next = drain;
+                drain = node;
+            } else {
+                node->func(node);
             }
-
-            n--;
-            node->func(node);
+        }
+        for (; drain; drain = next) {
+            next = drain->next;
+            drain->func(drain);
         }
         bql_unlock();
     }
@@ -307,12 +380,28 @@ static void *call_rcu_thread(void *opaque)
 
 void call_rcu1(struct rcu_head *node, void (*func)(struct rcu_head *node))
 {
+    RCUCallQueue *q = rcu_call_queue_get();
+
     node->func = func;
-    enqueue(node);
+    node->next = NULL;
+
+    qemu_spin_lock(&q->lock);
+    *q->tail = node;
+    q->tail = &node->next;
+    q->count++;
     qatomic_inc(&rcu_call_count);
+    qemu_spin_unlock(&q->lock);
+
     qemu_event_set(&rcu_call_ready_event);
 }
 
+void rcu_call_get_stats(RCUCallStats *stats)
+{
+    QEMU_LOCK_GUARD(&rcu_call_lock);
+    *stats = rcu_call_stats;
+    stats->pending = qatomic_read(&rcu_call_count);
+}
+
 
 struct rcu_drain {
     struct rcu_head rcu;
@@ -353,8 +442,8 @@ void drain_call_rcu(void)
      * is called, all RCU callbacks that were registered on this thread
      * prior to calling this function are completed.
      *
-     * Note that since we have only one global queue of the RCU callbacks,
-     * we also end up waiting for most of RCU callbacks that were registered
+     * Note that since each batch collects the callbacks of all threads,
+     * we also end up waiting for the RCU callbacks that were registered
      * on the other threads, but this is a side effect that shouldn't be
      * assumed.
      */
@@ -405,6 +494,7 @@ static void rcu_init_complete(void)
 
     qemu_mutex_init(&rcu_registry_lock);
     qemu_mutex_init(&rcu_sync_lock);
+    qemu_mutex_init(&rcu_call_lock);
     qemu_event_init(&rcu_gp_event, true);
 
     qemu_event_init(&rcu_call_ready_event, false);
@@ -439,6 +529,7 @@ static void rcu_init_lock(void)
 
     qemu_mutex_lock(&rcu_sync_lock);
     qemu_mutex_lock(&rcu_registry_lock);
+    qemu_mutex_lock(&rcu_call_lock);
 }
 
 static void rcu_init_unlock(void)
@@ -447,16 +538,30 @@ static void rcu_init_unlock(void)
         return;
     }
 
+    qemu_mutex_unlock(&rcu_call_lock);
     qemu_mutex_unlock(&rcu_registry_lock);
     qemu_mutex_unlock(&rcu_sync_lock);
 }
 
 static void rcu_init_child(void)
 {
+    RCUCallQueue *q, *own = get_rcu_call_queue();
+
     if (atfork_depth < 1) {
         return;
     }
 
+    /*
+     * Only this thread survives in the child; keep the callbacks that
+     * the others queued, but let the call_rcu thread free their queues.
+     */
+    QSLIST_FOREACH(q, &rcu_call_queues, next) {
+        if (q != own) {
+            qemu_spin_init(&q->lock);
+            q->dead = true;
+        }
+    }
+
     memset(&registry, 0, sizeof(registry));
     rcu_init_complete();
 }
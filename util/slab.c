@@ -0,0 +1,268 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Size-class allocator with per-thread caches
+ *
+ * This works like the coroutine pool.  Each thread caches up to two batches
+ * of free objects per size class, without any locking.  When a thread's
+ * cache runs empty it takes a batch from the shared cache of the size class,
+ * and when it overflows it hands a batch back.  This way, objects that are
+ * allocated in one thread and freed in another (for example a virtqueue
+ * element popped in an IOThread and completed in the main loop) flow back
+ * to the allocating thread in batches, with one lock acquisition for each
+ * batch.
+ *
+ * Free objects are linked through their first bytes, and the objects of a
+ * batch in the shared cache stay linked together, so batches need no
+ * memory of their own.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/atomic.h"
+#include "qemu/coroutine-tls.h"
+#include "qemu/host-utils.h"
+#include "qemu/lockable.h"
+#include "qemu/notify.h"
+#include "qemu/queue.h"
+#include "qemu/slab.h"
+#include "qemu/stats64.h"
+#include "qemu/thread.h"
+#include "qemu/units.h"
+
+enum {
+    /* Number of objects in a batch, depending on the size class */
+    SLAB_BATCH_BYTES = 128 * KiB,
+    SLAB_BATCH_MIN_SIZE = 4,
+    SLAB_BATCH_MAX_SIZE = 64,
+
+    /* Batches of each size class kept in the shared cache */
+    SLAB_SHARED_MAX_BATCHES = 16,
+
+    /* Allocations or frees a thread counts before publishing them */
+    SLAB_STATS_BATCH = 256,
+};
+
+typedef struct SlabObject SlabObject;
+struct SlabObject {
+    QSLIST_ENTRY(SlabObject) next;
+
+    /* Only used by the first object of a batch in the shared cache */
+    QSLIST_ENTRY(SlabObject) next_batch;
+};
+
+typedef struct SlabClass {
+    QemuMutex lock; /* protects batches and nr_batches */
+    QSLIST_HEAD(, SlabObject) batches;
+    unsigned int nr_batches;
+
+    Stat64 allocs;
+    Stat64 frees;
+    Stat64 heap_allocs;
+    Stat64 heap_frees;
+} SlabClass;
+
+typedef struct SlabLocalClass {
+    QSLIST_HEAD(, SlabObject) objs;
+    unsigned int nr_objs;
+
+    /* Not yet added to the SlabClass counters */
+    unsigned int allocs;
+    unsigned int frees;
+} SlabLocalClass;
+
+typedef struct SlabLocal {
+    SlabLocalClass classes[QEMU_SLAB_CLASSES];
+    Notifier cleanup_notifier;
+} SlabLocal;
+
+static SlabClass slab_classes[QEMU_SLAB_CLASSES];
+
+QEMU_DEFINE_STATIC_CO_TLS(SlabLocal, slab_local);
+
+static inline int slab_class(size_t size)
+{
+    if (size <= QEMU_SLAB_MIN_SIZE) {
+        return 0;
+    }
+    return 64 - clz64(size - 1) - QEMU_SLAB_MIN_SHIFT;
+}
+
+static inline size_t slab_class_size(int cls)
+{
+    return (size_t)QEMU_SLAB_MIN_SIZE << cls;
+}
+
+static inline unsigned int slab_batch_size(int cls)
+{
+    unsigned int n = SLAB_BATCH_BYTES / slab_class_size(cls);
+
+    return MIN(SLAB_BATCH_MAX_SIZE, MAX(SLAB_BATCH_MIN_SIZE, n));
+}
+
+static void slab_flush_stats(SlabLocalClass *lc, SlabClass *sc)
+{
+    stat64_add(&sc->allocs, lc->allocs);
+    stat64_add(&sc->frees, lc->frees);
+    lc->allocs = 0;
+    lc->frees = 0;
+}
+
+/* Move a batch from the shared cache into an empty thread cache */
+static bool slab_refill_local(SlabLocalClass *lc, int cls)
+{
+    SlabClass *sc = &slab_classes[cls];
+    SlabObject *batch;
+
+    WITH_QEMU_LOCK_GUARD(&sc->lock) {
+        batch = QSLIST_FIRST(&sc->batches);
+        if (batch) {
+            QSLIST_REMOVE_HEAD(&sc->batches, next_batch);
+            sc->nr_batches--;
+        }
+    }
+    if (!batch) {
+        return false;
+    }
+
+    lc->objs.slh_first = batch;
+    lc->nr_objs = slab_batch_size(cls);
+    return true;
+}
+
+/* Move a batch from the thread cache to the shared cache, or to the heap */
+static void slab_spill_local(SlabLocalClass *lc, int cls)
+{
+    SlabClass *sc = &slab_classes[cls];
+    unsigned int n = slab_batch_size(cls);
+    SlabObject *batch = QSLIST_FIRST(&lc->objs);
+    SlabObject *last = batch;
+    SlabObject *obj;
+
+    for (unsigned int i = 1; i < n; i++) {
+        last = QSLIST_NEXT(last, next);
+    }
+    lc->objs.slh_first = QSLIST_NEXT(last, next);
+    last->next.sle_next = NULL;
+    lc->nr_objs -= n;
+
+    WITH_QEMU_LOCK_GUARD(&sc->lock) {
+        if (sc->nr_batches < SLAB_SHARED_MAX_BATCHES) {
+            QSLIST_INSERT_HEAD(&sc->batches, batch, next_batch);
+            sc->nr_batches++;
+            return;
+        }
+    }
+
+    while ((obj = batch)) {
+        batch = QSLIST_NEXT(obj, next);
+        g_free(obj);
+    }
+    stat64_add(&sc->heap_frees, n);
+}
+
+static void slab_local_cleanup(Notifier *n, void *value)
+{
+    SlabLocal *local = get_ptr_slab_local();
+
+    for (int cls = 0; cls < QEMU_SLAB_CLASSES; cls++) {
+        SlabLocalClass *lc = &local->classes[cls];
+        SlabObject *obj;
+
+        slab_flush_stats(lc, &slab_classes[cls]);
+        while (lc->nr_objs >= slab_batch_size(cls)) {
+            slab_spill_local(lc, cls);
+        }
+        if (lc->nr_objs) {
+            stat64_add(&slab_classes[cls].heap_frees, lc->nr_objs);
+        }
+        while ((obj = QSLIST_FIRST(&lc->objs))) {
+            QSLIST_REMOVE_HEAD(&lc->objs, next);
+            g_free(obj);
+        }
+        lc->nr_objs = 0;
+    }
+}
+
+static SlabLocalClass *slab_get_local(int cls)
+{
+    SlabLocal *local = get_ptr_slab_local();
+
+    /* Ensure the atexit notifier is registered */
+    if (unlikely(!local->cleanup_notifier.notify)) {
+        local->cleanup_notifier.notify = slab_local_cleanup;
+        qemu_thread_atexit_add(&local->cleanup_notifier);
+    }
+    return &local->classes[cls];
+}
+
+void *qemu_slab_alloc(size_t size)
+{
+    int cls = slab_class(size);
+    SlabLocalClass *lc;
+    SlabObject *obj;
+
+    if (cls >= QEMU_SLAB_CLASSES) {
+        return g_malloc(size);
+    }
+
+    lc = slab_get_local(cls);
+    if (QSLIST_EMPTY(&lc->objs) && !slab_refill_local(lc, cls)) {
+        stat64_add(&slab_classes[cls].heap_allocs, 1);
+        obj = g_malloc(slab_class_size(cls));
+    } else {
+        obj = QSLIST_FIRST(&lc->objs);
+        QSLIST_REMOVE_HEAD(&lc->objs, next);
+        lc->nr_objs--;
+    }
+
+    if (++lc->allocs == SLAB_STATS_BATCH) {
+        slab_flush_stats(lc, &slab_classes[cls]);
+    }
+    return obj;
+}
+
+void qemu_slab_free(void *ptr, size_t size)
+{
+    int cls = slab_class(size);
+    SlabLocalClass *lc;
+
+    if (!ptr) {
+        return;
+    }
+    if (cls >= QEMU_SLAB_CLASSES) {
+        g_free(ptr);
+        return;
+    }
+
+    lc = slab_get_local(cls);
+    QSLIST_INSERT_HEAD(&lc->objs, (SlabObject *)ptr, next);
+    if (++lc->nr_objs == 2 * slab_batch_size(cls)) {
+        slab_spill_local(lc, cls);
+    }
+
+    if (++lc->frees == SLAB_STATS_BATCH) {
+        slab_flush_stats(lc, &slab_classes[cls]);
+    }
+}
+
+void qemu_slab_get_stats(QemuSlabStats stats[QEMU_SLAB_CLASSES])
+{
+    for (int cls = 0; cls < QEMU_SLAB_CLASSES; cls++) {
+        SlabClass *sc = &slab_classes[cls];
+
+        stats[cls].size = slab_class_size(cls);
+        stats[cls].allocs = stat64_get(&sc->allocs);
+        stats[cls].frees = stat64_get(&sc->frees);
+        stats[cls].heap_allocs = stat64_get(&sc->heap_allocs);
+        stats[cls].heap_frees = stat64_get(&sc->heap_frees);
+        WITH_QEMU_LOCK_GUARD(&sc->lock) {
+            stats[cls].cached = sc->nr_batches * slab_batch_size(cls);
+        }
+    }
+}
+
+static void __attribute__((constructor)) slab_init(void)
+{
+    for (int cls = 0; cls < QEMU_SLAB_CLASSES; cls++) {
+        qemu_mutex_init(&slab_classes[cls].lock);
+    }
+}
@@ -18,18 +18,36 @@
 #include "qemu/defer-call.h"
 #include "qemu/queue.h"
 #include "qemu/thread.h"
+#include "qemu/thread-context.h"
 #include "qemu/coroutine.h"
+#include "qemu/timer.h"
 #include "trace.h"
 #include "block/thread-pool.h"
 #include "qemu/main-loop.h"
 
+/*
+ * Requests are handed to the workers through a bounded lock-free ring, so
+ * that neither submission nor dequeueing takes pool->lock.  The lock is only
+ * taken to spawn and retire workers, to put a worker to sleep and wake it up,
+ * and when the ring is full and requests spill into request_list.
+ */
+#define THREAD_POOL_RING_SIZE   1024
+
+/*
+ * How long an idle worker busy-waits for new requests before going to sleep.
+ * Only one worker spins at a time, the others sleep on request_cond.
+ */
+#define THREAD_POOL_SPIN_NS     (50 * SCALE_US)
+
 static void do_spawn_thread(ThreadPoolAio *pool);
 
 typedef struct ThreadPoolElementAio ThreadPoolElementAio;
+typedef struct ThreadPoolSlot ThreadPoolSlot;
 
 enum ThreadState {
     THREAD_QUEUED,
     THREAD_ACTIVE,
+    THREAD_CANCELED,
     THREAD_DONE,
 };
 
@@ -39,20 +57,53 @@ struct ThreadPoolElementAio {
     ThreadPoolFunc *func;
     void *arg;
 
-    /* Moving state out of THREAD_QUEUED is protected by lock.  After
-     * that, only the worker thread can write to it.  Reads and writes
-     * of state and ret are ordered with memory barriers.
+    /*
+     * Moving state out of THREAD_QUEUED is done with cmpxchg, either by the
+     * worker that dequeues the request or by thread_pool_cancel().  After
+     * that, only whoever took the request out of the queue can write to it.
+     * ret is written before the request is pushed to done_list, which orders
+     * it with the read in the completion bottom half.
      */
     enum ThreadState state;
     int ret;
 
-    /* Access to this list is protected by lock.  */
+    /* Ring slot the request was pushed to, or NULL if it is in request_list */
+    ThreadPoolSlot *slot;
+
+    /*
+     * Access to this list is protected by lock.  Only used when the ring
+     * is full.
+     */
     QTAILQ_ENTRY(ThreadPoolElementAio) reqs;
 
-    /* This list is only written by the thread pool's mother thread.  */
+    /* Pushed atomically by workers, moved out by the completion BH.  */
+    QSLIST_ENTRY(ThreadPoolElementAio) done;
+
+    /* The following lists are only accessed from the pool's AioContext.  */
+    QSIMPLEQ_ENTRY(ThreadPoolElementAio) completed;
     QLIST_ENTRY(ThreadPoolElementAio) all;
 };
 
+/*
+ * Multi-producer multi-consumer bounded queue.  Each slot carries a sequence
+ * number that tells whether it is ready to be filled (seq == pos) or to be
+ * consumed (seq == pos + 1) by whoever claimed position pos.
+ *
+ * thread_pool_cancel() can take a request back by clearing req, in which
+ * case the consumer of the slot finds NULL and moves on to the next one.
+ */
+struct ThreadPoolSlot {
+    uintptr_t seq;
+    ThreadPoolElementAio *req;
+};
+
+typedef struct ThreadPoolRing {
+    /* Producers and consumers each get their own cache line */
+    QEMU_ALIGNED(64) uintptr_t tail;
+    QEMU_ALIGNED(64) uintptr_t head;
+    QEMU_ALIGNED(64) ThreadPoolSlot slots[THREAD_POOL_RING_SIZE];
+} ThreadPoolRing;
+
 struct ThreadPoolAio {
     AioContext *ctx;
     QEMUBH *completion_bh;
@@ -63,71 +114,266 @@ struct ThreadPoolAio {
 
     /* The following variables are only accessed from one AioContext. */
     QLIST_HEAD(, ThreadPoolElementAio) head;
+    QSIMPLEQ_HEAD(, ThreadPoolElementAio) completed;
 
-    /* The following variables are protected by lock.  */
+    /* Requests whose function has run, newest first.  */
+    QSLIST_HEAD(, ThreadPoolElementAio) done_list;
+
+    /*
+     * Workers that are not running a request, and those sleeping on
+     * request_cond.  Modified atomically.
+     */
+    int idle_threads;
+    int sleeping_threads;
+    bool spinning;
+
+    /*
+     * The following variables are protected by lock.  Fields that workers
+     * check without holding it are written with qatomic_set().
+     */
     QTAILQ_HEAD(, ThreadPoolElementAio) request_list;
+    int overflow_reqs;
     int cur_threads;
-    int idle_threads;
     int new_threads;     /* backlog of threads we need to create */
     int pending_threads; /* threads created but not running yet */
     int min_threads;
     int max_threads;
+    ThreadContext *tc;
+
+    ThreadPoolRing ring;
 };
 
-static void *worker_thread(void *opaque)
+static void thread_pool_ring_init(ThreadPoolRing *ring)
 {
-    ThreadPoolAio *pool = opaque;
+    ring->head = ring->tail = 0;
+    for (uintptr_t i = 0; i < THREAD_POOL_RING_SIZE; i++) {
+        ring->slots[i].seq = i;
+    }
+}
 
-    qemu_mutex_lock(&pool->lock);
-    pool->pending_threads--;
-    do_spawn_thread(pool);
+static bool thread_pool_ring_push(ThreadPoolRing *ring,
+                                  ThreadPoolElementAio *req)
+{
+    uintptr_t pos = qatomic_read(&ring->tail);
+    ThreadPoolSlot *slot;
+    intptr_t diff;
 
-    while (pool->cur_threads <= pool->max_threads) {
-        ThreadPoolElementAio *req;
-        int ret;
-
-        if (QTAILQ_EMPTY(&pool->request_list)) {
-            pool->idle_threads++;
-            ret = qemu_cond_timedwait(&pool->request_cond, &pool->lock, 10000);
-            pool->idle_threads--;
-            if (ret == 0 &&
-                QTAILQ_EMPTY(&pool->request_list) &&
-                pool->cur_threads > pool->min_threads) {
-                /* Timed out + no work to do + no need for warm threads = exit.  */
+    for (;;) {
+        slot = &ring->slots[pos % THREAD_POOL_RING_SIZE];
+        diff = qatomic_load_acquire(&slot->seq) - pos;
+
+        if (diff == 0) {
+            uintptr_t old = qatomic_cmpxchg(&ring->tail, pos, pos + 1);
+            if (old == pos) {
                 break;
             }
-            /*
-             * Even if there was some work to do, check if there aren't
-             * too many worker threads before picking it up.
-             */
-            continue;
+            pos = old;
+        } else if (diff < 0) {
+            /* The consumer of the previous lap has not freed the slot yet */
+            return false;
+        } else {
+            pos = qatomic_read(&ring->tail);
         }
+    }
+
+    req->slot = slot;
+    slot->req = req;
+    qatomic_store_release(&slot->seq, pos + 1);
+    return true;
+}
+
+static ThreadPoolElementAio *thread_pool_ring_pop(ThreadPoolRing *ring)
+{
+    uintptr_t pos = qatomic_read(&ring->head);
+    ThreadPoolElementAio *req;
+    ThreadPoolSlot *slot;
+    intptr_t diff;
+
+    for (;;) {
+        slot = &ring->slots[pos % THREAD_POOL_RING_SIZE];
+        diff = qatomic_load_acquire(&slot->seq) - (pos + 1);
+
+        if (diff == 0) {
+            uintptr_t old = qatomic_cmpxchg(&ring->head, pos, pos + 1);
+            if (old != pos) {
+                pos = old;
+                continue;
+            }
+
+            /* Races with thread_pool_cancel() taking the request back */
+            req = qatomic_xchg(&slot->req, NULL);
+            qatomic_store_release(&slot->seq, pos + THREAD_POOL_RING_SIZE);
+            if (req) {
+                return req;
+            }
+            pos = qatomic_read(&ring->head);
+        } else if (diff < 0) {
+            return NULL;
+        } else {
+            pos = qatomic_read(&ring->head);
+        }
+    }
+}
+
+static bool thread_pool_has_work(ThreadPoolAio *pool)
+{
+    return qatomic_read(&pool->ring.tail) != qatomic_read(&pool->ring.head) ||
+           qatomic_read(&pool->overflow_reqs);
+}
 
-        req = QTAILQ_FIRST(&pool->request_list);
+static bool thread_pool_too_many_threads(ThreadPoolAio *pool)
+{
+    return qatomic_read(&pool->cur_threads) > qatomic_read(&pool->max_threads);
+}
+
+static ThreadPoolElementAio *thread_pool_dequeue(ThreadPoolAio *pool)
+{
+    ThreadPoolElementAio *req = thread_pool_ring_pop(&pool->ring);
+
+    if (req || !qatomic_read(&pool->overflow_reqs)) {
+        return req;
+    }
+
+    QEMU_LOCK_GUARD(&pool->lock);
+    req = QTAILQ_FIRST(&pool->request_list);
+    if (req) {
         QTAILQ_REMOVE(&pool->request_list, req, reqs);
-        req->state = THREAD_ACTIVE;
-        qemu_mutex_unlock(&pool->lock);
+        qatomic_set(&pool->overflow_reqs, pool->overflow_reqs - 1);
+    }
+    return req;
+}
 
-        ret = req->func(req->arg);
+/*
+ * Wait for requests to be queued, first spinning and then sleeping on
+ * request_cond.  Returns false if the worker should exit.
+ */
+static bool thread_pool_wait_for_work(ThreadPoolAio *pool)
+{
+    bool timed_out = false;
+    bool stop = false;
 
-        req->ret = ret;
-        /* Write ret before state.  */
-        smp_wmb();
-        req->state = THREAD_DONE;
+    if (!qatomic_read(&pool->spinning) &&
+        !qatomic_xchg(&pool->spinning, true)) {
+        int64_t deadline = get_clock() + THREAD_POOL_SPIN_NS;
 
-        qemu_bh_schedule(pool->completion_bh);
-        qemu_mutex_lock(&pool->lock);
+        while (!thread_pool_has_work(pool) &&
+               !thread_pool_too_many_threads(pool) &&
+               get_clock() < deadline) {
+            cpu_relax();
+        }
+        qatomic_set(&pool->spinning, false);
+        if (thread_pool_has_work(pool) &&
+            !thread_pool_too_many_threads(pool)) {
+            return true;
+        }
     }
 
-    pool->cur_threads--;
-    qemu_cond_signal(&pool->worker_stopped);
+    qemu_mutex_lock(&pool->lock);
+    if (pool->cur_threads > pool->max_threads) {
+        stop = true;
+        goto out;
+    }
+
+    /* Pairs with smp_mb() in thread_pool_submit_aio() */
+    qatomic_inc(&pool->sleeping_threads);
+    smp_mb__after_rmw();
+    if (!thread_pool_has_work(pool)) {
+        timed_out = !qemu_cond_timedwait(&pool->request_cond, &pool->lock,
+                                         10000);
+    }
+    qatomic_dec(&pool->sleeping_threads);
+
+    if (timed_out &&
+        !thread_pool_has_work(pool) &&
+        pool->cur_threads > pool->min_threads) {
+        /* Timed out + no work to do + no need for warm threads = exit.  */
+        stop = true;
+    }
 
     /*
-     * Wake up another thread, in case we got a wakeup but decided
-     * to exit due to pool->cur_threads > pool->max_threads.
+     * Even if there was some work to do, check if there aren't
+     * too many worker threads before picking it up.
      */
-    qemu_cond_signal(&pool->request_cond);
+    stop = stop || pool->cur_threads > pool->max_threads;
+
+out:
+    if (stop) {
+        /*
+         * thread_pool_free_aio() may free the pool as soon as the lock is
+         * dropped with cur_threads == 0, so the worker must not touch it
+         * after that.
+         */
+        qatomic_dec(&pool->idle_threads);
+        qatomic_set(&pool->cur_threads, pool->cur_threads - 1);
+        qemu_cond_signal(&pool->worker_stopped);
+
+        /*
+         * Wake up another thread, in case we got a wakeup but decided
+         * to exit due to pool->cur_threads > pool->max_threads.
+         */
+        qemu_cond_signal(&pool->request_cond);
+    }
     qemu_mutex_unlock(&pool->lock);
+    return !stop;
+}
+
+static void thread_pool_complete(ThreadPoolAio *pool,
+                                 ThreadPoolElementAio *req)
+{
+    ThreadPoolElementAio *old;
+
+    do {
+        old = qatomic_read(&pool->done_list.slh_first);
+        req->done.sle_next = old;
+    } while (qatomic_cmpxchg(&pool->done_list.slh_first, old, req) != old);
+
+    /*
+     * Only the first request of a batch needs to kick the AioContext, the
+     * bottom half picks up everything that is on the list when it runs.
+     */
+    if (!old) {
+        qemu_bh_schedule(pool->completion_bh);
+    }
+}
+
+static void *worker_thread(void *opaque)
+{
+    ThreadPoolAio *pool = opaque;
+
+    qemu_mutex_lock(&pool->lock);
+    pool->pending_threads--;
+    do_spawn_thread(pool);
+    qemu_mutex_unlock(&pool->lock);
+
+    qatomic_inc(&pool->idle_threads);
+    for (;;) {
+        ThreadPoolElementAio *req = NULL;
+
+        if (!thread_pool_too_many_threads(pool)) {
+            req = thread_pool_dequeue(pool);
+        }
+        if (!req) {
+            if (!thread_pool_wait_for_work(pool)) {
+                break;
+            }
+            continue;
+        }
+
+        if (qatomic_cmpxchg(&req->state, THREAD_QUEUED, THREAD_ACTIVE) ==
+            THREAD_QUEUED) {
+            qatomic_dec(&pool->idle_threads);
+            req->ret = req->func(req->arg);
+            qatomic_inc(&pool->idle_threads);
+            qatomic_set(&req->state, THREAD_DONE);
+        } else {
+            /* Cancelled after the worker took it out of the queue */
+            assert(req->state == THREAD_CANCELED);
+            req->ret = -ECANCELED;
+        }
+
+        thread_pool_complete(pool, req);
+    }
+
     return NULL;
 }
 
@@ -143,7 +389,13 @@ static void do_spawn_thread(ThreadPoolAio *pool)
     pool->new_threads--;
     pool->pending_threads++;
 
-    qemu_thread_create(&t, "worker", worker_thread, pool, QEMU_THREAD_DETACHED);
+    if (pool->tc) {
+        thread_context_create_thread(pool->tc, &t, "worker", worker_thread,
+                                     pool, QEMU_THREAD_DETACHED);
+    } else {
+        qemu_thread_create(&t, "worker", worker_thread, pool,
+                           QEMU_THREAD_DETACHED);
+    }
 }
 
 static void spawn_thread_bh_fn(void *opaque)
@@ -157,7 +409,7 @@ static void spawn_thread_bh_fn(void *opaque)
 
 static void spawn_thread(ThreadPoolAio *pool)
 {
-    pool->cur_threads++;
+    qatomic_set(&pool->cur_threads, pool->cur_threads + 1);
     pool->new_threads++;
     /* If there are threads being created, they will spawn new workers, so
      * we don't spend time creating many threads in a loop holding a mutex or
@@ -171,27 +423,41 @@ static void spawn_thread(ThreadPoolAio *pool)
     }
 }
 
+static ThreadPoolElementAio *thread_pool_pop_completed(ThreadPoolAio *pool)
+{
+    ThreadPoolElementAio *elem;
+
+    if (QSIMPLEQ_EMPTY(&pool->completed)) {
+        QSLIST_HEAD(, ThreadPoolElementAio) done;
+
+        /* done_list is newest first, reverse it into completion order */
+        QSLIST_MOVE_ATOMIC(&done, &pool->done_list);
+        while ((elem = QSLIST_FIRST(&done))) {
+            QSLIST_REMOVE_HEAD(&done, done);
+            QSIMPLEQ_INSERT_HEAD(&pool->completed, elem, completed);
+        }
+    }
+
+    elem = QSIMPLEQ_FIRST(&pool->completed);
+    if (elem) {
+        QSIMPLEQ_REMOVE_HEAD(&pool->completed, completed);
+    }
+    return elem;
+}
+
 static void thread_pool_completion_bh(void *opaque)
 {
     ThreadPoolAio *pool = opaque;
-    ThreadPoolElementAio *elem, *next;
+    ThreadPoolElementAio *elem;
 
     defer_call_begin(); /* cb() may use defer_call() to coalesce work */
 
-restart:
-    QLIST_FOREACH_SAFE(elem, &pool->head, all, next) {
-        if (elem->state != THREAD_DONE) {
-            continue;
-        }
-
+    while ((elem = thread_pool_pop_completed(pool))) {
         trace_thread_pool_complete_aio(pool, elem, elem->common.opaque,
                                        elem->ret);
         QLIST_REMOVE(elem, all);
 
         if (elem->common.cb) {
-            /* Read state before ret.  */
-            smp_rmb();
-
             /* Schedule ourselves in case elem->common.cb() calls aio_poll() to
              * wait for another request that completed at the same time.
              */
@@ -200,16 +466,12 @@ restart:
             elem->common.cb(elem->common.opaque, elem->ret);
 
             /* We can safely cancel the completion_bh here regardless of someone
-             * else having scheduled it meanwhile because we reenter the
-             * completion function anyway (goto restart).
+             * else having scheduled it meanwhile because the loop looks at
+             * done_list again before exiting.
              */
             qemu_bh_cancel(pool->completion_bh);
-
-            qemu_aio_unref(elem);
-            goto restart;
-        } else {
-            qemu_aio_unref(elem);
         }
+        qemu_aio_unref(elem);
     }
 
     defer_call_end();
@@ -218,19 +480,38 @@ restart:
 static void thread_pool_cancel(BlockAIOCB *acb)
 {
     ThreadPoolElementAio *elem = (ThreadPoolElementAio *)acb;
+
     ThreadPoolAio *pool = elem->pool;
+    bool dequeued = false;
 
     trace_thread_pool_cancel_aio(elem, elem->common.opaque);
 
-    QEMU_LOCK_GUARD(&pool->lock);
-    if (elem->state == THREAD_QUEUED) {
-        QTAILQ_REMOVE(&pool->request_list, elem, reqs);
-        qemu_bh_schedule(pool->completion_bh);
+    if (qatomic_cmpxchg(&elem->state, THREAD_QUEUED, THREAD_CANCELED) !=
+        THREAD_QUEUED) {
+        return;
+    }
 
-        elem->state = THREAD_DONE;
-        elem->ret = -ECANCELED;
+    /*
+     * Take the request out of the queue so that it can complete right away.
+     * If a worker has already dequeued it, the worker sees THREAD_CANCELED,
+     * skips the function and completes the request itself.
+     */
+    if (elem->slot) {
+        dequeued = qatomic_cmpxchg(&elem->slot->req, elem, NULL) == elem;
+    } else {
+        WITH_QEMU_LOCK_GUARD(&pool->lock) {
+            if (QTAILQ_IN_USE(elem, reqs)) {
+                QTAILQ_REMOVE(&pool->request_list, elem, reqs);
+                qatomic_set(&pool->overflow_reqs, pool->overflow_reqs - 1);
+                dequeued = true;
+            }
+        }
     }
 
+    if (dequeued) {
+        elem->ret = -ECANCELED;
+        thread_pool_complete(pool, elem);
+    }
 }
 
 static const AIOCBInfo thread_pool_aiocb_info = {
@@ -253,18 +534,35 @@ BlockAIOCB *thread_pool_submit_aio(ThreadPoolFunc *func, void *arg,
     req->arg = arg;
     req->state = THREAD_QUEUED;
     req->pool = pool;
+    req->slot = NULL;
 
     QLIST_INSERT_HEAD(&pool->head, req, all);
 
     trace_thread_pool_submit_aio(pool, req, arg);
 
-    qemu_mutex_lock(&pool->lock);
-    if (pool->idle_threads == 0 && pool->cur_threads < pool->max_threads) {
-        spawn_thread(pool);
+    if (qatomic_read(&pool->idle_threads) == 0 &&
+        qatomic_read(&pool->cur_threads) < qatomic_read(&pool->max_threads)) {
+        WITH_QEMU_LOCK_GUARD(&pool->lock) {
+            if (pool->cur_threads < pool->max_threads) {
+                spawn_thread(pool);
+            }
+        }
+    }
+
+    if (!thread_pool_ring_push(&pool->ring, req)) {
+        WITH_QEMU_LOCK_GUARD(&pool->lock) {
+            QTAILQ_INSERT_TAIL(&pool->request_list, req, reqs);
+            qatomic_set(&pool->overflow_reqs, pool->overflow_reqs + 1);
+        }
+    }
+
+    /* Pairs with smp_mb__after_rmw() in thread_pool_wait_for_work() */
+    smp_mb();
+    if (qatomic_read(&pool->sleeping_threads)) {
+        qemu_mutex_lock(&pool->lock);
+        qemu_cond_signal(&pool->request_cond);
+        qemu_mutex_unlock(&pool->lock);
     }
-    QTAILQ_INSERT_TAIL(&pool->request_list, req, reqs);
-    qemu_mutex_unlock(&pool->lock);
-    qemu_cond_signal(&pool->request_cond);
     return &req->common;
 }
 
@@ -294,8 +592,9 @@ void thread_pool_update_params(ThreadPoolAio *pool, AioContext *ctx)
 {
     qemu_mutex_lock(&pool->lock);
 
-    pool->min_threads = ctx->thread_pool_min;
-    pool->max_threads = ctx->thread_pool_max;
+    qatomic_set(&pool->min_threads, ctx->thread_pool_min);
+    qatomic_set(&pool->max_threads, ctx->thread_pool_max);
+    pool->tc = ctx->thread_pool_context;
 
     /*
      * We either have to:
@@ -324,6 +623,7 @@ static void thread_pool_init_one(ThreadPoolAio *pool, AioContext *ctx)
     }
 
     memset(pool, 0, sizeof(*pool));
+    thread_pool_ring_init(&pool->ring);
     pool->ctx = ctx;
     pool->completion_bh = aio_bh_new(ctx, thread_pool_completion_bh, pool);
     qemu_mutex_init(&pool->lock);
@@ -332,6 +632,8 @@ static void thread_pool_init_one(ThreadPoolAio *pool, AioContext *ctx)
     pool->new_thread_bh = aio_bh_new(ctx, spawn_thread_bh_fn, pool);
 
     QLIST_INIT(&pool->head);
+    QSIMPLEQ_INIT(&pool->completed);
+    QSLIST_INIT(&pool->done_list);
     QTAILQ_INIT(&pool->request_list);
 
     thread_pool_update_params(pool, ctx);
@@ -339,7 +641,7 @@ static void thread_pool_init_one(ThreadPoolAio *pool, AioContext *ctx)
 
 ThreadPoolAio *thread_pool_new_aio(AioContext *ctx)
 {
-    ThreadPoolAio *pool = g_new(ThreadPoolAio, 1);
+    ThreadPoolAio *pool = qemu_memalign(64, sizeof(ThreadPoolAio));
     thread_pool_init_one(pool, ctx);
     return pool;
 }
@@ -356,11 +658,11 @@ void thread_pool_free_aio(ThreadPoolAio *pool)
 
     /* Stop new threads from spawning */
     qemu_bh_delete(pool->new_thread_bh);
-    pool->cur_threads -= pool->new_threads;
+    qatomic_set(&pool->cur_threads, pool->cur_threads - pool->new_threads);
     pool->new_threads = 0;
 
     /* Wait for worker threads to terminate */
-    pool->max_threads = 0;
+    qatomic_set(&pool->max_threads, 0);
     qemu_cond_broadcast(&pool->request_cond);
     while (pool->cur_threads > 0) {
         qemu_cond_wait(&pool->worker_stopped, &pool->lock);
@@ -372,7 +674,7 @@ void thread_pool_free_aio(ThreadPoolAio *pool)
     qemu_cond_destroy(&pool->request_cond);
     qemu_cond_destroy(&pool->worker_stopped);
     qemu_mutex_destroy(&pool->lock);
-    g_free(pool);
+    qemu_vfree(pool);
 }
 
 struct ThreadPool {
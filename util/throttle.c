@@ -87,6 +87,29 @@ static int64_t throttle_do_compute_wait(double limit, double extra)
     return wait;
 }
 
+/* Compute the sizes of the main and burst buckets
+ *
+ * @bkt:               the leaky bucket we operate on
+ * @bucket_size:       I/O before throttling to bkt->avg
+ * @burst_bucket_size: I/O before throttling to bkt->max
+ */
+static void throttle_bucket_sizes(LeakyBucket *bkt, double *bucket_size,
+                                  double *burst_bucket_size)
+{
+    if (!bkt->max) {
+        /* If bkt->max is 0 we still want to allow short bursts of I/O
+         * from the guest, otherwise every other request will be throttled
+         * and performance will suffer considerably. */
+        *bucket_size = (double) bkt->avg / 10;
+        *burst_bucket_size = 0;
+    } else {
+        /* If we have a burst limit then we have to wait until all I/O
+         * at burst rate has finished before throttling to bkt->avg */
+        *bucket_size = bkt->max * bkt->burst_length;
+        *burst_bucket_size = (double) bkt->max / 10;
+    }
+}
+
 /* This function compute the wait time in ns that a leaky bucket should trigger
  *
  * @bkt: the leaky bucket we operate on
@@ -102,18 +125,7 @@ int64_t throttle_compute_wait(LeakyBucket *bkt)
         return 0;
     }
 
-    if (!bkt->max) {
-        /* If bkt->max is 0 we still want to allow short bursts of I/O
-         * from the guest, otherwise every other request will be throttled
-         * and performance will suffer considerably. */
-        bucket_size = (double) bkt->avg / 10;
-        burst_bucket_size = 0;
-    } else {
-        /* If we have a burst limit then we have to wait until all I/O
-         * at burst rate has finished before throttling to bkt->avg */
-        bucket_size = bkt->max * bkt->burst_length;
-        burst_bucket_size = (double) bkt->max / 10;
-    }
+    throttle_bucket_sizes(bkt, &bucket_size, &burst_bucket_size);
 
     /* If the main bucket is full then we have to wait */
     extra = bkt->level - bucket_size;
@@ -504,6 +516,137 @@ void throttle_account(ThrottleState *ts, ThrottleDirection direction,
     }
 }
 
+/* Account a batch of I/O, or return unused units of a previous batch
+ *
+ * Unlike throttle_account() the number of units is given by the caller, which
+ * makes it possible to reserve I/O before the requests are known.  Negative
+ * values give back I/O that was accounted but not performed.
+ *
+ * @direction: throttle direction
+ * @size:      the number of bytes
+ * @units:     the number of operations
+ */
+void throttle_account_batch(ThrottleState *ts, ThrottleDirection direction,
+                            double size, double units)
+{
+    static const BucketType bucket_types_size[THROTTLE_MAX][2] = {
+        { THROTTLE_BPS_TOTAL, THROTTLE_BPS_READ },
+        { THROTTLE_BPS_TOTAL, THROTTLE_BPS_WRITE }
+    };
+    static const BucketType bucket_types_units[THROTTLE_MAX][2] = {
+        { THROTTLE_OPS_TOTAL, THROTTLE_OPS_READ },
+        { THROTTLE_OPS_TOTAL, THROTTLE_OPS_WRITE }
+    };
+    unsigned i;
+
+    assert(direction < THROTTLE_MAX);
+
+    for (i = 0; i < ARRAY_SIZE(bucket_types_size[THROTTLE_READ]); i++) {
+        LeakyBucket *bkt;
+
+        bkt = &ts->cfg.buckets[bucket_types_size[direction][i]];
+        bkt->level = MAX(bkt->level + size, 0);
+        if (bkt->burst_length > 1) {
+            bkt->burst_level = MAX(bkt->burst_level + size, 0);
+        }
+
+        bkt = &ts->cfg.buckets[bucket_types_units[direction][i]];
+        bkt->level = MAX(bkt->level + units, 0);
+        if (bkt->burst_length > 1) {
+            bkt->burst_level = MAX(bkt->burst_level + units, 0);
+        }
+    }
+}
+
+/* Compute how many units a leaky bucket accepts before it must wait
+ *
+ * @bkt:    the leaky bucket we operate on
+ * @max_ns: upper bound for the budget, in ns of I/O at the average rate
+ * @ret:    the budget, or -1 if the bucket has no limit
+ */
+static double throttle_bucket_budget(LeakyBucket *bkt, int64_t max_ns)
+{
+    double bucket_size, burst_bucket_size;
+    double budget;
+
+    if (!bkt->avg) {
+        return -1;
+    }
+
+    throttle_bucket_sizes(bkt, &bucket_size, &burst_bucket_size);
+
+    budget = bucket_size - bkt->level;
+    if (bkt->burst_length > 1) {
+        budget = MIN(budget, burst_bucket_size - bkt->burst_level);
+    }
+    budget = MIN(budget, (double) bkt->avg * max_ns / NANOSECONDS_PER_SECOND);
+
+    return MAX(budget, 0);
+}
+
+/* Combine the budgets of two buckets, -1 meaning no limit */
+static double throttle_min_budget(double a, double b)
+{
+    if (a < 0) {
+        return b;
+    }
+    if (b < 0) {
+        return a;
+    }
+    return MIN(a, b);
+}
+
+/* Compute how much I/O can be performed right away without being throttled
+ *
+ * This can be used together with throttle_account_batch() to hand out I/O
+ * budget ahead of time.  The budget never exceeds what the buckets would
+ * accept immediately, so requests that are later charged against it are not
+ * treated differently from requests that go through throttle_account().
+ *
+ * @direction: throttle direction
+ * @now:       the current clock timestamp
+ * @max_ns:    upper bound for the budget, in ns of I/O at the average rate
+ * @size:      the budget in bytes, or -1 if there is no bps limit
+ * @units:     the budget in operations, or -1 if there is no iops limit
+ * @ret:       false if I/O must wait, true if a budget was computed
+ */
+bool throttle_compute_budget(ThrottleState *ts, ThrottleDirection direction,
+                             int64_t now, int64_t max_ns,
+                             double *size, double *units)
+{
+    static const BucketType bucket_types_size[THROTTLE_MAX][2] = {
+        { THROTTLE_BPS_TOTAL, THROTTLE_BPS_READ },
+        { THROTTLE_BPS_TOTAL, THROTTLE_BPS_WRITE }
+    };
+    static const BucketType bucket_types_units[THROTTLE_MAX][2] = {
+        { THROTTLE_OPS_TOTAL, THROTTLE_OPS_READ },
+        { THROTTLE_OPS_TOTAL, THROTTLE_OPS_WRITE }
+    };
+    int64_t next_timestamp;
+    unsigned i;
+
+    assert(direction < THROTTLE_MAX);
+
+    if (throttle_compute_timer(ts, direction, now, &next_timestamp)) {
+        return false;
+    }
+
+    *size = -1;
+    *units = -1;
+    for (i = 0; i < ARRAY_SIZE(bucket_types_size[THROTTLE_READ]); i++) {
+        LeakyBucket *bkt;
+
+        bkt = &ts->cfg.buckets[bucket_types_size[direction][i]];
+        *size = throttle_min_budget(*size, throttle_bucket_budget(bkt, max_ns));
+
+        bkt = &ts->cfg.buckets[bucket_types_units[direction][i]];
+        *units = throttle_min_budget(*units,
+                                     throttle_bucket_budget(bkt, max_ns));
+    }
+
+    return true;
+}
+
 /* return a ThrottleConfig based on the options in a ThrottleLimits
  *
  * @arg:    the ThrottleLimits object to read from